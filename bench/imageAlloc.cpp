@@ -0,0 +1,133 @@
+// image allocation: VkDeviceMemory blocks and vma allocations of a synthetic scene of textures,
+// every image dedicated (the allocation policy before the size class pools) vs the default ImageAllocationPolicy
+// headless, no window: any vulkan 1.3 device, lavapipe included
+// usage: imageAllocBench [textureCount = 10000]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <misc.h>
+#include <context.h>
+
+namespace
+{
+    struct Report
+    {
+        uint32_t imageCount{0};
+        uint32_t blockCount{0};
+        uint32_t allocationCount{0};
+        VkDeviceSize blockBytes{0};
+        VkDeviceSize allocationBytes{0};
+        double createMs{0.0};
+    };
+
+    // square rgba8 textures, full mip chain: mostly small (decals, ui, terrain details), a few medium and large
+    std::vector<uint32_t> sceneTextureSizes(uint32_t textureCount)
+    {
+        std::mt19937 rng(42);
+        std::uniform_int_distribution<int> bucket(0, 99);
+        std::uniform_int_distribution<int> smallLog2(4, 6);  // 16..64
+        std::uniform_int_distribution<int> mediumLog2(7, 8); // 128..256
+        std::uniform_int_distribution<int> largeLog2(9, 10); // 512..1024
+        std::vector<uint32_t> sizes;
+        sizes.reserve(textureCount);
+        for (uint32_t i = 0; i < textureCount; ++i)
+        {
+            const auto b = bucket(rng);
+            const auto log2 = b < 80 ? smallLog2(rng) : (b < 98 ? mediumLog2(rng) : largeLog2(rng));
+            sizes.push_back(1u << log2);
+        }
+        return sizes;
+    }
+
+    Report run(VkContext &ctx, const std::vector<uint32_t> &sizes, uint32_t maxImages)
+    {
+        auto allocator = ctx.getVmaAllocator();
+        VmaTotalStatistics baseline{};
+        vmaCalculateStatistics(allocator, &baseline);
+
+        std::vector<ImageEntity> images;
+        images.reserve(sizes.size());
+        const auto begin = std::chrono::steady_clock::now();
+        for (const auto size : sizes)
+        {
+            if (images.size() == maxImages)
+            {
+                break;
+            }
+            images.push_back(ctx.createImage("bench texture " + std::to_string(images.size()),
+                                             VK_IMAGE_TYPE_2D,
+                                             VK_FORMAT_R8G8B8A8_UNORM,
+                                             {size, size, 1},
+                                             getMipLevelsCount(size, size),
+                                             1,
+                                             VK_SAMPLE_COUNT_1_BIT,
+                                             VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                             false));
+        }
+        const auto end = std::chrono::steady_clock::now();
+
+        VmaTotalStatistics statistics{};
+        vmaCalculateStatistics(allocator, &statistics);
+        const auto &total = statistics.total.statistics;
+        const auto &base = baseline.total.statistics;
+        const Report report{
+            .imageCount = static_cast<uint32_t>(images.size()),
+            .blockCount = total.blockCount - base.blockCount,
+            .allocationCount = total.allocationCount - base.allocationCount,
+            .blockBytes = total.blockBytes - base.blockBytes,
+            .allocationBytes = total.allocationBytes - base.allocationBytes,
+            .createMs = std::chrono::duration<double, std::milli>(end - begin).count(),
+        };
+
+        for (const auto &image : images)
+        {
+            vkDestroyImageView(ctx.getLogicDevice(), std::get<IMAGE_ENTITY_OFFSET::IMAGE_VIEW>(image), nullptr);
+            vmaDestroyImage(allocator, std::get<IMAGE_ENTITY_OFFSET::IMAGE>(image),
+                            std::get<IMAGE_ENTITY_OFFSET::IMAGE_VMA_ALLOCATION>(image));
+        }
+        return report;
+    }
+
+    void print(const char *name, const Report &report)
+    {
+        std::printf("%-10s %8u images %8u blocks %8u allocations %10.1f MB blocks %10.1f MB allocated %10.1f ms\n",
+                    name, report.imageCount, report.blockCount, report.allocationCount,
+                    report.blockBytes / (1024.0 * 1024.0), report.allocationBytes / (1024.0 * 1024.0), report.createMs);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const uint32_t textureCount = argc > 1 ? static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 10)) : 10000;
+    VK_CHECK(volkInitialize());
+    VkContext ctx({64, 64}, {}, {VK_EXT_DEBUG_UTILS_EXTENSION_NAME}, {});
+    const auto sizes = sceneTextureSizes(textureCount);
+
+    // before: one VkDeviceMemory per image, capped by maxMemoryAllocationCount (4096 on many drivers)
+    const auto maxAllocations = ctx.getSelectedPhysicalDeviceProp().limits.maxMemoryAllocationCount;
+    const auto dedicatedCap = maxAllocations > 256 ? maxAllocations - 256 : 0;
+    auto policy = ctx.getImageAllocationPolicy();
+    const auto pooledPolicy = policy;
+    policy.dedicatedThreshold = 0;
+    ctx.setImageAllocationPolicy(policy);
+    const auto dedicated = run(ctx, sizes, dedicatedCap);
+
+    // after: size class pools
+    ctx.setImageAllocationPolicy(pooledPolicy);
+    const auto pooled = run(ctx, sizes, textureCount);
+
+    std::printf("%u textures, maxMemoryAllocationCount %u\n", textureCount, maxAllocations);
+    print("dedicated", dedicated);
+    print("pooled", pooled);
+    if (dedicated.imageCount < textureCount)
+    {
+        std::printf("dedicated stopped at %u images: one more VkDeviceMemory per image would exceed maxMemoryAllocationCount\n",
+                    dedicated.imageCount);
+    }
+    return 0;
+}
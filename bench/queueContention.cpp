@@ -0,0 +1,129 @@
+// queue contention: QueueLockFree vs QueueThreadSafe, P producers and P consumers moving the same number of items
+// QueueLockFree twice: polling consumers (try_pop) and sleeping ones (wait_pop_for)
+// throughput in million items per second, cpu only, no vulkan device needed
+// usage: queueContentionBench [itemCount = 1048576] [maxThreads = 64]
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <queueLockFree.h>
+#include <queuethreadsafe.h>
+
+namespace
+{
+    // every producer pushes its share, every consumer pops until all items are through, returns items/s
+    template <typename Push, typename Pop>
+    double measure(uint32_t threadCount, uint64_t itemCount, Push push, Pop pop)
+    {
+        std::atomic<uint64_t> consumed{0};
+        std::atomic<uint64_t> checksum{0};
+        std::atomic<bool> go{false};
+        std::vector<std::thread> threads;
+        threads.reserve(threadCount * 2);
+        for (uint32_t p = 0; p < threadCount; ++p)
+        {
+            threads.emplace_back([&, p]()
+                                 {
+                                     while (!go.load(std::memory_order_acquire))
+                                     {
+                                         std::this_thread::yield();
+                                     }
+                                     for (uint64_t i = p; i < itemCount; i += threadCount)
+                                     {
+                                         push(i);
+                                     } });
+        }
+        for (uint32_t c = 0; c < threadCount; ++c)
+        {
+            threads.emplace_back([&]()
+                                 {
+                                     while (!go.load(std::memory_order_acquire))
+                                     {
+                                         std::this_thread::yield();
+                                     }
+                                     uint64_t sum = 0;
+                                     while (consumed.load(std::memory_order_relaxed) < itemCount)
+                                     {
+                                         if (const auto v = pop())
+                                         {
+                                             sum += *v;
+                                             consumed.fetch_add(1, std::memory_order_relaxed);
+                                         }
+                                         else
+                                         {
+                                             std::this_thread::yield();
+                                         }
+                                     }
+                                     checksum.fetch_add(sum, std::memory_order_relaxed); });
+        }
+        const auto begin = std::chrono::steady_clock::now();
+        go.store(true, std::memory_order_release);
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+        const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        if (checksum.load() != itemCount * (itemCount - 1) / 2)
+        {
+            std::fprintf(stderr, "checksum mismatch: items lost or duplicated\n");
+            std::exit(1);
+        }
+        return itemCount / seconds;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const uint64_t itemCount = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : (1ull << 20);
+    const uint32_t maxThreads = argc > 2 ? static_cast<uint32_t>(std::strtoul(argv[2], nullptr, 10)) : 64;
+    std::printf("%llu items, %u hardware threads\n", static_cast<unsigned long long>(itemCount), std::thread::hardware_concurrency());
+    std::printf("%10s %22s %22s %22s\n", "producers", "QueueLockFree (M/s)", "wait_pop_for (M/s)", "QueueThreadSafe (M/s)");
+    for (uint32_t threadCount = 1; threadCount <= maxThreads; threadCount *= 2)
+    {
+        QueueLockFree<uint64_t> lockFree(1024);
+        const auto lockFreeRate = measure(
+            threadCount, itemCount,
+            [&](uint64_t v)
+            {
+                while (!lockFree.try_push(v))
+                {
+                    std::this_thread::yield();
+                }
+            },
+            [&]()
+            { return lockFree.try_pop(); });
+
+        QueueLockFree<uint64_t> waiting(1024);
+        const auto waitingRate = measure(
+            threadCount, itemCount,
+            [&](uint64_t v)
+            {
+                while (!waiting.try_push(v))
+                {
+                    std::this_thread::yield();
+                }
+            },
+            [&]()
+            { return waiting.wait_pop_for(std::chrono::milliseconds(1)); });
+
+        QueueThreadSafe<uint64_t> threadSafe;
+        const auto threadSafeRate = measure(
+            threadCount, itemCount,
+            [&](uint64_t v)
+            { threadSafe.push(v); },
+            [&]()
+            {
+                std::optional<uint64_t> v;
+                threadSafe.pop(v);
+                return v;
+            });
+
+        std::printf("%10u %22.2f %22.2f %22.2f\n", threadCount, lockFreeRate / 1e6, waitingRate / 1e6, threadSafeRate / 1e6);
+    }
+    return 0;
+}
@@ -0,0 +1,150 @@
+// shader build profiles: spirv size and gpu time of the frustum culling dispatch (cullFustrum.comp)
+// built as debug, release and size, every build dispatched over the same synthetic scene of bounding boxes
+// headless, no window: any vulkan 1.3 device, lavapipe included, 0 ms when the queue has no timestamps
+// run from a directory next to assets/ (getAssetPath), e.g. build/
+// usage: shaderProfileBench [dispatchCount = 1000] [meshCount = 4096]
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <misc.h>
+#include <context.h>
+#include <scene.h>
+#include <arcballCamera.h>
+#include <cullFustrum.h>
+#include <renderGraph.h>
+#include <uniformRing.h>
+#include <descriptorAllocator.h>
+
+namespace
+{
+    struct Report
+    {
+        size_t spirvBytes{0};
+        double medianDispatchMs{0.0};
+    };
+
+    // unit boxes and larger ones scattered in a cube around the origin, part of them behind the camera
+    std::shared_ptr<Scene> syntheticScene(uint32_t meshCount)
+    {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> position(-100.f, 100.f);
+        std::uniform_real_distribution<float> extent(0.5f, 2.f);
+        auto scene = std::make_shared<Scene>();
+        scene->meshes.resize(meshCount);
+        scene->indirectDraw.reserve(meshCount);
+        for (uint32_t i = 0; i < meshCount; ++i)
+        {
+            auto &mesh = scene->meshes[i];
+            mesh.center = glm::vec3(position(rng), position(rng), position(rng));
+            mesh.extents = glm::vec3(extent(rng), extent(rng), extent(rng));
+            scene->indirectDraw.emplace_back(IndirectDrawDef1{
+                .indexCount = 36,
+                .instanceCount = 1,
+                .firstIndex = 0,
+                .vertexOffset = 0,
+                .firstInstance = 0,
+                .meshId = i,
+                .materialIndex = -1,
+            });
+        }
+        return scene;
+    }
+
+    // frames are paced as in the app: the slot's readback (CullFustrum::update) holds the dispatch of framesInFlight frames ago
+    Report run(VkContext &ctx,
+               SHADER_BUILD_PROFILE profile,
+               uint32_t dispatchCount,
+               const std::shared_ptr<Scene> &scene,
+               const CameraBase &camera,
+               BufferEntity &indirectDrawBuffer,
+               UniformRing &uniformRing,
+               DescriptorAllocator &descriptorAllocator)
+    {
+        Report report;
+        report.spirvBytes = buildSpirv(getAssetPath() + "/cullFustrum.comp", "main", profile).size();
+
+        ctx.setShaderBuildProfile(profile);
+        CullFustrum cullFustrum;
+        cullFustrum.setContext(&ctx);
+        cullFustrum.setScene(scene);
+        cullFustrum.setCamera(&camera);
+        cullFustrum.setIndirectDrawBuffer(&indirectDrawBuffer);
+        cullFustrum.setUniformRing(&uniformRing);
+        cullFustrum.setDescriptorAllocator(&descriptorAllocator);
+        cullFustrum.finalizeInit();
+
+        RenderGraph graph(&ctx);
+        graph.addPass("cull fustrum", &cullFustrum);
+        graph.markOutput(CullFustrum::CULLED_IDR_RESOURCE, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT);
+        graph.markOutput(CullFustrum::CULLED_IDR_COUNT_RESOURCE, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT);
+        graph.compile();
+
+        const auto framesInFlight = ctx.getFramesInFlight();
+        std::vector<double> dispatchMs;
+        dispatchMs.reserve(dispatchCount);
+        for (uint32_t frame = 0; frame < dispatchCount + framesInFlight; ++frame)
+        {
+            ctx.advanceCommandBuffer();
+            auto [frameIndex, cmd] = ctx.getCommandBufferForRendering();
+            ctx.BeginRecordCommandBuffer(cmd);
+            graph.execute(cmd, static_cast<int>(frameIndex));
+            ctx.EndRecordCommandBuffer(cmd);
+            ctx.submitCommand();
+            // every slot has been dispatched once: the readback is the one of a completed frame
+            if (frame >= framesInFlight)
+            {
+                dispatchMs.push_back(cullFustrum.getDispatchGpuMs());
+            }
+        }
+        // the graph's transient buffers and the pass go away with this scope
+        vkDeviceWaitIdle(ctx.getLogicDevice());
+
+        std::nth_element(dispatchMs.begin(), dispatchMs.begin() + dispatchMs.size() / 2, dispatchMs.end());
+        report.medianDispatchMs = dispatchMs.empty() ? 0.0 : dispatchMs[dispatchMs.size() / 2];
+        return report;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const uint32_t dispatchCount = argc > 1 ? static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 10)) : 1000;
+    const uint32_t meshCount = argc > 2 ? static_cast<uint32_t>(std::strtoul(argv[2], nullptr, 10)) : 4096;
+    VK_CHECK(volkInitialize());
+    VkContext ctx({64, 64}, {}, {VK_EXT_DEBUG_UTILS_EXTENSION_NAME}, {});
+    ctx.createSwapChain();
+    ctx.initDefaultCommandBuffers();
+
+    // shared by the three builds: only the shader module differs
+    const auto scene = syntheticScene(meshCount);
+    ArcballCamera camera(glm::vec3(0.f, 0.f, 150.f), glm::vec3(0.f), glm::vec3(0.f, 1.f, 0.f), 0.1f, 1000.f, 65.f, 1.f);
+    const auto indirectDrawBytes = static_cast<uint32_t>(scene->indirectDraw.size() * sizeof(IndirectDrawDef1));
+    auto indirectDrawBuffer = ctx.createDeviceLocalBuffer("bench indirect draw",
+                                                          indirectDrawBytes,
+                                                          VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+                                                              VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                                              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                                              VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+    auto batch = ctx.createUploadBatch();
+    batch.writeBuffer(indirectDrawBuffer, scene->indirectDraw.data(), indirectDrawBytes, 0, true);
+    ctx.waitUpload(batch.submit());
+    UniformRing uniformRing(&ctx);
+    DescriptorAllocator descriptorAllocator(&ctx);
+
+    std::printf("%u meshes, %u dispatches per profile\n", meshCount, dispatchCount);
+    for (const auto profile : {SHADER_PROFILE_DEBUG, SHADER_PROFILE_RELEASE, SHADER_PROFILE_SIZE})
+    {
+        const auto report = run(ctx, profile, dispatchCount, scene, camera, indirectDrawBuffer, uniformRing, descriptorAllocator);
+        std::printf("%-8s %8zu bytes spirv %10.4f ms median dispatch\n",
+                    shaderBuildProfileName(profile), report.spirvBytes, report.medianDispatchMs);
+    }
+
+    vmaDestroyBuffer(ctx.getVmaAllocator(),
+                     std::get<BUFFER_ENTITY_UID::BUFFER>(indirectDrawBuffer),
+                     std::get<BUFFER_ENTITY_UID::VMA_ALLOCATION>(indirectDrawBuffer));
+    return 0;
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <context.h>
+
+// synchronization2 barrier batching
+// collect memory/buffer/image transitions, then flush them into one vkCmdPipelineBarrier2
+// transitions of the same resource (same range, layouts and queue families) are merged by or-ing the masks
+// usage:
+//     BarrierBatch barriers;
+//     barriers.buffer(idr, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+//                     VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT);
+//     barriers.image(...);
+//     barriers.flush(cmdBufferHandle);
+class BarrierBatch
+{
+public:
+    BarrierBatch() = default;
+
+    // global memory dependency, all of them are folded into one VkMemoryBarrier2
+    BarrierBatch &memory(
+        VkPipelineStageFlags2 srcStageMask,
+        VkAccessFlags2 srcAccessMask,
+        VkPipelineStageFlags2 dstStageMask,
+        VkAccessFlags2 dstAccessMask)
+    {
+        if (_memoryBarriers.empty())
+        {
+            _memoryBarriers.emplace_back(VkMemoryBarrier2{
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+            });
+        }
+        auto &memoryBarrier = _memoryBarriers.front();
+        memoryBarrier.srcStageMask |= srcStageMask;
+        memoryBarrier.srcAccessMask |= srcAccessMask;
+        memoryBarrier.dstStageMask |= dstStageMask;
+        memoryBarrier.dstAccessMask |= dstAccessMask;
+        return *this;
+    }
+
+    BarrierBatch &buffer(
+        VkBuffer buffer,
+        VkPipelineStageFlags2 srcStageMask,
+        VkAccessFlags2 srcAccessMask,
+        VkPipelineStageFlags2 dstStageMask,
+        VkAccessFlags2 dstAccessMask,
+        VkDeviceSize offset = 0,
+        VkDeviceSize size = VK_WHOLE_SIZE,
+        uint32_t srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        uint32_t dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED)
+    {
+        auto it = std::find_if(_bufferBarriers.begin(), _bufferBarriers.end(), [&](const VkBufferMemoryBarrier2 &b)
+                               { return b.buffer == buffer && b.offset == offset && b.size == size &&
+                                        b.srcQueueFamilyIndex == srcQueueFamilyIndex &&
+                                        b.dstQueueFamilyIndex == dstQueueFamilyIndex; });
+        if (it != _bufferBarriers.end())
+        {
+            it->srcStageMask |= srcStageMask;
+            it->srcAccessMask |= srcAccessMask;
+            it->dstStageMask |= dstStageMask;
+            it->dstAccessMask |= dstAccessMask;
+            return *this;
+        }
+        _bufferBarriers.emplace_back(VkBufferMemoryBarrier2{
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+            .srcStageMask = srcStageMask,
+            .srcAccessMask = srcAccessMask,
+            .dstStageMask = dstStageMask,
+            .dstAccessMask = dstAccessMask,
+            .srcQueueFamilyIndex = srcQueueFamilyIndex,
+            .dstQueueFamilyIndex = dstQueueFamilyIndex,
+            .buffer = buffer,
+            .offset = offset,
+            .size = size,
+        });
+        return *this;
+    }
+
+    // whole buffer
+    BarrierBatch &buffer(
+        const BufferEntity &buffer,
+        VkPipelineStageFlags2 srcStageMask,
+        VkAccessFlags2 srcAccessMask,
+        VkPipelineStageFlags2 dstStageMask,
+        VkAccessFlags2 dstAccessMask)
+    {
+        return this->buffer(std::get<BUFFER_ENTITY_UID::BUFFER>(buffer),
+                            srcStageMask, srcAccessMask, dstStageMask, dstAccessMask);
+    }
+
+    BarrierBatch &image(
+        VkImage image,
+        VkImageLayout oldLayout,
+        VkImageLayout newLayout,
+        VkPipelineStageFlags2 srcStageMask,
+        VkAccessFlags2 srcAccessMask,
+        VkPipelineStageFlags2 dstStageMask,
+        VkAccessFlags2 dstAccessMask,
+        const VkImageSubresourceRange &subresourceRange,
+        uint32_t srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        uint32_t dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED)
+    {
+        auto it = std::find_if(_imageBarriers.begin(), _imageBarriers.end(), [&](const VkImageMemoryBarrier2 &b)
+                               { return b.image == image && b.oldLayout == oldLayout && b.newLayout == newLayout &&
+                                        b.subresourceRange.aspectMask == subresourceRange.aspectMask &&
+                                        b.subresourceRange.baseMipLevel == subresourceRange.baseMipLevel &&
+                                        b.subresourceRange.levelCount == subresourceRange.levelCount &&
+                                        b.subresourceRange.baseArrayLayer == subresourceRange.baseArrayLayer &&
+                                        b.subresourceRange.layerCount == subresourceRange.layerCount &&
+                                        b.srcQueueFamilyIndex == srcQueueFamilyIndex &&
+                                        b.dstQueueFamilyIndex == dstQueueFamilyIndex; });
+        if (it != _imageBarriers.end())
+        {
+            it->srcStageMask |= srcStageMask;
+            it->srcAccessMask |= srcAccessMask;
+            it->dstStageMask |= dstStageMask;
+            it->dstAccessMask |= dstAccessMask;
+            return *this;
+        }
+        _imageBarriers.emplace_back(VkImageMemoryBarrier2{
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+            .srcStageMask = srcStageMask,
+            .srcAccessMask = srcAccessMask,
+            .dstStageMask = dstStageMask,
+            .dstAccessMask = dstAccessMask,
+            .oldLayout = oldLayout,
+            .newLayout = newLayout,
+            .srcQueueFamilyIndex = srcQueueFamilyIndex,
+            .dstQueueFamilyIndex = dstQueueFamilyIndex,
+            .image = image,
+            .subresourceRange = subresourceRange,
+        });
+        return *this;
+    }
+
+    // color, all the mips of layer 0
+    BarrierBatch &image(
+        const ImageEntity &image,
+        VkImageLayout oldLayout,
+        VkImageLayout newLayout,
+        VkPipelineStageFlags2 srcStageMask,
+        VkAccessFlags2 srcAccessMask,
+        VkPipelineStageFlags2 dstStageMask,
+        VkAccessFlags2 dstAccessMask)
+    {
+        return this->image(std::get<IMAGE_ENTITY_OFFSET::IMAGE>(image), oldLayout, newLayout,
+                           srcStageMask, srcAccessMask, dstStageMask, dstAccessMask,
+                           {VK_IMAGE_ASPECT_COLOR_BIT, 0, std::get<IMAGE_ENTITY_OFFSET::MIPMAP_COUNT>(image), 0, 1});
+    }
+
+    // release/acquire pairs of a queue family ownership transfer can be added as is
+    BarrierBatch &buffer(const VkBufferMemoryBarrier2 &barrier)
+    {
+        _bufferBarriers.emplace_back(barrier);
+        return *this;
+    }
+
+    BarrierBatch &image(const VkImageMemoryBarrier2 &barrier)
+    {
+        _imageBarriers.emplace_back(barrier);
+        return *this;
+    }
+
+    inline bool empty() const
+    {
+        return _memoryBarriers.empty() && _bufferBarriers.empty() && _imageBarriers.empty();
+    }
+
+    // one vkCmdPipelineBarrier2 for everything collected so far, the batch is empty afterwards
+    void flush(VkCommandBuffer cmdBufferHandle)
+    {
+        if (empty())
+        {
+            return;
+        }
+        const VkDependencyInfo dependencyInfo{
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .memoryBarrierCount = static_cast<uint32_t>(_memoryBarriers.size()),
+            .pMemoryBarriers = _memoryBarriers.data(),
+            .bufferMemoryBarrierCount = static_cast<uint32_t>(_bufferBarriers.size()),
+            .pBufferMemoryBarriers = _bufferBarriers.data(),
+            .imageMemoryBarrierCount = static_cast<uint32_t>(_imageBarriers.size()),
+            .pImageMemoryBarriers = _imageBarriers.data(),
+        };
+        vkCmdPipelineBarrier2(cmdBufferHandle, &dependencyInfo);
+        _memoryBarriers.clear();
+        _bufferBarriers.clear();
+        _imageBarriers.clear();
+    }
+
+    void flush(const CommandBufferEntity &cmdBuffer)
+    {
+        flush(std::get<COMMAND_BUFFER_ENTITY_OFFSET::COMMAND_BUFFER>(cmdBuffer));
+    }
+
+private:
+    // at most one
+    std::vector<VkMemoryBarrier2> _memoryBarriers;
+    std::vector<VkBufferMemoryBarrier2> _bufferBarriers;
+    std::vector<VkImageMemoryBarrier2> _imageBarriers;
+};
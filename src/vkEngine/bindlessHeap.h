@@ -0,0 +1,278 @@
+#pragma once
+
+#include <array>
+#include <mutex>
+#include <tuple>
+#include <vector>
+#include <algorithm>
+
+#include <misc.h>
+#include <context.h>
+
+// binding of each resource array inside the global set
+enum BINDLESS_HEAP_BINDING : int
+{
+    BINDLESS_STORAGE_BUFFER = 0,
+    BINDLESS_SAMPLED_IMAGE,
+    BINDLESS_SAMPLER,
+    BINDLESS_STORAGE_IMAGE,
+    BINDLESS_BINDING_SIZE
+};
+
+// bindless: one global descriptor set with large, partially bound arrays (descriptor indexing)
+// resources are written once when they are created, shaders address them by index (push constants)
+// every pass binds the same set once, no per pass set layout/pool/set and no cap on the texture count of a pass
+// glsl side, set 0:
+//     layout(set = 0, binding = 0) buffer StorageBuffers { uint data[]; } storageBuffers[];
+//     layout(set = 0, binding = 1) uniform texture2D sampledImages[];
+//     layout(set = 0, binding = 2) uniform sampler samplers[];
+//     layout(set = 0, binding = 3, rgba8) uniform image2D storageImages[];
+//     // indices: nonuniformEXT() when they are not dynamically uniform
+// usage:
+//     BindlessHeap heap(&ctx);
+//     auto idr = heap.addStorageBuffer(idrBuffer);
+//     pipeline layout: {heap.getDescriptorSetLayout()} + push constant range with the indices
+//     heap.bind(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout);
+//     vkCmdPushConstants(cmd, pipelineLayout, ..., &indices);
+class BindlessHeap
+{
+public:
+    // capacities are clamped to the update after bind limits of the device
+    explicit BindlessHeap(VkContext *ctx,
+                          uint32_t storageBufferCount = 1u << 16,
+                          uint32_t sampledImageCount = 1u << 14,
+                          uint32_t samplerCount = 1u << 8,
+                          uint32_t storageImageCount = 1u << 12)
+        : _ctx(ctx)
+    {
+        ASSERT(_ctx, "vk context should be defined");
+        VkPhysicalDeviceVulkan12Properties properties12{
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES,
+        };
+        VkPhysicalDeviceProperties2 properties{
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &properties12,
+        };
+        vkGetPhysicalDeviceProperties2(_ctx->getSelectedPhysicalDevice(), &properties);
+
+        _capacities[BINDLESS_STORAGE_BUFFER] = std::min({storageBufferCount,
+                                                         properties12.maxDescriptorSetUpdateAfterBindStorageBuffers,
+                                                         properties12.maxPerStageDescriptorUpdateAfterBindStorageBuffers});
+        _capacities[BINDLESS_SAMPLED_IMAGE] = std::min({sampledImageCount,
+                                                        properties12.maxDescriptorSetUpdateAfterBindSampledImages,
+                                                        properties12.maxPerStageDescriptorUpdateAfterBindSampledImages});
+        _capacities[BINDLESS_SAMPLER] = std::min({samplerCount,
+                                                  properties12.maxDescriptorSetUpdateAfterBindSamplers,
+                                                  properties12.maxPerStageDescriptorUpdateAfterBindSamplers});
+        _capacities[BINDLESS_STORAGE_IMAGE] = std::min({storageImageCount,
+                                                        properties12.maxDescriptorSetUpdateAfterBindStorageImages,
+                                                        properties12.maxPerStageDescriptorUpdateAfterBindStorageImages});
+        // all the arrays are visible to every stage: they share the per stage resource budget
+        uint64_t totalCount{0};
+        for (const auto capacity : _capacities)
+        {
+            totalCount += capacity;
+        }
+        if (totalCount > properties12.maxPerStageUpdateAfterBindResources)
+        {
+            for (auto &capacity : _capacities)
+            {
+                capacity = static_cast<uint32_t>(capacity * properties12.maxPerStageUpdateAfterBindResources / totalCount);
+            }
+        }
+
+        // every stage: a single set layout for graphics, compute and ray tracing pipelines
+        constexpr VkShaderStageFlags stages = VK_SHADER_STAGE_ALL;
+        std::vector<std::vector<VkDescriptorSetLayoutBinding>> setBindings(1);
+        for (int binding = 0; binding < BINDLESS_BINDING_SIZE; ++binding)
+        {
+            setBindings[0].emplace_back(VkDescriptorSetLayoutBinding{
+                .binding = static_cast<uint32_t>(binding),
+                .descriptorType = DESCRIPTOR_TYPES[binding],
+                .descriptorCount = _capacities[binding],
+                .stageFlags = stages,
+            });
+        }
+        // partially bound, update after bind, update unused while pending
+        _descriptorSetLayout = _ctx->createDescriptorSetLayout(setBindings)[0];
+
+        std::unordered_map<VkDescriptorType, uint32_t> budgets;
+        for (int binding = 0; binding < BINDLESS_BINDING_SIZE; ++binding)
+        {
+            budgets[DESCRIPTOR_TYPES[binding]] += _capacities[binding];
+        }
+        _descriptorPool = _ctx->createDescriptorSetPool(budgets, 1);
+        _descriptorSet = _ctx->allocateDescriptorSet(_descriptorPool, {{&_descriptorSetLayout, 1}})[&_descriptorSetLayout][0];
+        setCorrlationId(_descriptorSet, _ctx->getLogicDevice(), VK_OBJECT_TYPE_DESCRIPTOR_SET, "Bindless Heap");
+
+        log(Level::Info, "BindlessHeap: ", _capacities[BINDLESS_STORAGE_BUFFER], " storage buffer(s), ",
+            _capacities[BINDLESS_SAMPLED_IMAGE], " sampled image(s), ",
+            _capacities[BINDLESS_SAMPLER], " sampler(s), ",
+            _capacities[BINDLESS_STORAGE_IMAGE], " storage image(s)");
+    }
+
+    BindlessHeap(const BindlessHeap &) = delete;
+    BindlessHeap &operator=(const BindlessHeap &) = delete;
+
+    ~BindlessHeap()
+    {
+        // the set layout is owned by the context
+        vkDestroyDescriptorPool(_ctx->getLogicDevice(), _descriptorPool, nullptr);
+    }
+
+    uint32_t addStorageBuffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE)
+    {
+        const VkDescriptorBufferInfo bufferInfo{
+            .buffer = buffer,
+            .offset = offset,
+            .range = range,
+        };
+        std::scoped_lock lock{_mux};
+        const auto index = allocate(BINDLESS_STORAGE_BUFFER);
+        write(BINDLESS_STORAGE_BUFFER, index, nullptr, &bufferInfo);
+        return index;
+    }
+
+    uint32_t addStorageBuffer(const BufferEntity &buffer)
+    {
+        return addStorageBuffer(std::get<BUFFER_ENTITY_UID::BUFFER>(buffer), 0, std::get<BUFFER_ENTITY_UID::BUFFER_SIZE>(buffer));
+    }
+
+    // arena slice: the descriptor covers [offset, offset + size) of the backing buffer
+    uint32_t addStorageBuffer(const BufferSlice &slice)
+    {
+        return addStorageBuffer(std::get<BUFFER_SLICE_OFFSET::SLICE_BUFFER>(slice),
+                                std::get<BUFFER_SLICE_OFFSET::SLICE_OFFSET>(slice),
+                                std::get<BUFFER_SLICE_OFFSET::SLICE_SIZE>(slice));
+    }
+
+    uint32_t addSampledImage(VkImageView imageView, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+    {
+        const VkDescriptorImageInfo imageInfo{
+            .imageView = imageView,
+            .imageLayout = layout,
+        };
+        std::scoped_lock lock{_mux};
+        const auto index = allocate(BINDLESS_SAMPLED_IMAGE);
+        write(BINDLESS_SAMPLED_IMAGE, index, &imageInfo, nullptr);
+        return index;
+    }
+
+    uint32_t addSampledImage(const ImageEntity &image)
+    {
+        return addSampledImage(std::get<IMAGE_ENTITY_OFFSET::IMAGE_VIEW>(image));
+    }
+
+    uint32_t addSampler(VkSampler sampler)
+    {
+        const VkDescriptorImageInfo imageInfo{
+            .sampler = sampler,
+        };
+        std::scoped_lock lock{_mux};
+        const auto index = allocate(BINDLESS_SAMPLER);
+        write(BINDLESS_SAMPLER, index, &imageInfo, nullptr);
+        return index;
+    }
+
+    uint32_t addStorageImage(VkImageView imageView)
+    {
+        const VkDescriptorImageInfo imageInfo{
+            .imageView = imageView,
+            .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+        };
+        std::scoped_lock lock{_mux};
+        const auto index = allocate(BINDLESS_STORAGE_IMAGE);
+        write(BINDLESS_STORAGE_IMAGE, index, &imageInfo, nullptr);
+        return index;
+    }
+
+    uint32_t addStorageImage(const ImageEntity &image)
+    {
+        return addStorageImage(std::get<IMAGE_ENTITY_OFFSET::IMAGE_VIEW>(image));
+    }
+
+    // the frame being recorded may still use the slot: it is handed out again once that frame is complete
+    void release(BINDLESS_HEAP_BINDING binding, uint32_t index)
+    {
+        std::scoped_lock lock{_mux};
+        ASSERT(binding < BINDLESS_BINDING_SIZE && index < _next[binding], "bindless index should be allocated");
+        _retired[binding].emplace_back(_ctx->getFrameNumber(), index);
+    }
+
+    // once per command buffer and bind point, any pipeline layout starting with getDescriptorSetLayout() at firstSet
+    void bind(VkCommandBuffer cmdBufferHandle, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout, uint32_t firstSet = 0) const
+    {
+        vkCmdBindDescriptorSets(cmdBufferHandle, bindPoint, pipelineLayout, firstSet, 1, &_descriptorSet, 0, nullptr);
+    }
+
+    inline VkDescriptorSetLayout getDescriptorSetLayout() const
+    {
+        return _descriptorSetLayout;
+    }
+
+    inline uint32_t getCapacity(BINDLESS_HEAP_BINDING binding) const
+    {
+        return _capacities[binding];
+    }
+
+private:
+    static constexpr std::array<VkDescriptorType, BINDLESS_BINDING_SIZE> DESCRIPTOR_TYPES{
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+        VK_DESCRIPTOR_TYPE_SAMPLER,
+        VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+    };
+
+    // under _mux
+    uint32_t allocate(BINDLESS_HEAP_BINDING binding)
+    {
+        auto &retired = _retired[binding];
+        auto &freeIndices = _free[binding];
+        std::erase_if(retired, [&](const auto &entry)
+                      {
+                          const auto &[frameNumber, index] = entry;
+                          if (!_ctx->isFrameComplete(frameNumber))
+                          {
+                              return false;
+                          }
+                          freeIndices.push_back(index);
+                          return true; });
+        if (!freeIndices.empty())
+        {
+            const auto index = freeIndices.back();
+            freeIndices.pop_back();
+            return index;
+        }
+        ASSERT(_next[binding] < _capacities[binding], "bindless heap is full");
+        return _next[binding]++;
+    }
+
+    // update after bind: visible to the command buffers submitted from now on, even if the set is already bound
+    void write(BINDLESS_HEAP_BINDING binding, uint32_t index, const VkDescriptorImageInfo *imageInfo, const VkDescriptorBufferInfo *bufferInfo)
+    {
+        const VkWriteDescriptorSet writeDescriptorSet{
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = _descriptorSet,
+            .dstBinding = static_cast<uint32_t>(binding),
+            .dstArrayElement = index,
+            .descriptorCount = 1,
+            .descriptorType = DESCRIPTOR_TYPES[binding],
+            .pImageInfo = imageInfo,
+            .pBufferInfo = bufferInfo,
+        };
+        vkUpdateDescriptorSets(_ctx->getLogicDevice(), 1, &writeDescriptorSet, 0, nullptr);
+    }
+
+    VkContext *_ctx{nullptr};
+    VkDescriptorSetLayout _descriptorSetLayout{VK_NULL_HANDLE};
+    VkDescriptorPool _descriptorPool{VK_NULL_HANDLE};
+    VkDescriptorSet _descriptorSet{VK_NULL_HANDLE};
+    std::array<uint32_t, BINDLESS_BINDING_SIZE> _capacities{};
+
+    // allocation and descriptor writes (the set is externally synchronized)
+    std::mutex _mux;
+    std::array<uint32_t, BINDLESS_BINDING_SIZE> _next{};
+    std::array<std::vector<uint32_t>, BINDLESS_BINDING_SIZE> _free;
+    // frame number, index
+    std::array<std::vector<std::tuple<uint64_t, uint32_t>>, BINDLESS_BINDING_SIZE> _retired;
+};
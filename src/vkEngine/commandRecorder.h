@@ -0,0 +1,322 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <misc.h>
+#include <context.h>
+#include <jobSystem.h>
+
+// multi-threaded command recording into secondary command buffers
+// every worker owns one command pool per frame in flight (pools are externally synchronized, nothing is shared)
+// a pool is reset wholesale (vkResetCommandPool) the first time its frame slot is reused, once the gpu is done with it
+// the calling thread records as well, the other workers live as long as the recorder
+// or: the workers of a JobSystem, record may be called from any thread (e.g. a RenderThread),
+// threads which are not workers of the job system share one more set of pools, recording into it is serialized
+// usage:
+//     ParallelCommandRecorder recorder(&ctx);
+//     // per frame, between advanceCommandBuffer and submitCommand
+//     auto secondaries = recorder.record(drawChunkCount, [&](size_t chunk, VkCommandBuffer cmd)
+//                                        { recordDraws(cmd, chunk); });
+//     recorder.execute(primaryCmd, secondaries);
+class ParallelCommandRecorder
+{
+public:
+    explicit ParallelCommandRecorder(VkContext *ctx, uint32_t workerCount = std::thread::hardware_concurrency())
+        : _ctx(ctx), _workerCount(std::max(workerCount, 1u))
+    {
+        ASSERT(_ctx, "vk context should be defined");
+        createPools();
+        // worker 0 is the thread calling record
+        _threads.reserve(_workerCount - 1);
+        for (uint32_t worker = 1; worker < _workerCount; ++worker)
+        {
+            _threads.emplace_back([this, worker]()
+                                  { workerLoop(worker); });
+        }
+    }
+
+    // no threads of its own: one set of pools per worker of the job system, plus one for the other threads
+    ParallelCommandRecorder(VkContext *ctx, JobSystem *jobs)
+        : _ctx(ctx), _jobs(jobs)
+    {
+        ASSERT(_ctx, "vk context should be defined");
+        ASSERT(_jobs, "job system should be defined");
+        _workerCount = _jobs->getWorkerCount();
+        createPools();
+    }
+
+    ParallelCommandRecorder(const ParallelCommandRecorder &) = delete;
+    ParallelCommandRecorder &operator=(const ParallelCommandRecorder &) = delete;
+
+    // the command buffers are freed with their pools, the caller makes sure the gpu is done with them (e.g. vkDeviceWaitIdle)
+    ~ParallelCommandRecorder()
+    {
+        {
+            std::scoped_lock lock{_mux};
+            _stop = true;
+        }
+        _cv.notify_all();
+        for (auto &thread : _threads)
+        {
+            thread.join();
+        }
+        for (auto &workerPools : _pools)
+        {
+            for (auto &pool : workerPools)
+            {
+                vkDestroyCommandPool(_ctx->getLogicDevice(), pool.pool, nullptr);
+            }
+        }
+    }
+
+    // one secondary command buffer per task, returned in task order, ready for execute
+    // fn runs concurrently on the workers: tasks must not share cpu state without synchronization
+    // inheritance: render pass/subpass/framebuffer when the secondaries continue a render pass of the primary
+    std::vector<VkCommandBuffer> record(size_t taskCount,
+                                        const std::function<void(size_t, VkCommandBuffer)> &fn,
+                                        const VkCommandBufferInheritanceInfo &inheritance = {})
+    {
+        ZoneScopedN("ParallelCommandRecorder::record");
+        std::vector<VkCommandBuffer> secondaries(taskCount, VK_NULL_HANDLE);
+        if (taskCount == 0)
+        {
+            return secondaries;
+        }
+        // one record call at a time, the workers only ever see a single job
+        std::scoped_lock recordLock{_recordMux};
+        recycleFramePools();
+
+        _job = Job{
+            .fn = &fn,
+            .inheritance = inheritance,
+            .secondaries = &secondaries,
+            .taskCount = taskCount,
+        };
+        _job.inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        if (_jobs)
+        {
+            _jobs->parallelFor(taskCount, 1, [this](size_t begin, size_t end)
+                               {
+                                   for (auto task = begin; task < end; ++task)
+                                   {
+                                       recordTask(_jobs->getWorkerIndex(), task);
+                                   } });
+            return secondaries;
+        }
+        _nextTask = 0;
+        const auto helperCount = static_cast<uint32_t>(std::min<size_t>(_workerCount, taskCount) - 1);
+        {
+            std::scoped_lock lock{_mux};
+            _activeHelpers = helperCount;
+            _helpersToWake = helperCount;
+            ++_generation;
+        }
+        _cv.notify_all();
+
+        runTasks(0);
+
+        std::unique_lock lock{_mux};
+        _done.wait(lock, [this]()
+                   { return _activeHelpers == 0; });
+        return secondaries;
+    }
+
+    // big draw lists: [begin, end) ranges of at most chunkSize items, one secondary each
+    std::vector<VkCommandBuffer> recordChunks(size_t itemCount,
+                                              size_t chunkSize,
+                                              const std::function<void(size_t, size_t, VkCommandBuffer)> &fn,
+                                              const VkCommandBufferInheritanceInfo &inheritance = {})
+    {
+        ASSERT(chunkSize > 0, "chunk should hold at least one item");
+        const auto chunkCount = (itemCount + chunkSize - 1) / chunkSize;
+        return record(
+            chunkCount, [&](size_t chunk, VkCommandBuffer cmd)
+            {
+                const auto begin = chunk * chunkSize;
+                fn(begin, std::min(begin + chunkSize, itemCount), cmd); },
+            inheritance);
+    }
+
+    // in order, into the primary
+    void execute(VkCommandBuffer primary, const std::vector<VkCommandBuffer> &secondaries) const
+    {
+        if (!secondaries.empty())
+        {
+            vkCmdExecuteCommands(primary, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+        }
+    }
+
+    inline uint32_t getWorkerCount() const
+    {
+        return _workerCount;
+    }
+
+private:
+    struct FramePool
+    {
+        VkCommandPool pool{VK_NULL_HANDLE};
+        // allocated once, reused after every reset
+        std::vector<VkCommandBuffer> commandBuffers;
+        size_t next{0};
+        // frame which recorded from the pool, 0: never used
+        uint64_t frameNumber{0};
+    };
+
+    struct Job
+    {
+        const std::function<void(size_t, VkCommandBuffer)> *fn{nullptr};
+        VkCommandBufferInheritanceInfo inheritance{};
+        std::vector<VkCommandBuffer> *secondaries{nullptr};
+        size_t taskCount{0};
+    };
+
+    void createPools()
+    {
+        const VkCommandPoolCreateInfo poolInfo{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            // short-lived, reset as a whole
+            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+            .queueFamilyIndex = _ctx->getGraphicsComputeQueueFamilyIndex(),
+        };
+        // job system: getWorkerIndex() == workerCount for the threads which are not its workers
+        _pools.resize(_jobs ? _workerCount + 1 : _workerCount);
+        for (uint32_t worker = 0; worker < _pools.size(); ++worker)
+        {
+            _pools[worker].resize(_ctx->getFramesInFlight());
+            for (uint32_t frame = 0; frame < _pools[worker].size(); ++frame)
+            {
+                auto &pool = _pools[worker][frame];
+                VK_CHECK(vkCreateCommandPool(_ctx->getLogicDevice(), &poolInfo, nullptr, &pool.pool));
+                setCorrlationId(pool.pool, _ctx->getLogicDevice(), VK_OBJECT_TYPE_COMMAND_POOL,
+                                "secondary worker " + std::to_string(worker) + " frame " + std::to_string(frame));
+            }
+        }
+    }
+
+    // under _recordMux, workers are idle
+    void recycleFramePools()
+    {
+        const auto frameNumber = _ctx->getFrameNumber();
+        const auto frameSlot = (frameNumber - 1) % _ctx->getFramesInFlight();
+        for (auto &workerPools : _pools)
+        {
+            ASSERT(workerPools.size() == _ctx->getFramesInFlight(), "frames in flight changed after the recorder was created");
+            auto &pool = workerPools[frameSlot];
+            if (pool.frameNumber == frameNumber)
+            {
+                continue;
+            }
+            // normally already retired by advanceCommandBuffer
+            if (pool.frameNumber && !_ctx->isFrameComplete(pool.frameNumber))
+            {
+                _ctx->waitFrame(pool.frameNumber);
+            }
+            if (pool.next > 0)
+            {
+                VK_CHECK(vkResetCommandPool(_ctx->getLogicDevice(), pool.pool, 0));
+            }
+            pool.next = 0;
+            pool.frameNumber = frameNumber;
+        }
+    }
+
+    VkCommandBuffer acquire(uint32_t worker)
+    {
+        auto &pool = _pools[worker][(_ctx->getFrameNumber() - 1) % _ctx->getFramesInFlight()];
+        if (pool.next == pool.commandBuffers.size())
+        {
+            const VkCommandBufferAllocateInfo allocInfo{
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .commandPool = pool.pool,
+                .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+                .commandBufferCount = 1,
+            };
+            VkCommandBuffer cmd{VK_NULL_HANDLE};
+            VK_CHECK(vkAllocateCommandBuffers(_ctx->getLogicDevice(), &allocInfo, &cmd));
+            pool.commandBuffers.push_back(cmd);
+        }
+        return pool.commandBuffers[pool.next++];
+    }
+
+    void recordTask(uint32_t worker, size_t task)
+    {
+        // the pool of the non-worker threads: the caller of record and any other thread helping in JobSystem::wait
+        std::unique_lock lock{_externalPoolMux, std::defer_lock};
+        if (worker == _workerCount)
+        {
+            lock.lock();
+        }
+        auto cmd = acquire(worker);
+        const VkCommandBufferBeginInfo beginInfo{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VkCommandBufferUsageFlags(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                                               (_job.inheritance.renderPass ? VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT : 0)),
+            .pInheritanceInfo = &_job.inheritance,
+        };
+        VK_CHECK(vkBeginCommandBuffer(cmd, &beginInfo));
+        (*_job.fn)(task, cmd);
+        VK_CHECK(vkEndCommandBuffer(cmd));
+        (*_job.secondaries)[task] = cmd;
+    }
+
+    void runTasks(uint32_t worker)
+    {
+        for (auto task = _nextTask.fetch_add(1); task < _job.taskCount; task = _nextTask.fetch_add(1))
+        {
+            recordTask(worker, task);
+        }
+    }
+
+    void workerLoop(uint32_t worker)
+    {
+        uint64_t seenGeneration = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock lock{_mux};
+                _cv.wait(lock, [&]()
+                         { return _stop || (_generation != seenGeneration && _helpersToWake > 0); });
+                if (_stop)
+                {
+                    return;
+                }
+                seenGeneration = _generation;
+                --_helpersToWake;
+            }
+            runTasks(worker);
+            {
+                std::scoped_lock lock{_mux};
+                --_activeHelpers;
+            }
+            _done.notify_one();
+        }
+    }
+
+    VkContext *_ctx{nullptr};
+    JobSystem *_jobs{nullptr};
+    uint32_t _workerCount{1};
+    // [worker][frame in flight], job system: [workerCount] is shared by the threads which are not its workers
+    std::vector<std::vector<FramePool>> _pools;
+    std::mutex _externalPoolMux;
+    std::vector<std::thread> _threads;
+
+    std::mutex _recordMux;
+    Job _job;
+    std::atomic<size_t> _nextTask{0};
+
+    // worker wake up and completion
+    std::mutex _mux;
+    std::condition_variable _cv;
+    std::condition_variable _done;
+    uint64_t _generation{0};
+    uint32_t _helpersToWake{0};
+    uint32_t _activeHelpers{0};
+    bool _stop{false};
+};
@@ -1,6 +1,14 @@
 #include <vector>
 #include <array>
 #include <optional>
+#include <atomic>
+#include <deque>
+#include <algorithm>
+#include <mutex>
+#include <chrono>
+#include <filesystem>
+#include <cstring>
+#include <type_traits>
 #include <context.h>
 #include <window.h>
 
@@ -8,6 +16,7 @@
 #include <tracy/TracyVulkan.hpp>
 
 #include <queuethreadsafe.h>
+#include <barrierBatch.h>
 #include <future> //packaged_task<>
 
 #ifdef _WIN64
@@ -17,12 +26,21 @@
 #define VK_NO_PROTOTYPES // for volk
 #define VOLK_IMPLEMENTATION
 
-// triple-buffer
-static constexpr int MAX_FRAMES_IN_FLIGHT = 3;
-static constexpr int MAX_DESCRIPTOR_SETS = 1 * MAX_FRAMES_IN_FLIGHT + 1 + 4;
-// static constexpr int MAX_DESCRIPTOR_SETS = 1000;
+// triple-buffer unless VkContext::setFramesInFlight says otherwise
+static constexpr uint32_t DEFAULT_FRAMES_IN_FLIGHT = 3;
 //  Default fence timeout in nanoseconds
 #define DEFAULT_FENCE_TIMEOUT 100000000000
+// one persistently mapped host buffer shared by all the uploads
+static constexpr VkDeviceSize STAGING_RING_SIZE_IN_BYTES = 64 * 1024 * 1024;
+// regions reserved or in flight at the same time, an upload batch takes one region for all of its writes
+static constexpr uint32_t STAGING_RING_MAX_REGIONS = 1024;
+// backing buffer size per usage class of the buffer arena, larger requests get a block of their own
+static constexpr std::array<VkDeviceSize, BUFFER_ARENA_USAGE_SIZE> BUFFER_ARENA_BLOCK_SIZE_IN_BYTES{
+    64 * 1024 * 1024,
+    16 * 1024 * 1024,
+};
+// upload batches recording/executing at the same time
+static constexpr uint32_t UPLOAD_BATCH_INFLIGHT_COUNT = 4;
 
 static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
                                                     VkDebugUtilsMessageTypeFlagsEXT messageType,
@@ -39,25 +57,43 @@ class VkContext::Impl
 public:
     explicit Impl(
         const VkContext &ctx,
-        const Window &window,
+        const Window *window,
+        VkExtent2D offscreenExtent,
         const std::vector<const char *> &instanceValidationLayers,
         const std::set<std::string> &instanceExtensions,
         const std::vector<const char *> deviceExtensions)
         : _window(window),
+          _headless(window == nullptr),
           _instanceValidationLayers(instanceValidationLayers),
           _instanceExtensions(instanceExtensions),
           _deviceExtensions(deviceExtensions)
     {
+        if (_headless)
+        {
+            ASSERT(offscreenExtent.width > 0 && offscreenExtent.height > 0, "offscreen extent should not be empty");
+            _swapChainExtent = offscreenExtent;
+            // storage image support is mandatory for rgba8, not for bgra8
+            _swapChainFormat = VK_FORMAT_R8G8B8A8_UNORM;
+        }
         createInstance();
-        createSurface();
+        if (!_headless)
+        {
+            createSurface();
+        }
         selectPhysicalDevice();
-        cacheSupportedSurfaceFormats();
+        if (!_headless)
+        {
+            cacheSupportedSurfaceFormats();
+        }
         queryPhysicalDeviceCaps();
         selectQueueFamily();
         selectFeatures();
         createLogicDevice();
         cacheCommandQueue();
         createVMA();
+        createStagingRing();
+        createUploadTimelines();
+        createPipelineCache();
 
         createCommandPool();
         createTracyContext();
@@ -88,24 +124,81 @@ public:
             vkDestroyCommandPool(_logicalDevice, p, nullptr);
         }
 
+        // headless: views of the offscreen targets
         for (size_t i = 0; i < _swapChainImageViews.size(); i++)
         {
             vkDestroyImageView(_logicalDevice, _swapChainImageViews[i], nullptr);
+        }
+        for (size_t i = 0; i < imageCanAcquireSemaphores.size(); i++)
+        {
             vkDestroySemaphore(_logicalDevice, imageCanAcquireSemaphores[i], nullptr);
             vkDestroySemaphore(_logicalDevice, imageRendereredSemaphores[i], nullptr);
         }
 
         // image is owned by swap chain
-        vkDestroySwapchainKHR(_logicalDevice, _swapChain, nullptr);
+        // headless: VK_KHR_swapchain may not be enabled, its entry points are not loaded
+        if (_swapChain != VK_NULL_HANDLE)
+        {
+            vkDestroySwapchainKHR(_logicalDevice, _swapChain, nullptr);
+        }
+
+        vkDestroySemaphore(_logicalDevice, _graphicsTimeline, nullptr);
+        vkDestroySemaphore(_logicalDevice, _transferTimeline, nullptr);
+
+        log(Level::Info, "pipeline creation: ", _pipelineCreationCount.load(), " pipeline(s) in ",
+            _pipelineCreationTimeInUs.load() / 1000.0, " ms, ", _pipelineCacheWarm ? "warm" : "cold", " pipeline cache");
+        savePipelineCache();
+        vkDestroyPipelineCache(_logicalDevice, _pipelineCache, nullptr);
+
+        log(Level::Info, "object caches: ", _descriptorSetLayoutCache.size(), "/", _descriptorSetLayoutRequests, " descriptor set layout(s), ",
+            _pipelineLayoutCache.size(), "/", _pipelineLayoutRequests, " pipeline layout(s), ",
+            _samplerCache.size(), "/", _samplerRequests, " sampler(s)");
+        for (const auto &[key, pipelineLayout] : _pipelineLayoutCache)
+        {
+            vkDestroyPipelineLayout(_logicalDevice, pipelineLayout, nullptr);
+        }
+        for (const auto &[key, descriptorSetLayout] : _descriptorSetLayoutCache)
+        {
+            vkDestroyDescriptorSetLayout(_logicalDevice, descriptorSetLayout, nullptr);
+        }
+        for (const auto &[key, sampler] : _samplerCache)
+        {
+            vkDestroySampler(_logicalDevice, sampler, nullptr);
+        }
 
         // clean vma resource
+        for (const auto &blocks : _bufferArenaBlocks)
+        {
+            for (const auto &[buffer, block] : blocks)
+            {
+                // slices still alive are leaked by the app, drop them with the block
+                vmaClearVirtualBlock(block);
+                vmaDestroyVirtualBlock(block);
+                vmaDestroyBuffer(_vmaAllocator, std::get<BUFFER_ENTITY_UID::BUFFER>(buffer),
+                                 std::get<BUFFER_ENTITY_UID::VMA_ALLOCATION>(buffer));
+            }
+        }
+        vmaDestroyBuffer(_vmaAllocator, std::get<BUFFER_ENTITY_UID::BUFFER>(_stagingRing),
+                         std::get<BUFFER_ENTITY_UID::VMA_ALLOCATION>(_stagingRing));
+        for (const auto &target : _offscreenTargets)
+        {
+            vmaDestroyImage(_vmaAllocator, std::get<IMAGE_ENTITY_OFFSET::IMAGE>(target),
+                            std::get<IMAGE_ENTITY_OFFSET::IMAGE_VMA_ALLOCATION>(target));
+        }
         for (const auto &[memTypeIndex, pool] : _vmaCustomMemoryPool)
         {
             vmaDestroyPool(_vmaAllocator, pool);
         }
+        for (const auto &[key, pool] : _imagePools)
+        {
+            vmaDestroyPool(_vmaAllocator, pool);
+        }
         vmaDestroyAllocator(_vmaAllocator);
         vkDestroyDebugUtilsMessengerEXT(_instance, _debugMessenger, nullptr);
-        vkDestroySurfaceKHR(_instance, _surface, nullptr);
+        if (_surface != VK_NULL_HANDLE)
+        {
+            vkDestroySurfaceKHR(_instance, _surface, nullptr);
+        }
         vkDestroyDevice(_logicalDevice, nullptr);
         vkDestroyInstance(_instance, nullptr);
 
@@ -114,6 +207,8 @@ public:
 
     void createSwapChain();
     void createSwapChainImageView();
+    // headless replacement of the swapchain and its views
+    void createOffscreenTargets();
     void createPerFrameSyncObjects();
 
     VkRenderPass createSwapChainRenderPass();
@@ -195,9 +290,15 @@ public:
 #endif
 
     std::tuple<VkSampler> createSampler(const std::string &name);
+    std::tuple<VkSampler> createSampler(const VkSamplerCreateInfo &samplerCreateInfo, const std::string &name);
 
     std::vector<VkDescriptorSetLayout> createDescriptorSetLayout(std::vector<std::vector<VkDescriptorSetLayoutBinding>> &setBindings);
 
+    // cached, shared by every pipeline with the same set layouts and push constant ranges
+    VkPipelineLayout getPipelineLayout(
+        const std::vector<VkDescriptorSetLayout> &dsLayouts,
+        const std::vector<VkPushConstantRange> &pushConstants);
+
     VkDescriptorPool createDescriptorSetPool(
         const std::unordered_map<VkDescriptorType, uint32_t> &dsBudgets,
         uint32_t dsCap);
@@ -206,17 +307,20 @@ public:
         const std::unordered_map<VkShaderStageFlagBits, std::tuple<VkShaderModule, const char *, const VkSpecializationInfo *>> &shaderModuleEntities,
         const std::vector<VkDescriptorSetLayout> &dsLayouts,
         const std::vector<VkPushConstantRange> &pushConstants,
-        const VkRenderPass &renderPass);
+        const VkRenderPass &renderPass,
+        VkResult *result);
 
     std::tuple<VkPipeline, VkPipelineLayout> createComputePipeline(
         const std::unordered_map<VkShaderStageFlagBits, std::tuple<VkShaderModule, const char *, const VkSpecializationInfo *>> &shaderModuleEntities,
         const std::vector<VkDescriptorSetLayout> &dsLayouts,
-        const std::vector<VkPushConstantRange> &pushConstants);
+        const std::vector<VkPushConstantRange> &pushConstants,
+        VkResult *result);
 
     std::tuple<VkPipeline, VkPipelineLayout, std::vector<VkRayTracingShaderGroupCreateInfoKHR>> createRayTracingPipeline(
         const std::unordered_map<VkShaderStageFlagBits, std::tuple<VkShaderModule, const char *, const VkSpecializationInfo *>> &shaderModuleEntities,
         const std::vector<VkDescriptorSetLayout> &dsLayouts,
-        const std::vector<VkPushConstantRange> &pushConstants);
+        const std::vector<VkPushConstantRange> &pushConstants,
+        VkResult *result);
 
     BufferEntity createBuffer(
         const std::string &name,
@@ -264,38 +368,88 @@ public:
         VkDescriptorType descriptorSetType,
         uint32_t descriptorSetBindingPoint);
 
+    // reserve: the region is recycled once the submission it is committed to is done
+    // frameOwned: committed by the next submitCommand unless committed explicitly before
+    StagingAllocation allocateStaging(
+        VkDeviceSize sizeInBytes,
+        VkDeviceSize alignment,
+        bool frameOwned);
+
+    // commit: the allocations are read by the submission signaling fence
+    void fenceStagingRing(VkFence fence, const std::vector<StagingAllocation> &allocations);
+
+    // same for submissions signaling a timeline semaphore instead of a fence
+    void fenceStagingRing(VkSemaphore timeline, uint64_t timelineValue, const std::vector<StagingAllocation> &allocations);
+
+    // commit every frame owned region still reserved to the frame submission
+    void fenceFrameStagingRegions(VkSemaphore timeline, uint64_t timelineValue);
+
+    // fence is known to be signaled (waited by the caller)
+    void retireStagingRing(VkFence fence);
+
+    BufferSlice allocateBufferSlice(
+        BUFFER_ARENA_USAGE usage,
+        VkDeviceSize sizeInBytes,
+        VkDeviceSize alignment);
+
+    void freeBufferSlice(const BufferSlice &slice);
+
+    // free the retired slices whose frame is complete, caller holds _bufferArenaMutex
+    void collectBufferSlices();
+
     void writeBuffer(
-        const BufferEntity &stagingBuffer,
+        const StagingAllocation &staging,
         const BufferEntity &deviceLocalBuffer,
         const CommandBufferEntity &cmdBuffer,
         const void *rawData,
         uint32_t sizeInBytes,
-        uint32_t srcOffset = 0,
         uint32_t dstOffset = 0);
 
     // not a complete api, v1
     void writeImage(
         const ImageEntity &image,
-        const BufferEntity &stagingBuffer,
+        const StagingAllocation &staging,
         const CommandBufferEntity &cmdBuffer,
-        void *rawData);
+        const void *rawData);
+
+    // record all the copies of a batch into one command buffer and submit once
+    UploadTicket submitUploadBatch(
+        const std::vector<std::tuple<VkBuffer, const void *, uint32_t, uint32_t, bool>> &bufferWrites,
+        const std::vector<std::tuple<ImageEntity, const void *, bool>> &imageWrites,
+        const std::vector<std::function<void(VkCommandBuffer)>> &commands);
+
+    bool isUploadComplete(UploadTicket ticket);
+
+    void waitUpload(UploadTicket ticket);
+
+    // transfer family is only picked when it has no compute bit, see selectQueueFamily
+    inline bool hasDedicatedTransferQueue() const
+    {
+        return _transferQueue != VK_NULL_HANDLE && _transferQueueFamilyIndex != _graphicsComputeQueueFamilyIndex;
+    }
+
+    std::optional<VkCommandBuffer> recordPendingUploadAcquire();
+
+    bool isTimelineReached(VkSemaphore timeline, uint64_t timelineValue);
+
+    void waitTimeline(VkSemaphore timeline, uint64_t timelineValue);
 
     // cmdBufferEntity: where to submit the command
     // imageEntity: target of write op
-    // stagingBufferEntity: pinned memory< source of write
-    // rawData: needs to copy to stagingBuffer first, then staging to device memory
+    // rawData: needs to copy to staging ring first, then staging to device memory
 
     // semaphores to wait
     // semaphores to signal
     // stage of semaphores to wait
+    // wait: block on the fence of cmdBuffer
     void submitWriteImageCommand(
         ImageEntity &image,
-        BufferEntity &stagingBuffer,
         CommandBufferEntity &cmdBuffer,
         void *rawData,
         const std::vector<VkSemaphore> &semaphoresToWait,
         std::optional<VkPipelineStageFlags> waitStage,
-        const std::vector<VkSemaphore> &semaphoresToSignal);
+        const std::vector<VkSemaphore> &semaphoresToSignal,
+        bool wait);
 
     // not a complete api, v1, host application manage sync objects
     void generateMipmaps(
@@ -315,6 +469,18 @@ public:
 
     void submitCommand();
 
+    // next frame slot, blocks until the gpu is done with the frame which used it last time
+    void advanceFrame();
+
+    bool isFrameComplete(uint64_t frameNumber);
+
+    uint64_t getCompletedFrameNumber();
+
+    void waitFrame(uint64_t frameNumber);
+
+    // fetch-max: never moves back when two queries race
+    void setCompletedFrameNumber(uint64_t frameNumber);
+
     void present(uint32_t swapChainImageIndex);
 
     uint32_t getSwapChainImageIndexToRender() const;
@@ -329,6 +495,42 @@ public:
         return _vmaAllocator;
     }
 
+    inline bool isMemoryBudgetEnabled() const
+    {
+        return _memoryBudgetEnabled;
+    }
+
+    // true: the handler freed something, the allocation is worth another try
+    bool recoverFromOutOfDeviceMemory(VkDeviceSize sizeInBytes)
+    {
+        if (!_outOfDeviceMemoryHandler)
+        {
+            return false;
+        }
+        log(Level::Warn, "out of device memory, ", sizeInBytes, " bytes requested");
+        return _outOfDeviceMemoryHandler(sizeInBytes);
+    }
+
+    std::function<bool(VkDeviceSize)> _outOfDeviceMemoryHandler;
+
+    // image allocation policy
+    ImageAllocationPolicy _imageAllocationPolicy;
+    // (memory type index, size class) -> pool, created on first use
+    std::unordered_map<uint64_t, VmaPool> _imagePools;
+    std::mutex _imagePoolMutex;
+
+    // nullptr: dedicated memory
+    VmaPool selectImagePool(const VkImageCreateInfo &imageCreateInfo,
+                            const VmaAllocationCreateInfo &allocCreateInfo,
+                            VkDeviceSize sizeInBytes);
+
+    inline auto getPipelineCache() const
+    {
+        return _pipelineCache;
+    }
+
+    void savePipelineCache();
+
     inline auto getInstance() const
     {
         return _instance;
@@ -400,6 +602,16 @@ public:
         return _swapChainImageViews;
     }
 
+    inline bool isHeadless() const
+    {
+        return _headless;
+    }
+
+    inline const auto &getOffscreenTargets() const
+    {
+        return _offscreenTargets;
+    }
+
     inline TracyVkCtx getTracyContext() const
     {
         return _tracyCtx;
@@ -413,6 +625,22 @@ public:
     std::vector<VkSemaphore> imageRendereredSemaphores;
     // 0, 1, 2, 0, 1, 2, ...
     uint32_t currentFrameId = 0;
+    uint32_t _framesInFlight{DEFAULT_FRAMES_IN_FLIGHT};
+    // set by getFramesInFlight: per frame arrays outside of the context are sized from then on
+    std::atomic<bool> _framesInFlightUsed{false};
+#ifdef NDEBUG
+    SHADER_BUILD_PROFILE _shaderBuildProfile{SHADER_PROFILE_RELEASE};
+#else
+    SHADER_BUILD_PROFILE _shaderBuildProfile{SHADER_PROFILE_DEBUG};
+#endif
+    // frame being recorded, starts from 1, currentFrameId == (_frameNumber - 1) % _framesInFlight
+    uint64_t _frameNumber{1};
+    // written by submitCommand, read by the frame queries: submitting thread only
+    uint64_t _submittedFrameNumber{0};
+    // every frame up to this one is known to be done on the gpu
+    std::atomic<uint64_t> _completedFrameNumber{0};
+    // per frame slot: frame number, value of _graphicsTimeline signaled by its submit, submitting thread only
+    std::vector<std::tuple<uint64_t, uint64_t>> _frameTimelineValues;
 
 private:
     void createInstance()
@@ -432,11 +660,12 @@ private:
         }
 
         // SDL2 specific extension supported
+        if (_window)
         {
             unsigned int extensionCount = 0;
-            SDL_Vulkan_GetInstanceExtensions(_window.nativeHandle(), &extensionCount, nullptr);
+            SDL_Vulkan_GetInstanceExtensions(_window->nativeHandle(), &extensionCount, nullptr);
             std::vector<const char *> extensions(extensionCount);
-            SDL_Vulkan_GetInstanceExtensions(_window.nativeHandle(), &extensionCount, extensions.data());
+            SDL_Vulkan_GetInstanceExtensions(_window->nativeHandle(), &extensionCount, extensions.data());
             log(Level::Info, "SDL2 Found ", extensionCount, " available Instance Extension(s)");
             for (const auto &extension : extensions)
             {
@@ -622,8 +851,8 @@ private:
         // Caution:
         // The window must have been created with the SDL_WINDOW_VULKAN flag and instance must have been created
         // with extensions returned by SDL_Vulkan_GetInstanceExtensions() enabled.
-        ASSERT(_window.nativeHandle(), "SDL_window is needed to create os surface");
-        auto sdlWindow = _window.nativeHandle();
+        ASSERT(_window && _window->nativeHandle(), "SDL_window is needed to create os surface");
+        auto sdlWindow = _window->nativeHandle();
         SDL_Vulkan_CreateSurface(sdlWindow, _instance, &_surface);
         ASSERT(_surface != VK_NULL_HANDLE, "Error creating SDL_Vulkan_CreateSurface");
 #endif
@@ -642,91 +871,77 @@ private:
                                                 physicalDevices.data()));
             log(Level::Info, "Found ", physicalDeviceCount, "Vulkan capable device(s)");
 
-            // select physical gpu
-            VkPhysicalDevice discrete_gpu = VK_NULL_HANDLE;
-            VkPhysicalDevice integrated_gpu = VK_NULL_HANDLE;
+            // select physical gpu: discrete > integrated > virtual > cpu (e.g. lavapipe on a gpu-less box)
+            // the device needs a graphics or GPGPU family, which must support the surface unless headless
+            const auto deviceTypeRank = [](VkPhysicalDeviceType deviceType) -> uint32_t
+            {
+                switch (deviceType)
+                {
+                case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+                    return 0;
+                case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+                    return 1;
+                case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+                    return 2;
+                case VK_PHYSICAL_DEVICE_TYPE_CPU:
+                    return 3;
+                default:
+                    return 4;
+                }
+            };
+            uint32_t selectedRank = std::numeric_limits<uint32_t>::max();
 
             VkPhysicalDeviceProperties prop;
             for (uint32_t i = 0; i < physicalDeviceCount; ++i)
             {
                 VkPhysicalDevice physicalDevice = physicalDevices[i];
                 vkGetPhysicalDeviceProperties(physicalDevice, &prop);
-
-                if (prop.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
+                const auto rank = deviceTypeRank(prop.deviceType);
+                log(Level::Info, "Physical device: ", prop.deviceName, " type: ", prop.deviceType);
+                if (rank >= selectedRank)
                 {
-                    uint32_t queueFamilyCount = 0;
-                    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
-                                                             nullptr);
-
-                    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-                    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
-                                                             queueFamilies.data());
-
-                    VkBool32 surfaceSupported;
-                    for (uint32_t familyIndex = 0; familyIndex < queueFamilyCount; ++familyIndex)
-                    {
-                        const VkQueueFamilyProperties &queueFamilyProp = queueFamilies[familyIndex];
-                        // graphics or GPGPU family queue
-                        if (queueFamilyProp.queueCount > 0 && (queueFamilyProp.queueFlags &
-                                                               (VK_QUEUE_GRAPHICS_BIT |
-                                                                VK_QUEUE_COMPUTE_BIT)))
-                        {
-                            vkGetPhysicalDeviceSurfaceSupportKHR(
-                                physicalDevice,
-                                familyIndex,
-                                _surface,
-                                &surfaceSupported);
-
-                            if (surfaceSupported)
-                            {
-                                _presentQueueFamilyIndex = familyIndex;
-                                discrete_gpu = physicalDevice;
-                                break;
-                            }
-                        }
-                    }
                     continue;
                 }
 
-                if (prop.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU)
-                {
-                    uint32_t queueFamilyCount = 0;
-                    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
-                                                             nullptr);
+                uint32_t queueFamilyCount = 0;
+                vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
+                                                         nullptr);
+
+                std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+                vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
+                                                         queueFamilies.data());
 
-                    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-                    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
-                                                             queueFamilies.data());
+                for (uint32_t familyIndex = 0; familyIndex < queueFamilyCount; ++familyIndex)
+                {
+                    const VkQueueFamilyProperties &queueFamilyProp = queueFamilies[familyIndex];
+                    // graphics or GPGPU family queue
+                    if (queueFamilyProp.queueCount == 0 || (queueFamilyProp.queueFlags &
+                                                            (VK_QUEUE_GRAPHICS_BIT |
+                                                             VK_QUEUE_COMPUTE_BIT)) == 0)
+                    {
+                        continue;
+                    }
+                    VkBool32 surfaceSupported = VK_TRUE;
+                    if (!_headless)
+                    {
+                        vkGetPhysicalDeviceSurfaceSupportKHR(
+                            physicalDevice,
+                            familyIndex,
+                            _surface,
+                            &surfaceSupported);
+                    }
 
-                    VkBool32 surfaceSupported;
-                    for (uint32_t familyIndex = 0; familyIndex < queueFamilyCount; ++familyIndex)
+                    if (surfaceSupported)
                     {
-                        const VkQueueFamilyProperties &queueFamilyProp = queueFamilies[familyIndex];
-                        // graphics or GPGPU family queue
-                        if (queueFamilyProp.queueCount > 0 && (queueFamilyProp.queueFlags &
-                                                               (VK_QUEUE_GRAPHICS_BIT |
-                                                                VK_QUEUE_COMPUTE_BIT)))
-                        {
-                            vkGetPhysicalDeviceSurfaceSupportKHR(
-                                physicalDevice,
-                                familyIndex,
-                                _surface,
-                                &surfaceSupported);
-
-                            if (surfaceSupported)
-                            {
-                                _presentQueueFamilyIndex = familyIndex;
-                                integrated_gpu = physicalDevice;
-
-                                break;
-                            }
-                        }
+                        // headless: nothing is presented, selectQueueFamily points it at the graphics family
+                        _presentQueueFamilyIndex = familyIndex;
+                        _selectedPhysicalDevice = physicalDevice;
+                        selectedRank = rank;
+                        break;
                     }
-                    continue;
                 }
             }
 
-            _selectedPhysicalDevice = discrete_gpu ? discrete_gpu : integrated_gpu;
             ASSERT(_selectedPhysicalDevice, "No Vulkan Physical Devices found");
             ASSERT(_presentQueueFamilyIndex != std::numeric_limits<uint32_t>::max(),
                    "No Queue Family Index supporting surface found");
@@ -805,6 +1020,7 @@ private:
             {
                 log(Level::Info, ext);
             }
+            _supportedDeviceExtensions.insert(extensions.begin(), extensions.end());
         }
     }
 
@@ -849,9 +1065,11 @@ private:
             {
                 // Sparse memory bindings execute on a queue that includes the VK_QUEUE_SPARSE_BINDING_BIT bit
                 // While some implementations may include VK_QUEUE_SPARSE_BINDING_BIT support in queue families that also include graphics and compute support
-                ASSERT((queueFamily.queueFlags & VK_QUEUE_SPARSE_BINDING_BIT) ==
-                           VK_QUEUE_SPARSE_BINDING_BIT,
-                       "Sparse memory bindings is not supported");
+                // software rasterizers (lavapipe) have none, only sparse resources are off then
+                if ((queueFamily.queueFlags & VK_QUEUE_SPARSE_BINDING_BIT) == 0)
+                {
+                    log(Level::Warn, "Sparse memory bindings is not supported");
+                }
                 _graphicsComputeQueueFamilyIndex = i;
                 _graphicsQueueIndex = 0;
                 // separate graphics and compute queue
@@ -878,6 +1096,18 @@ private:
                 continue;
             }
         }
+        ASSERT(_graphicsComputeQueueFamilyIndex != std::numeric_limits<uint32_t>::max(),
+               "No graphics and compute queue family found");
+        // single queue in a single family (lavapipe): compute shares the graphics queue
+        if (_computeQueueIndex == std::numeric_limits<uint32_t>::max())
+        {
+            _computeQueueFamilyIndex = _graphicsComputeQueueFamilyIndex;
+            _computeQueueIndex = _graphicsQueueIndex;
+        }
+        if (_headless)
+        {
+            _presentQueueFamilyIndex = _graphicsComputeQueueFamilyIndex;
+        }
     }
 
     void selectFeatures();
@@ -888,6 +1118,27 @@ private:
 
     void createVMA();
 
+    void createStagingRing();
+
+    // timeline semaphores signaled by upload batches
+    void createUploadTimelines();
+
+    // seeded from disk when the header matches this vendor/device/driver, empty otherwise
+    void createPipelineCache();
+
+    bool isPipelineCacheCompatible(const std::vector<char> &data) const;
+
+    // per pipeline and accumulated, compare runs with a cold and a warm cache
+    void recordPipelineCreationTime(const char *pipelineType, std::chrono::steady_clock::time_point start);
+
+    // either fence or timeline is set
+    void commitStagingRegion(const StagingAllocation &allocation, VkFence fence, VkSemaphore timeline, uint64_t timelineValue);
+
+    // _stagingRingMutex must be held
+    // pop the oldest region if its submission is done (or wait for it), false if nothing popped
+    // a region which is not committed yet stops the tail: its copy is not recorded or not submitted
+    bool popStagingRegion(bool wait);
+
     // uint32_t: queueFamilyIndex is needed for caller to do memory barrier
     std::vector<CommandBufferEntity> createCommandBuffers(
         const std::string &name,
@@ -955,7 +1206,10 @@ private:
     {
         return _fragmentDensityMapFeature.fragmentDensityMap == VK_TRUE;
     }
-    const Window &_window;
+    // nullptr when headless
+    const Window *_window{nullptr};
+    // no surface and no swapchain: frames go to _offscreenTargets
+    bool _headless{false};
     const std::vector<const char *> _instanceValidationLayers;
     const std::set<std::string> &_instanceExtensions;
     const std::vector<const char *> _deviceExtensions;
@@ -985,8 +1239,13 @@ private:
         .pNext = &_rtPipelineProperties,
     };
 
+    std::set<std::string> _supportedDeviceExtensions;
+    // _deviceExtensions + the ones the context turns on by itself (VK_EXT_memory_budget)
+    std::vector<const char *> _enabledDeviceExtensions;
+
     // physical device features
     bool _bindlessSupported{false};
+    bool _memoryBudgetEnabled{false};
     bool _protectedMemory{false};
 
     uint32_t _graphicsComputeQueueFamilyIndex{std::numeric_limits<uint32_t>::max()};
@@ -1090,6 +1349,8 @@ private:
     VkSwapchainKHR _swapChain{VK_NULL_HANDLE};
     std::vector<VkImage> _swapChainImages;
     std::vector<VkImageView> _swapChainImageViews;
+    // headless: one color target per frame slot, _swapChainImages/_swapChainImageViews mirror them
+    std::vector<ImageEntity> _offscreenTargets;
     // fbo for swapchain
     std::vector<VkFramebuffer> _swapChainFramebuffers;
 
@@ -1099,6 +1360,84 @@ private:
     VkCommandPool _computeCmdPool{VK_NULL_HANDLE};
     VkCommandPool _transferCmdPool{VK_NULL_HANDLE};
     TracyVkCtx _tracyCtx{nullptr};
+
+    // staging ring
+    BufferEntity _stagingRing;
+    MappingAddressType _stagingRingMappedAddress{nullptr};
+    // monotonic byte positions, offset in ring = position % STAGING_RING_SIZE_IN_BYTES
+    uint64_t _stagingRingHead{0};
+    uint64_t _stagingRingTail{0};
+    // one per allocation, in ring order: [begin, end) is recycled once the submission it was committed to is done
+    struct StagingRegion
+    {
+        // monotonic, slot = id % STAGING_RING_MAX_REGIONS
+        uint64_t id{0};
+        uint64_t end{0};
+        // fence or (timeline, value), set by the commit
+        VkFence fence{VK_NULL_HANDLE};
+        VkSemaphore timeline{VK_NULL_HANDLE};
+        uint64_t timelineValue{0};
+        bool frameOwned{false};
+        bool committed{false};
+        // fence is known to be signaled
+        bool retired{false};
+    };
+    // fixed size circular queue, no allocation in steady state
+    std::array<StagingRegion, STAGING_RING_MAX_REGIONS> _stagingRegions;
+    uint64_t _stagingRegionsFirst{0};
+    uint64_t _stagingRegionsEnd{0};
+    std::mutex _stagingRingMutex;
+
+    // buffer arena: backing buffer + virtual block, per usage class
+    std::array<std::vector<std::tuple<BufferEntity, VmaVirtualBlock>>, BUFFER_ARENA_USAGE_SIZE> _bufferArenaBlocks;
+    // frame number when freed, slice
+    std::deque<std::tuple<uint64_t, BufferSlice>> _retiredBufferSlices;
+    std::mutex _bufferArenaMutex;
+
+    // upload batch
+    std::mutex _uploadMutex;
+    // next command buffer to record, round robin
+    uint32_t _graphicsUploadSlot{0};
+    uint32_t _transferUploadSlot{0};
+    // timeline value signaled by the last submit of each command buffer
+    std::array<uint64_t, UPLOAD_BATCH_INFLIGHT_COUNT> _graphicsUploadSlotTimelineValues{};
+    std::array<uint64_t, UPLOAD_BATCH_INFLIGHT_COUNT> _transferUploadSlotTimelineValues{};
+    // one timeline per queue, value increases by 1 every submit
+    // graphics: frames and upload batches, transfer: upload batches
+    // _uploadMutex also serializes the graphics queue submits which signal it
+    VkSemaphore _graphicsTimeline{VK_NULL_HANDLE};
+    uint64_t _graphicsTimelineValue{0};
+    VkSemaphore _transferTimeline{VK_NULL_HANDLE};
+    uint64_t _transferTimelineValue{0};
+    // queue family ownership acquire for transfer uploads, recorded by the next submitCommand
+    BarrierBatch _pendingAcquireBarriers;
+    std::vector<ImageEntity> _pendingMipmapImages;
+    // 0: nothing to acquire
+    uint64_t _pendingAcquireTimelineValue{0};
+    // submitted acquires: (transfer timeline value, graphics timeline value of the frame running the acquire)
+    // a transfer upload is complete once the acquire of its value is done on graphics
+    std::deque<std::tuple<uint64_t, uint64_t>> _uploadAcquires;
+    // every transfer value up to this one is acquired on graphics
+    uint64_t _completedAcquireTimelineValue{0};
+
+    // persistent pipeline cache, internally synchronized
+    VkPipelineCache _pipelineCache{VK_NULL_HANDLE};
+    std::string _pipelineCachePath;
+    // seeded from disk
+    bool _pipelineCacheWarm{false};
+    std::atomic<uint32_t> _pipelineCreationCount{0};
+    std::atomic<uint64_t> _pipelineCreationTimeInUs{0};
+
+    // deduplicated objects, keyed by the bytes of their create info; owned by the context
+    // pipelines are created concurrently: guarded by _objectCacheMux
+    std::mutex _objectCacheMux;
+    std::unordered_map<std::string, VkDescriptorSetLayout> _descriptorSetLayoutCache;
+    std::unordered_map<std::string, VkPipelineLayout> _pipelineLayoutCache;
+    std::unordered_map<std::string, VkSampler> _samplerCache;
+    // requests, compared to the cache sizes at destruction
+    uint32_t _descriptorSetLayoutRequests{0};
+    uint32_t _pipelineLayoutRequests{0};
+    uint32_t _samplerRequests{0};
 };
 
 void VkContext::Impl::selectFeatures()
@@ -1144,9 +1483,12 @@ void VkContext::Impl::selectFeatures()
     sEnable12Features.runtimeDescriptorArray = VK_TRUE;
     sEnable12Features.scalarBlockLayout = VK_TRUE;
     sEnable12Features.bufferDeviceAddress = VK_TRUE;
-    sEnable12Features.bufferDeviceAddressCaptureReplay = VK_TRUE;
+    // capture/replay tools only, not exposed by every driver (lavapipe)
+    sEnable12Features.bufferDeviceAddressCaptureReplay = _vk12features.bufferDeviceAddressCaptureReplay;
     sEnable12Features.drawIndirectCount = VK_TRUE;
     sEnable12Features.shaderFloat16 = VK_TRUE;
+    // upload completion across queues
+    sEnable12Features.timelineSemaphore = VK_TRUE;
     // dynamic rendering feature
     sEnable13Features.dynamicRendering = VK_TRUE;
     sEnable13Features.maintenance4 = VK_TRUE;
@@ -1205,8 +1547,9 @@ void VkContext::Impl::createLogicDevice()
     // graphicsComputeQueue.flags = VK_DEVICE_QUEUE_CREATE_PROTECTED_BIT;
     graphicsComputeQueue.flags = 0x0;
     graphicsComputeQueue.queueFamilyIndex = _graphicsComputeQueueFamilyIndex;
-    // within that queuefamily:[0(graphics), 1(compute)];
-    graphicsComputeQueue.queueCount = (_graphicsComputeQueueFamilyIndex == _computeQueueFamilyIndex
+    // within that queuefamily:[0(graphics), 1(compute)], a single queue when compute shares the graphics one
+    graphicsComputeQueue.queueCount = (_graphicsComputeQueueFamilyIndex == _computeQueueFamilyIndex &&
+                                               _graphicsQueueIndex != _computeQueueIndex
                                            ? 2
                                            : 1);
     graphicsComputeQueue.pQueuePriorities = queuePriority;
@@ -1244,8 +1587,18 @@ void VkContext::Impl::createLogicDevice()
     VkDeviceCreateInfo logicDeviceCreateInfo{VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO};
     logicDeviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueInfos.size());
     logicDeviceCreateInfo.pQueueCreateInfos = queueInfos.data();
-    logicDeviceCreateInfo.enabledExtensionCount = _deviceExtensions.size();
-    logicDeviceCreateInfo.ppEnabledExtensionNames = _deviceExtensions.data();
+    // real per-heap budget/usage for vma instead of its own estimate
+    _enabledDeviceExtensions = _deviceExtensions;
+    const auto memoryBudgetRequested = std::any_of(_deviceExtensions.begin(), _deviceExtensions.end(), [](const char *extension)
+                                                   { return std::string(extension) == VK_EXT_MEMORY_BUDGET_EXTENSION_NAME; });
+    _memoryBudgetEnabled = memoryBudgetRequested || _supportedDeviceExtensions.contains(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if (_memoryBudgetEnabled && !memoryBudgetRequested)
+    {
+        _enabledDeviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
+    log(Level::Info, "memory budget: ", _memoryBudgetEnabled ? "VK_EXT_memory_budget" : "vma estimate");
+    logicDeviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(_enabledDeviceExtensions.size());
+    logicDeviceCreateInfo.ppEnabledExtensionNames = _enabledDeviceExtensions.data();
     logicDeviceCreateInfo.enabledLayerCount =
         static_cast<uint32_t>(_instanceValidationLayers.size());
     logicDeviceCreateInfo.ppEnabledLayerNames = _instanceValidationLayers.data();
@@ -1279,12 +1632,14 @@ void VkContext::Impl::cacheCommandQueue()
         vkGetDeviceQueue(_logicalDevice, _transferQueueFamilyIndex, _transferQueueIndex, &_transferQueue);
     }
 
-    // familyIndexSupportSurface
+    // familyIndexSupportSurface, headless: the graphics family, nothing is presented
     vkGetDeviceQueue(_logicalDevice, _presentQueueFamilyIndex, 0, &_presentationQueue);
     vkGetDeviceQueue(_logicalDevice, _graphicsComputeQueueFamilyIndex, 0, &_sparseQueues);
     ASSERT(_graphicsComputeQueue, "Failed to access graphics&compute queue");
     ASSERT(_computeQueue, "Failed to access compute queue");
-    ASSERT(_transferQueue, "Failed to access transfer queue");
+    // no dedicated transfer family: copies go through the graphics queue
+    ASSERT(_transferQueue || _transferQueueFamilyIndex == std::numeric_limits<uint32_t>::max(),
+           "Failed to access transfer queue");
     ASSERT(_presentationQueue, "Failed to access presentation queue");
     ASSERT(_sparseQueues, "Failed to access sparse queue");
 }
@@ -1297,17 +1652,21 @@ void VkContext::Impl::createCommandPool()
     // since we want to record a command buffer every frame, so we want to be able to
     // reset and record over it
     poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-    poolInfo.queueFamilyIndex = _graphicsQueueIndex;
+    // family indices, not queue indices
+    poolInfo.queueFamilyIndex = _graphicsComputeQueueFamilyIndex;
     VK_CHECK(vkCreateCommandPool(_logicalDevice, &poolInfo, nullptr, &_graphicsCmdPool));
     // setCorrlationId(_instance, _logicalDevice, VK_OBJECT_TYPE_COMMAND_POOL, "createCommandPool: graphics");
 
-    poolInfo.queueFamilyIndex = _computeQueueIndex;
+    poolInfo.queueFamilyIndex = _computeQueueFamilyIndex;
     VK_CHECK(vkCreateCommandPool(_logicalDevice, &poolInfo, nullptr, &_computeCmdPool));
     // setCorrlationId(_instance, _logicalDevice, VK_OBJECT_TYPE_COMMAND_POOL, "createCommandPool: compute");
 
-    poolInfo.queueFamilyIndex = _transferQueueIndex;
-    VK_CHECK(vkCreateCommandPool(_logicalDevice, &poolInfo, nullptr, &_transferCmdPool));
-    // setCorrlationId(_instance, _logicalDevice, VK_OBJECT_TYPE_COMMAND_POOL, "createCommandPool: transfer");
+    if (_transferQueueFamilyIndex != std::numeric_limits<uint32_t>::max())
+    {
+        poolInfo.queueFamilyIndex = _transferQueueFamilyIndex;
+        VK_CHECK(vkCreateCommandPool(_logicalDevice, &poolInfo, nullptr, &_transferCmdPool));
+        // setCorrlationId(_instance, _logicalDevice, VK_OBJECT_TYPE_COMMAND_POOL, "createCommandPool: transfer");
+    }
 }
 
 void VkContext::Impl::createVMA()
@@ -1352,6 +1711,10 @@ void VkContext::Impl::createVMA()
 
     VmaAllocatorCreateInfo allocatorInfo = {};
     allocatorInfo.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
+    if (_memoryBudgetEnabled)
+    {
+        allocatorInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+    }
     allocatorInfo.physicalDevice = _selectedPhysicalDevice;
     allocatorInfo.device = _logicalDevice;
     allocatorInfo.instance = _instance;
@@ -1360,6 +1723,105 @@ void VkContext::Impl::createVMA()
     ASSERT(_vmaAllocator, "Failed to create vma allocator");
 }
 
+void VkContext::Impl::createStagingRing()
+{
+    _stagingRing = createStagingBuffer("Staging Ring", STAGING_RING_SIZE_IN_BYTES);
+    // VMA_ALLOCATION_CREATE_MAPPED_BIT: mapped once for the whole life of the context
+    _stagingRingMappedAddress = std::get<BUFFER_ENTITY_UID::VMA_ALLOCATION_INFO>(_stagingRing).pMappedData;
+    ASSERT(_stagingRingMappedAddress, "staging ring must be persistently mapped");
+    setCorrlationId(std::get<BUFFER_ENTITY_UID::BUFFER>(_stagingRing), _logicalDevice, VK_OBJECT_TYPE_BUFFER, "Staging Ring");
+}
+
+void VkContext::Impl::createUploadTimelines()
+{
+    const VkSemaphoreTypeCreateInfo semaphoreTypeInfo{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0,
+    };
+    const VkSemaphoreCreateInfo semaphoreInfo{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &semaphoreTypeInfo,
+    };
+    VK_CHECK(vkCreateSemaphore(_logicalDevice, &semaphoreInfo, nullptr, &_graphicsTimeline));
+    setCorrlationId(_graphicsTimeline, _logicalDevice, VK_OBJECT_TYPE_SEMAPHORE, "Timeline: graphics");
+    VK_CHECK(vkCreateSemaphore(_logicalDevice, &semaphoreInfo, nullptr, &_transferTimeline));
+    setCorrlationId(_transferTimeline, _logicalDevice, VK_OBJECT_TYPE_SEMAPHORE, "Timeline: transfer upload");
+}
+
+void VkContext::Impl::createPipelineCache()
+{
+    // one file per gpu, switching between gpus does not throw the other cache away
+    const auto &props = _physicalDevicesProp1;
+    _pipelineCachePath = (std::filesystem::path(getCachePath()) /
+                          ("pipelineCache_" + std::to_string(props.vendorID) + "_" + std::to_string(props.deviceID) + ".bin"))
+                             .string();
+
+    std::vector<char> data;
+    if (std::filesystem::exists(_pipelineCachePath))
+    {
+        data = readFile(_pipelineCachePath);
+        if (!isPipelineCacheCompatible(data))
+        {
+            // driver update or foreign file: start cold, it is overwritten at shutdown
+            log(Level::Warn, "pipeline cache ", _pipelineCachePath, " does not match the device/driver, discarded");
+            data.clear();
+        }
+    }
+    _pipelineCacheWarm = !data.empty();
+
+    const VkPipelineCacheCreateInfo pipelineCacheInfo{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = data.size(),
+        .pInitialData = data.empty() ? nullptr : data.data(),
+    };
+    VK_CHECK(vkCreatePipelineCache(_logicalDevice, &pipelineCacheInfo, nullptr, &_pipelineCache));
+    setCorrlationId(_pipelineCache, _logicalDevice, VK_OBJECT_TYPE_PIPELINE_CACHE, "Pipeline Cache");
+    log(Level::Info, "pipeline cache: ", _pipelineCacheWarm ? "warm, " : "cold, ", data.size(), " bytes from ", _pipelineCachePath);
+}
+
+// VkPipelineCacheHeaderVersionOne: drivers are supposed to reject foreign data, some crash instead
+bool VkContext::Impl::isPipelineCacheCompatible(const std::vector<char> &data) const
+{
+    VkPipelineCacheHeaderVersionOne header{};
+    if (data.size() < sizeof(header))
+    {
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    const auto &props = _physicalDevicesProp1;
+    return header.headerSize >= sizeof(header) &&
+           header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           header.vendorID == props.vendorID &&
+           header.deviceID == props.deviceID &&
+           memcmp(header.pipelineCacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void VkContext::Impl::savePipelineCache()
+{
+    if (_pipelineCache == VK_NULL_HANDLE || _pipelineCachePath.empty())
+    {
+        return;
+    }
+    size_t dataSize{0};
+    VK_CHECK(vkGetPipelineCacheData(_logicalDevice, _pipelineCache, &dataSize, nullptr));
+    std::vector<char> data(dataSize);
+    VK_CHECK(vkGetPipelineCacheData(_logicalDevice, _pipelineCache, &dataSize, data.data()));
+    if (writeFileAtomic(_pipelineCachePath, data.data(), dataSize))
+    {
+        log(Level::Info, "pipeline cache: ", dataSize, " bytes written to ", _pipelineCachePath);
+    }
+}
+
+void VkContext::Impl::recordPipelineCreationTime(const char *pipelineType, std::chrono::steady_clock::time_point start)
+{
+    const auto elapsedInUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    _pipelineCreationCount.fetch_add(1);
+    _pipelineCreationTimeInUs.fetch_add(elapsedInUs);
+    log(Level::Info, pipelineType, " pipeline created in ", elapsedInUs / 1000.0, " ms (",
+        _pipelineCacheWarm ? "warm" : "cold", " pipeline cache)");
+}
+
 void VkContext::Impl::createSwapChain()
 {
     log(Level::Info, "-->createSwapChain");
@@ -1480,16 +1942,57 @@ void VkContext::Impl::createSwapChainImageView()
     }
 }
 
+void VkContext::Impl::createOffscreenTargets()
+{
+    log(Level::Info, "-->createOffscreenTargets");
+    ASSERT(_headless, "offscreen targets replace the swapchain of a headless context");
+    // one per frame slot: nothing holds a target past its frame, advanceFrame already paces the reuse
+    const auto numFramesInFlight = _framesInFlight;
+    _offscreenTargets.reserve(numFramesInFlight);
+    for (uint32_t i = 0; i < numFramesInFlight; ++i)
+    {
+        // color attachment or compute output, then copied out (readback) or sampled
+        _offscreenTargets.emplace_back(createImage("Offscreen Target " + std::to_string(i),
+                                                   VK_IMAGE_TYPE_2D,
+                                                   _swapChainFormat,
+                                                   VkExtent3D{_swapChainExtent.width, _swapChainExtent.height, 1},
+                                                   1,
+                                                   1,
+                                                   VK_SAMPLE_COUNT_1_BIT,
+                                                   VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT |
+                                                       VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                                                       VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                                                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                                   false));
+        const auto &target = _offscreenTargets.back();
+        _swapChainImages.push_back(std::get<IMAGE_ENTITY_OFFSET::IMAGE>(target));
+        _swapChainImageViews.push_back(std::get<IMAGE_ENTITY_OFFSET::IMAGE_VIEW>(target));
+        setCorrlationId(_swapChainImages.back(), _logicalDevice, VK_OBJECT_TYPE_IMAGE,
+                        "Offscreen Target: " + std::to_string(i));
+        setCorrlationId(_swapChainImageViews.back(), _logicalDevice, VK_OBJECT_TYPE_IMAGE_VIEW,
+                        "Offscreen Target Image view: " + std::to_string(i));
+    }
+    log(Level::Info, "offscreen targets: ", numFramesInFlight, " x ", _swapChainExtent.width, "x", _swapChainExtent.height);
+    log(Level::Info, "<--createOffscreenTargets");
+}
+
 void VkContext::Impl::createPerFrameSyncObjects()
 {
-    const auto numFramesInFlight = getSwapChainImageViews().size();
+    const auto numFramesInFlight = _framesInFlight;
+    // cpu-gpu pacing goes through _graphicsTimeline, no per-frame fence
+    _frameTimelineValues.assign(numFramesInFlight, std::make_tuple(0, 0));
+    // headless: no acquire/present, nothing to signal to the presentation engine
+    if (_headless)
+    {
+        return;
+    }
     imageCanAcquireSemaphores.resize(numFramesInFlight);
     imageRendereredSemaphores.resize(numFramesInFlight);
 
     VkSemaphoreCreateInfo semaphoreInfo{};
     semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for (size_t i = 0; i < numFramesInFlight; ++i)
     {
         VK_CHECK(vkCreateSemaphore(_logicalDevice, &semaphoreInfo, nullptr,
                                    &imageCanAcquireSemaphores[i]));
@@ -1516,8 +2019,9 @@ VkRenderPass VkContext::Impl::createSwapChainRenderPass()
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    // swap chain is for presentation
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    // swap chain is for presentation, offscreen targets are copied out
+    colorAttachment.finalLayout = _headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                            : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
     // VkAttachmentReference is for subpass, how subpass could refer to the color attachment
     // here only 1 color attachement, index is 0;
@@ -1660,6 +2164,11 @@ std::vector<CommandBufferEntity> VkContext::Impl::createTransferCommandBuffers(
     uint32_t inflightCount,
     VkFenceCreateFlags flags)
 {
+    // no transfer only family: graphics queues support transfer as well
+    if (_transferQueueFamilyIndex == std::numeric_limits<uint32_t>::max())
+    {
+        return createGraphicsCommandBuffers(name, count, inflightCount, flags);
+    }
     return this->createCommandBuffers(name, count, inflightCount, flags,
                                       _transferQueueFamilyIndex,
                                       _transferQueue);
@@ -1723,7 +2232,11 @@ void VkContext::Impl::BeginRecordCommandBuffer(CommandBufferEntity &cmdBufferEnt
     const auto fenceHandle = std::get<2>(cmdBufferEntity);
 
     if (fenceHandle)
-        VK_CHECK(vkWaitForFences(_logicalDevice, 1, &fenceHandle, true, UINT32_MAX));
+    {
+        VK_CHECK(vkWaitForFences(_logicalDevice, 1, &fenceHandle, true, DEFAULT_FENCE_TIMEOUT));
+        // fence is about to be reset, hand its staging regions back before the state is lost
+        retireStagingRing(fenceHandle);
+    }
     // specifies that most or all memory resources currently owned by the command buffer should be returned to the parent command pool
     VK_CHECK(vkResetCommandBuffer(cmdBufferHandle, VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT));
 
@@ -1808,10 +2321,18 @@ BufferEntity VkContext::Impl::createBuffer(
     //     .priority = 1.0f,
     // };
 
-    VK_CHECK(vmaCreateBuffer(_vmaAllocator, &bufferCreateInfo,
-                             &bufferMemoryAllocationCreateInfo,
-                             &buffer,
-                             &allocation, nullptr));
+    auto result = vmaCreateBuffer(_vmaAllocator, &bufferCreateInfo,
+                                  &bufferMemoryAllocationCreateInfo,
+                                  &buffer,
+                                  &allocation, nullptr);
+    while (result == VK_ERROR_OUT_OF_DEVICE_MEMORY && recoverFromOutOfDeviceMemory(bufferSizeInBytes))
+    {
+        result = vmaCreateBuffer(_vmaAllocator, &bufferCreateInfo,
+                                 &bufferMemoryAllocationCreateInfo,
+                                 &buffer,
+                                 &allocation, nullptr);
+    }
+    VK_CHECK(result);
 
     VkBufferDeviceAddressInfoKHR bufferDeviceAI{};
     bufferDeviceAI.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
@@ -2041,21 +2562,39 @@ ImageEntity VkContext::Impl::createImage(
     // no need for VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, cpu does not need access
     // Consider creating them as dedicated allocations using VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT, especially if they are large or if you plan to destroy and recreate them with different sizes
     // e.g. when display resolution changes.
-
-    const VmaAllocationCreateInfo allocCreateInfo = {
-        .flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT,
+    // small images are sub-allocated instead: one VkDeviceMemory per 16x16 texture exhausts maxMemoryAllocationCount
+    VmaAllocationCreateInfo allocCreateInfo = {
         .usage = memoryFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
                      ? VMA_MEMORY_USAGE_AUTO_PREFER_HOST
                      : VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
         .priority = 1.0f,
     };
+    const VkDeviceImageMemoryRequirements requirementsInfo{
+        .sType = VK_STRUCTURE_TYPE_DEVICE_IMAGE_MEMORY_REQUIREMENTS,
+        .pCreateInfo = &imageCreateInfo,
+    };
+    VkMemoryRequirements2 requirements{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+    };
+    vkGetDeviceImageMemoryRequirements(_logicalDevice, &requirementsInfo, &requirements);
+    allocCreateInfo.pool = selectImagePool(imageCreateInfo, allocCreateInfo, requirements.memoryRequirements.size);
+    if (!allocCreateInfo.pool)
+    {
+        allocCreateInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+    }
 
     VkImage image;
     VmaAllocation imageAllocation;
     VmaAllocationInfo imageAllocationInfo;
     VkImageView imageView;
-    VK_CHECK(vmaCreateImage(_vmaAllocator, &imageCreateInfo, &allocCreateInfo, &image,
-                            &imageAllocation, nullptr));
+    auto result = vmaCreateImage(_vmaAllocator, &imageCreateInfo, &allocCreateInfo, &image,
+                                 &imageAllocation, nullptr);
+    while (result == VK_ERROR_OUT_OF_DEVICE_MEMORY && recoverFromOutOfDeviceMemory(requirements.memoryRequirements.size))
+    {
+        result = vmaCreateImage(_vmaAllocator, &imageCreateInfo, &allocCreateInfo, &image,
+                                &imageAllocation, nullptr);
+    }
+    VK_CHECK(result);
     // multi-threading debugging
     log(Level::Info, "vmaGetAllocationInfo:", std::this_thread::get_id());
     vmaGetAllocationInfo(_vmaAllocator, imageAllocation, &imageAllocationInfo);
@@ -2077,6 +2616,45 @@ ImageEntity VkContext::Impl::createImage(
                            extent, format);
 }
 
+VmaPool VkContext::Impl::selectImagePool(
+    const VkImageCreateInfo &imageCreateInfo,
+    const VmaAllocationCreateInfo &allocCreateInfo,
+    VkDeviceSize sizeInBytes)
+{
+    std::scoped_lock lock(_imagePoolMutex);
+    const auto &policy = _imageAllocationPolicy;
+    if ((imageCreateInfo.usage & policy.dedicatedUsage) || sizeInBytes >= policy.dedicatedThreshold)
+    {
+        return VK_NULL_HANDLE;
+    }
+    const auto sizeClass = static_cast<int>(std::distance(policy.sizeClassLimit.begin(),
+                                                          std::lower_bound(policy.sizeClassLimit.begin(), policy.sizeClassLimit.end(), sizeInBytes)));
+    if (sizeClass == IMAGE_SIZE_CLASS_SIZE)
+    {
+        return VK_NULL_HANDLE;
+    }
+
+    uint32_t memTypeIndex = UINT32_MAX;
+    VK_CHECK(vmaFindMemoryTypeIndexForImageInfo(_vmaAllocator, &imageCreateInfo, &allocCreateInfo, &memTypeIndex));
+    const auto key = (uint64_t(memTypeIndex) << 32) | uint64_t(sizeClass);
+    if (auto it = _imagePools.find(key); it != _imagePools.end())
+    {
+        return it->second;
+    }
+    const VmaPoolCreateInfo poolCreateInfo{
+        .memoryTypeIndex = memTypeIndex,
+        .blockSize = policy.sizeClassBlockSize[sizeClass],
+        .priority = 1.0f,
+    };
+    VmaPool pool{VK_NULL_HANDLE};
+    VK_CHECK(vmaCreatePool(_vmaAllocator, &poolCreateInfo, &pool));
+    const auto name = "Image Pool: memory type " + std::to_string(memTypeIndex) + ", size class " + std::to_string(sizeClass);
+    vmaSetPoolName(_vmaAllocator, pool, name.c_str());
+    _imagePools.emplace(key, pool);
+    log(Level::Info, name, ", block size: ", policy.sizeClassBlockSize[sizeClass]);
+    return pool;
+}
+
 #ifdef _WIN64
 void VkContext::Impl::createExportableImage(
     const std::string &name,
@@ -2167,9 +2745,16 @@ void VkContext::Impl::createExportableImage(
 }
 #endif
 
+// object cache keys: field by field, struct padding is never part of a key
+template <typename T>
+void appendCacheKey(std::string &key, const T &value)
+{
+    static_assert(std::is_trivially_copyable_v<T>, "cache key fields should be trivially copyable");
+    key.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
 std::tuple<VkSampler> VkContext::Impl::createSampler(const std::string &name)
 {
-    VkSampler sampler;
     VkSamplerCreateInfo samplerCreateInfo = {};
     samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
     samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
@@ -2196,9 +2781,40 @@ std::tuple<VkSampler> VkContext::Impl::createSampler(const std::string &name)
         samplerCreateInfo.anisotropyEnable = VK_FALSE;
     }
     samplerCreateInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
-    VK_CHECK(vkCreateSampler(_logicalDevice, &samplerCreateInfo, nullptr, &sampler));
-    setCorrlationId(sampler, _logicalDevice, VK_OBJECT_TYPE_SAMPLER, name);
-    return std::make_tuple(sampler);
+    return createSampler(samplerCreateInfo, name);
+}
+
+// the first name wins for the debug name of a shared sampler
+std::tuple<VkSampler> VkContext::Impl::createSampler(const VkSamplerCreateInfo &samplerCreateInfo, const std::string &name)
+{
+    ASSERT(samplerCreateInfo.pNext == nullptr, "sampler create info chain is not part of the cache key");
+    std::string key;
+    appendCacheKey(key, samplerCreateInfo.flags);
+    appendCacheKey(key, samplerCreateInfo.magFilter);
+    appendCacheKey(key, samplerCreateInfo.minFilter);
+    appendCacheKey(key, samplerCreateInfo.mipmapMode);
+    appendCacheKey(key, samplerCreateInfo.addressModeU);
+    appendCacheKey(key, samplerCreateInfo.addressModeV);
+    appendCacheKey(key, samplerCreateInfo.addressModeW);
+    appendCacheKey(key, samplerCreateInfo.mipLodBias);
+    appendCacheKey(key, samplerCreateInfo.anisotropyEnable);
+    appendCacheKey(key, samplerCreateInfo.maxAnisotropy);
+    appendCacheKey(key, samplerCreateInfo.compareEnable);
+    appendCacheKey(key, samplerCreateInfo.compareOp);
+    appendCacheKey(key, samplerCreateInfo.minLod);
+    appendCacheKey(key, samplerCreateInfo.maxLod);
+    appendCacheKey(key, samplerCreateInfo.borderColor);
+    appendCacheKey(key, samplerCreateInfo.unnormalizedCoordinates);
+
+    std::scoped_lock lock{_objectCacheMux};
+    ++_samplerRequests;
+    auto [it, inserted] = _samplerCache.try_emplace(key, VK_NULL_HANDLE);
+    if (inserted)
+    {
+        VK_CHECK(vkCreateSampler(_logicalDevice, &samplerCreateInfo, nullptr, &it->second));
+        setCorrlationId(it->second, _logicalDevice, VK_OBJECT_TYPE_SAMPLER, name);
+    }
+    return std::make_tuple(it->second);
 }
 
 std::vector<VkDescriptorSetLayout> VkContext::Impl::createDescriptorSetLayout(
@@ -2215,7 +2831,12 @@ std::vector<VkDescriptorSetLayout> VkContext::Impl::createDescriptorSetLayout(
                                                        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT;
     for (const auto &setBinding : setBindings)
     {
-        std::vector<VkDescriptorBindingFlags> bindFlags(setBinding.size(), flagsToEnable);
+        // dynamic uniform/storage buffers cannot be updated after bind: such a set layout keeps the classic update rules
+        const bool updateAfterBind = std::none_of(setBinding.begin(), setBinding.end(), [](const VkDescriptorSetLayoutBinding &binding)
+                                                  { return binding.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC ||
+                                                           binding.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC; });
+        std::vector<VkDescriptorBindingFlags> bindFlags(setBinding.size(),
+                                                        updateAfterBind ? flagsToEnable : VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT);
         const VkDescriptorSetLayoutBindingFlagsCreateInfo extendedInfo{
             .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
             .pNext = nullptr,
@@ -2226,18 +2847,70 @@ std::vector<VkDescriptorSetLayout> VkContext::Impl::createDescriptorSetLayout(
         layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
         layoutInfo.bindingCount = setBinding.size();
         layoutInfo.pBindings = setBinding.data();
-#if defined(_WIN32)
+        // descriptor indexing is core in 1.2 and required by selectFeatures: on every platform
         layoutInfo.pNext = &extendedInfo;
-        layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
-#endif
-        VkDescriptorSetLayout descriptorSetLayout{VK_NULL_HANDLE};
-        VK_CHECK(vkCreateDescriptorSetLayout(_logicalDevice, &layoutInfo, nullptr,
-                                             &descriptorSetLayout));
-        layouts.push_back(std::move(descriptorSetLayout));
+        layoutInfo.flags = updateAfterBind ? VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT : 0;
+        // the binding flags only depend on the layout flags and the descriptor types, covered by the key
+        std::string key;
+        appendCacheKey(key, layoutInfo.flags);
+        for (const auto &binding : setBinding)
+        {
+            appendCacheKey(key, binding.binding);
+            appendCacheKey(key, binding.descriptorType);
+            appendCacheKey(key, binding.descriptorCount);
+            appendCacheKey(key, binding.stageFlags);
+            for (uint32_t i = 0; binding.pImmutableSamplers && i < binding.descriptorCount; ++i)
+            {
+                appendCacheKey(key, binding.pImmutableSamplers[i]);
+            }
+        }
+
+        std::scoped_lock lock{_objectCacheMux};
+        ++_descriptorSetLayoutRequests;
+        auto [it, inserted] = _descriptorSetLayoutCache.try_emplace(key, VK_NULL_HANDLE);
+        if (inserted)
+        {
+            VK_CHECK(vkCreateDescriptorSetLayout(_logicalDevice, &layoutInfo, nullptr, &it->second));
+        }
+        layouts.push_back(it->second);
     }
     return layouts;
 }
 
+VkPipelineLayout VkContext::Impl::getPipelineLayout(
+    const std::vector<VkDescriptorSetLayout> &dsLayouts,
+    const std::vector<VkPushConstantRange> &pushConstants)
+{
+    std::string key;
+    appendCacheKey(key, dsLayouts.size());
+    for (const auto &dsLayout : dsLayouts)
+    {
+        appendCacheKey(key, dsLayout);
+    }
+    for (const auto &pushConstant : pushConstants)
+    {
+        appendCacheKey(key, pushConstant.stageFlags);
+        appendCacheKey(key, pushConstant.offset);
+        appendCacheKey(key, pushConstant.size);
+    }
+
+    std::scoped_lock lock{_objectCacheMux};
+    ++_pipelineLayoutRequests;
+    auto [it, inserted] = _pipelineLayoutCache.try_emplace(key, VK_NULL_HANDLE);
+    if (inserted)
+    {
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        // multiple set layouts binded to the pipeline
+        pipelineLayoutInfo.setLayoutCount = (uint32_t)dsLayouts.size();
+        pipelineLayoutInfo.pSetLayouts = dsLayouts.data();
+        pipelineLayoutInfo.pushConstantRangeCount = pushConstants.size();
+        pipelineLayoutInfo.pPushConstantRanges = pushConstants.data();
+        VK_CHECK(vkCreatePipelineLayout(_logicalDevice, &pipelineLayoutInfo, nullptr, &it->second));
+    }
+    return it->second;
+}
+
 VkDescriptorPool VkContext::Impl::createDescriptorSetPool(
     const std::unordered_map<VkDescriptorType, uint32_t> &dsBudgets,
     uint32_t dsCap)
@@ -2268,12 +2941,30 @@ VkDescriptorPool VkContext::Impl::createDescriptorSetPool(
     return descriptorSetPool;
 }
 
+// without result: VK_CHECK, with it: the failure is handed to the caller
+static bool checkPipelineCreation(VkResult res, VkResult *result, const char *pipelineType)
+{
+    if (!result)
+    {
+        VK_CHECK(res);
+        return true;
+    }
+    *result = res;
+    if (res != VK_SUCCESS)
+    {
+        log(Level::Warn, "failed to create ", pipelineType, " pipeline: ", res);
+        return false;
+    }
+    return true;
+}
+
 std::tuple<std::unordered_map<GRAPHICS_PIPELINE_SEMANTIC, VkPipeline>, VkPipelineLayout> VkContext::Impl::createGraphicsPipeline(
     const std::unordered_map<VkShaderStageFlagBits,
                              std::tuple<VkShaderModule, const char *, const VkSpecializationInfo *>> &shaderModuleEntities,
     const std::vector<VkDescriptorSetLayout> &dsLayouts,
     const std::vector<VkPushConstantRange> &pushConstants,
-    const VkRenderPass &renderPass)
+    const VkRenderPass &renderPass,
+    VkResult *result)
 {
     VkPipelineLayout pipelineLayout;
     VkPipeline graphicsPipeline;
@@ -2385,15 +3076,7 @@ std::tuple<std::unordered_map<GRAPHICS_PIPELINE_SEMANTIC, VkPipeline>, VkPipelin
     //    layout(set = 0, binding = 0) uniform Transforms
     //    layout(set = 1, binding = 0) uniform ObjectProperties
 
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    // multiple set layouts binded to the graphics pipeline
-    pipelineLayoutInfo.setLayoutCount = (uint32_t)dsLayouts.size();
-    pipelineLayoutInfo.pSetLayouts = dsLayouts.data();
-    pipelineLayoutInfo.pushConstantRangeCount = pushConstants.size();
-    pipelineLayoutInfo.pPushConstantRanges = pushConstants.data();
-
-    VK_CHECK(vkCreatePipelineLayout(_logicalDevice, &pipelineLayoutInfo, nullptr, &pipelineLayout));
+    pipelineLayout = getPipelineLayout(dsLayouts, pushConstants);
 
     std::vector<VkDynamicState> dynamicStateEnables = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
     VkPipelineDynamicStateCreateInfo dynamicStateCI{};
@@ -2425,7 +3108,12 @@ std::tuple<std::unordered_map<GRAPHICS_PIPELINE_SEMANTIC, VkPipeline>, VkPipelin
 
     std::unordered_map<GRAPHICS_PIPELINE_SEMANTIC, VkPipeline> lk;
 
-    VK_CHECK(vkCreateGraphicsPipelines(_logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline));
+    auto start = std::chrono::steady_clock::now();
+    if (!checkPipelineCreation(vkCreateGraphicsPipelines(_logicalDevice, _pipelineCache, 1, &pipelineInfo, nullptr, &graphicsPipeline), result, "graphics"))
+    {
+        return make_tuple(lk, pipelineLayout);
+    }
+    recordPipelineCreationTime("graphics", start);
     lk.insert(std::make_pair(GRAPHICS_PIPELINE_SEMANTIC::NORMAL, graphicsPipeline));
 
     pipelineInfo.flags = VK_PIPELINE_CREATE_DERIVATIVE_BIT;
@@ -2434,7 +3122,15 @@ std::tuple<std::unordered_map<GRAPHICS_PIPELINE_SEMANTIC, VkPipeline>, VkPipelin
     // pipelineInfo.pRasterizationState = &rasterizer; is a pointer
     rasterizer.polygonMode = VK_POLYGON_MODE_LINE;
     VkPipeline graphicsPipelineWireframe;
-    VK_CHECK(vkCreateGraphicsPipelines(_logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipelineWireframe));
+    start = std::chrono::steady_clock::now();
+    if (!checkPipelineCreation(vkCreateGraphicsPipelines(_logicalDevice, _pipelineCache, 1, &pipelineInfo, nullptr, &graphicsPipelineWireframe), result, "graphics wireframe"))
+    {
+        // all or nothing
+        vkDestroyPipeline(_logicalDevice, graphicsPipeline, nullptr);
+        lk.clear();
+        return make_tuple(lk, pipelineLayout);
+    }
+    recordPipelineCreationTime("graphics wireframe", start);
     lk.insert(std::make_pair(GRAPHICS_PIPELINE_SEMANTIC::WIREFRAME, graphicsPipelineWireframe));
     return make_tuple(lk, pipelineLayout);
 }
@@ -2443,31 +3139,29 @@ std::tuple<std::unordered_map<GRAPHICS_PIPELINE_SEMANTIC, VkPipeline>, VkPipelin
 std::tuple<VkPipeline, VkPipelineLayout> VkContext::Impl::createComputePipeline(
     const std::unordered_map<VkShaderStageFlagBits, std::tuple<VkShaderModule, const char *, const VkSpecializationInfo *>> &shaderModuleEntities,
     const std::vector<VkDescriptorSetLayout> &dsLayouts,
-    const std::vector<VkPushConstantRange> &pushConstants)
+    const std::vector<VkPushConstantRange> &pushConstants,
+    VkResult *result)
 {
     std::tuple<VkPipeline, VkPipelineLayout> res;
     VkPipelineLayout pipelineLayout;
-    VkPipeline computePipeline;
+    VkPipeline computePipeline{VK_NULL_HANDLE};
 
     std::vector<VkPipelineShaderStageCreateInfo> shaderStages = gatherPipelineShaderStageCreateInfos(shaderModuleEntities);
     ASSERT(shaderStages.size() == 1, "compute shader pipeline should have only 1 stage");
 
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    // multiple set layouts binded to the graphics pipeline
-    pipelineLayoutInfo.setLayoutCount = (uint32_t)dsLayouts.size();
-    pipelineLayoutInfo.pSetLayouts = dsLayouts.data();
-    pipelineLayoutInfo.pushConstantRangeCount = pushConstants.size();
-    pipelineLayoutInfo.pPushConstantRanges = pushConstants.data();
-
-    VK_CHECK(vkCreatePipelineLayout(_logicalDevice, &pipelineLayoutInfo, nullptr, &pipelineLayout));
+    pipelineLayout = getPipelineLayout(dsLayouts, pushConstants);
 
     VkComputePipelineCreateInfo pipelineInfo{};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
     pipelineInfo.stage = shaderStages[0];
     pipelineInfo.layout = pipelineLayout;
 
-    VK_CHECK(vkCreateComputePipelines(_logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &computePipeline));
+    const auto start = std::chrono::steady_clock::now();
+    if (!checkPipelineCreation(vkCreateComputePipelines(_logicalDevice, _pipelineCache, 1, &pipelineInfo, nullptr, &computePipeline), result, "compute"))
+    {
+        return std::make_tuple(VkPipeline{VK_NULL_HANDLE}, pipelineLayout);
+    }
+    recordPipelineCreationTime("compute", start);
     return std::make_tuple(computePipeline, pipelineLayout);
 }
 
@@ -2477,7 +3171,8 @@ std::tuple<VkPipeline, VkPipelineLayout> VkContext::Impl::createComputePipeline(
 std::tuple<VkPipeline, VkPipelineLayout, std::vector<VkRayTracingShaderGroupCreateInfoKHR>> VkContext::Impl::createRayTracingPipeline(
     const std::unordered_map<VkShaderStageFlagBits, std::tuple<VkShaderModule, const char *, const VkSpecializationInfo *>> &shaderModuleEntities,
     const std::vector<VkDescriptorSetLayout> &dsLayouts,
-    const std::vector<VkPushConstantRange> &pushConstants)
+    const std::vector<VkPushConstantRange> &pushConstants,
+    VkResult *result)
 {
     std::tuple<VkPipeline, VkPipelineLayout> res;
     VkPipelineLayout pipelineLayout;
@@ -2534,14 +3229,7 @@ std::tuple<VkPipeline, VkPipelineLayout, std::vector<VkRayTracingShaderGroupCrea
                                 .intersectionShader = VK_SHADER_UNUSED_KHR});
     }
 
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    // multiple set layouts binded to the graphics pipeline
-    pipelineLayoutInfo.setLayoutCount = (uint32_t)dsLayouts.size();
-    pipelineLayoutInfo.pSetLayouts = dsLayouts.data();
-    pipelineLayoutInfo.pushConstantRangeCount = pushConstants.size();
-    pipelineLayoutInfo.pPushConstantRanges = pushConstants.data();
-    VK_CHECK(vkCreatePipelineLayout(_logicalDevice, &pipelineLayoutInfo, nullptr, &pipelineLayout));
+    pipelineLayout = getPipelineLayout(dsLayouts, pushConstants);
 
     VkRayTracingPipelineCreateInfoKHR rayTracingPipelineCI{};
     rayTracingPipelineCI.sType = VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR;
@@ -2552,7 +3240,12 @@ std::tuple<VkPipeline, VkPipelineLayout, std::vector<VkRayTracingShaderGroupCrea
     rayTracingPipelineCI.maxPipelineRayRecursionDepth = 1;
     rayTracingPipelineCI.layout = pipelineLayout;
 
-    VK_CHECK(vkCreateRayTracingPipelinesKHR(_logicalDevice, VK_NULL_HANDLE, VK_NULL_HANDLE, 1, &rayTracingPipelineCI, nullptr, &rtPipeline));
+    const auto start = std::chrono::steady_clock::now();
+    if (!checkPipelineCreation(vkCreateRayTracingPipelinesKHR(_logicalDevice, VK_NULL_HANDLE, _pipelineCache, 1, &rayTracingPipelineCI, nullptr, &rtPipeline), result, "ray tracing"))
+    {
+        return make_tuple(VkPipeline{VK_NULL_HANDLE}, pipelineLayout, shaderGroups);
+    }
+    recordPipelineCreationTime("ray tracing", start);
     return make_tuple(rtPipeline, pipelineLayout, shaderGroups);
 }
 
@@ -2677,30 +3370,306 @@ void VkContext::Impl::bindSamplerToDescriptorSet(
     vkUpdateDescriptorSets(_logicalDevice, 1, &bindResToDsPayload, 0, nullptr);
 }
 
-void VkContext::Impl::writeBuffer(
-    const BufferEntity &stagingBuffer,
-    const BufferEntity &deviceLocalBuffer,
-    const CommandBufferEntity &cmdBuffer,
-    const void *rawData,
-    uint32_t sizeInBytes,
-    uint32_t srcOffset,
-    uint32_t dstOffset)
+// bump the head, blocks only when the ring is full
+StagingAllocation VkContext::Impl::allocateStaging(
+    VkDeviceSize sizeInBytes,
+    VkDeviceSize alignment,
+    bool frameOwned)
 {
-    const auto stagingBufferHandle = std::get<0>(stagingBuffer);
-    const auto deviceLocalBufferHandle = std::get<0>(deviceLocalBuffer);
-    // https://gpuopen-librariesandsdks.github.io/VulkanMemoryAllocator/html/general_considerations.html
-    // vmaStagingImageBufferAllocation is not thread-safe
-    const auto vmaStagingImageBufferAllocation = std::get<1>(stagingBuffer);
-    const auto cmdBufferHandle = std::get<1>(cmdBuffer);
-
-    // copy vb from host to device, region
-    void *mappedMemory{nullptr};
-    // log(Level::Info, "vmaMapMemory:", std::this_thread::get_id());
-    VK_CHECK(vmaMapMemory(_vmaAllocator, vmaStagingImageBufferAllocation, &mappedMemory));
-    memcpy(mappedMemory, rawData, sizeInBytes);
-    vmaUnmapMemory(_vmaAllocator, vmaStagingImageBufferAllocation);
+    ASSERT(sizeInBytes > 0 && sizeInBytes <= STAGING_RING_SIZE_IN_BYTES,
+           "staging allocation must fit into the staging ring");
+    // buffer to image copy prefers optimalBufferCopyOffsetAlignment
+    alignment = std::max(alignment, _physicalDevicesProp1.limits.optimalBufferCopyOffsetAlignment);
+    ASSERT((alignment & (alignment - 1)) == 0, "staging alignment must be power of 2");
+
+    // the region is recorded in ring order: the tail only passes it once its own submission is done,
+    // never because a submission of another thread completed
+    std::lock_guard<std::mutex> lock(_stagingRingMutex);
+    uint64_t begin = (_stagingRingHead + alignment - 1) & ~(alignment - 1);
+    // a region never wraps around the end of the ring, skip the remainder
+    if (begin % STAGING_RING_SIZE_IN_BYTES + sizeInBytes > STAGING_RING_SIZE_IN_BYTES)
+    {
+        begin = (begin / STAGING_RING_SIZE_IN_BYTES + 1) * STAGING_RING_SIZE_IN_BYTES;
+    }
+    const uint64_t end = begin + sizeInBytes;
+    // cheap pass first: whatever already finished
+    while (popStagingRegion(false))
+    {
+    }
+    // slow path: gpu still reads the bytes we want to overwrite, or too many regions
+    while (end - _stagingRingTail > STAGING_RING_SIZE_IN_BYTES ||
+           _stagingRegionsEnd - _stagingRegionsFirst == STAGING_RING_MAX_REGIONS)
+    {
+        ZoneScopedN("reclaimStagingRing");
+        if (!popStagingRegion(true))
+        {
+            // the rest of the ring is held by uploads which are recorded but not submitted yet
+            log(Level::Fatal, "staging ring exhausted: submit pending uploads or increase STAGING_RING_SIZE_IN_BYTES");
+            abort();
+        }
+    }
+    const uint64_t id = _stagingRegionsEnd++;
+    _stagingRegions[id % STAGING_RING_MAX_REGIONS] = StagingRegion{
+        .id = id,
+        .end = end,
+        .frameOwned = frameOwned,
+    };
+    _stagingRingHead = end;
+
+    const VkDeviceSize offset = begin % STAGING_RING_SIZE_IN_BYTES;
+    return std::make_tuple(std::get<BUFFER_ENTITY_UID::BUFFER>(_stagingRing),
+                           offset,
+                           sizeInBytes,
+                           static_cast<MappingAddressType>(static_cast<uint8_t *>(_stagingRingMappedAddress) + offset),
+                           id);
+}
+
+// first fit over the blocks of the usage class, a new block when none has room
+BufferSlice VkContext::Impl::allocateBufferSlice(
+    BUFFER_ARENA_USAGE usage,
+    VkDeviceSize sizeInBytes,
+    VkDeviceSize alignment)
+{
+    ASSERT(usage >= 0 && usage < BUFFER_ARENA_USAGE_SIZE, "buffer arena usage out of range");
+    ASSERT(sizeInBytes > 0, "buffer slice must not be empty");
+    // any slice may be bound as uniform or storage buffer with its offset
+    const auto &limits = _physicalDevicesProp1.limits;
+    alignment = std::max({alignment,
+                          limits.minUniformBufferOffsetAlignment,
+                          limits.minStorageBufferOffsetAlignment,
+                          VkDeviceSize(16)});
+    ASSERT((alignment & (alignment - 1)) == 0, "buffer slice alignment must be power of 2");
+
+    const VmaVirtualAllocationCreateInfo allocationCreateInfo{
+        .size = sizeInBytes,
+        .alignment = alignment,
+    };
+    std::scoped_lock lock(_bufferArenaMutex);
+    collectBufferSlices();
+
+    auto &blocks = _bufferArenaBlocks[usage];
+    VmaVirtualAllocation allocation{VK_NULL_HANDLE};
+    VkDeviceSize offset = 0;
+    const std::tuple<BufferEntity, VmaVirtualBlock> *owner = nullptr;
+    for (const auto &entry : blocks)
+    {
+        if (vmaVirtualAllocate(std::get<1>(entry), &allocationCreateInfo, &allocation, &offset) == VK_SUCCESS)
+        {
+            owner = &entry;
+            break;
+        }
+    }
+    if (!owner)
+    {
+        const auto blockSizeInBytes = std::max(BUFFER_ARENA_BLOCK_SIZE_IN_BYTES[usage], sizeInBytes);
+        const auto name = std::string(usage == ARENA_DEVICE_LOCAL ? "Buffer Arena: device local " : "Buffer Arena: host visible ") +
+                          std::to_string(blocks.size());
+        BufferEntity buffer;
+        if (usage == ARENA_DEVICE_LOCAL)
+        {
+            buffer = createDeviceLocalBuffer(
+                name,
+                blockSizeInBytes,
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+                    VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                    VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                    VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+        }
+        else
+        {
+            buffer = createBuffer(
+                name,
+                blockSizeInBytes,
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+                    VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                    VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                VK_SHARING_MODE_EXCLUSIVE,
+                VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                    VMA_ALLOCATION_CREATE_MAPPED_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                VMA_MEMORY_USAGE_AUTO_PREFER_HOST);
+            // persistently mapped by VMA_ALLOCATION_CREATE_MAPPED_BIT
+            std::get<BUFFER_ENTITY_UID::MAPPING_ADDRESS>(buffer) =
+                std::get<BUFFER_ENTITY_UID::VMA_ALLOCATION_INFO>(buffer).pMappedData;
+        }
+        setCorrlationId(std::get<BUFFER_ENTITY_UID::BUFFER>(buffer), _logicalDevice, VK_OBJECT_TYPE_BUFFER, name);
+
+        const VmaVirtualBlockCreateInfo blockCreateInfo{
+            .size = blockSizeInBytes,
+        };
+        VmaVirtualBlock block{VK_NULL_HANDLE};
+        VK_CHECK(vmaCreateVirtualBlock(&blockCreateInfo, &block));
+        owner = &blocks.emplace_back(buffer, block);
+        VK_CHECK(vmaVirtualAllocate(block, &allocationCreateInfo, &allocation, &offset));
+        log(Level::Info, name, ": ", blockSizeInBytes, " bytes");
+    }
+
+    const auto &buffer = std::get<0>(*owner);
+    const auto mappingAddress = std::get<BUFFER_ENTITY_UID::MAPPING_ADDRESS>(buffer);
+    return std::make_tuple(std::get<BUFFER_ENTITY_UID::BUFFER>(buffer),
+                           offset,
+                           sizeInBytes,
+                           static_cast<VkDeviceAddress>(std::get<BUFFER_ENTITY_UID::DEVICE_HOST_ADDRESS>(buffer).deviceAddress + offset),
+                           mappingAddress ? static_cast<MappingAddressType>(static_cast<uint8_t *>(mappingAddress) + offset) : nullptr,
+                           allocation);
+}
+
+void VkContext::Impl::freeBufferSlice(const BufferSlice &slice)
+{
+    ASSERT(std::get<BUFFER_SLICE_OFFSET::SLICE_VIRTUAL_ALLOCATION>(slice), "buffer slice must come from the arena");
+    std::scoped_lock lock(_bufferArenaMutex);
+    // commands of the current frame may still read it
+    _retiredBufferSlices.emplace_back(_frameNumber, slice);
+}
+
+void VkContext::Impl::collectBufferSlices()
+{
+    while (!_retiredBufferSlices.empty())
+    {
+        const auto &[frameNumber, slice] = _retiredBufferSlices.front();
+        // retired in frame order
+        if (!isFrameComplete(frameNumber))
+        {
+            break;
+        }
+        const auto buffer = std::get<BUFFER_SLICE_OFFSET::SLICE_BUFFER>(slice);
+        for (const auto &blocks : _bufferArenaBlocks)
+        {
+            const auto it = std::find_if(blocks.begin(), blocks.end(), [buffer](const auto &entry)
+                                         { return std::get<BUFFER_ENTITY_UID::BUFFER>(std::get<0>(entry)) == buffer; });
+            if (it != blocks.end())
+            {
+                vmaVirtualFree(std::get<1>(*it), std::get<BUFFER_SLICE_OFFSET::SLICE_VIRTUAL_ALLOCATION>(slice));
+                break;
+            }
+        }
+        _retiredBufferSlices.pop_front();
+    }
+}
+
+void VkContext::Impl::fenceStagingRing(VkFence fence, const std::vector<StagingAllocation> &allocations)
+{
+    ASSERT(fence, "staging ring regions are recycled by fence");
+    std::lock_guard<std::mutex> lock(_stagingRingMutex);
+    for (const auto &allocation : allocations)
+    {
+        commitStagingRegion(allocation, fence, VK_NULL_HANDLE, 0);
+    }
+}
+
+void VkContext::Impl::fenceStagingRing(VkSemaphore timeline, uint64_t timelineValue, const std::vector<StagingAllocation> &allocations)
+{
+    ASSERT(timeline, "staging ring regions are recycled by timeline");
+    std::lock_guard<std::mutex> lock(_stagingRingMutex);
+    for (const auto &allocation : allocations)
+    {
+        commitStagingRegion(allocation, VK_NULL_HANDLE, timeline, timelineValue);
+    }
+}
+
+void VkContext::Impl::fenceFrameStagingRegions(VkSemaphore timeline, uint64_t timelineValue)
+{
+    std::lock_guard<std::mutex> lock(_stagingRingMutex);
+    for (uint64_t id = _stagingRegionsFirst; id < _stagingRegionsEnd; ++id)
+    {
+        auto &region = _stagingRegions[id % STAGING_RING_MAX_REGIONS];
+        if (region.frameOwned && !region.committed)
+        {
+            region.timeline = timeline;
+            region.timelineValue = timelineValue;
+            region.committed = true;
+        }
+    }
+}
+
+void VkContext::Impl::commitStagingRegion(const StagingAllocation &allocation, VkFence fence, VkSemaphore timeline, uint64_t timelineValue)
+{
+    const auto id = std::get<STAGING_ALLOCATION_OFFSET::STAGING_REGION>(allocation);
+    auto &region = _stagingRegions[id % STAGING_RING_MAX_REGIONS];
+    ASSERT(id >= _stagingRegionsFirst && id < _stagingRegionsEnd && region.id == id && !region.committed,
+           "staging allocation must be committed exactly once");
+    region.fence = fence;
+    region.timeline = timeline;
+    region.timelineValue = timelineValue;
+    region.committed = true;
+}
+
+void VkContext::Impl::retireStagingRing(VkFence fence)
+{
+    std::lock_guard<std::mutex> lock(_stagingRingMutex);
+    for (uint64_t id = _stagingRegionsFirst; id < _stagingRegionsEnd; ++id)
+    {
+        auto &region = _stagingRegions[id % STAGING_RING_MAX_REGIONS];
+        if (region.committed && region.fence == fence)
+        {
+            region.retired = true;
+        }
+    }
+    while (popStagingRegion(false))
+    {
+    }
+}
+
+bool VkContext::Impl::popStagingRegion(bool wait)
+{
+    if (_stagingRegionsFirst == _stagingRegionsEnd)
+    {
+        return false;
+    }
+    const auto &region = _stagingRegions[_stagingRegionsFirst % STAGING_RING_MAX_REGIONS];
+    if (!region.committed)
+    {
+        return false;
+    }
+    if (!region.retired && region.fence)
+    {
+        if (wait)
+        {
+            VK_CHECK(vkWaitForFences(_logicalDevice, 1, &region.fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT));
+        }
+        else if (vkGetFenceStatus(_logicalDevice, region.fence) != VK_SUCCESS)
+        {
+            return false;
+        }
+    }
+    // timelines never reset, nothing to retire
+    if (region.timeline)
+    {
+        if (wait)
+        {
+            waitTimeline(region.timeline, region.timelineValue);
+        }
+        else if (!isTimelineReached(region.timeline, region.timelineValue))
+        {
+            return false;
+        }
+    }
+    _stagingRingTail = region.end;
+    ++_stagingRegionsFirst;
+    return true;
+}
+
+void VkContext::Impl::writeBuffer(
+    const StagingAllocation &staging,
+    const BufferEntity &deviceLocalBuffer,
+    const CommandBufferEntity &cmdBuffer,
+    const void *rawData,
+    uint32_t sizeInBytes,
+    uint32_t dstOffset)
+{
+    ASSERT(sizeInBytes <= std::get<STAGING_ALLOCATION_OFFSET::STAGING_SIZE>(staging),
+           "staging allocation is smaller than the data to write");
+    const auto stagingBufferHandle = std::get<STAGING_ALLOCATION_OFFSET::STAGING_BUFFER>(staging);
+    const auto deviceLocalBufferHandle = std::get<0>(deviceLocalBuffer);
+    const auto cmdBufferHandle = std::get<1>(cmdBuffer);
+
+    // ring is persistently mapped and host coherent: no map/unmap, no flush
+    memcpy(std::get<STAGING_ALLOCATION_OFFSET::STAGING_MAPPING_ADDRESS>(staging), rawData, sizeInBytes);
     // cmd to copy from staging to device
-    VkBufferCopy region{.srcOffset = srcOffset,
+    VkBufferCopy region{.srcOffset = std::get<STAGING_ALLOCATION_OFFSET::STAGING_OFFSET>(staging),
                         .dstOffset = dstOffset,
                         .size = sizeInBytes};
     vkCmdCopyBuffer(cmdBufferHandle, stagingBufferHandle, deviceLocalBufferHandle, 1, &region);
@@ -2708,24 +3677,21 @@ void VkContext::Impl::writeBuffer(
 
 void VkContext::Impl::writeImage(
     const ImageEntity &image,
-    const BufferEntity &stagingBuffer,
+    const StagingAllocation &staging,
     const CommandBufferEntity &cmdBuffer,
-    void *rawData)
+    const void *rawData)
 {
     const auto imageHandle = std::get<0>(image);
     const auto textureMipLevelCount = std::get<4>(image);
     const auto extent = std::get<5>(image);
-    const auto stagingBufferHandle = std::get<0>(stagingBuffer);
-    const auto vmaStagingImageBufferAllocation = std::get<1>(stagingBuffer);
+    const auto stagingBufferHandle = std::get<STAGING_ALLOCATION_OFFSET::STAGING_BUFFER>(staging);
     const auto cmdBufferHandle = std::get<1>(cmdBuffer);
 
-    void *imageDataPtr{nullptr};
     // format: VK_FORMAT_R8G8B8A8_UNORM took 4 bytes
     const auto imageDataSizeInBytes = get3DImageSizeInBytes(extent, VK_FORMAT_R8G8B8A8_UNORM);
-    // log(Level::Info, "vmaMapMemory:", std::this_thread::get_id());
-    VK_CHECK(vmaMapMemory(_vmaAllocator, vmaStagingImageBufferAllocation, &imageDataPtr));
-    memcpy(imageDataPtr, rawData, imageDataSizeInBytes);
-    vmaUnmapMemory(_vmaAllocator, vmaStagingImageBufferAllocation);
+    ASSERT(imageDataSizeInBytes <= std::get<STAGING_ALLOCATION_OFFSET::STAGING_SIZE>(staging),
+           "staging allocation is smaller than the image");
+    memcpy(std::get<STAGING_ALLOCATION_OFFSET::STAGING_MAPPING_ADDRESS>(staging), rawData, imageDataSizeInBytes);
     // image layout from undefined to write dst
     // transition layout
     // barrier based on mip level, array layers
@@ -2735,32 +3701,21 @@ void VkContext::Impl::writeImage(
     subresourceRange.levelCount = textureMipLevelCount;
     subresourceRange.layerCount = 1;
 
-    VkImageMemoryBarrier imageMemoryBarrier{};
-    imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    imageMemoryBarrier.image = imageHandle;
-    imageMemoryBarrier.subresourceRange = subresourceRange;
-    imageMemoryBarrier.srcAccessMask = VK_ACCESS_NONE; // 0: VK_ACCESS_NONE
-    imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     // VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL: written into
-    imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-
-    vkCmdPipelineBarrier(
-        cmdBufferHandle,
-        VK_PIPELINE_STAGE_HOST_BIT,
-        VK_PIPELINE_STAGE_TRANSFER_BIT,
-        0,
-        0, nullptr,
-        0, nullptr,
-        1, &imageMemoryBarrier);
+    // host writes to the staging ring are made visible by the queue submit, nothing to wait for
+    BarrierBatch barriers;
+    barriers.image(imageHandle,
+                   VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                   VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+                   VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                   subresourceRange);
+    barriers.flush(cmdBufferHandle);
 
     // now image layout(usage) is writable
     // staging buffer to device-local(image is device local memory)
     VkBufferImageCopy bufferCopyRegion = {};
     // mipmap level0: original copy
-    bufferCopyRegion.bufferOffset = 0;
+    bufferCopyRegion.bufferOffset = std::get<STAGING_ALLOCATION_OFFSET::STAGING_OFFSET>(staging);
     // could be depth, stencil and color
     bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     bufferCopyRegion.imageSubresource.mipLevel = 0;
@@ -2782,19 +3737,317 @@ void VkContext::Impl::writeImage(
         &bufferCopyRegion);
 }
 
+UploadTicket VkContext::Impl::submitUploadBatch(
+    const std::vector<std::tuple<VkBuffer, const void *, uint32_t, uint32_t, bool>> &bufferWrites,
+    const std::vector<std::tuple<ImageEntity, const void *, bool>> &imageWrites,
+    const std::vector<std::function<void(VkCommandBuffer)>> &commands)
+{
+    ZoneScopedN("submitUploadBatch");
+    // custom commands (as build, ...) need graphics/compute, pure copies go to the transfer queue
+    // only when no buffer content has to survive: the buffers are exclusive to graphics and the transfer queue
+    // gets them without a graphics -> transfer release, everything outside the copied ranges is undefined afterwards
+    // images are always written whole from VK_IMAGE_LAYOUT_UNDEFINED, their old content is discarded anyway
+    const bool initialUploadsOnly = std::all_of(bufferWrites.begin(), bufferWrites.end(), [](const auto &write)
+                                                { return std::get<4>(write); });
+    const bool onTransferQueue = commands.empty() && initialUploadsOnly && hasDedicatedTransferQueue();
+    auto &uploadCmdBuffers = cmdBuffers[onTransferQueue ? COMMAND_SEMANTIC::UPLOAD_TRANSFER : COMMAND_SEMANTIC::UPLOAD];
+    ASSERT(uploadCmdBuffers.size() == UPLOAD_BATCH_INFLIGHT_COUNT, "initDefaultCommandBuffers must be called before uploading");
+
+    std::lock_guard<std::mutex> lock(_uploadMutex);
+    auto &slot = onTransferQueue ? _transferUploadSlot : _graphicsUploadSlot;
+    auto &slotTimelineValues = onTransferQueue ? _transferUploadSlotTimelineValues : _graphicsUploadSlotTimelineValues;
+    const auto timeline = onTransferQueue ? _transferTimeline : _graphicsTimeline;
+    auto &cmdBuffer = uploadCmdBuffers[slot];
+    // wait for the batch which used this command buffer last time
+    waitTimeline(timeline, slotTimelineValues[slot]);
+    BeginRecordCommandBuffer(cmdBuffer);
+    const auto cmdBufferHandle = std::get<COMMAND_BUFFER_ENTITY_OFFSET::COMMAND_BUFFER>(cmdBuffer);
+    const auto stagingBufferHandle = std::get<BUFFER_ENTITY_UID::BUFFER>(_stagingRing);
+
+    // staging is taken right before the submit so the ring regions never outlive a frame unsubmitted
+    // one region for the whole batch, committed to this submission only
+    // 4: vkCmdCopyBuffer has no alignment requirement, keep consecutive writes tight for merging
+    const VkDeviceSize imageAlignment = std::max<VkDeviceSize>(16, _physicalDevicesProp1.limits.optimalBufferCopyOffsetAlignment);
+    const auto alignUp = [](VkDeviceSize offset, VkDeviceSize alignment)
+    {
+        return (offset + alignment - 1) & ~(alignment - 1);
+    };
+    VkDeviceSize batchSizeInBytes = 0;
+    for (const auto &[dstBufferHandle, rawData, sizeInBytes, dstOffset, initialUpload] : bufferWrites)
+    {
+        ASSERT(sizeInBytes > 0, "buffer write must not be empty");
+        batchSizeInBytes = alignUp(batchSizeInBytes, 4) + sizeInBytes;
+    }
+    for (const auto &[image, rawData, generateMips] : imageWrites)
+    {
+        const auto extent = std::get<IMAGE_ENTITY_OFFSET::IMAGE_EXTENT>(image);
+        batchSizeInBytes = alignUp(batchSizeInBytes, imageAlignment) + get3DImageSizeInBytes(extent, VK_FORMAT_R8G8B8A8_UNORM);
+    }
+    std::optional<StagingAllocation> batchStaging;
+    if (batchSizeInBytes > 0)
+    {
+        batchStaging = allocateStaging(batchSizeInBytes, imageAlignment, false);
+    }
+    // relative to the region, the region itself is imageAlignment aligned
+    VkDeviceSize batchOffset = 0;
+    const auto reserveInBatch = [&](VkDeviceSize sizeInBytes, VkDeviceSize alignment)
+    {
+        batchOffset = alignUp(batchOffset, alignment);
+        const auto offset = batchOffset;
+        batchOffset += sizeInBytes;
+        return offset;
+    };
+    std::unordered_map<VkBuffer, std::vector<VkBufferCopy>> bufferCopies;
+    for (const auto &[dstBufferHandle, rawData, sizeInBytes, dstOffset, initialUpload] : bufferWrites)
+    {
+        const auto offset = reserveInBatch(sizeInBytes, 4);
+        memcpy(static_cast<uint8_t *>(std::get<STAGING_ALLOCATION_OFFSET::STAGING_MAPPING_ADDRESS>(*batchStaging)) + offset, rawData, sizeInBytes);
+        bufferCopies[dstBufferHandle].emplace_back(VkBufferCopy{
+            .srcOffset = std::get<STAGING_ALLOCATION_OFFSET::STAGING_OFFSET>(*batchStaging) + offset,
+            .dstOffset = dstOffset,
+            .size = sizeInBytes,
+        });
+    }
+    // image, staging offset, generate mips
+    std::vector<std::tuple<ImageEntity, VkDeviceSize, bool>> imageCopies;
+    imageCopies.reserve(imageWrites.size());
+    for (const auto &[image, rawData, generateMips] : imageWrites)
+    {
+        const auto extent = std::get<IMAGE_ENTITY_OFFSET::IMAGE_EXTENT>(image);
+        const auto imageDataSizeInBytes = get3DImageSizeInBytes(extent, VK_FORMAT_R8G8B8A8_UNORM);
+        const auto offset = reserveInBatch(imageDataSizeInBytes, imageAlignment);
+        memcpy(static_cast<uint8_t *>(std::get<STAGING_ALLOCATION_OFFSET::STAGING_MAPPING_ADDRESS>(*batchStaging)) + offset, rawData, imageDataSizeInBytes);
+        imageCopies.emplace_back(image, std::get<STAGING_ALLOCATION_OFFSET::STAGING_OFFSET>(*batchStaging) + offset, generateMips);
+    }
+
+    // buffers: merge regions which are contiguous in both staging ring and dst buffer
+    for (auto &[dstBufferHandle, regions] : bufferCopies)
+    {
+        std::sort(regions.begin(), regions.end(), [](const VkBufferCopy &a, const VkBufferCopy &b)
+                  { return a.srcOffset < b.srcOffset; });
+        size_t merged = 0;
+        for (size_t i = 1; i < regions.size(); ++i)
+        {
+            auto &last = regions[merged];
+            if (last.srcOffset + last.size == regions[i].srcOffset &&
+                last.dstOffset + last.size == regions[i].dstOffset)
+            {
+                last.size += regions[i].size;
+            }
+            else
+            {
+                regions[++merged] = regions[i];
+            }
+        }
+        regions.resize(merged + 1);
+        vkCmdCopyBuffer(cmdBufferHandle, stagingBufferHandle, dstBufferHandle, regions.size(), regions.data());
+    }
+
+    // images: undefined -> transfer dst for all of them in one barrier
+    BarrierBatch barriers;
+    for (const auto &[image, stagingOffset, generateMips] : imageCopies)
+    {
+        barriers.image(image,
+                       VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+                       VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+    }
+    barriers.flush(cmdBufferHandle);
+    for (const auto &[image, stagingOffset, generateMips] : imageCopies)
+    {
+        const auto extent = std::get<IMAGE_ENTITY_OFFSET::IMAGE_EXTENT>(image);
+        const VkBufferImageCopy bufferCopyRegion{
+            .bufferOffset = stagingOffset,
+            .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+            .imageOffset = {0, 0, 0},
+            .imageExtent = {extent.width, extent.height, 1},
+        };
+        vkCmdCopyBufferToImage(cmdBufferHandle, stagingBufferHandle, std::get<IMAGE_ENTITY_OFFSET::IMAGE>(image),
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &bufferCopyRegion);
+        // mips need blit (graphics), on the transfer path they are generated after the acquire
+        if (generateMips && !onTransferQueue)
+        {
+            // ends up with shader read
+            generateMipmaps(image, cmdBuffer);
+        }
+    }
+
+    if (onTransferQueue)
+    {
+        // release everything to graphics in one barrier, matching acquire is recorded by the next submitCommand
+        for (const auto &[dstBufferHandle, regions] : bufferCopies)
+        {
+            barriers.buffer(dstBufferHandle,
+                            VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                            VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+                            0, VK_WHOLE_SIZE, _transferQueueFamilyIndex, _graphicsComputeQueueFamilyIndex);
+            // acquire: src stage/access are ignored
+            _pendingAcquireBarriers.buffer(dstBufferHandle,
+                                           VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+                                           VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT,
+                                           0, VK_WHOLE_SIZE, _transferQueueFamilyIndex, _graphicsComputeQueueFamilyIndex);
+        }
+        for (const auto &[image, stagingOffset, generateMips] : imageCopies)
+        {
+            // layout transition is part of the ownership transfer, has to match on both sides
+            const auto newLayout = generateMips ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            const VkImageSubresourceRange subresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, 0, std::get<IMAGE_ENTITY_OFFSET::MIPMAP_COUNT>(image), 0, 1};
+            barriers.image(std::get<IMAGE_ENTITY_OFFSET::IMAGE>(image),
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, newLayout,
+                           VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                           VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+                           subresourceRange, _transferQueueFamilyIndex, _graphicsComputeQueueFamilyIndex);
+            _pendingAcquireBarriers.image(std::get<IMAGE_ENTITY_OFFSET::IMAGE>(image),
+                                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, newLayout,
+                                          VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+                                          generateMips ? VK_PIPELINE_STAGE_2_BLIT_BIT : VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                                          generateMips ? VK_ACCESS_2_TRANSFER_READ_BIT : VK_ACCESS_2_SHADER_READ_BIT,
+                                          subresourceRange, _transferQueueFamilyIndex, _graphicsComputeQueueFamilyIndex);
+            if (generateMips)
+            {
+                _pendingMipmapImages.emplace_back(image);
+            }
+        }
+        barriers.flush(cmdBufferHandle);
+    }
+    else
+    {
+        // images without mips: transfer dst -> shader read in one barrier
+        for (const auto &[image, stagingOffset, generateMips] : imageCopies)
+        {
+            if (generateMips)
+            {
+                continue;
+            }
+            barriers.image(image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                           VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                           VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_SHADER_READ_BIT);
+        }
+        // buffer copies visible to whatever comes next in this queue (custom commands, later submits)
+        if (!bufferCopies.empty())
+        {
+            barriers.memory(VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                            VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT);
+        }
+        barriers.flush(cmdBufferHandle);
+
+        for (const auto &command : commands)
+        {
+            command(cmdBufferHandle);
+        }
+    }
+    EndRecordCommandBuffer(cmdBuffer);
+
+    // completion is signaled on the queue's timeline
+    const uint64_t timelineValue = onTransferQueue ? ++_transferTimelineValue : ++_graphicsTimelineValue;
+    const VkCommandBufferSubmitInfo cmdBufferSubmitInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+        .commandBuffer = cmdBufferHandle,
+    };
+    // signal once all the commands are done
+    const VkSemaphoreSubmitInfo signalSemaphoreInfo{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+        .semaphore = timeline,
+        .value = timelineValue,
+        .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+    };
+    const VkSubmitInfo2 submitInfo{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+        .commandBufferInfoCount = 1,
+        .pCommandBufferInfos = &cmdBufferSubmitInfo,
+        .signalSemaphoreInfoCount = 1,
+        .pSignalSemaphoreInfos = &signalSemaphoreInfo,
+    };
+    // timeline value: command buffer reuse and staging ring recycling
+    const auto cmdQueue = std::get<COMMAND_BUFFER_ENTITY_OFFSET::QUEUE>(cmdBuffer);
+    VK_CHECK(vkQueueSubmit2(cmdQueue, 1, &submitInfo, VK_NULL_HANDLE));
+    if (batchStaging)
+    {
+        fenceStagingRing(timeline, timelineValue, {*batchStaging});
+    }
+    slotTimelineValues[slot] = timelineValue;
+    slot = (slot + 1) % UPLOAD_BATCH_INFLIGHT_COUNT;
+    if (onTransferQueue)
+    {
+        // the next graphics submit waits for this value on the gpu
+        _pendingAcquireTimelineValue = timelineValue;
+    }
+    return std::make_tuple(timeline, timelineValue);
+}
+
+bool VkContext::Impl::isUploadComplete(UploadTicket ticket)
+{
+    const auto [timeline, timelineValue] = ticket;
+    if (timeline == VK_NULL_HANDLE)
+    {
+        return true;
+    }
+    if (timeline != _transferTimeline)
+    {
+        return isTimelineReached(timeline, timelineValue);
+    }
+    // transfer: the copy alone is not enough, the graphics side acquire must be done as well
+    std::lock_guard<std::mutex> lock(_uploadMutex);
+    while (!_uploadAcquires.empty() && isTimelineReached(_graphicsTimeline, std::get<1>(_uploadAcquires.front())))
+    {
+        _completedAcquireTimelineValue = std::get<0>(_uploadAcquires.front());
+        _uploadAcquires.pop_front();
+    }
+    return timelineValue <= _completedAcquireTimelineValue;
+}
+
+void VkContext::Impl::waitUpload(UploadTicket ticket)
+{
+    ZoneScopedN("waitUpload");
+    const auto [timeline, timelineValue] = ticket;
+    if (timeline == VK_NULL_HANDLE)
+    {
+        return;
+    }
+    ASSERT(timeline == _graphicsTimeline || timeline == _transferTimeline, "upload ticket should come from submitUploadBatch");
+    waitTimeline(timeline, timelineValue);
+}
+
+// graphics side of the transfer uploads, nullopt if nothing is pending
+// _uploadMutex must be held
+std::optional<VkCommandBuffer> VkContext::Impl::recordPendingUploadAcquire()
+{
+    if (_pendingAcquireTimelineValue == 0)
+    {
+        return std::nullopt;
+    }
+    // one per frame slot: the slot's timeline value, waited for in advanceFrame (advanceCommandBuffer), covers its reuse
+    auto &cmdBuffer = cmdBuffers[COMMAND_SEMANTIC::UPLOAD_ACQUIRE][currentFrameId];
+    BeginRecordCommandBuffer(cmdBuffer);
+    const auto cmdBufferHandle = std::get<COMMAND_BUFFER_ENTITY_OFFSET::COMMAND_BUFFER>(cmdBuffer);
+    _pendingAcquireBarriers.flush(cmdBufferHandle);
+    for (const auto &image : _pendingMipmapImages)
+    {
+        generateMipmaps(image, cmdBuffer);
+    }
+    EndRecordCommandBuffer(cmdBuffer);
+
+    _pendingMipmapImages.clear();
+    return cmdBufferHandle;
+}
+
 void VkContext::Impl::submitWriteImageCommand(
     ImageEntity &image,
-    BufferEntity &stagingBuffer,
     CommandBufferEntity &cmdBuffer,
     void *rawData,
     const std::vector<VkSemaphore> &semaphoresToWait,
     std::optional<VkPipelineStageFlags> waitStage,
-    const std::vector<VkSemaphore> &semaphoresToSignal)
+    const std::vector<VkSemaphore> &semaphoresToSignal,
+    bool wait)
 {
     BeginRecordCommandBuffer(cmdBuffer);
+    StagingAllocation staging;
     {
         ZoneScopedN("submitWriteImageCommand::writeImage");
-        writeImage(image, stagingBuffer, cmdBuffer, rawData);
+        const auto extent = std::get<IMAGE_ENTITY_OFFSET::IMAGE_EXTENT>(image);
+        staging = allocateStaging(get3DImageSizeInBytes(extent, VK_FORMAT_R8G8B8A8_UNORM), 16, false);
+        writeImage(image, staging, cmdBuffer, rawData);
     }
     EndRecordCommandBuffer(cmdBuffer);
 
@@ -2802,25 +4055,55 @@ void VkContext::Impl::submitWriteImageCommand(
     const auto fence = std::get<COMMAND_BUFFER_ENTITY_OFFSET::FENCE>(cmdBuffer);
     const auto cmdQueue = std::get<COMMAND_BUFFER_ENTITY_OFFSET::QUEUE>(cmdBuffer);
 
-    VkSubmitInfo submitInfo{};
-    submitInfo.waitSemaphoreCount = semaphoresToWait.size();
-    submitInfo.pWaitSemaphores = semaphoresToWait.size() ? semaphoresToWait.data() : VK_NULL_HANDLE;
     if (semaphoresToWait.size())
     {
         ASSERT(waitStage.has_value(), "waitStage must be set when you wait for semaphores");
-        submitInfo.pWaitDstStageMask = &waitStage.value();
     }
-
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
-    submitInfo.signalSemaphoreCount = semaphoresToSignal.size();
-    submitInfo.pSignalSemaphores = semaphoresToSignal.size() ? semaphoresToSignal.data() : VK_NULL_HANDLE;
+    // legacy stage bits have the same value in VkPipelineStageFlags2
+    std::vector<VkSemaphoreSubmitInfo> waitSemaphoreInfos;
+    waitSemaphoreInfos.reserve(semaphoresToWait.size());
+    for (const auto semaphore : semaphoresToWait)
+    {
+        waitSemaphoreInfos.emplace_back(VkSemaphoreSubmitInfo{
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+            .semaphore = semaphore,
+            .stageMask = static_cast<VkPipelineStageFlags2>(waitStage.value()),
+        });
+    }
+    std::vector<VkSemaphoreSubmitInfo> signalSemaphoreInfos;
+    signalSemaphoreInfos.reserve(semaphoresToSignal.size());
+    for (const auto semaphore : semaphoresToSignal)
+    {
+        signalSemaphoreInfos.emplace_back(VkSemaphoreSubmitInfo{
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+            .semaphore = semaphore,
+            .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        });
+    }
+    const VkCommandBufferSubmitInfo cmdBufferSubmitInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+        .commandBuffer = commandBuffer,
+    };
+    const VkSubmitInfo2 submitInfo{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+        .waitSemaphoreInfoCount = static_cast<uint32_t>(waitSemaphoreInfos.size()),
+        .pWaitSemaphoreInfos = waitSemaphoreInfos.data(),
+        .commandBufferInfoCount = 1,
+        .pCommandBufferInfos = &cmdBufferSubmitInfo,
+        .signalSemaphoreInfoCount = static_cast<uint32_t>(signalSemaphoreInfos.size()),
+        .pSignalSemaphoreInfos = signalSemaphoreInfos.data(),
+    };
 
     // must reset fence of waiting (Signal -> not signal, due to initally fence is created with state "signaled")
     VK_CHECK(vkResetFences(_logicalDevice, 1, &fence));
     // This will change state of fence to signaled
-    VK_CHECK(vkQueueSubmit(cmdQueue, 1, &submitInfo, fence));
+    VK_CHECK(vkQueueSubmit2(cmdQueue, 1, &submitInfo, fence));
+    fenceStagingRing(fence, {staging});
+    if (!wait)
+    {
+        // next BeginRecordCommandBuffer on cmdBuffer waits the fence, gpu consumers wait on semaphoresToSignal
+        return;
+    }
     // this manifest a sync point, the command is submitted not necessary executed by the devices
     const auto result = vkWaitForFences(_logicalDevice, 1, &fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT);
     if (result == VK_TIMEOUT)
@@ -2855,37 +4138,22 @@ void VkContext::Impl::generateMipmaps(
     subresourceRange.baseArrayLayer = 0;
     subresourceRange.layerCount = 1;
 
-    VkImageMemoryBarrier imageMemoryBarrier{};
-    imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    imageMemoryBarrier.image = imageHandle;
-    imageMemoryBarrier.subresourceRange = subresourceRange;
-    imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-    imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-
+    BarrierBatch barriers;
     int32_t w = extent.width;
     int32_t h = extent.height;
-    for (uint32_t i = 1; i <= textureMipLevelCount; ++i)
+    for (uint32_t i = 1; i < textureMipLevelCount; ++i)
     {
         // Prepare current mip level as image blit source for next level
-        imageMemoryBarrier.subresourceRange.baseMipLevel = i - 1;
-        vkCmdPipelineBarrier(
-            cmdBufferHandle,
-            VK_PIPELINE_STAGE_TRANSFER_BIT,
-            VK_PIPELINE_STAGE_TRANSFER_BIT,
-            0,
-            0, nullptr,
-            0, nullptr,
-            1, &imageMemoryBarrier);
         // level0 write, barrier, level0 read, level 1write, barrier
         // level1 read, ....
-        if (i == textureMipLevelCount)
-        {
-            break;
-        }
+        // level0 is written by copy, the others by blit
+        subresourceRange.baseMipLevel = i - 1;
+        barriers.image(imageHandle,
+                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       VK_PIPELINE_STAGE_2_COPY_BIT | VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                       VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_TRANSFER_READ_BIT,
+                       subresourceRange);
+        barriers.flush(cmdBufferHandle);
         const int32_t newW = w > 1 ? w >> 1 : w;
         const int32_t newH = h > 1 ? h >> 1 : h;
 
@@ -2918,30 +4186,23 @@ void VkContext::Impl::generateMipmaps(
         w = newW;
         h = newH;
     }
-    // all mip layers are in TRANSFER_SRC --> SHADER_READ
-    const VkImageMemoryBarrier convertToShaderReadBarrier = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
-        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-        .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .image = imageHandle,
-        .subresourceRange =
-            {
-                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                .baseMipLevel = 0,
-                .levelCount = textureMipLevelCount,
-                .baseArrayLayer = 0,
-                .layerCount = 1,
-            },
-
-    };
-    vkCmdPipelineBarrier(cmdBufferHandle, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0,
-                         nullptr,
-                         1, &convertToShaderReadBarrier);
+    // one barrier to SHADER_READ for all the levels:
+    // [0, last) are TRANSFER_SRC (only read by blit), last level is still TRANSFER_DST
+    const auto lastLevel = textureMipLevelCount - 1;
+    if (lastLevel > 0)
+    {
+        barriers.image(imageHandle,
+                       VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                       VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_NONE,
+                       VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+                       {VK_IMAGE_ASPECT_COLOR_BIT, 0, lastLevel, 0, 1});
+    }
+    barriers.image(imageHandle,
+                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                   VK_PIPELINE_STAGE_2_COPY_BIT | VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                   VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+                   {VK_IMAGE_ASPECT_COLOR_BIT, lastLevel, 1, 0, 1});
+    barriers.flush(cmdBufferHandle);
 }
 
 // void VkContext::Impl::submitGenerateMipmapsCommand(
@@ -3009,37 +4270,182 @@ std::vector<CommandBufferEntity> &VkContext::Impl::getCommandBufferForRenderingF
 void VkContext::Impl::submitCommand()
 {
     auto [currentFrameId, cmdBuffersForRendering] = getCommandBufferForRendering();
-    const auto cmdToRecord = std::get<1>(cmdBuffersForRendering);
-    const auto fenceToWait = std::get<2>(cmdBuffersForRendering);
-    // submit command
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-
-    VkSemaphore waitSemaphores[] = {imageCanAcquireSemaphores[currentFrameId]};
-    // pipeline stages
+    const auto cmdToRecord = std::get<COMMAND_BUFFER_ENTITY_OFFSET::COMMAND_BUFFER>(cmdBuffersForRendering);
+
+    // transfer uploads since last frame: acquire ownership in front of the rendering commands
+    std::lock_guard<std::mutex> lock(_uploadMutex);
+    const auto acquireTimelineValue = _pendingAcquireTimelineValue;
+    const auto acquireCmd = recordPendingUploadAcquire();
+    _pendingAcquireTimelineValue = 0;
+
     // specifies the stage of the pipeline after blending where the final color values are output from the pipeline
     // basically wait for the previous rendering finished
-    VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+    // acquire must wait with VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT
+    // headless: no swapchain image to wait for and no present to signal, the leading binary semaphores are skipped
+    const uint32_t skippedBinarySemaphores = _headless ? 1u : 0u;
+    const VkSemaphoreSubmitInfo waitSemaphoreInfos[] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+            .semaphore = _headless ? VK_NULL_HANDLE : imageCanAcquireSemaphores[currentFrameId],
+            .stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+            .semaphore = _transferTimeline,
+            .value = acquireTimelineValue,
+            .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        },
+    };
+    const VkCommandBufferSubmitInfo cmdBufferSubmitInfos[] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+            .commandBuffer = acquireCmd.value_or(VK_NULL_HANDLE),
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+            .commandBuffer = cmdToRecord,
+        },
+    };
 
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = waitSemaphores;
-    submitInfo.pWaitDstStageMask = waitStages;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &cmdToRecord;
+    // signal semaphore: binary one for present, timeline one for frame pacing
+    const uint64_t frameTimelineValue = ++_graphicsTimelineValue;
+    const VkSemaphoreSubmitInfo signalSemaphoreInfos[] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+            .semaphore = _headless ? VK_NULL_HANDLE : imageRendereredSemaphores[currentFrameId],
+            .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+            .semaphore = _graphicsTimeline,
+            .value = frameTimelineValue,
+            .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        },
+    };
+    const VkSubmitInfo2 submitInfo{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+        .waitSemaphoreInfoCount = (acquireCmd ? 2u : 1u) - skippedBinarySemaphores,
+        .pWaitSemaphoreInfos = &waitSemaphoreInfos[skippedBinarySemaphores],
+        .commandBufferInfoCount = acquireCmd ? 2u : 1u,
+        .pCommandBufferInfos = acquireCmd ? cmdBufferSubmitInfos : &cmdBufferSubmitInfos[1],
+        .signalSemaphoreInfoCount = 2 - skippedBinarySemaphores,
+        .pSignalSemaphoreInfos = &signalSemaphoreInfos[skippedBinarySemaphores],
+    };
 
-    // signal semaphore
-    VkSemaphore signalRenderedSemaphores[] = {imageRendereredSemaphores[currentFrameId]};
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = signalRenderedSemaphores;
+    VK_CHECK(vkQueueSubmit2(_graphicsComputeQueue, 1, &submitInfo, VK_NULL_HANDLE));
+    _frameTimelineValues[currentFrameId] = std::make_tuple(_frameNumber, frameTimelineValue);
+    _submittedFrameNumber = _frameNumber;
+    if (acquireCmd)
+    {
+        _uploadAcquires.emplace_back(acquireTimelineValue, frameTimelineValue);
+    }
+    // per-frame uploads recorded into this command buffer
+    fenceFrameStagingRegions(_graphicsTimeline, frameTimelineValue);
+}
+
+void VkContext::Impl::advanceFrame()
+{
+    ZoneScopedN("advanceFrame");
+    ++_frameNumber;
+    currentFrameId = (currentFrameId + 1) % _framesInFlight;
+    // vma refreshes the heap budgets once per frame index
+    vmaSetCurrentFrameIndex(_vmaAllocator, static_cast<uint32_t>(_frameNumber));
+    // the slot is about to be reused: its command buffer and semaphores must be done
+    const auto [frameNumber, timelineValue] = _frameTimelineValues[currentFrameId];
+    waitTimeline(_graphicsTimeline, timelineValue);
+    setCompletedFrameNumber(frameNumber);
+}
+
+bool VkContext::Impl::isFrameComplete(uint64_t frameNumber)
+{
+    if (frameNumber <= _completedFrameNumber)
+    {
+        return true;
+    }
+    if (frameNumber > _submittedFrameNumber)
+    {
+        return false;
+    }
+    // still in flight, one slot per frame
+    const auto [slotFrameNumber, timelineValue] = _frameTimelineValues[(frameNumber - 1) % _framesInFlight];
+    ASSERT(slotFrameNumber == frameNumber, "frame in flight must own its slot");
+    return isTimelineReached(_graphicsTimeline, timelineValue);
+}
+
+uint64_t VkContext::Impl::getCompletedFrameNumber()
+{
+    // newest first, submissions on the same queue complete in order
+    for (uint64_t frameNumber = _submittedFrameNumber; frameNumber > _completedFrameNumber; --frameNumber)
+    {
+        if (isFrameComplete(frameNumber))
+        {
+            setCompletedFrameNumber(frameNumber);
+            break;
+        }
+    }
+    return _completedFrameNumber;
+}
+
+void VkContext::Impl::waitFrame(uint64_t frameNumber)
+{
+    ZoneScopedN("waitFrame");
+    ASSERT(frameNumber <= _submittedFrameNumber, "frame must be submitted before waiting for it");
+    if (frameNumber <= _completedFrameNumber)
+    {
+        return;
+    }
+    const auto [slotFrameNumber, timelineValue] = _frameTimelineValues[(frameNumber - 1) % _framesInFlight];
+    ASSERT(slotFrameNumber == frameNumber, "frame in flight must own its slot");
+    waitTimeline(_graphicsTimeline, timelineValue);
+    setCompletedFrameNumber(frameNumber);
+}
 
-    // vkWaitForFences and reset pattern
-    VK_CHECK(vkResetFences(_logicalDevice, 1, &fenceToWait));
-    // signal fence+
-    VK_CHECK(vkQueueSubmit(_graphicsComputeQueue, 1, &submitInfo, fenceToWait));
+void VkContext::Impl::setCompletedFrameNumber(uint64_t frameNumber)
+{
+    auto completed = _completedFrameNumber.load(std::memory_order_relaxed);
+    while (completed < frameNumber &&
+           !_completedFrameNumber.compare_exchange_weak(completed, frameNumber, std::memory_order_release, std::memory_order_relaxed))
+    {
+    }
+}
+
+bool VkContext::Impl::isTimelineReached(VkSemaphore timeline, uint64_t timelineValue)
+{
+    uint64_t completedValue{0};
+    VK_CHECK(vkGetSemaphoreCounterValue(_logicalDevice, timeline, &completedValue));
+    return completedValue >= timelineValue;
+}
+
+void VkContext::Impl::waitTimeline(VkSemaphore timeline, uint64_t timelineValue)
+{
+    // value 0 is the initial value, nothing to wait for
+    if (timelineValue == 0)
+    {
+        return;
+    }
+    const VkSemaphoreWaitInfo waitInfo{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &timeline,
+        .pValues = &timelineValue,
+    };
+    const auto result = vkWaitSemaphores(_logicalDevice, &waitInfo, DEFAULT_FENCE_TIMEOUT);
+    if (result == VK_TIMEOUT)
+    {
+        // should not happen
+        ASSERT(false, "vkWaitSemaphores somehow Timed out !");
+        vkDeviceWaitIdle(_logicalDevice);
+    }
 }
 
 void VkContext::Impl::present(uint32_t swapChainImageIndex)
 {
+    // headless: the target stays with its frame slot, read back once isFrameComplete says so
+    if (_headless)
+    {
+        ASSERT(swapChainImageIndex < _offscreenTargets.size(), "offscreen target index should be in a valid range");
+        return;
+    }
     // present after rendering is done
     VkSemaphore signalRenderedSemaphores[] = {imageRendereredSemaphores[currentFrameId]};
 
@@ -3059,6 +4465,11 @@ void VkContext::Impl::present(uint32_t swapChainImageIndex)
 uint32_t VkContext::Impl::getSwapChainImageIndexToRender() const
 {
     ZoneScopedN("getSwapChainImageIndexToRender");
+    // headless: the target of the frame slot, advanceFrame waited for its last use
+    if (_headless)
+    {
+        return currentFrameId;
+    }
     uint32_t swapChainImageIndex;
     VkResult result = vkAcquireNextImageKHR(
         _logicalDevice, _swapChain, UINT64_MAX, imageCanAcquireSemaphores[currentFrameId],
@@ -3116,7 +4527,22 @@ VkContext::VkContext(const Window &window,
 {
     _pimpl = std::make_unique<Impl>(
         *this,
-        window,
+        &window,
+        VkExtent2D{},
+        instanceValidationLayers,
+        instanceExtensions,
+        deviceExtensions);
+}
+
+VkContext::VkContext(VkExtent2D offscreenExtent,
+                     const std::vector<const char *> &instanceValidationLayers,
+                     const std::set<std::string> &instanceExtensions,
+                     const std::vector<const char *> deviceExtensions)
+{
+    _pimpl = std::make_unique<Impl>(
+        *this,
+        nullptr,
+        offscreenExtent,
         instanceValidationLayers,
         instanceExtensions,
         deviceExtensions);
@@ -3128,8 +4554,15 @@ VkContext::~VkContext()
 
 void VkContext::createSwapChain()
 {
-    _pimpl->createSwapChain();
-    _pimpl->createSwapChainImageView();
+    if (_pimpl->isHeadless())
+    {
+        _pimpl->createOffscreenTargets();
+    }
+    else
+    {
+        _pimpl->createSwapChain();
+        _pimpl->createSwapChainImageView();
+    }
     _pimpl->createPerFrameSyncObjects();
 }
 
@@ -3153,10 +4586,10 @@ VkFramebuffer VkContext::createFramebuffer(
 void VkContext::initDefaultCommandBuffers()
 {
     log(Level::Info, "-->initDefaultCommandBuffers");
-    const auto numFramesInFlight = getSwapChainImageViews().size();
+    const auto numFramesInFlight = getFramesInFlight();
+    // no fence: frames are paced by the graphics timeline in advanceCommandBuffer
     _pimpl->cmdBuffers.insert(std::make_pair(COMMAND_SEMANTIC::RENDERING,
-                                             _pimpl->createGraphicsCommandBuffers("rendering", numFramesInFlight,
-                                                                                  numFramesInFlight, VK_FENCE_CREATE_SIGNALED_BIT)));
+                                             _pimpl->createGraphicsCommandBuffers("rendering", numFramesInFlight, 0, 0)));
     // mipmap requires graphics capablilities
     // VK_FENCE_CREATE_SIGNALED_BIT to unify waitFence behavior in beginRecordCommandBuffer
     _pimpl->cmdBuffers.insert(std::make_pair(COMMAND_SEMANTIC::IO,
@@ -3166,6 +4599,17 @@ void VkContext::initDefaultCommandBuffers()
                                              _pimpl->createGraphicsCommandBuffers("mipmap", 1, 1, VK_FENCE_CREATE_SIGNALED_BIT)));
     _pimpl->cmdBuffers.insert(std::make_pair(COMMAND_SEMANTIC::TRANSFER,
                                              _pimpl->createTransferCommandBuffers("transfer", 1, 1, VK_FENCE_CREATE_SIGNALED_BIT)));
+    // upload batches, round-robin, reuse is tracked by timeline values
+    _pimpl->cmdBuffers.insert(std::make_pair(COMMAND_SEMANTIC::UPLOAD,
+                                             _pimpl->createGraphicsCommandBuffers("upload", UPLOAD_BATCH_INFLIGHT_COUNT, 0, 0)));
+    if (_pimpl->hasDedicatedTransferQueue())
+    {
+        _pimpl->cmdBuffers.insert(std::make_pair(COMMAND_SEMANTIC::UPLOAD_TRANSFER,
+                                                 _pimpl->createTransferCommandBuffers("upload transfer", UPLOAD_BATCH_INFLIGHT_COUNT, 0, 0)));
+        // no fence: submitted together with the rendering command buffer of the same frame
+        _pimpl->cmdBuffers.insert(std::make_pair(COMMAND_SEMANTIC::UPLOAD_ACQUIRE,
+                                                 _pimpl->createGraphicsCommandBuffers("upload acquire", numFramesInFlight, 0, 0)));
+    }
     log(Level::Info, "<--initDefaultCommandBuffers");
 }
 
@@ -3295,6 +4739,11 @@ std::tuple<VkSampler> VkContext::createSampler(const std::string &name)
     return _pimpl->createSampler(name);
 }
 
+std::tuple<VkSampler> VkContext::createSampler(const VkSamplerCreateInfo &samplerCreateInfo, const std::string &name)
+{
+    return _pimpl->createSampler(samplerCreateInfo, name);
+}
+
 std::vector<VkDescriptorSetLayout> VkContext::createDescriptorSetLayout(
     std::vector<std::vector<VkDescriptorSetLayoutBinding>> &setBindings)
 {
@@ -3312,9 +4761,10 @@ std::tuple<std::unordered_map<GRAPHICS_PIPELINE_SEMANTIC, VkPipeline>, VkPipelin
     std::unordered_map<VkShaderStageFlagBits, std::tuple<VkShaderModule, const char *, const VkSpecializationInfo *>> vsShaderEntities,
     const std::vector<VkDescriptorSetLayout> &dsLayouts,
     const std::vector<VkPushConstantRange> &pushConstants,
-    const VkRenderPass &renderPass)
+    const VkRenderPass &renderPass,
+    VkResult *result)
 {
-    return _pimpl->createGraphicsPipeline(vsShaderEntities, dsLayouts, pushConstants, renderPass);
+    return _pimpl->createGraphicsPipeline(vsShaderEntities, dsLayouts, pushConstants, renderPass, result);
 }
 
 std::tuple<VkPipeline, VkPipelineLayout> VkContext::createComputePipeline(
@@ -3324,9 +4774,10 @@ std::tuple<VkPipeline, VkPipelineLayout> VkContext::createComputePipeline(
                                                          const VkSpecializationInfo *>>
         vsShaderEntities,
     const std::vector<VkDescriptorSetLayout> &dsLayouts,
-    const std::vector<VkPushConstantRange> &pushConstants)
+    const std::vector<VkPushConstantRange> &pushConstants,
+    VkResult *result)
 {
-    return _pimpl->createComputePipeline(vsShaderEntities, dsLayouts, pushConstants);
+    return _pimpl->createComputePipeline(vsShaderEntities, dsLayouts, pushConstants, result);
 }
 
 std::tuple<VkPipeline, VkPipelineLayout, std::vector<VkRayTracingShaderGroupCreateInfoKHR>> VkContext::createRayTracingPipeline(
@@ -3336,9 +4787,10 @@ std::tuple<VkPipeline, VkPipelineLayout, std::vector<VkRayTracingShaderGroupCrea
                                                          const VkSpecializationInfo *>>
         vsShaderEntities,
     const std::vector<VkDescriptorSetLayout> &dsLayouts,
-    const std::vector<VkPushConstantRange> &pushConstants)
+    const std::vector<VkPushConstantRange> &pushConstants,
+    VkResult *result)
 {
-    return _pimpl->createRayTracingPipeline(vsShaderEntities, dsLayouts, pushConstants);
+    return _pimpl->createRayTracingPipeline(vsShaderEntities, dsLayouts, pushConstants, result);
 }
 
 std::unordered_map<VkDescriptorSetLayout *, std::vector<VkDescriptorSet>> VkContext::allocateDescriptorSet(
@@ -3360,6 +4812,18 @@ void VkContext::bindBufferToDescriptorSet(
                                              descriptorSetType, descriptorSetBindingPoint);
 }
 
+void VkContext::bindBufferToDescriptorSet(
+    const BufferSlice &slice,
+    VkDescriptorSet descriptorSetToBind,
+    VkDescriptorType descriptorSetType,
+    uint32_t descriptorSetBindingPoint)
+{
+    return _pimpl->bindBufferToDescriptorSet(std::get<BUFFER_SLICE_OFFSET::SLICE_BUFFER>(slice),
+                                             std::get<BUFFER_SLICE_OFFSET::SLICE_OFFSET>(slice),
+                                             std::get<BUFFER_SLICE_OFFSET::SLICE_SIZE>(slice),
+                                             descriptorSetToBind, descriptorSetType, descriptorSetBindingPoint);
+}
+
 void VkContext::bindTextureToDescriptorSet(
     const std::vector<ImageEntity> &images,
     VkDescriptorSet descriptorSetToBind,
@@ -3382,37 +4846,132 @@ void VkContext::bindSamplerToDescriptorSet(
     return _pimpl->bindSamplerToDescriptorSet(samplers, descriptorSetToBind, descriptorSetType, descriptorSetBindingPoint);
 }
 
+StagingAllocation VkContext::allocateStaging(
+    VkDeviceSize sizeInBytes,
+    VkDeviceSize alignment)
+{
+    return _pimpl->allocateStaging(sizeInBytes, alignment, true);
+}
+
+void VkContext::fenceStagingRing(VkFence fence, const std::vector<StagingAllocation> &allocations)
+{
+    return _pimpl->fenceStagingRing(fence, allocations);
+}
+
+BufferSlice VkContext::allocateBufferSlice(
+    BUFFER_ARENA_USAGE usage,
+    VkDeviceSize sizeInBytes,
+    VkDeviceSize alignment)
+{
+    return _pimpl->allocateBufferSlice(usage, sizeInBytes, alignment);
+}
+
+void VkContext::freeBufferSlice(const BufferSlice &slice)
+{
+    return _pimpl->freeBufferSlice(slice);
+}
+
 void VkContext::writeBuffer(
-    const BufferEntity &stagingBuffer,
+    const StagingAllocation &staging,
     const BufferEntity &deviceLocalBuffer,
     const CommandBufferEntity &cmdBuffer,
     const void *rawData,
     uint32_t sizeInBytes,
-    uint32_t srcOffset,
     uint32_t dstOffset)
 {
-    return _pimpl->writeBuffer(stagingBuffer, deviceLocalBuffer, cmdBuffer, rawData, sizeInBytes, srcOffset, dstOffset);
+    return _pimpl->writeBuffer(staging, deviceLocalBuffer, cmdBuffer, rawData, sizeInBytes, dstOffset);
 }
 
 void VkContext::writeImage(
     const ImageEntity &image,
-    const BufferEntity &stagingBuffer,
+    const StagingAllocation &staging,
     const CommandBufferEntity &cmdBuffer,
-    void *rawData)
+    const void *rawData)
+{
+    return _pimpl->writeImage(image, staging, cmdBuffer, rawData);
+}
+
+UploadBatch VkContext::createUploadBatch()
+{
+    return UploadBatch(*this);
+}
+
+UploadTicket VkContext::submitUploadBatch(UploadBatch &batch)
+{
+    if (batch.empty())
+    {
+        return {};
+    }
+    const auto ticket = _pimpl->submitUploadBatch(batch._bufferWrites, batch._imageWrites, batch._commands);
+    batch._bufferWrites.clear();
+    batch._imageWrites.clear();
+    batch._commands.clear();
+    return ticket;
+}
+
+bool VkContext::isUploadComplete(UploadTicket ticket) const
+{
+    return _pimpl->isUploadComplete(ticket);
+}
+
+void VkContext::waitUpload(UploadTicket ticket) const
 {
-    return _pimpl->writeImage(image, stagingBuffer, cmdBuffer, rawData);
+    return _pimpl->waitUpload(ticket);
+}
+
+bool VkContext::hasDedicatedTransferQueue() const
+{
+    return _pimpl->hasDedicatedTransferQueue();
+}
+
+void UploadBatch::writeBuffer(
+    const BufferEntity &deviceLocalBuffer,
+    const void *rawData,
+    uint32_t sizeInBytes,
+    uint32_t dstOffset,
+    bool initialUpload)
+{
+    _bufferWrites.emplace_back(std::get<BUFFER_ENTITY_UID::BUFFER>(deviceLocalBuffer), rawData, sizeInBytes, dstOffset, initialUpload);
+}
+
+void UploadBatch::writeImage(
+    const ImageEntity &image,
+    const void *rawData,
+    bool generateMips)
+{
+    _imageWrites.emplace_back(image, rawData, generateMips);
+}
+
+void UploadBatch::record(std::function<void(VkCommandBuffer)> &&commands)
+{
+    _commands.emplace_back(std::move(commands));
+}
+
+UploadTicket UploadBatch::submit()
+{
+    return _ctx.submitUploadBatch(*this);
 }
 
 void VkContext::submitWriteImageCommand(
     ImageEntity &image,
-    BufferEntity &stagingBuffer,
     CommandBufferEntity &cmdBuffer,
     void *rawData,
     const std::vector<VkSemaphore> &semaphoresToWait,
     std::optional<VkPipelineStageFlags> waitStage,
     const std::vector<VkSemaphore> &semaphoresToSignal)
 {
-    return _pimpl->submitWriteImageCommand(image, stagingBuffer, cmdBuffer, rawData, semaphoresToWait, waitStage, semaphoresToSignal);
+    return _pimpl->submitWriteImageCommand(image, cmdBuffer, rawData, semaphoresToWait, waitStage, semaphoresToSignal, true);
+}
+
+void VkContext::submitWriteImageCommandAsync(
+    ImageEntity &image,
+    CommandBufferEntity &cmdBuffer,
+    void *rawData,
+    const std::vector<VkSemaphore> &semaphoresToWait,
+    std::optional<VkPipelineStageFlags> waitStage,
+    const std::vector<VkSemaphore> &semaphoresToSignal)
+{
+    return _pimpl->submitWriteImageCommand(image, cmdBuffer, rawData, semaphoresToWait, waitStage, semaphoresToSignal, false);
 }
 
 void VkContext::BeginRecordCommandBuffer(CommandBufferEntity &cmdBuffer)
@@ -3446,6 +5005,50 @@ VmaAllocator VkContext::getVmaAllocator() const
     return _pimpl->getVmaAllocator();
 }
 
+bool VkContext::isMemoryBudgetEnabled() const
+{
+    return _pimpl->isMemoryBudgetEnabled();
+}
+
+void VkContext::setOutOfDeviceMemoryHandler(std::function<bool(VkDeviceSize)> handler)
+{
+    _pimpl->_outOfDeviceMemoryHandler = std::move(handler);
+}
+
+void VkContext::setImageAllocationPolicy(const ImageAllocationPolicy &policy)
+{
+    ASSERT(std::is_sorted(policy.sizeClassLimit.begin(), policy.sizeClassLimit.end()), "image size classes should be sorted");
+    std::scoped_lock lock(_pimpl->_imagePoolMutex);
+    _pimpl->_imageAllocationPolicy = policy;
+}
+
+const ImageAllocationPolicy &VkContext::getImageAllocationPolicy() const
+{
+    return _pimpl->_imageAllocationPolicy;
+}
+
+std::vector<VmaPool> VkContext::getImagePools() const
+{
+    std::scoped_lock lock(_pimpl->_imagePoolMutex);
+    std::vector<VmaPool> pools;
+    pools.reserve(_pimpl->_imagePools.size());
+    for (const auto &[key, pool] : _pimpl->_imagePools)
+    {
+        pools.push_back(pool);
+    }
+    return pools;
+}
+
+VkPipelineCache VkContext::getPipelineCache() const
+{
+    return _pimpl->getPipelineCache();
+}
+
+void VkContext::savePipelineCache()
+{
+    _pimpl->savePipelineCache();
+}
+
 VkQueue VkContext::getGraphicsComputeQueue() const
 {
     return _pimpl->getGraphicsComputeQueue();
@@ -3476,6 +5079,16 @@ VkSurfaceKHR VkContext::getSurfaceKHR() const
     return _pimpl->getSurfaceKHR();
 }
 
+bool VkContext::isHeadless() const
+{
+    return _pimpl->isHeadless();
+}
+
+const std::vector<ImageEntity> &VkContext::getOffscreenTargets() const
+{
+    return _pimpl->getOffscreenTargets();
+}
+
 uint32_t VkContext::getGraphicsComputeQueueFamilyIndex() const
 {
     return _pimpl->getGraphicsComputeQueueFamilyIndex();
@@ -3543,8 +5156,63 @@ TracyVkCtx VkContext::getTracyContext() const
 
 void VkContext::advanceCommandBuffer()
 {
-    const auto numFramesInFlight = getSwapChainImageViews().size();
-    _pimpl->currentFrameId = (_pimpl->currentFrameId + 1) % numFramesInFlight;
+    _pimpl->advanceFrame();
+}
+
+void VkContext::setFramesInFlight(uint32_t framesInFlight)
+{
+    ASSERT(framesInFlight > 0, "at least one frame in flight");
+    ASSERT(_pimpl->_frameTimelineValues.empty(), "frames in flight must be set before createSwapChain");
+    ASSERT(!_pimpl->_framesInFlightUsed.load(std::memory_order_relaxed) || framesInFlight == _pimpl->_framesInFlight,
+           "frames in flight must be set before anything is sized from getFramesInFlight");
+    _pimpl->_framesInFlight = framesInFlight;
+}
+
+uint32_t VkContext::getFramesInFlight() const
+{
+    _pimpl->_framesInFlightUsed.store(true, std::memory_order_relaxed);
+    return _pimpl->_framesInFlight;
+}
+
+void VkContext::setShaderBuildProfile(SHADER_BUILD_PROFILE profile)
+{
+    log(Level::Info, "shader build profile: ", shaderBuildProfileName(profile));
+    _pimpl->_shaderBuildProfile = profile;
+}
+
+SHADER_BUILD_PROFILE VkContext::getShaderBuildProfile() const
+{
+    return _pimpl->_shaderBuildProfile;
+}
+
+VkShaderModule VkContext::createShaderModule(const std::string &filePath, const std::string &entryPoint, const std::string &correlationId) const
+{
+    return ::createShaderModule(getLogicDevice(), filePath, entryPoint, correlationId, _pimpl->_shaderBuildProfile);
+}
+
+VkShaderModule VkContext::tryCreateShaderModule(const std::string &filePath, const std::string &entryPoint, const std::string &correlationId) const
+{
+    return ::tryCreateShaderModule(getLogicDevice(), filePath, entryPoint, correlationId, _pimpl->_shaderBuildProfile);
+}
+
+uint64_t VkContext::getFrameNumber() const
+{
+    return _pimpl->_frameNumber;
+}
+
+uint64_t VkContext::getCompletedFrameNumber() const
+{
+    return _pimpl->getCompletedFrameNumber();
+}
+
+bool VkContext::isFrameComplete(uint64_t frameNumber) const
+{
+    return _pimpl->isFrameComplete(frameNumber);
+}
+
+void VkContext::waitFrame(uint64_t frameNumber) const
+{
+    return _pimpl->waitFrame(frameNumber);
 }
 
 void VkContext::submitCommand()
@@ -3627,4 +5295,59 @@ void VkContext::acquireQueueFamilyOwnership(
     };
     const auto cmdBufferHandle = std::get<1>(cmdBuffer);
     vkCmdPipelineBarrier2(cmdBufferHandle, &dependencyInfo);
+}
+
+void VkContext::releaseQueueFamilyOwnership(
+    const CommandBufferEntity &cmdBuffer,
+    const std::vector<BufferEntity> &buffers,
+    const std::vector<ImageEntity> &images,
+    uint32_t srcQueueFamilyIndex,
+    uint32_t dstQueueFamilyIndex)
+{
+    BarrierBatch barriers;
+    for (const auto &buffer : buffers)
+    {
+        barriers.buffer(std::get<BUFFER_ENTITY_UID::BUFFER>(buffer),
+                        VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                        VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+                        0, VK_WHOLE_SIZE, srcQueueFamilyIndex, dstQueueFamilyIndex);
+    }
+    for (const auto &image : images)
+    {
+        barriers.image(std::get<IMAGE_ENTITY_OFFSET::IMAGE>(image),
+                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                       VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                       VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+                       {VK_IMAGE_ASPECT_COLOR_BIT, 0, std::get<IMAGE_ENTITY_OFFSET::MIPMAP_COUNT>(image), 0, 1},
+                       srcQueueFamilyIndex, dstQueueFamilyIndex);
+    }
+    barriers.flush(cmdBuffer);
+}
+
+// layouts must match the release side
+void VkContext::acquireQueueFamilyOwnership(
+    const CommandBufferEntity &cmdBuffer,
+    const std::vector<BufferEntity> &buffers,
+    const std::vector<ImageEntity> &images,
+    uint32_t srcQueueFamilyIndex,
+    uint32_t dstQueueFamilyIndex)
+{
+    BarrierBatch barriers;
+    for (const auto &buffer : buffers)
+    {
+        barriers.buffer(std::get<BUFFER_ENTITY_UID::BUFFER>(buffer),
+                        VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+                        VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT,
+                        0, VK_WHOLE_SIZE, srcQueueFamilyIndex, dstQueueFamilyIndex);
+    }
+    for (const auto &image : images)
+    {
+        barriers.image(std::get<IMAGE_ENTITY_OFFSET::IMAGE>(image),
+                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                       VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+                       VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_SHADER_READ_BIT,
+                       {VK_IMAGE_ASPECT_COLOR_BIT, 0, std::get<IMAGE_ENTITY_OFFSET::MIPMAP_COUNT>(image), 0, 1},
+                       srcQueueFamilyIndex, dstQueueFamilyIndex);
+    }
+    barriers.flush(cmdBuffer);
 }
\ No newline at end of file
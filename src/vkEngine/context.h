@@ -31,6 +31,7 @@
 #include <numeric>
 #include <filesystem> // for shader
 #include <optional>
+#include <functional>
 
 // must ahead of <vk_mem_alloc.h>, or else it will crash on vk functions
 #ifndef __ANDROID__
@@ -74,6 +75,11 @@ enum COMMAND_SEMANTIC : int
     IO,
     MIPMAP,
     TRANSFER,
+    UPLOAD,
+    // upload batches on the dedicated transfer queue
+    UPLOAD_TRANSFER,
+    // graphics side ownership acquire of the transfer uploads, one per frame in flight
+    UPLOAD_ACQUIRE,
     COMMAND_SEMANTIC_SIZE
 };
 
@@ -120,6 +126,72 @@ enum BUFFER_ENTITY_UID : int
     EXPORT_HANDLE,
 };
 
+// sub-range of the persistently mapped staging ring
+// mapping address already points at offset, no vmaMapMemory needed
+// region: id of the ring region, the commit (fenceStagingRing) hands it to one submission
+using StagingAllocation = std::tuple<VkBuffer, VkDeviceSize, VkDeviceSize, MappingAddressType, uint64_t>;
+enum STAGING_ALLOCATION_OFFSET : int
+{
+    STAGING_BUFFER = 0,
+    STAGING_OFFSET,
+    STAGING_SIZE,
+    STAGING_MAPPING_ADDRESS,
+    STAGING_REGION
+};
+
+// sub-range of one of the arena's large backing buffers, bind with the offset
+// device address and mapping address (host visible arena only) already point at offset
+using BufferSlice = std::tuple<VkBuffer, VkDeviceSize, VkDeviceSize, VkDeviceAddress, MappingAddressType, VmaVirtualAllocation>;
+enum BUFFER_SLICE_OFFSET : int
+{
+    SLICE_BUFFER = 0,
+    SLICE_OFFSET,
+    SLICE_SIZE,
+    SLICE_DEVICE_ADDRESS,
+    SLICE_MAPPING_ADDRESS,
+    SLICE_VIRTUAL_ALLOCATION
+};
+
+// one set of backing buffers per usage class
+enum BUFFER_ARENA_USAGE : int
+{
+    // storage, uniform, indirect, vertex, index; written by copies or by the gpu
+    ARENA_DEVICE_LOCAL = 0,
+    // persistently mapped, written by the cpu
+    ARENA_HOST_VISIBLE,
+    BUFFER_ARENA_USAGE_SIZE
+};
+
+// where createImage places the memory of an image
+// dedicated VkDeviceMemory for render targets and large images, everything else is sub-allocated
+// from vma pools per memory type and size class: no maxMemoryAllocationCount pressure from small textures
+enum IMAGE_SIZE_CLASS : int
+{
+    IMAGE_SIZE_SMALL = 0,
+    IMAGE_SIZE_MEDIUM,
+    IMAGE_SIZE_LARGE,
+    IMAGE_SIZE_CLASS_SIZE
+};
+struct ImageAllocationPolicy
+{
+    // recreated on resize or aliased: their own memory
+    VkImageUsageFlags dedicatedUsage{VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                                     VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                                     VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT};
+    // memory requirement at or above: dedicated
+    VkDeviceSize dedicatedThreshold{32 * 1024 * 1024};
+    // per IMAGE_SIZE_CLASS: largest memory requirement of the class, block size of its pools
+    std::array<VkDeviceSize, IMAGE_SIZE_CLASS_SIZE> sizeClassLimit{256 * 1024, 4 * 1024 * 1024, 32 * 1024 * 1024};
+    std::array<VkDeviceSize, IMAGE_SIZE_CLASS_SIZE> sizeClassBlockSize{16 * 1024 * 1024, 64 * 1024 * 1024, 128 * 1024 * 1024};
+};
+
+// timeline semaphore and the value signaled when the upload batch is done
+// {VK_NULL_HANDLE, 0}: nothing to wait for
+// keyed on the timeline value only, no command buffer slot or fence: valid after the slot is recycled
+using UploadTicket = std::tuple<VkSemaphore, uint64_t>;
+
+class UploadBatch;
+
 using ASEntity = std::tuple<BufferEntity, VkAccelerationStructureKHR, VkDeviceAddress>;
 enum AS_ENTITY_UID : int
 {
@@ -146,6 +218,15 @@ public:
         const std::vector<const char *> &instanceValidationLayers,
         const std::set<std::string> &instanceExtensions,
         const std::vector<const char *> deviceExtensions);
+    // headless: no window, surface or swapchain, e.g. a software driver (lavapipe) on a gpu-less box
+    // createSwapChain creates a ring of offscreen targets of offscreenExtent instead, one per frame slot
+    // getSwapChainImages/getSwapChainImageViews/getSwapChainImageIndexToRender serve the ring, present is a no-op
+    // VK_KHR_surface/VK_KHR_swapchain are not needed in the extension lists
+    VkContext(
+        VkExtent2D offscreenExtent,
+        const std::vector<const char *> &instanceValidationLayers,
+        const std::set<std::string> &instanceExtensions,
+        const std::vector<const char *> deviceExtensions);
     VkContext(const VkContext &) = delete;
     VkContext &operator=(const VkContext &) = delete;
     VkContext(VkContext &&) noexcept = default;
@@ -153,6 +234,7 @@ public:
 
     ~VkContext();
 
+    // headless: the offscreen target ring
     void createSwapChain();
 
     // generic to swapchain image and non-swapchain images
@@ -250,7 +332,10 @@ public:
         VkSampleCountFlagBits textureMultiSampleCount,
         VkImageUsageFlags usage);
 
+    // samplers, descriptor set layouts and the pipeline layouts of create*Pipeline are cached:
+    // identical requests return the same handle, owned by the context, never destroy them
     std::tuple<VkSampler> createSampler(const std::string &name);
+    std::tuple<VkSampler> createSampler(const VkSamplerCreateInfo &samplerCreateInfo, const std::string &name);
 
     // uint32_t: set id
     std::vector<VkDescriptorSetLayout> createDescriptorSetLayout(std::vector<std::vector<VkDescriptorSetLayoutBinding>> &setBindings);
@@ -259,6 +344,8 @@ public:
         const std::unordered_map<VkDescriptorType, uint32_t> &dsBudgets,
         uint32_t dsCap = 100);
 
+    // result: the VkResult of a failed creation is written there and null pipelines are returned (hot reload keeps
+    // the previous pipeline), without it a failure aborts (VK_CHECK)
     std::tuple<std::unordered_map<GRAPHICS_PIPELINE_SEMANTIC, VkPipeline>, VkPipelineLayout> createGraphicsPipeline(
         std::unordered_map<VkShaderStageFlagBits, std::tuple<VkShaderModule,
                                                              const char *,
@@ -267,7 +354,8 @@ public:
             vsShaderEntities,
         const std::vector<VkDescriptorSetLayout> &dsLayouts,
         const std::vector<VkPushConstantRange> &pushConstants,
-        const VkRenderPass &renderPass);
+        const VkRenderPass &renderPass,
+        VkResult *result = nullptr);
 
     std::tuple<VkPipeline, VkPipelineLayout> createComputePipeline(
         std::unordered_map<VkShaderStageFlagBits, std::tuple<VkShaderModule,
@@ -276,7 +364,8 @@ public:
                                                              const VkSpecializationInfo *>>
             vsShaderEntities,
         const std::vector<VkDescriptorSetLayout> &dsLayouts,
-        const std::vector<VkPushConstantRange> &pushConstants);
+        const std::vector<VkPushConstantRange> &pushConstants,
+        VkResult *result = nullptr);
 
     std::tuple<VkPipeline, VkPipelineLayout, std::vector<VkRayTracingShaderGroupCreateInfoKHR>> createRayTracingPipeline(
         std::unordered_map<VkShaderStageFlagBits, std::tuple<VkShaderModule,
@@ -285,7 +374,8 @@ public:
                                                              const VkSpecializationInfo *>>
             vsShaderEntities,
         const std::vector<VkDescriptorSetLayout> &dsLayouts,
-        const std::vector<VkPushConstantRange> &pushConstants);
+        const std::vector<VkPushConstantRange> &pushConstants,
+        VkResult *result = nullptr);
 
     std::unordered_map<VkDescriptorSetLayout *, std::vector<VkDescriptorSet>> allocateDescriptorSet(
         const VkDescriptorPool pool,
@@ -299,6 +389,12 @@ public:
         VkDescriptorType descriptorSetType,
         uint32_t descriptorSetBindingPoint = 0);
 
+    void bindBufferToDescriptorSet(
+        const BufferSlice &slice,
+        VkDescriptorSet descriptorSetToBind,
+        VkDescriptorType descriptorSetType,
+        uint32_t descriptorSetBindingPoint = 0);
+
     // uint32_t dstArrayElement = 0 useful for async io case
     void bindTextureToDescriptorSet(
         const std::vector<ImageEntity> &images,
@@ -313,24 +409,68 @@ public:
         VkDescriptorType descriptorSetType,
         uint32_t descriptorSetBindingPoint = 0);
 
+    // staging ring: bump allocation out of one persistently mapped host buffer, a short lock per allocation
+    // each allocation is a region of its own, recycled once the submission it is committed to is done:
+    // a region of one thread is never recycled because a submission of another thread completed
+    // by default the allocation belongs to the frame being recorded (copy recorded into the rendering command buffer),
+    // submitCommand commits it, a region which is never committed holds the ring
+    StagingAllocation allocateStaging(
+        VkDeviceSize sizeInBytes,
+        VkDeviceSize alignment = 16);
+
+    // own submission instead of the frame: commit the allocations it reads right after vkQueueSubmit(..., fence),
+    // before the submitCommand of the frame they were allocated in
+    void fenceStagingRing(VkFence fence, const std::vector<StagingAllocation> &allocations);
+
+    // buffer arena: small buffers are offset sub-allocations (vma virtual blocks) of a few large VkBuffers
+    // instead of one VkBuffer + VmaAllocation each, alignment covers uniform/storage offset limits
+    // ARENA_HOST_VISIBLE slices are written through their mapping address: not a valid TRANSFER_DST (copy or fill)
+    BufferSlice allocateBufferSlice(
+        BUFFER_ARENA_USAGE usage,
+        VkDeviceSize sizeInBytes,
+        VkDeviceSize alignment = 0);
+
+    // deferred: the range is reused once the current frame is complete on the gpu
+    void freeBufferSlice(const BufferSlice &slice);
+
     void writeBuffer(
-        const BufferEntity &stagingBuffer,
+        const StagingAllocation &staging,
         const BufferEntity &deviceLocalBuffer,
         const CommandBufferEntity &cmdBuffer,
         const void *rawData,
         uint32_t sizeInBytes,
-        uint32_t srcOffset = 0,
         uint32_t dstOffset = 0);
 
     void writeImage(
         const ImageEntity &image,
-        const BufferEntity &stagingBuffer,
+        const StagingAllocation &staging,
         const CommandBufferEntity &cmdBuffer,
-        void *rawData);
-
+        const void *rawData);
+
+    // upload batch: coalesce many writes into one command buffer and one submit
+    // pure copies of initial uploads go to the dedicated transfer queue when there is one, ownership is handed
+    // to graphics and the next submitCommand waits on the transfer timeline on the gpu, no cpu stall
+    UploadBatch createUploadBatch();
+    UploadTicket submitUploadBatch(UploadBatch &batch);
+    // poll: the data is visible to graphics, on the transfer path once the acquire of the next submitCommand is done
+    bool isUploadComplete(UploadTicket ticket) const;
+    // block until the copies are done, only needed when the cpu has to touch the result (e.g. free scratch buffers)
+    // transfer path: the acquire may still be pending (next submitCommand), poll isUploadComplete for that
+    void waitUpload(UploadTicket ticket) const;
+    bool hasDedicatedTransferQueue() const;
+
+    // staging memory comes from the staging ring
+    // blocks until the image is written
     void submitWriteImageCommand(
         ImageEntity &image,
-        BufferEntity &stagingBuffer,
+        CommandBufferEntity &cmdBuffer,
+        void *rawData,
+        const std::vector<VkSemaphore> &semaphoresToWait,
+        std::optional<VkPipelineStageFlags> waitStage,
+        const std::vector<VkSemaphore> &semaphoresToSignal);
+    // does not block: the fence of cmdBuffer or semaphoresToSignal tell when it is done
+    void submitWriteImageCommandAsync(
+        ImageEntity &image,
         CommandBufferEntity &cmdBuffer,
         void *rawData,
         const std::vector<VkSemaphore> &semaphoresToWait,
@@ -347,6 +487,21 @@ public:
     VkInstance getInstance() const;
     VkDevice getLogicDevice() const;
     VmaAllocator getVmaAllocator() const;
+    // VK_EXT_memory_budget is turned on whenever the device has it: vma reports the real per-heap budget and usage
+    // (vmaGetHeapBudgets, refreshed by advanceCommandBuffer), otherwise its own estimate
+    bool isMemoryBudgetEnabled() const;
+    // createBuffer/createImage hit VK_ERROR_OUT_OF_DEVICE_MEMORY: the handler gets the size of the request,
+    // returns true once it freed memory (the allocation is retried), false to fail as before
+    void setOutOfDeviceMemoryHandler(std::function<bool(VkDeviceSize)> handler);
+    // images created from now on, existing pools keep their block size
+    void setImageAllocationPolicy(const ImageAllocationPolicy &policy);
+    const ImageAllocationPolicy &getImageAllocationPolicy() const;
+    // the size class pools of createImage created so far, e.g. to defragment them
+    std::vector<VmaPool> getImagePools() const;
+    // shared by every pipeline creation, loaded from getCachePath() at startup
+    VkPipelineCache getPipelineCache() const;
+    // written back at shutdown anyway, e.g. after a loading screen to survive a crash
+    void savePipelineCache();
     VkQueue getGraphicsComputeQueue() const;
     VkQueue getPresentationQueue() const;
 
@@ -354,8 +509,14 @@ public:
     VkPhysicalDeviceProperties getSelectedPhysicalDeviceProp() const;
     VkPhysicalDeviceRayTracingPipelinePropertiesKHR getSelectedPhysicalDeviceRayTracingProperties() const;
 
+    // VK_NULL_HANDLE when headless
     VkSurfaceKHR getSurfaceKHR() const;
 
+    bool isHeadless() const;
+    // headless: color targets (rgba8, color attachment | storage | sampled | transfer src/dst) indexed like the swapchain images,
+    // the target of a frame can be copied out once isFrameComplete says so, empty otherwise
+    const std::vector<ImageEntity> &getOffscreenTargets() const;
+
     uint32_t getGraphicsComputeQueueFamilyIndex() const;
     uint32_t getPresentQueueFamilyIndex() const;
 
@@ -380,8 +541,32 @@ public:
     // let application to access the tracy
     TracyVkCtx getTracyContext() const;
 
+    // frame boundary: moves to the next frame slot and blocks until the gpu is done with it
+    // rendering command buffers have no fence, this is the only cpu-gpu pacing of frames
     void advanceCommandBuffer();
 
+    // must be called before createSwapChain and before anything is sized from getFramesInFlight, default 3
+    // fixed from then on: recorders, descriptor allocators, uniform rings and render graphs keep per frame arrays
+    void setFramesInFlight(uint32_t framesInFlight);
+    uint32_t getFramesInFlight() const;
+
+    // profile of the glsl shaders compiled for this context, default: debug unless NDEBUG
+    void setShaderBuildProfile(SHADER_BUILD_PROFILE profile);
+    SHADER_BUILD_PROFILE getShaderBuildProfile() const;
+    // glsl (or spirv) shader module built with the profile of this context
+    VkShaderModule createShaderModule(const std::string &filePath, const std::string &entryPoint, const std::string &correlationId) const;
+    // VK_NULL_HANDLE on compile errors, the error is logged
+    VkShaderModule tryCreateShaderModule(const std::string &filePath, const std::string &entryPoint, const std::string &correlationId) const;
+
+    // monotonically increasing frame number, starts from 1, the frame being recorded
+    // key for deferred destruction, readback and streaming: done once isFrameComplete says so
+    uint64_t getFrameNumber() const;
+    // getCompletedFrameNumber/isFrameComplete/waitFrame: from the thread which calls submitCommand (e.g. the render thread)
+    // every frame up to the returned one is done on the gpu
+    uint64_t getCompletedFrameNumber() const;
+    bool isFrameComplete(uint64_t frameNumber) const;
+    void waitFrame(uint64_t frameNumber) const;
+
     void submitCommand();
 
     void present(uint32_t swapChainImageIndex);
@@ -442,6 +627,21 @@ public:
         uint32_t srcQueueFamilyIndex,
         uint32_t dstQueueFamilyIndex);
 
+    // batched: one vkCmdPipelineBarrier2 for all the buffers (whole range) and images
+    void releaseQueueFamilyOwnership(
+        const CommandBufferEntity &cmdBuffer,
+        const std::vector<BufferEntity> &buffers,
+        const std::vector<ImageEntity> &images,
+        uint32_t srcQueueFamilyIndex,
+        uint32_t dstQueueFamilyIndex);
+
+    void acquireQueueFamilyOwnership(
+        const CommandBufferEntity &cmdBuffer,
+        const std::vector<BufferEntity> &buffers,
+        const std::vector<ImageEntity> &images,
+        uint32_t srcQueueFamilyIndex,
+        uint32_t dstQueueFamilyIndex);
+
     // features chains
     // now is to toggle features selectively
     // enable features
@@ -460,3 +660,52 @@ public:
 private:
     std::unique_ptr<Impl> _pimpl;
 };
+
+// accumulate buffer/image writes, then VkContext records them once
+// staging is taken from the staging ring at submit, copies into the same buffer are merged
+// into as few VkBufferCopy regions as possible
+class UploadBatch
+{
+public:
+    explicit UploadBatch(VkContext &ctx) : _ctx(ctx)
+    {
+    }
+
+    // rawData must stay alive until submit()
+    // initialUpload: the buffer is freshly created, nothing on the gpu used it and this batch writes everything
+    // it needs, bytes outside the written ranges may be discarded. Only batches of initial uploads (and images)
+    // may go to the transfer queue, any other write keeps the whole batch on the graphics queue
+    void writeBuffer(
+        const BufferEntity &deviceLocalBuffer,
+        const void *rawData,
+        uint32_t sizeInBytes,
+        uint32_t dstOffset = 0,
+        bool initialUpload = false);
+
+    // VK_FORMAT_R8G8B8A8_UNORM, mip level0, rawData must stay alive until submit()
+    // image ends up in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+    void writeImage(
+        const ImageEntity &image,
+        const void *rawData,
+        bool generateMips = false);
+
+    // recorded after all the copies, e.g. acceleration structure build on the uploaded geometry
+    void record(std::function<void(VkCommandBuffer)> &&commands);
+
+    UploadTicket submit();
+
+    inline bool empty() const
+    {
+        return _bufferWrites.empty() && _imageWrites.empty() && _commands.empty();
+    }
+
+private:
+    friend class VkContext;
+
+    VkContext &_ctx;
+    // dst buffer, rawData, size, dst offset, initial upload
+    std::vector<std::tuple<VkBuffer, const void *, uint32_t, uint32_t, bool>> _bufferWrites;
+    // image, rawData, generate mips
+    std::vector<std::tuple<ImageEntity, const void *, bool>> _imageWrites;
+    std::vector<std::function<void(VkCommandBuffer)>> _commands;
+};
@@ -9,7 +9,12 @@
 #include <glm/gtx/transform.hpp>
 
 #include <misc.h>
-#include <renderPassBase.h>
+#include <renderGraph.h>
+#include <pipelineBuilder.h>
+#include <barrierBatch.h>
+#include <bindlessHeap.h>
+#include <uniformRing.h>
+#include <descriptorAllocator.h>
 
 class CullFustrum : public RenderPassBase,
                     public VkContextAccessor,
@@ -24,6 +29,10 @@ public:
 
     ~CullFustrum()
     {
+        if (_timestampPool)
+        {
+            vkDestroyQueryPool(_ctx->getLogicDevice(), _timestampPool, nullptr);
+        }
     }
 
     virtual void setContext(VkContext *ctx) override
@@ -73,208 +82,319 @@ public:
         _indirectDrawBuffer = idb;
     }
 
-    virtual void finalizeInit() override
+    // the fustrum lives in a reserved chunk of the ring, before registerPipelines/finalizeInit
+    inline void setUniformRing(UniformRing *uniformRing)
+    {
+        _uniformRing = uniformRing;
+        invalidateCommands();
+    }
+
+    // classic descriptor mode, before finalizeInit: the sets come from the growable allocator
+    // instead of the fixed pool of setDescriptorPool, one set per frame slot for the culled buffers
+    inline void setDescriptorAllocator(DescriptorAllocator *descriptorAllocator)
+    {
+        _descriptorAllocator = descriptorAllocator;
+        invalidateCommands();
+    }
+
+    // bindless mode, before registerPipelines/finalizeInit: the buffers are addressed through the global heap,
+    // one set bound per dispatch and the indices in the push constants, see BindlessPushConstants
+    inline void setBindlessHeap(BindlessHeap *bindlessHeap)
+    {
+        _bindlessHeap = bindlessHeap;
+        invalidateCommands();
+    }
+
+    // cullFustrumBindless.comp, set 0 is the bindless heap:
+    // layout(push_constant) uniform PushConsts {
+    // 	uint count;
+    // 	uint idr;
+    // 	uint boundingBox;
+    // 	uint fustrum;
+    // 	uint culledIDR;
+    // 	uint culledIDRCount;
+    // } MeshesToCull;
+    // the fustrum is read as a storage buffer
+    struct BindlessPushConstants
+    {
+        uint32_t count;
+        uint32_t idr;
+        uint32_t boundingBox;
+        uint32_t fustrum;
+        uint32_t culledIDR;
+        uint32_t culledIDRCount;
+    };
+
+    virtual void registerPipelines(PipelineBuilder &builder) override
     {
-        initShaderModules();
+        ASSERT(_ctx, "vk context should be defined");
+        if (_bindlessHeap)
+        {
+            _descriptorSetLayouts = {_bindlessHeap->getDescriptorSetLayout()};
+            const auto cs = builder.addShader(getAssetPath() + "/cullFustrumBindless.comp", "main", "cullFustrumBindless.comp", &_csShaderModule);
+            builder.addComputePipeline(cs,
+                                       _descriptorSetLayouts,
+                                       {{
+                                           .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                                           .offset = 0,
+                                           .size = sizeof(BindlessPushConstants),
+                                       }},
+                                       &_computePipelineEntity,
+                                       [this]()
+                                       { invalidateCommands(); });
+            return;
+        }
         createDescriptorSetLayout();
-        initComputePipeline();
-        allocateDescriptorSets();
 
-        initFustrumBuffer();
+        const auto computeShaderPath = getAssetPath() + "/cullFustrum.comp";
+        const auto cs = builder.addShader(computeShaderPath, "main", "cullFustrum.comp", &_csShaderModule);
+        // layout(push_constant) uniform PushConsts {
+        // 	uint count;
+        // } MeshesToCull;
+        builder.addComputePipeline(cs,
+                                   _descriptorSetLayouts,
+                                   {{
+                                       .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                                       .offset = 0,
+                                       .size = sizeof(uint32_t),
+                                   }},
+                                   &_computePipelineEntity,
+                                   [this]()
+                                   { invalidateCommands(); });
+    }
+
+    virtual void finalizeInit() override
+    {
+        // not part of a shared startup build phase: build its own
+        if (!std::get<0>(_computePipelineEntity))
+        {
+            PipelineBuilder builder(_ctx);
+            registerPipelines(builder);
+            builder.build();
+        }
+        reserveFustrum();
         initMeshBoundingBoxBuffer();
-        initCulledIndirectDrawBuffer();
-        // step1: bind res to ds, then later on bind ds to the compute pipeline
-        bindResourceToDescriptorSets();
+        initTimestampQueries();
+        if (_bindlessHeap)
+        {
+            addResourceToBindlessHeap();
+        }
+        else
+        {
+            allocateDescriptorSets();
+            // step1: bind res to ds, then later on bind ds to the compute pipeline
+            // culled idr and its counter are transient resources of the render graph, bound in onCompiled
+            bindResourceToDescriptorSets();
+        }
 
         uploadResource();
     }
 
-    inline BufferEntity getCulledIDR() const
+    // render graph resource names
+    inline static const std::string IDR_RESOURCE{"cullFustrum.idr"};
+    inline static const std::string BOUNDING_BOX_RESOURCE{"cullFustrum.boundingBox"};
+    inline static const std::string CULLED_IDR_RESOURCE{"cullFustrum.culledIDR"};
+    inline static const std::string CULLED_IDR_COUNT_RESOURCE{"cullFustrum.culledIDRCount"};
+
+    // after finalizeInit
+    // consumers of the culled idr (indirect draw) read CULLED_IDR_RESOURCE/CULLED_IDR_COUNT_RESOURCE,
+    // or mark them as graph outputs when they draw outside of the graph
+    virtual void setup(RenderGraphBuilder &builder) override
+    {
+        ASSERT(_indirectDrawBuffer, "indirect draw buffer should be defined");
+        // VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT: specifies that the buffer can be used to retrieve a buffer device address via vkGetBufferDeviceAddress
+        // and use that address to access the buffer’s memory from a shader.
+        // VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT must be provided
+        const auto culledIDRUsage = VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+                                    VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                    VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+        builder.importBuffer(IDR_RESOURCE, *_indirectDrawBuffer)
+            .importBuffer(BOUNDING_BOX_RESOURCE, _meshBoundBoxComboDeviceBuffer)
+            .createBuffer(CULLED_IDR_RESOURCE, std::get<4>(*_indirectDrawBuffer), culledIDRUsage)
+            .createBuffer(CULLED_IDR_COUNT_RESOURCE, sizeof(uint32_t), culledIDRUsage)
+            .read(IDR_RESOURCE, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT)
+            .read(BOUNDING_BOX_RESOURCE, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT)
+            .write(CULLED_IDR_RESOURCE, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT)
+            // counter: cleared by transfer, then atomically incremented by the shader
+            .write(CULLED_IDR_COUNT_RESOURCE,
+                   VK_PIPELINE_STAGE_2_TRANSFER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                   VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+    }
+
+    virtual void onCompiled(const RenderGraph &graph) override
+    {
+        // transient: one instance per frame slot
+        const auto numFramesInFlight = _ctx->getFramesInFlight();
+        _culledIndirectDrawBuffers.resize(numFramesInFlight);
+        _culledIndirectDrawCountBuffers.resize(numFramesInFlight);
+        for (uint32_t i = 0; i < numFramesInFlight; ++i)
+        {
+            _culledIndirectDrawBuffers[i] = graph.getBuffer(CULLED_IDR_RESOURCE, i);
+            _culledIndirectDrawCountBuffers[i] = graph.getBuffer(CULLED_IDR_COUNT_RESOURCE, i);
+        }
+        if (_bindlessHeap)
+        {
+            addCulledResourceToBindlessHeap();
+        }
+        else
+        {
+            bindCulledResourceToDescriptorSets();
+        }
+        invalidateCommands();
+    }
+
+    // written by the dispatch of the frame slot
+    inline BufferEntity getCulledIDR(int currentFrameId) const
+    {
+        return this->_culledIndirectDrawBuffers[currentFrameId];
+    }
+
+    inline BufferEntity getCulledIDRCount(int currentFrameId) const
+    {
+        return this->_culledIndirectDrawCountBuffers[currentFrameId];
+    }
+
+    // poll/wait with VkContext::isUploadComplete/waitUpload
+    inline UploadTicket getUploadTicket() const
+    {
+        return this->_uploadTicket;
+    }
+
+    // gpu time of the culling dispatch, ms, of the last completed frame: compare shader build profiles with it
+    // 0 when the queue has no timestamps
+    inline double getDispatchGpuMs() const
     {
-        return this->_culledIndirectDrawBuffer;
+        return _dispatchGpuMs;
     }
 
-    inline BufferEntity getCulledIDRCount() const
+    // gpu driven: every input of the dispatch lives in buffers, recorded once per frame slot by the render graph
+    virtual bool isStatic() const override
     {
-        return this->_culledIndirectDrawCountBuffer;
+        return true;
+    }
+
+    virtual void update(int currentFrameId) override
+    {
+        // reserved chunk: same dynamic offset every frame, the replayed commands stay valid
+        auto frustrum = _camera->fustrumPlanes();
+        _uniformRing->write(currentFrameId, _fustrumOffset, frustrum);
+        readDispatchTimestamps(currentFrameId);
     }
 
     virtual void execute(CommandBufferEntity cmd, int currentFrameId) override
     {
         auto commandBufferHandle = std::get<1>(cmd);
-        // for buffer memory barrier (two idr which shader writes into)
-        // shared compute/graphics queue family
-        auto commandQueueFamilyIndex = std::get<3>(cmd);
         auto computePipelineHandle = std::get<0>(_computePipelineEntity);
         auto computePipelineLayout = std::get<1>(_computePipelineEntity);
-        auto vmaAllocator = _ctx->getVmaAllocator();
 
-        const auto &fustrumBuffers = std::get<0>(_fustrumBuffers);
-        ASSERT(
-            currentFrameId >= 0 && currentFrameId < fustrumBuffers.size(),
-            "execute:: currentFrameId should be in a valid range");
+        update(currentFrameId);
 
-        auto vmaAllocation = std::get<1>(fustrumBuffers[currentFrameId]);
-        auto mappedMemory = std::get<3>(fustrumBuffers[currentFrameId]);
+        // transient counter: content is undefined at the beginning of the frame
+        const auto culledIDRCountBufferHandle = std::get<0>(_culledIndirectDrawCountBuffers[currentFrameId]);
+        vkCmdFillBuffer(commandBufferHandle, culledIDRCountBufferHandle, 0, sizeof(uint32_t), 0);
+        BarrierBatch barriers;
+        barriers.buffer(culledIDRCountBufferHandle,
+                        VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+        barriers.flush(commandBufferHandle);
 
-        // update uniform buffer
-        auto frustrum = _camera->fustrumPlanes();
-        if (mappedMemory)
+        // update push constants
+        const auto numMeshesToCull = uint32_t(_bb.size());
+        vkCmdBindPipeline(commandBufferHandle, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineHandle);
+        if (_bindlessHeap)
         {
-            memcpy(mappedMemory, &frustrum, sizeof(Fustrum));
+            _bindlessHeap->bind(commandBufferHandle, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout);
+            const BindlessPushConstants pushConstants{
+                .count = numMeshesToCull,
+                .idr = _bindlessIndices[DESC_LAYOUT_SEMANTIC::IDR],
+                .boundingBox = _bindlessIndices[DESC_LAYOUT_SEMANTIC::BOUNDING_BOX],
+                .fustrum = _bindlessFustrumIndices[currentFrameId],
+                .culledIDR = _bindlessCulledIndices[currentFrameId][0],
+                .culledIDRCount = _bindlessCulledIndices[currentFrameId][1],
+            };
+            vkCmdPushConstants(commandBufferHandle, computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
         }
         else
         {
-            // racing condition due to vmaAllocator
-            void *mappedMemory{nullptr};
-            VK_CHECK(vmaMapMemory(vmaAllocator, vmaAllocation, &mappedMemory));
-            memcpy(mappedMemory, &frustrum, sizeof(Fustrum));
-            // memcpy(mappedMemory, &ubo, sizeof(ubo));
-            vmaUnmapMemory(vmaAllocator, vmaAllocation);
+            vkCmdPushConstants(commandBufferHandle, computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &numMeshesToCull);
+            // resource and ds to the shaders of this pipeline, sets 0..4 in one call
+            // IDR = 0,
+            // BOUNDING_BOX,
+            // FUSTRUMS,
+            // CULLED_IDR,
+            // CULLED_IDR_COUNTER,
+            // DESC_LAYOUT_SEMANTIC_SIZE
+            // FUSTRUMS is the uniform ring's set of this frame slot, its only dynamic binding
+            const auto &descriptorSets = _frameDescriptorSets[currentFrameId];
+            vkCmdBindDescriptorSets(commandBufferHandle,
+                                    VK_PIPELINE_BIND_POINT_COMPUTE,
+                                    computePipelineLayout, 0, static_cast<uint32_t>(descriptorSets.size()),
+                                    descriptorSets.data(),
+                                    1,
+                                    &_fustrumOffset);
         }
-        // update push constants
-        const auto numMeshesToCull = uint32_t(_bb.size());
-        vkCmdBindPipeline(commandBufferHandle, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineHandle);
-        vkCmdPushConstants(commandBufferHandle, computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &numMeshesToCull);
-
-        // resource and ds to the shaders of this pipeline
-        // IDR = 0,
-        // BOUNDING_BOX,
-        // FUSTRUMS,
-        // CULLED_IDR,
-        // CULLED_IDR_COUNTER,
-        // DESC_LAYOUT_SEMANTIC_SIZE
-        vkCmdBindDescriptorSets(commandBufferHandle,
-                                VK_PIPELINE_BIND_POINT_COMPUTE,
-                                computePipelineLayout, 0, 1,
-                                &_descriptorSets[&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::IDR]][0],
-                                0,
-                                nullptr);
-        vkCmdBindDescriptorSets(commandBufferHandle,
-                                VK_PIPELINE_BIND_POINT_COMPUTE,
-                                computePipelineLayout, 1, 1,
-                                &_descriptorSets[&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::BOUNDING_BOX]][0],
-                                0,
-                                nullptr);
-        vkCmdBindDescriptorSets(commandBufferHandle,
-                                VK_PIPELINE_BIND_POINT_COMPUTE,
-                                computePipelineLayout, 2, 1,
-                                &_descriptorSets[&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::FUSTRUMS]][currentFrameId],
-                                0,
-                                nullptr);
-        vkCmdBindDescriptorSets(commandBufferHandle,
-                                VK_PIPELINE_BIND_POINT_COMPUTE,
-                                computePipelineLayout, 3, 1,
-                                &_descriptorSets[&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::CULLED_IDR]][0],
-                                0,
-                                nullptr);
-        vkCmdBindDescriptorSets(commandBufferHandle,
-                                VK_PIPELINE_BIND_POINT_COMPUTE,
-                                computePipelineLayout, 4, 1,
-                                &_descriptorSets[&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::CULLED_IDR_COUNTER]][0],
-                                0,
-                                nullptr);
         // thread group x,y,z
+        // timestamps of this frame slot, replayed as well: read back once the slot comes around again (update)
+        const auto firstQuery = static_cast<uint32_t>(currentFrameId) * 2;
+        if (_timestampPool)
+        {
+            vkCmdResetQueryPool(commandBufferHandle, _timestampPool, firstQuery, 2);
+            vkCmdWriteTimestamp2(commandBufferHandle, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, _timestampPool, firstQuery);
+        }
         vkCmdDispatch(commandBufferHandle, (numMeshesToCull / 64) + 1, 1, 1);
-
-        const auto culledIDRBufferHandle = std::get<0>(_culledIndirectDrawBuffer);
-        const auto culledIDRBufferSizeInBytes = std::get<4>(_culledIndirectDrawBuffer);
-        const auto culledIDRCountBufferHandle = std::get<0>(_culledIndirectDrawCountBuffer);
-        const auto culledIDRCountBufferSizeInBytes = std::get<4>(_culledIndirectDrawCountBuffer);
-
-        // from shader write to idr buffer read
-        std::array<VkBufferMemoryBarrier, 2> bufferMemoryBarriers{
-            VkBufferMemoryBarrier{
-                .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-                .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
-                .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
-                .srcQueueFamilyIndex = commandQueueFamilyIndex,
-                .dstQueueFamilyIndex = commandQueueFamilyIndex,
-                .buffer = culledIDRBufferHandle,
-                .size = culledIDRBufferSizeInBytes,
-            },
-            VkBufferMemoryBarrier{
-                .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-                .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
-                .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
-                .srcQueueFamilyIndex = commandQueueFamilyIndex,
-                .dstQueueFamilyIndex = commandQueueFamilyIndex,
-                .buffer = culledIDRCountBufferHandle,
-                .size = culledIDRCountBufferSizeInBytes,
-            },
-        };
-
-        vkCmdPipelineBarrier(
-            commandBufferHandle,
-            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
-            0,
-            0, nullptr,                                                         // memory
-            (uint32_t)bufferMemoryBarriers.size(), bufferMemoryBarriers.data(), // buffer
-            0, nullptr                                                          // image
-        );
-
-        // cpu testing
-        for (const auto &bb : _bb)
+        if (_timestampPool)
         {
-            for (int i = 0; i < 1; ++i)
-            {
-                const auto p = frustrum.planes[i];
-                glm::vec3 n(p);
-                glm::vec3 extents(bb.extents[0], bb.extents[1],
-                                  bb.extents[2]);
-                glm::vec3 center(bb.center[0], bb.center[1],
-                                 bb.center[2]);
-                float radiusEffective = 0.5 * glm::dot(glm::abs(n), extents);
-                float distFromCenter = glm::dot(center, n) + p.w;
-                const bool shouldBeCulled = (distFromCenter <= -radiusEffective);
-
-                if (shouldBeCulled)
-                {
-                    log(Level::Info, "shouldBeCulled: ", shouldBeCulled);
-                }
-            }
+            vkCmdWriteTimestamp2(commandBufferHandle, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, _timestampPool, firstQuery + 1);
+            _timestampsRecorded[currentFrameId] = true;
         }
+        // barrier from the dispatch to the indirect draw is emitted by the render graph
     }
 
 private:
-    void initShaderModules()
+    // begin/end of the dispatch, per frame slot
+    void initTimestampQueries()
     {
-        ASSERT(_ctx, "vk context should be defined");
-        auto logicalDevice = _ctx->getLogicDevice();
-        const auto shadersPath = getAssetPath();
-        const auto computeShaderPath = shadersPath + "/cullFustrum.comp";
-        _csShaderModule = createShaderModule(
-            logicalDevice,
-            computeShaderPath,
-            "main",
-            "cullFustrum.comp");
+        const auto limits = _ctx->getSelectedPhysicalDeviceProp().limits;
+        if (!limits.timestampComputeAndGraphics)
+        {
+            log(Level::Warn, "CullFustrum: no timestamps on the graphics/compute queue, dispatch gpu time is not measured");
+            return;
+        }
+        _timestampPeriodNs = limits.timestampPeriod;
+        const VkQueryPoolCreateInfo queryPoolInfo{
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = 2 * _ctx->getFramesInFlight(),
+        };
+        VK_CHECK(vkCreateQueryPool(_ctx->getLogicDevice(), &queryPoolInfo, nullptr, &_timestampPool));
+        _timestampsRecorded.assign(_ctx->getFramesInFlight(), false);
+        setCorrlationId(_timestampPool, _ctx->getLogicDevice(), VK_OBJECT_TYPE_QUERY_POOL, "CullFustrum: dispatch timestamps");
     }
 
-    void initFustrumBuffer()
+    // the frame which last used the slot is complete: no wait
+    void readDispatchTimestamps(int currentFrameId)
     {
-        ASSERT(_ctx, "vk context should be defined");
-        const auto numFramesInFlight = _ctx->getSwapChainImageViews().size();
-
-        // sizeof(Fustrum) * numFramesInFlight
-        std::vector<BufferEntity> buffers;
-        buffers.reserve(numFramesInFlight);
-
-        for (size_t i = 0; i < numFramesInFlight; ++i)
+        // never reset before the slot's first recording
+        if (!_timestampPool || !_timestampsRecorded[currentFrameId])
+        {
+            return;
+        }
+        std::array<uint64_t, 2> timestamps{};
+        const auto result = vkGetQueryPoolResults(_ctx->getLogicDevice(), _timestampPool, static_cast<uint32_t>(currentFrameId) * 2, 2,
+                                                  sizeof(timestamps), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+        if (result != VK_SUCCESS || timestamps[1] < timestamps[0])
         {
-            buffers.emplace_back(_ctx->createPersistentBuffer(
-                "Uniform Fustrum Buffer" + std::to_string(i),
-                numFramesInFlight * sizeof(Fustrum),
-                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
-                    VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
-                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
-                    VK_MEMORY_PROPERTY_HOST_CACHED_BIT));
+            return;
         }
+        _dispatchGpuMs = static_cast<double>(timestamps[1] - timestamps[0]) * _timestampPeriodNs / 1e6;
+        TracyPlot("cullFustrum dispatch gpu (ms)", _dispatchGpuMs);
+    }
 
-        _fustrumBuffers = std::make_tuple(buffers, numFramesInFlight);
+    void reserveFustrum()
+    {
+        ASSERT(_uniformRing, "uniform ring should be defined");
+        _fustrumOffset = _uniformRing->reserve(sizeof(Fustrum));
     }
 
     void initMeshBoundingBoxBuffer()
@@ -301,12 +421,8 @@ private:
             log(Level::Info, "BoundingBox Center: ", _bb.back().center);
             log(Level::Info, "BoundingBox Extents: ", _bb.back().extents);
         }
-        // build up the combo buffer
+        // build up the combo buffer, staging comes from the context's staging ring at upload
         const auto bytesize = sizeof(BoundingBox) * _bb.size();
-        _meshBoundBoxComboStagingBuffer = _ctx->createStagingBuffer(
-            "Combo BoundingBox Staging Buffer",
-            bytesize);
-
         _meshBoundBoxComboDeviceBuffer = _ctx->createDeviceLocalBuffer(
             "Combo BoundingBox Device Local Buffer",
             bytesize,
@@ -315,32 +431,6 @@ private:
                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
     }
 
-    void initCulledIndirectDrawBuffer()
-    {
-        ASSERT(_ctx, "vk context should be defined");
-        ASSERT(_indirectDrawBuffer, "indirect draw buffer should be defined");
-        const auto bufferSizeInBytes = std::get<4>(*_indirectDrawBuffer);
-
-        // VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT: specifies that the buffer can be used to retrieve a buffer device address via vkGetBufferDeviceAddress
-        // and use that address to access the buffer’s memory from a shader.
-        // VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT must be provided
-        _culledIndirectDrawBuffer = _ctx->createDeviceLocalBuffer(
-            "Culled Indirect Draw Buffer",
-            bufferSizeInBytes,
-            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
-                VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
-                VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
-
-        _culledIndirectDrawCountBuffer = _ctx->createDeviceLocalBuffer(
-            "Culled Indirect Draw Counter Buffer",
-            sizeof(uint32_t),
-            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
-                VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
-                VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
-    }
-
     // refer to section in cs
     // #define IDR_SETID 0
     // #define BOUNDINGBOX_SETID 1
@@ -375,12 +465,6 @@ private:
         setBindings[DESC_LAYOUT_SEMANTIC::BOUNDING_BOX][0].descriptorCount = 1;
         setBindings[DESC_LAYOUT_SEMANTIC::BOUNDING_BOX][0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 
-        setBindings[DESC_LAYOUT_SEMANTIC::FUSTRUMS].resize(1);
-        setBindings[DESC_LAYOUT_SEMANTIC::FUSTRUMS][0].binding = 0; // depends on the shader: set 0, binding = 0
-        setBindings[DESC_LAYOUT_SEMANTIC::FUSTRUMS][0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        setBindings[DESC_LAYOUT_SEMANTIC::FUSTRUMS][0].descriptorCount = 1;
-        setBindings[DESC_LAYOUT_SEMANTIC::FUSTRUMS][0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-
         setBindings[DESC_LAYOUT_SEMANTIC::CULLED_IDR].resize(1);
         setBindings[DESC_LAYOUT_SEMANTIC::CULLED_IDR][0].binding = 0; // depends on the shader: set 0, binding = 0
         setBindings[DESC_LAYOUT_SEMANTIC::CULLED_IDR][0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
@@ -393,49 +477,103 @@ private:
         setBindings[DESC_LAYOUT_SEMANTIC::CULLED_IDR_COUNTER][0].descriptorCount = 1;
         setBindings[DESC_LAYOUT_SEMANTIC::CULLED_IDR_COUNTER][0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 
+        // FUSTRUMS: the uniform ring's layout, a single dynamic uniform buffer
+        setBindings.erase(setBindings.begin() + DESC_LAYOUT_SEMANTIC::FUSTRUMS);
         _descriptorSetLayouts = _ctx->createDescriptorSetLayout(setBindings);
+        ASSERT(_uniformRing, "uniform ring should be defined");
+        _descriptorSetLayouts.insert(_descriptorSetLayouts.begin() + DESC_LAYOUT_SEMANTIC::FUSTRUMS, _uniformRing->getDescriptorSetLayout());
     }
 
-    void initComputePipeline()
+    void allocateDescriptorSets()
     {
-        const std::string entryPoint{"main"};
-        // layout(push_constant) uniform PushConsts {
-        // 	uint count;
-        // } MeshesToCull;
-        _computePipelineEntity = _ctx->createComputePipeline(
-            {{VK_SHADER_STAGE_COMPUTE_BIT,
-              std::make_tuple(_csShaderModule, entryPoint.c_str(), nullptr)}},
-            _descriptorSetLayouts,
-            {{
-                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
-                .offset = 0,
-                .size = sizeof(uint32_t),
-            }});
+        ASSERT(_ctx, "vk context should be defined");
+        const auto numFramesInFlight = _ctx->getFramesInFlight();
+        if (_descriptorAllocator)
+        {
+            // read only inputs: one set shared by the frame slots, culled outputs: one set per frame slot
+            for (const auto semantic : {DESC_LAYOUT_SEMANTIC::IDR, DESC_LAYOUT_SEMANTIC::BOUNDING_BOX})
+            {
+                _descriptorSets[&_descriptorSetLayouts[semantic]] = {_descriptorAllocator->allocate(_descriptorSetLayouts[semantic])};
+            }
+            for (const auto semantic : {DESC_LAYOUT_SEMANTIC::CULLED_IDR, DESC_LAYOUT_SEMANTIC::CULLED_IDR_COUNTER})
+            {
+                auto &sets = _descriptorSets[&_descriptorSetLayouts[semantic]];
+                sets.resize(numFramesInFlight);
+                for (auto &set : sets)
+                {
+                    set = _descriptorAllocator->allocate(_descriptorSetLayouts[semantic]);
+                }
+            }
+        }
+        else
+        {
+            ASSERT(_dsPool, "descriptorset pool should be defined");
+            _descriptorSets = _ctx->allocateDescriptorSet(_dsPool,
+                                                          {{&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::IDR],
+                                                            1},
+                                                           {&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::BOUNDING_BOX],
+                                                            1},
+                                                           {&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::CULLED_IDR],
+                                                            numFramesInFlight},
+                                                           {&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::CULLED_IDR_COUNTER],
+                                                            numFramesInFlight}});
+        }
+        // flattened once: execute binds the sets of a frame without any lookup
+        _frameDescriptorSets.resize(numFramesInFlight);
+        for (size_t i = 0; i < numFramesInFlight; ++i)
+        {
+            for (int semantic = 0; semantic < DESC_LAYOUT_SEMANTIC_SIZE; ++semantic)
+            {
+                if (semantic == DESC_LAYOUT_SEMANTIC::FUSTRUMS)
+                {
+                    _frameDescriptorSets[i][semantic] = _uniformRing->getDescriptorSet(i);
+                    continue;
+                }
+                const auto &sets = _descriptorSets[&_descriptorSetLayouts[semantic]];
+                _frameDescriptorSets[i][semantic] = sets[sets.size() == 1 ? 0 : i];
+            }
+        }
     }
 
-    void allocateDescriptorSets()
+    void addResourceToBindlessHeap()
     {
-        ASSERT(_ctx, "vk context should be defined");
-        ASSERT(_dsPool, "descriptorset pool should be defined");
-        const auto numFramesInFlight = _ctx->getSwapChainImageViews().size();
-        _descriptorSets = _ctx->allocateDescriptorSet(_dsPool,
-                                                      {{&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::IDR],
-                                                        1},
-                                                       {&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::BOUNDING_BOX],
-                                                        1},
-                                                       {&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::FUSTRUMS],
-                                                        numFramesInFlight},
-                                                       {&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::CULLED_IDR],
-                                                        1},
-                                                       {&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::CULLED_IDR_COUNTER],
-                                                        1}});
+        ASSERT(_bindlessHeap, "bindless heap should be defined");
+        ASSERT(_indirectDrawBuffer, "indirect draw buffer should be defined");
+        _bindlessIndices[DESC_LAYOUT_SEMANTIC::IDR] = _bindlessHeap->addStorageBuffer(*_indirectDrawBuffer);
+        _bindlessIndices[DESC_LAYOUT_SEMANTIC::BOUNDING_BOX] = _bindlessHeap->addStorageBuffer(_meshBoundBoxComboDeviceBuffer);
+        // the reserved chunk of every frame slot
+        const auto numFramesInFlight = _ctx->getFramesInFlight();
+        _bindlessFustrumIndices.clear();
+        for (uint32_t i = 0; i < numFramesInFlight; ++i)
+        {
+            _bindlessFustrumIndices.push_back(_bindlessHeap->addStorageBuffer(std::get<BUFFER_ENTITY_UID::BUFFER>(_uniformRing->getBuffer(i)),
+                                                                              _fustrumOffset,
+                                                                              sizeof(Fustrum)));
+        }
+    }
+
+    // the graph may be recompiled: the slots of the previous transient buffers are released
+    void addCulledResourceToBindlessHeap()
+    {
+        ASSERT(_bindlessHeap, "bindless heap should be defined");
+        for (const auto &indices : _bindlessCulledIndices)
+        {
+            for (const auto index : indices)
+            {
+                _bindlessHeap->release(BINDLESS_STORAGE_BUFFER, index);
+            }
+        }
+        _bindlessCulledIndices.resize(_culledIndirectDrawBuffers.size());
+        for (size_t i = 0; i < _culledIndirectDrawBuffers.size(); ++i)
+        {
+            _bindlessCulledIndices[i] = {_bindlessHeap->addStorageBuffer(_culledIndirectDrawBuffers[i]),
+                                         _bindlessHeap->addStorageBuffer(_culledIndirectDrawCountBuffers[i])};
+        }
     }
 
     void bindResourceToDescriptorSets()
     {
         ASSERT(_ctx, "vk context should be defined");
-        auto logicalDevice = _ctx->getLogicDevice();
-        const auto numFramesInFlight = _ctx->getSwapChainImageViews().size();
 
         // idr as input (readonly)
         {
@@ -464,112 +602,78 @@ private:
                 VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
                 0);
         }
+    }
 
-        // fustrum uniform buffer
+    void bindCulledResourceToDescriptorSets()
+    {
+        ASSERT(_ctx, "vk context should be defined");
+        // culled idr buffer (writable)
         {
-            const auto &dstSets = _descriptorSets[&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::FUSTRUMS]];
-            ASSERT(dstSets.size() == numFramesInFlight, "FUSTRUMS descriptor set size should equal # of frames in flight");
-            const auto &fustrumBuffers = std::get<0>(_fustrumBuffers);
-            ASSERT(fustrumBuffers.size() == numFramesInFlight, "fustrumBuffers' size should equal # of frames in flight");
-
-            for (size_t i = 0; i < numFramesInFlight; i++)
+            const auto &dstSets = _descriptorSets[&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::CULLED_IDR]];
+            ASSERT(dstSets.size() == _culledIndirectDrawBuffers.size(), "one culled idr descriptor set per frame slot");
+            for (size_t i = 0; i < dstSets.size(); ++i)
             {
-                const auto bufferSizeInBytes = std::get<4>(fustrumBuffers[i]);
                 _ctx->bindBufferToDescriptorSet(
-                    std::get<0>(fustrumBuffers[i]),
+                    std::get<0>(_culledIndirectDrawBuffers[i]),
                     0,
-                    bufferSizeInBytes,
-                    _descriptorSets[&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::FUSTRUMS]][i],
-                    VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                    std::get<4>(_culledIndirectDrawBuffers[i]),
+                    dstSets[i],
+                    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
                     0);
             }
         }
 
-        // culled idr buffer (writable)
-        {
-            const auto &dstSets = _descriptorSets[&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::CULLED_IDR]];
-            ASSERT(dstSets.size() == 1, "culled idr descriptor set size is 1");
-            const auto bufferSizeInBytes = std::get<4>(_culledIndirectDrawBuffer);
-            _ctx->bindBufferToDescriptorSet(
-                std::get<0>(_culledIndirectDrawBuffer),
-                0,
-                bufferSizeInBytes,
-                dstSets[0],
-                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-                0);
-        }
-
         // culled idr counter buffer (writable)
         {
             const auto &dstSets = _descriptorSets[&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::CULLED_IDR_COUNTER]];
-            ASSERT(dstSets.size() == 1, "culled idr counter descriptor set size is 1");
-            const auto bufferSizeInBytes = std::get<4>(_culledIndirectDrawCountBuffer);
-            _ctx->bindBufferToDescriptorSet(
-                std::get<0>(_culledIndirectDrawCountBuffer),
-                0,
-                bufferSizeInBytes,
-                dstSets[0],
-                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-                0);
+            ASSERT(dstSets.size() == _culledIndirectDrawCountBuffers.size(), "one culled idr counter descriptor set per frame slot");
+            for (size_t i = 0; i < dstSets.size(); ++i)
+            {
+                _ctx->bindBufferToDescriptorSet(
+                    std::get<0>(_culledIndirectDrawCountBuffers[i]),
+                    0,
+                    std::get<4>(_culledIndirectDrawCountBuffers[i]),
+                    dstSets[i],
+                    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    0);
+            }
         }
     }
 
     void uploadResource()
     {
         ASSERT(_ctx, "vk context should be defined");
-        auto logicalDevice = _ctx->getLogicDevice();
-        // this io belongs to the graphics queue, so no explict ownership acq and release needed
-        auto cmdBuffersForIO = _ctx->getCommandBufferForIO();
-        auto graphicsComputeQueue = _ctx->getGraphicsComputeQueue();
-        _ctx->BeginRecordCommandBuffer(cmdBuffersForIO);
-        _ctx->writeBuffer(
-            _meshBoundBoxComboStagingBuffer,
+        // first and only write of a fresh buffer: may run on the dedicated transfer queue
+        // no cpu wait: either the same queue, where the batch's barrier orders the copy before the culling dispatch,
+        // or the transfer queue, where the next submitCommand waits on its timeline and acquires the buffer
+        // in front of the frame's commands
+        auto batch = _ctx->createUploadBatch();
+        batch.writeBuffer(
             _meshBoundBoxComboDeviceBuffer,
-            cmdBuffersForIO,
             reinterpret_cast<const void *>(_bb.data()),
             _bb.size() * sizeof(BoundingBox),
             0,
-            0);
-        _ctx->EndRecordCommandBuffer(cmdBuffersForIO);
-
-        const auto uploadCmdBuffer = std::get<1>(cmdBuffersForIO);
-        const auto uploadCmdBufferFence = std::get<2>(cmdBuffersForIO);
-
-        const VkPipelineStageFlags flags = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        // wait for no body
-        VkSubmitInfo submitInfo{};
-        submitInfo.waitSemaphoreCount = 0;
-        submitInfo.pWaitSemaphores = VK_NULL_HANDLE;
-        // only useful when having waitsemaphore
-        submitInfo.pWaitDstStageMask = &flags;
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &uploadCmdBuffer;
-        // no body needs to be notified
-        submitInfo.signalSemaphoreCount = 0;
-        submitInfo.pSignalSemaphores = VK_NULL_HANDLE;
-
-        VK_CHECK(vkResetFences(logicalDevice, 1, &uploadCmdBufferFence));
-        VK_CHECK(vkQueueSubmit(graphicsComputeQueue, 1, &submitInfo, uploadCmdBufferFence));
-        // sync io
-        const auto result = vkWaitForFences(logicalDevice, 1, &uploadCmdBufferFence, VK_TRUE,
-                                            100000000000);
-        if (result == VK_TIMEOUT)
-        {
-            vkDeviceWaitIdle(logicalDevice);
-        }
+            true);
+        _uploadTicket = batch.submit();
     }
     // ownership be careful
     BufferEntity *_indirectDrawBuffer{nullptr};
-    BufferEntity _culledIndirectDrawBuffer;
+    // transient resources of the render graph, per frame slot
+    std::vector<BufferEntity> _culledIndirectDrawBuffers;
     // vkCmdDrawIndexedIndirectCount vs vkCmdDrawIndexedIndirect
     // vkCmdDrawIndexedIndirectCount: extra buffer for draw counter, which is filled in in the gpu
-    BufferEntity _culledIndirectDrawCountBuffer;
-    // refer to frame in fight
-    std::tuple<std::vector<BufferEntity>, size_t> _fustrumBuffers;
+    std::vector<BufferEntity> _culledIndirectDrawCountBuffers;
+    // per frame fustrum: reserved chunk of the uniform ring, same dynamic offset in every frame slot
+    UniformRing *_uniformRing{nullptr};
+    uint32_t _fustrumOffset{0};
     // interleave all the bounding box of meshes into one big buffer.
     BufferEntity _meshBoundBoxComboDeviceBuffer;
-    BufferEntity _meshBoundBoxComboStagingBuffer;
+    UploadTicket _uploadTicket{};
+    // dispatch gpu time
+    VkQueryPool _timestampPool{VK_NULL_HANDLE};
+    float _timestampPeriodNs{1.f};
+    std::vector<bool> _timestampsRecorded;
+    double _dispatchGpuMs{0.0};
     // life cycle of host buffer matters when gpu uploading process is done
     std::vector<BoundingBox> _bb;
     // for pipeline and binding resource
@@ -577,5 +681,19 @@ private:
     VkShaderModule _csShaderModule{VK_NULL_HANDLE};
     std::tuple<VkPipeline, VkPipelineLayout> _computePipelineEntity;
     // do i use individual ds pool ?
+    // growable pools, see setDescriptorAllocator, otherwise the fixed pool of setDescriptorPool
+    DescriptorAllocator *_descriptorAllocator{nullptr};
     std::unordered_map<VkDescriptorSetLayout *, std::vector<VkDescriptorSet>> _descriptorSets;
+    // per frame in flight, in set order
+    std::vector<std::array<VkDescriptorSet, DESC_LAYOUT_SEMANTIC_SIZE>> _frameDescriptorSets;
+
+    // bindless mode
+    static constexpr uint32_t INVALID_BINDLESS_INDEX = ~0u;
+    BindlessHeap *_bindlessHeap{nullptr};
+    // per DESC_LAYOUT_SEMANTIC, FUSTRUMS and the culled buffers are per frame slot
+    std::array<uint32_t, DESC_LAYOUT_SEMANTIC_SIZE> _bindlessIndices{INVALID_BINDLESS_INDEX, INVALID_BINDLESS_INDEX, INVALID_BINDLESS_INDEX,
+                                                                     INVALID_BINDLESS_INDEX, INVALID_BINDLESS_INDEX};
+    std::vector<uint32_t> _bindlessFustrumIndices;
+    // per frame slot: culled idr, culled idr counter
+    std::vector<std::array<uint32_t, 2>> _bindlessCulledIndices;
 };
\ No newline at end of file
@@ -0,0 +1,728 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <misc.h>
+#include <context.h>
+#include <barrierBatch.h>
+#include <bindlessHeap.h>
+
+using DefragHandle = uint32_t;
+
+// incremental vma defragmentation, a bounded slice per frame
+// a run starts on request, or by itself once the vma blocks of a device local heap hold too much unused memory,
+// it goes over the default pools of vma, then over the size class pools of createImage (VkContext::getImagePools)
+// every frame at most one pass: vma picks allocations to move (bytes/moves per pass capped), the defragmenter
+// creates the replacement buffer/image from the original create info on the new memory, records the copy at the top
+// of the frame's command buffer, patches the bindless slot, the classic descriptor sets and the device addresses stored
+// in other buffers, then tells the owner (onMoved) which switches to the replacement
+// the pass ends once that frame is done on the gpu: the old handles are destroyed and vma releases the old memory
+// only tracked resources move, every other allocation stays where it is (render graph blocks, staging ring, ...)
+// dedicated allocations never move (attachments, large images), color images only, mapped buffers are not supported
+// usage:
+//     Defragmenter defragmenter(&ctx);
+//     auto handle = defragmenter.trackBuffer(vertices, verticesCreateInfo,
+//                                            [&](DefragHandle h, VkCommandBuffer) { vertices = defragmenter.getBuffer(h); });
+//     defragmenter.setBindlessSlot(handle, &heap, BINDLESS_STORAGE_BUFFER, verticesIndex);
+//     defragmenter.addDescriptorReference(handle, perFrameSets, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+//     defragmenter.addDeviceAddressReference(handle, materialBuffer, offsetof(Material, vertices));
+//     // per frame, after advanceCommandBuffer, before the passes are recorded
+//     defragmenter.update(cmd);
+class Defragmenter
+{
+public:
+    // the resource moved: fetch the replacement (getBuffer/getImage/getBindlessIndex), invalidate pre-recorded commands
+    // cmd: the frame's command buffer, e.g. to patch what addDescriptorReference/addDeviceAddressReference do not cover
+    using OnMoved = std::function<void(DefragHandle, VkCommandBuffer)>;
+
+    struct Stats
+    {
+        uint64_t runs{0};
+        uint64_t passes{0};
+        uint64_t allocationsMoved{0};
+        VkDeviceSize bytesMoved{0};
+        // memory given back to the driver
+        VkDeviceSize bytesFreed{0};
+        uint64_t deviceMemoryBlocksFreed{0};
+        // of the last pass which recorded copies
+        double lastPassCpuMs{0.0};
+    };
+
+    static constexpr DefragHandle INVALID_HANDLE = std::numeric_limits<DefragHandle>::max();
+
+    explicit Defragmenter(VkContext *ctx) : _ctx(ctx)
+    {
+        ASSERT(_ctx, "vk context should be defined");
+        const VkPhysicalDeviceMemoryProperties *memoryProperties{nullptr};
+        vmaGetMemoryProperties(_ctx->getVmaAllocator(), &memoryProperties);
+        _memoryProperties = *memoryProperties;
+    }
+
+    Defragmenter(const Defragmenter &) = delete;
+    Defragmenter &operator=(const Defragmenter &) = delete;
+
+    // the caller makes sure the gpu is done (e.g. vkDeviceWaitIdle)
+    ~Defragmenter()
+    {
+        if (_passFrameNumber)
+        {
+            endPass();
+        }
+        if (_defragmentation)
+        {
+            finish();
+        }
+    }
+
+    // createInfo: the one the buffer was created with, the replacement is created with it (pNext chains are not supported)
+    // it needs VK_BUFFER_USAGE_TRANSFER_DST_BIT (the source TRANSFER_SRC)
+    DefragHandle trackBuffer(const BufferEntity &buffer, const VkBufferCreateInfo &createInfo, OnMoved onMoved = {})
+    {
+        ASSERT(std::get<BUFFER_ENTITY_UID::MAPPING_ADDRESS>(buffer) == nullptr, "mapped buffers cannot be moved");
+        ASSERT(createInfo.usage & VK_BUFFER_USAGE_TRANSFER_SRC_BIT && createInfo.usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+               "movable buffer should be a transfer source and destination");
+        ASSERT(createInfo.pNext == nullptr, "movable buffer should not need a create info chain");
+        std::scoped_lock lock{_mux};
+        const auto handle = allocateHandle();
+        auto &resource = _resources[handle];
+        resource.type = MOVABLE_BUFFER;
+        resource.buffer = buffer;
+        resource.bufferCreateInfo = createInfo;
+        resource.queueFamilyIndices.assign(createInfo.pQueueFamilyIndices, createInfo.pQueueFamilyIndices + createInfo.queueFamilyIndexCount);
+        resource.bufferCreateInfo.pQueueFamilyIndices = resource.queueFamilyIndices.data();
+        resource.onMoved = std::move(onMoved);
+        _handles[std::get<BUFFER_ENTITY_UID::VMA_ALLOCATION>(buffer)] = handle;
+        return handle;
+    }
+
+    // createInfo: the one the image was created with (type, layers, samples, flags, sharing), the replacement is created with it
+    // layout: the one the image is in between frames, the replacement ends up in it as well
+    DefragHandle trackImage(const ImageEntity &image, const VkImageCreateInfo &createInfo,
+                            VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, OnMoved onMoved = {})
+    {
+        ASSERT(createInfo.usage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT && createInfo.usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+               "movable image should be a transfer source and destination");
+        ASSERT(createInfo.pNext == nullptr, "movable image should not need a create info chain");
+        std::scoped_lock lock{_mux};
+        const auto handle = allocateHandle();
+        auto &resource = _resources[handle];
+        resource.type = MOVABLE_IMAGE;
+        resource.image = image;
+        resource.imageCreateInfo = createInfo;
+        resource.queueFamilyIndices.assign(createInfo.pQueueFamilyIndices, createInfo.pQueueFamilyIndices + createInfo.queueFamilyIndexCount);
+        resource.imageCreateInfo.pQueueFamilyIndices = resource.queueFamilyIndices.data();
+        resource.layout = layout;
+        resource.onMoved = std::move(onMoved);
+        _handles[std::get<IMAGE_ENTITY_OFFSET::IMAGE_VMA_ALLOCATION>(image)] = handle;
+        return handle;
+    }
+
+    // the slot is replaced on every move (new slot written, old one released, no update while pending)
+    void setBindlessSlot(DefragHandle handle, BindlessHeap *heap, BINDLESS_HEAP_BINDING binding, uint32_t index)
+    {
+        std::scoped_lock lock{_mux};
+        auto &resource = _resources[handle];
+        ASSERT(resource.type == MOVABLE_IMAGE ? binding == BINDLESS_SAMPLED_IMAGE || binding == BINDLESS_STORAGE_IMAGE
+                                              : binding == BINDLESS_STORAGE_BUFFER,
+               "bindless binding should match the resource");
+        resource.heap = heap;
+        resource.binding = binding;
+        resource.bindlessIndex = index;
+    }
+
+    // classic descriptor set written with the whole buffer, or the image view in its layout (sampler: combined image sampler)
+    // one set per frame slot: a set read by the frames in flight cannot be updated, the set of a slot is rewritten
+    // when the first frame of that slot after the move is recorded (update)
+    void addDescriptorReference(DefragHandle handle, const std::vector<VkDescriptorSet> &sets, uint32_t binding,
+                                VkDescriptorType type, uint32_t arrayElement = 0, VkSampler sampler = VK_NULL_HANDLE)
+    {
+        ASSERT(sets.size() == _ctx->getFramesInFlight(), "one descriptor set per frame slot");
+        std::scoped_lock lock{_mux};
+        _resources[handle].descriptorReferences.emplace_back(DescriptorReference{
+            .sets = sets,
+            .binding = binding,
+            .arrayElement = arrayElement,
+            .type = type,
+            .sampler = sampler,
+        });
+    }
+
+    // the device address of the buffer is stored at dstOffset of dstBuffer (VK_BUFFER_USAGE_TRANSFER_DST_BIT),
+    // rewritten by the frame which records the copy, after the frames in flight on the queue
+    void addDeviceAddressReference(DefragHandle handle, VkBuffer dstBuffer, VkDeviceSize dstOffset)
+    {
+        std::scoped_lock lock{_mux};
+        auto &resource = _resources[handle];
+        ASSERT(resource.type == MOVABLE_BUFFER && resource.bufferCreateInfo.usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+               "device address reference needs a buffer with a device address");
+        ASSERT(dstOffset % 4 == 0, "vkCmdUpdateBuffer offset should be a multiple of 4");
+        resource.deviceAddressReferences.emplace_back(dstBuffer, dstOffset);
+    }
+
+    // before the owner destroys the resource, not while its move is pending (isMoving)
+    void untrack(DefragHandle handle)
+    {
+        std::scoped_lock lock{_mux};
+        ASSERT(!moving(handle), "resource should not be destroyed while it is moved");
+        auto &resource = _resources[handle];
+        _handles.erase(allocation(resource));
+        std::erase(_staleDescriptors, handle);
+        resource = Resource{};
+        _freeHandles.push_back(handle);
+    }
+
+    bool isMoving(DefragHandle handle) const
+    {
+        std::scoped_lock lock{_mux};
+        return moving(handle);
+    }
+
+    const BufferEntity &getBuffer(DefragHandle handle) const
+    {
+        std::scoped_lock lock{_mux};
+        return _resources[handle].buffer;
+    }
+
+    const ImageEntity &getImage(DefragHandle handle) const
+    {
+        std::scoped_lock lock{_mux};
+        return _resources[handle].image;
+    }
+
+    uint32_t getBindlessIndex(DefragHandle handle) const
+    {
+        std::scoped_lock lock{_mux};
+        return _resources[handle].bindlessIndex;
+    }
+
+    // per frame cost: vma moves at most maxBytesPerFrame/maxMovesPerFrame (from the next run on),
+    // moves left once maxCpuMs is spent are skipped
+    void setFrameBudget(VkDeviceSize maxBytesPerFrame, uint32_t maxMovesPerFrame, double maxCpuMs)
+    {
+        std::scoped_lock lock{_mux};
+        _maxBytesPerPass = maxBytesPerFrame;
+        _maxMovesPerPass = maxMovesPerFrame;
+        _maxCpuMs = maxCpuMs;
+    }
+
+    // a run starts by itself when a device local heap has more than minUnusedBytes and unusedRatio of its blocks unused,
+    // checked every checkInterval frames, 0: on request only
+    void setAutomatic(float unusedRatio, VkDeviceSize minUnusedBytes, uint32_t checkInterval = 120)
+    {
+        std::scoped_lock lock{_mux};
+        _unusedRatio = unusedRatio;
+        _minUnusedBytes = minUnusedBytes;
+        _checkInterval = checkInterval;
+    }
+
+    // e.g. after a scene was unloaded
+    void request()
+    {
+        std::scoped_lock lock{_mux};
+        _requested = true;
+    }
+
+    inline bool isRunning() const
+    {
+        std::scoped_lock lock{_mux};
+        return _defragmentation != VK_NULL_HANDLE;
+    }
+
+    // once per frame, after advanceCommandBuffer, cmd: the frame's command buffer, before the passes are recorded
+    void update(VkCommandBuffer cmd)
+    {
+        ZoneScopedN("Defragmenter::update");
+        std::scoped_lock lock{_mux};
+        if (_passFrameNumber && _ctx->isFrameComplete(_passFrameNumber))
+        {
+            endPass();
+        }
+        if (!_defragmentation && shouldStart())
+        {
+            start();
+        }
+        if (_defragmentation && !_passFrameNumber)
+        {
+            beginPass(cmd);
+        }
+        rewriteStaleDescriptors();
+    }
+
+    Stats getStats() const
+    {
+        std::scoped_lock lock{_mux};
+        return _stats;
+    }
+
+private:
+    enum MOVABLE_TYPE : int
+    {
+        MOVABLE_NONE = 0,
+        MOVABLE_BUFFER,
+        MOVABLE_IMAGE
+    };
+
+    struct DescriptorReference
+    {
+        // per frame slot
+        std::vector<VkDescriptorSet> sets;
+        uint32_t binding{0};
+        uint32_t arrayElement{0};
+        VkDescriptorType type{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER};
+        VkSampler sampler{VK_NULL_HANDLE};
+    };
+
+    struct Resource
+    {
+        MOVABLE_TYPE type{MOVABLE_NONE};
+        BufferEntity buffer{};
+        ImageEntity image{};
+        // the replacement is created with them, pQueueFamilyIndices points at queueFamilyIndices
+        VkBufferCreateInfo bufferCreateInfo{};
+        VkImageCreateInfo imageCreateInfo{};
+        std::vector<uint32_t> queueFamilyIndices;
+        VkImageLayout layout{VK_IMAGE_LAYOUT_UNDEFINED};
+        BindlessHeap *heap{nullptr};
+        BINDLESS_HEAP_BINDING binding{BINDLESS_STORAGE_BUFFER};
+        uint32_t bindlessIndex{0};
+        std::vector<DescriptorReference> descriptorReferences;
+        // dst buffer, dst offset
+        std::vector<std::tuple<VkBuffer, VkDeviceSize>> deviceAddressReferences;
+        // frame which recorded the last copy
+        uint64_t movedFrameNumber{0};
+        OnMoved onMoved;
+    };
+
+    // copy recorded, waiting for its frame
+    struct Move
+    {
+        DefragHandle handle{INVALID_HANDLE};
+        // destroyed at the end of the pass
+        VkBuffer oldBuffer{VK_NULL_HANDLE};
+        VkImage oldImage{VK_NULL_HANDLE};
+        VkImageView oldImageView{VK_NULL_HANDLE};
+    };
+
+    static VmaAllocation allocation(const Resource &resource)
+    {
+        return resource.type == MOVABLE_BUFFER
+                   ? std::get<BUFFER_ENTITY_UID::VMA_ALLOCATION>(resource.buffer)
+                   : std::get<IMAGE_ENTITY_OFFSET::IMAGE_VMA_ALLOCATION>(resource.image);
+    }
+
+    bool moving(DefragHandle handle) const
+    {
+        return std::any_of(_moves.begin(), _moves.end(), [handle](const Move &move)
+                           { return move.handle == handle; });
+    }
+
+    DefragHandle allocateHandle()
+    {
+        if (!_freeHandles.empty())
+        {
+            const auto handle = _freeHandles.back();
+            _freeHandles.pop_back();
+            return handle;
+        }
+        _resources.emplace_back();
+        return static_cast<DefragHandle>(_resources.size() - 1);
+    }
+
+    bool shouldStart()
+    {
+        if (std::exchange(_requested, false))
+        {
+            return true;
+        }
+        if (_checkInterval == 0 || _ctx->getFrameNumber() % _checkInterval != 0)
+        {
+            return false;
+        }
+        std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> budgets{};
+        vmaGetHeapBudgets(_ctx->getVmaAllocator(), budgets.data());
+        for (uint32_t heapIndex = 0; heapIndex < _memoryProperties.memoryHeapCount; ++heapIndex)
+        {
+            if (!(_memoryProperties.memoryHeaps[heapIndex].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT))
+            {
+                continue;
+            }
+            const auto &statistics = budgets[heapIndex].statistics;
+            const auto unused = statistics.blockBytes - statistics.allocationBytes;
+            if (unused >= _minUnusedBytes && unused > statistics.blockBytes * _unusedRatio)
+            {
+                log(Level::Info, "defragmentation: heap ", heapIndex, " has ", unused >> 20, "/", statistics.blockBytes >> 20,
+                    " MB unused in its blocks");
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // a run: the default pools (VK_NULL_HANDLE), then the image pools, one vma defragmentation context at a time
+    void start()
+    {
+        _runPools = {VK_NULL_HANDLE};
+        const auto imagePools = _ctx->getImagePools();
+        _runPools.insert(_runPools.end(), imagePools.begin(), imagePools.end());
+        _runPool = 0;
+        ++_stats.runs;
+        beginDefragmentation();
+    }
+
+    void beginDefragmentation()
+    {
+        // incremental: cheap passes, the budget caps the work per frame
+        const VmaDefragmentationInfo defragmentationInfo{
+            .flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_FAST_BIT,
+            .pool = _runPools[_runPool],
+            .maxBytesPerPass = _maxBytesPerPass,
+            .maxAllocationsPerPass = _maxMovesPerPass,
+        };
+        VK_CHECK(vmaBeginDefragmentation(_ctx->getVmaAllocator(), &defragmentationInfo, &_defragmentation));
+    }
+
+    // the current pool is done: on to the next one of the run
+    void nextPool()
+    {
+        finish();
+        if (++_runPool < _runPools.size())
+        {
+            beginDefragmentation();
+        }
+    }
+
+    void finish()
+    {
+        VmaDefragmentationStats defragmentationStats{};
+        vmaEndDefragmentation(_ctx->getVmaAllocator(), _defragmentation, &defragmentationStats);
+        _defragmentation = VK_NULL_HANDLE;
+        _stats.allocationsMoved += defragmentationStats.allocationsMoved;
+        _stats.bytesMoved += defragmentationStats.bytesMoved;
+        _stats.bytesFreed += defragmentationStats.bytesFreed;
+        _stats.deviceMemoryBlocksFreed += defragmentationStats.deviceMemoryBlocksFreed;
+        log(Level::Info, "defragmentation: moved ", defragmentationStats.allocationsMoved, " allocation(s) (",
+            defragmentationStats.bytesMoved >> 20, " MB), freed ", defragmentationStats.deviceMemoryBlocksFreed,
+            " block(s) (", defragmentationStats.bytesFreed >> 20, " MB)");
+    }
+
+    void beginPass(VkCommandBuffer cmd)
+    {
+        const auto begin = std::chrono::steady_clock::now();
+        const auto result = vmaBeginDefragmentationPass(_ctx->getVmaAllocator(), _defragmentation, &_pass);
+        if (result == VK_SUCCESS)
+        {
+            // nothing left worth moving in this pool
+            nextPool();
+            return;
+        }
+        ASSERT(result == VK_INCOMPLETE, "defragmentation pass should begin");
+        ++_stats.passes;
+
+        auto logicalDevice = _ctx->getLogicDevice();
+        auto vmaAllocator = _ctx->getVmaAllocator();
+        // previous frames on the queue may still write the sources
+        // (and read the buffers holding device addresses, rewritten by vkCmdUpdateBuffer)
+        BarrierBatch barriers;
+        barriers.memory(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_WRITE_BIT,
+                        VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT);
+        // copies are recorded once every barrier is known
+        std::vector<std::function<void()>> copies;
+        for (uint32_t i = 0; i < _pass.moveCount; ++i)
+        {
+            auto &move = _pass.pMoves[i];
+            const auto it = _handles.find(move.srcAllocation);
+            const auto elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+            if (it == _handles.end() || elapsedMs > _maxCpuMs)
+            {
+                // not ours, or out of time for this frame: stays where it is
+                move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+                continue;
+            }
+            auto &resource = _resources[it->second];
+            Move pending{.handle = it->second};
+            VmaAllocationInfo dstAllocationInfo;
+            vmaGetAllocationInfo(vmaAllocator, move.dstTmpAllocation, &dstAllocationInfo);
+            if (resource.type == MOVABLE_BUFFER)
+            {
+                pending.oldBuffer = std::get<BUFFER_ENTITY_UID::BUFFER>(resource.buffer);
+                const auto sizeInBytes = resource.bufferCreateInfo.size;
+                VkBuffer buffer{VK_NULL_HANDLE};
+                VK_CHECK(vkCreateBuffer(logicalDevice, &resource.bufferCreateInfo, nullptr, &buffer));
+                VK_CHECK(vmaBindBufferMemory(vmaAllocator, move.dstTmpAllocation, buffer));
+                copies.emplace_back([cmd, src = pending.oldBuffer, buffer, sizeInBytes]()
+                                    {
+                                        const VkBufferCopy region{.size = sizeInBytes};
+                                        vkCmdCopyBuffer(cmd, src, buffer, 1, &region); });
+                std::get<BUFFER_ENTITY_UID::BUFFER>(resource.buffer) = buffer;
+                std::get<BUFFER_ENTITY_UID::VMA_ALLOCATION_INFO>(resource.buffer) = dstAllocationInfo;
+                if (resource.bufferCreateInfo.usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT)
+                {
+                    const VkBufferDeviceAddressInfo bufferDeviceAI{
+                        .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+                        .buffer = buffer,
+                    };
+                    std::get<BUFFER_ENTITY_UID::DEVICE_HOST_ADDRESS>(resource.buffer) = VkDeviceOrHostAddressConstKHR{
+                        .deviceAddress = vkGetBufferDeviceAddressKHR(logicalDevice, &bufferDeviceAI),
+                    };
+                }
+            }
+            else
+            {
+                pending.oldImage = std::get<IMAGE_ENTITY_OFFSET::IMAGE>(resource.image);
+                pending.oldImageView = std::get<IMAGE_ENTITY_OFFSET::IMAGE_VIEW>(resource.image);
+                const auto &imageCreateInfo = resource.imageCreateInfo;
+                const auto mipCount = imageCreateInfo.mipLevels;
+                const auto layerCount = imageCreateInfo.arrayLayers;
+                const auto extent = imageCreateInfo.extent;
+                const auto format = imageCreateInfo.format;
+                VkImage image{VK_NULL_HANDLE};
+                VK_CHECK(vkCreateImage(logicalDevice, &imageCreateInfo, nullptr, &image));
+                VK_CHECK(vmaBindImageMemory(vmaAllocator, move.dstTmpAllocation, image));
+                const VkImageSubresourceRange range{VK_IMAGE_ASPECT_COLOR_BIT, 0, mipCount, 0, layerCount};
+                // same view as createImage
+                const VkImageViewCreateInfo imageViewInfo{
+                    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+                    .image = image,
+                    .viewType = getImageViewType(imageCreateInfo.imageType),
+                    .format = format,
+                    .subresourceRange = range,
+                };
+                VkImageView imageView{VK_NULL_HANDLE};
+                VK_CHECK(vkCreateImageView(logicalDevice, &imageViewInfo, nullptr, &imageView));
+                // the old image is never used again: no need to transition it back
+                barriers.image(pending.oldImage, resource.layout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                               VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_WRITE_BIT,
+                               VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, range);
+                barriers.image(image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+                               VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, range);
+                copies.emplace_back([cmd, src = pending.oldImage, image, mipCount, layerCount, extent]()
+                                    {
+                                        std::vector<VkImageCopy> regions;
+                                        regions.reserve(mipCount);
+                                        for (uint32_t level = 0; level < mipCount; ++level)
+                                        {
+                                            regions.emplace_back(VkImageCopy{
+                                                .srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, layerCount},
+                                                .dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, layerCount},
+                                                .extent = {std::max(extent.width >> level, 1u), std::max(extent.height >> level, 1u),
+                                                           std::max(extent.depth >> level, 1u)},
+                                            });
+                                        }
+                                        vkCmdCopyImage(cmd, src, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                                       static_cast<uint32_t>(regions.size()), regions.data()); });
+                std::get<IMAGE_ENTITY_OFFSET::IMAGE>(resource.image) = image;
+                std::get<IMAGE_ENTITY_OFFSET::IMAGE_VIEW>(resource.image) = imageView;
+                std::get<IMAGE_ENTITY_OFFSET::IMAGE_VMA_ALLOCATION_INFO>(resource.image) = dstAllocationInfo;
+            }
+            _moves.push_back(pending);
+        }
+
+        if (_moves.empty())
+        {
+            // every move skipped, nothing to wait for
+            endDefragmentationPass();
+            return;
+        }
+
+        barriers.flush(cmd);
+        for (const auto &copy : copies)
+        {
+            copy();
+        }
+        for (const auto &move : _moves)
+        {
+            const auto &resource = _resources[move.handle];
+            for (const auto &[dstBuffer, dstOffset] : resource.deviceAddressReferences)
+            {
+                const auto deviceAddress = std::get<BUFFER_ENTITY_UID::DEVICE_HOST_ADDRESS>(resource.buffer).deviceAddress;
+                vkCmdUpdateBuffer(cmd, dstBuffer, dstOffset, sizeof(VkDeviceAddress), &deviceAddress);
+            }
+        }
+        // the rest of the frame reads/writes the replacements
+        barriers.memory(VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                        VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT);
+        for (const auto &move : _moves)
+        {
+            const auto &resource = _resources[move.handle];
+            if (resource.type == MOVABLE_IMAGE)
+            {
+                barriers.image(std::get<IMAGE_ENTITY_OFFSET::IMAGE>(resource.image), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, resource.layout,
+                               VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                               VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT,
+                               {VK_IMAGE_ASPECT_COLOR_BIT, 0, resource.imageCreateInfo.mipLevels, 0, resource.imageCreateInfo.arrayLayers});
+            }
+        }
+        barriers.flush(cmd);
+
+        for (const auto &move : _moves)
+        {
+            auto &resource = _resources[move.handle];
+            if (resource.heap)
+            {
+                // frames in flight keep reading the old slot
+                resource.heap->release(resource.binding, resource.bindlessIndex);
+                if (resource.type == MOVABLE_BUFFER)
+                {
+                    resource.bindlessIndex = resource.heap->addStorageBuffer(resource.buffer);
+                }
+                else if (resource.binding == BINDLESS_STORAGE_IMAGE)
+                {
+                    resource.bindlessIndex = resource.heap->addStorageImage(resource.image);
+                }
+                else
+                {
+                    resource.bindlessIndex = resource.heap->addSampledImage(std::get<IMAGE_ENTITY_OFFSET::IMAGE_VIEW>(resource.image),
+                                                                            resource.layout);
+                }
+            }
+            resource.movedFrameNumber = _ctx->getFrameNumber();
+            if (!resource.descriptorReferences.empty() &&
+                std::find(_staleDescriptors.begin(), _staleDescriptors.end(), move.handle) == _staleDescriptors.end())
+            {
+                _staleDescriptors.push_back(move.handle);
+            }
+            if (resource.onMoved)
+            {
+                resource.onMoved(move.handle, cmd);
+            }
+        }
+        _passFrameNumber = _ctx->getFrameNumber();
+        _stats.lastPassCpuMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        TracyPlot("defragmentation pass (ms)", _stats.lastPassCpuMs);
+    }
+
+    // the frame which recorded the copies is done on the gpu
+    void endPass()
+    {
+        auto logicalDevice = _ctx->getLogicDevice();
+        for (const auto &move : _moves)
+        {
+            if (move.oldBuffer)
+            {
+                vkDestroyBuffer(logicalDevice, move.oldBuffer, nullptr);
+            }
+            if (move.oldImageView)
+            {
+                vkDestroyImageView(logicalDevice, move.oldImageView, nullptr);
+            }
+            if (move.oldImage)
+            {
+                vkDestroyImage(logicalDevice, move.oldImage, nullptr);
+            }
+        }
+        _passFrameNumber = 0;
+        endDefragmentationPass();
+        // the allocation handles stay, vma swapped the memory behind them
+        auto vmaAllocator = _ctx->getVmaAllocator();
+        for (const auto &move : _moves)
+        {
+            auto &resource = _resources[move.handle];
+            if (resource.type == MOVABLE_BUFFER)
+            {
+                vmaGetAllocationInfo(vmaAllocator, allocation(resource),
+                                     &std::get<BUFFER_ENTITY_UID::VMA_ALLOCATION_INFO>(resource.buffer));
+            }
+            else
+            {
+                vmaGetAllocationInfo(vmaAllocator, allocation(resource),
+                                     &std::get<IMAGE_ENTITY_OFFSET::IMAGE_VMA_ALLOCATION_INFO>(resource.image));
+            }
+        }
+        _moves.clear();
+    }
+
+    // the frame being recorded: its slot's sets point at the replacements, the other slots wait for their next frame
+    void rewriteStaleDescriptors()
+    {
+        const auto frameNumber = _ctx->getFrameNumber();
+        const auto framesInFlight = _ctx->getFramesInFlight();
+        const auto slot = (frameNumber - 1) % framesInFlight;
+        std::erase_if(_staleDescriptors, [&](DefragHandle handle)
+                      {
+                          const auto &resource = _resources[handle];
+                          for (const auto &reference : resource.descriptorReferences)
+                          {
+                              writeDescriptor(resource, reference, reference.sets[slot]);
+                          }
+                          // every slot had a frame since the move
+                          return frameNumber + 1 >= resource.movedFrameNumber + framesInFlight; });
+    }
+
+    void writeDescriptor(const Resource &resource, const DescriptorReference &reference, VkDescriptorSet set) const
+    {
+        const VkDescriptorBufferInfo bufferInfo{
+            .buffer = std::get<BUFFER_ENTITY_UID::BUFFER>(resource.buffer),
+            .offset = 0,
+            .range = VK_WHOLE_SIZE,
+        };
+        const VkDescriptorImageInfo imageInfo{
+            .sampler = reference.sampler,
+            .imageView = std::get<IMAGE_ENTITY_OFFSET::IMAGE_VIEW>(resource.image),
+            .imageLayout = resource.layout,
+        };
+        const VkWriteDescriptorSet write{
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = set,
+            .dstBinding = reference.binding,
+            .dstArrayElement = reference.arrayElement,
+            .descriptorCount = 1,
+            .descriptorType = reference.type,
+            .pImageInfo = resource.type == MOVABLE_IMAGE ? &imageInfo : nullptr,
+            .pBufferInfo = resource.type == MOVABLE_BUFFER ? &bufferInfo : nullptr,
+        };
+        vkUpdateDescriptorSets(_ctx->getLogicDevice(), 1, &write, 0, nullptr);
+    }
+
+    void endDefragmentationPass()
+    {
+        const auto result = vmaEndDefragmentationPass(_ctx->getVmaAllocator(), _defragmentation, &_pass);
+        if (result == VK_SUCCESS)
+        {
+            nextPool();
+            return;
+        }
+        ASSERT(result == VK_INCOMPLETE, "defragmentation pass should end");
+    }
+
+    VkContext *_ctx{nullptr};
+    VkPhysicalDeviceMemoryProperties _memoryProperties{};
+    mutable std::mutex _mux;
+
+    std::deque<Resource> _resources;
+    std::vector<DefragHandle> _freeHandles;
+    std::unordered_map<VmaAllocation, DefragHandle> _handles;
+
+    VmaDefragmentationContext _defragmentation{VK_NULL_HANDLE};
+    // pools of the current run, _runPool: the one being defragmented
+    std::vector<VmaPool> _runPools;
+    size_t _runPool{0};
+    VmaDefragmentationPassMoveInfo _pass{};
+    std::vector<Move> _moves;
+    // frame which recorded the copies of the pass, 0: no pass pending
+    uint64_t _passFrameNumber{0};
+    // moved resources with classic descriptor sets not rewritten for every frame slot yet
+    std::vector<DefragHandle> _staleDescriptors;
+
+    // per frame budget
+    VkDeviceSize _maxBytesPerPass{16ull << 20};
+    uint32_t _maxMovesPerPass{64};
+    double _maxCpuMs{0.5};
+
+    bool _requested{false};
+    float _unusedRatio{0.25f};
+    VkDeviceSize _minUnusedBytes{64ull << 20};
+    uint32_t _checkInterval{120};
+
+    Stats _stats;
+};
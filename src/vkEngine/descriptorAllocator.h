@@ -0,0 +1,269 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <misc.h>
+#include <context.h>
+
+// one descriptor of an update template, packed in binding order (descriptorCount entries per binding)
+union DescriptorInfo
+{
+    VkDescriptorBufferInfo buffer;
+    VkDescriptorImageInfo image;
+    VkAccelerationStructureKHR accelerationStructure;
+
+    DescriptorInfo(const VkDescriptorBufferInfo &bufferInfo) : buffer(bufferInfo) {}
+    DescriptorInfo(const VkDescriptorImageInfo &imageInfo) : image(imageInfo) {}
+    DescriptorInfo(VkAccelerationStructureKHR as) : accelerationStructure(as) {}
+    // whole buffer
+    DescriptorInfo(const BufferEntity &bufferEntity)
+        : buffer{std::get<BUFFER_ENTITY_UID::BUFFER>(bufferEntity), 0, std::get<BUFFER_ENTITY_UID::BUFFER_SIZE>(bufferEntity)} {}
+    // arena slice, offset into the backing buffer
+    DescriptorInfo(const BufferSlice &slice)
+        : buffer{std::get<BUFFER_SLICE_OFFSET::SLICE_BUFFER>(slice), std::get<BUFFER_SLICE_OFFSET::SLICE_OFFSET>(slice), std::get<BUFFER_SLICE_OFFSET::SLICE_SIZE>(slice)} {}
+};
+
+// growable descriptor set allocation
+// persistent sets: chained pools, a new (larger) pool is created when the current one is out of memory
+// transient sets: one pool chain per frame in flight, valid for the frame being recorded only;
+// reset wholesale (vkResetDescriptorPool) once that frame is complete, no vkFreeDescriptorSets
+// after the first frames every transient allocation is served from recycled pools
+// writes: one vkUpdateDescriptorSetWithTemplate per set, templates are cached per set layout
+// usage:
+//     DescriptorAllocator allocator(&ctx);
+//     auto updateTemplate = allocator.getUpdateTemplate(dsLayout, bindings);
+//     // per frame
+//     auto ds = allocator.allocateTransient(dsLayout);
+//     allocator.update(ds, updateTemplate, {DescriptorInfo(uniformBuffer), DescriptorInfo(storageBuffer)});
+class DescriptorAllocator
+{
+public:
+    // per set budget, scaled by the number of sets of a pool
+    struct PoolSizeRatio
+    {
+        VkDescriptorType type;
+        float ratio;
+    };
+
+    explicit DescriptorAllocator(VkContext *ctx,
+                                 std::vector<PoolSizeRatio> ratios = {
+                                     {VK_DESCRIPTOR_TYPE_SAMPLER, 0.5f},
+                                     {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4.f},
+                                     {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 4.f},
+                                     {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.f},
+                                     {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2.f},
+                                     {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4.f},
+                                     {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1.f},
+                                     {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1.f},
+                                 },
+                                 uint32_t initialSetsPerPool = 64)
+        : _ctx(ctx), _ratios(std::move(ratios)), _initialSetsPerPool(initialSetsPerPool)
+    {
+        ASSERT(_ctx, "vk context should be defined");
+        ASSERT(_initialSetsPerPool > 0, "a pool should hold at least one set");
+        _persistent.setsPerPool = _initialSetsPerPool;
+        _frames.resize(_ctx->getFramesInFlight());
+        for (auto &frame : _frames)
+        {
+            frame.chain.setsPerPool = _initialSetsPerPool;
+        }
+    }
+
+    DescriptorAllocator(const DescriptorAllocator &) = delete;
+    DescriptorAllocator &operator=(const DescriptorAllocator &) = delete;
+
+    // the sets are freed with their pools, the caller makes sure the gpu is done with them (e.g. vkDeviceWaitIdle)
+    ~DescriptorAllocator()
+    {
+        auto logicalDevice = _ctx->getLogicDevice();
+        auto destroyChain = [logicalDevice](PoolChain &chain)
+        {
+            for (auto pool : chain.pools)
+            {
+                vkDestroyDescriptorPool(logicalDevice, pool, nullptr);
+            }
+        };
+        destroyChain(_persistent);
+        for (auto &frame : _frames)
+        {
+            destroyChain(frame.chain);
+        }
+        for (const auto &[layout, updateTemplate] : _updateTemplates)
+        {
+            vkDestroyDescriptorUpdateTemplate(logicalDevice, updateTemplate, nullptr);
+        }
+    }
+
+    // lives as long as the allocator
+    VkDescriptorSet allocate(VkDescriptorSetLayout layout)
+    {
+        std::scoped_lock lock{_mux};
+        return allocate(_persistent, layout);
+    }
+
+    // valid until the end of the frame being recorded (VkContext::getFrameNumber)
+    VkDescriptorSet allocateTransient(VkDescriptorSetLayout layout)
+    {
+        std::scoped_lock lock{_mux};
+        ASSERT(_frames.size() == _ctx->getFramesInFlight(), "frames in flight changed after the allocator was created");
+        const auto frameNumber = _ctx->getFrameNumber();
+        auto &frame = _frames[(frameNumber - 1) % _frames.size()];
+        if (frame.frameNumber != frameNumber)
+        {
+            // the slot was last used framesInFlight frames ago: normally already retired by advanceCommandBuffer
+            if (frame.frameNumber && !_ctx->isFrameComplete(frame.frameNumber))
+            {
+                _ctx->waitFrame(frame.frameNumber);
+            }
+            for (size_t i = 0; i < frame.chain.current; ++i)
+            {
+                VK_CHECK(vkResetDescriptorPool(_ctx->getLogicDevice(), frame.chain.pools[i], 0));
+            }
+            if (frame.chain.current < frame.chain.pools.size())
+            {
+                VK_CHECK(vkResetDescriptorPool(_ctx->getLogicDevice(), frame.chain.pools[frame.chain.current], 0));
+            }
+            frame.chain.current = 0;
+            frame.frameNumber = frameNumber;
+        }
+        return allocate(frame.chain, layout);
+    }
+
+    // entries in binding order, one DescriptorInfo per descriptor, see update
+    VkDescriptorUpdateTemplate getUpdateTemplate(VkDescriptorSetLayout layout, const std::vector<VkDescriptorSetLayoutBinding> &bindings)
+    {
+        std::scoped_lock lock{_mux};
+        if (auto it = _updateTemplates.find(layout); it != _updateTemplates.end())
+        {
+            return it->second;
+        }
+        std::vector<VkDescriptorUpdateTemplateEntry> entries;
+        entries.reserve(bindings.size());
+        size_t offset = 0;
+        for (const auto &binding : bindings)
+        {
+            entries.emplace_back(VkDescriptorUpdateTemplateEntry{
+                .dstBinding = binding.binding,
+                .dstArrayElement = 0,
+                .descriptorCount = binding.descriptorCount,
+                .descriptorType = binding.descriptorType,
+                .offset = offset,
+                .stride = sizeof(DescriptorInfo),
+            });
+            offset += binding.descriptorCount * sizeof(DescriptorInfo);
+        }
+        const VkDescriptorUpdateTemplateCreateInfo templateInfo{
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO,
+            .descriptorUpdateEntryCount = static_cast<uint32_t>(entries.size()),
+            .pDescriptorUpdateEntries = entries.data(),
+            .templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET,
+            .descriptorSetLayout = layout,
+        };
+        VkDescriptorUpdateTemplate updateTemplate{VK_NULL_HANDLE};
+        VK_CHECK(vkCreateDescriptorUpdateTemplate(_ctx->getLogicDevice(), &templateInfo, nullptr, &updateTemplate));
+        _updateTemplates.emplace(layout, updateTemplate);
+        return updateTemplate;
+    }
+
+    // every binding of the template at once
+    void update(VkDescriptorSet set, VkDescriptorUpdateTemplate updateTemplate, const std::vector<DescriptorInfo> &descriptors) const
+    {
+        vkUpdateDescriptorSetWithTemplate(_ctx->getLogicDevice(), set, updateTemplate, descriptors.data());
+    }
+
+private:
+    struct PoolChain
+    {
+        // [0, current): full, current: being allocated from, (current, end): empty, recycled
+        std::vector<VkDescriptorPool> pools;
+        size_t current{0};
+        uint32_t setsPerPool{0};
+    };
+
+    struct FrameSlot
+    {
+        // frame which allocated from the chain, 0: never used
+        uint64_t frameNumber{0};
+        PoolChain chain;
+    };
+
+    static constexpr uint32_t MAX_SETS_PER_POOL = 4096;
+
+    VkDescriptorPool createPool(uint32_t setCount) const
+    {
+        std::vector<VkDescriptorPoolSize> poolSizes;
+        poolSizes.reserve(_ratios.size());
+        for (const auto &[type, ratio] : _ratios)
+        {
+            poolSizes.emplace_back(VkDescriptorPoolSize{
+                .type = type,
+                .descriptorCount = std::max(1u, static_cast<uint32_t>(ratio * setCount)),
+            });
+        }
+        // set layouts of the context are update after bind (createDescriptorSetLayout)
+        const VkDescriptorPoolCreateInfo poolInfo{
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+            .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+            .maxSets = setCount,
+            .poolSizeCount = static_cast<uint32_t>(poolSizes.size()),
+            .pPoolSizes = poolSizes.data(),
+        };
+        VkDescriptorPool pool{VK_NULL_HANDLE};
+        VK_CHECK(vkCreateDescriptorPool(_ctx->getLogicDevice(), &poolInfo, nullptr, &pool));
+        return pool;
+    }
+
+    // under _mux
+    VkDescriptorSet allocate(PoolChain &chain, VkDescriptorSetLayout layout)
+    {
+        for (;;)
+        {
+            bool freshPool = false;
+            if (chain.current == chain.pools.size())
+            {
+                chain.pools.push_back(createPool(chain.setsPerPool));
+                log(Level::Info, "DescriptorAllocator: new pool of ", chain.setsPerPool, " set(s), ", chain.pools.size(), " in the chain");
+                chain.setsPerPool = std::min(chain.setsPerPool * 2, MAX_SETS_PER_POOL);
+                freshPool = true;
+            }
+            const VkDescriptorSetAllocateInfo allocInfo{
+                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+                .descriptorPool = chain.pools[chain.current],
+                .descriptorSetCount = 1,
+                .pSetLayouts = &layout,
+            };
+            VkDescriptorSet set{VK_NULL_HANDLE};
+            const auto result = vkAllocateDescriptorSets(_ctx->getLogicDevice(), &allocInfo, &set);
+            if (result == VK_SUCCESS)
+            {
+                return set;
+            }
+            ASSERT(result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL, "failed to allocate descriptor set");
+            // an empty pool cannot hold the layout, neither will the next one:
+            // a descriptor type missing from the ratios, or more descriptors than ratio * sets
+            if (freshPool)
+            {
+                log(Level::Fatal, "DescriptorAllocator: the set layout does not fit in a new pool, add its descriptor types to the pool size ratios or raise them");
+                abort();
+            }
+            // full: move on to the next pool of the chain
+            ++chain.current;
+        }
+    }
+
+    VkContext *_ctx{nullptr};
+    std::vector<PoolSizeRatio> _ratios;
+    uint32_t _initialSetsPerPool{64};
+
+    // pools are externally synchronized
+    std::mutex _mux;
+    PoolChain _persistent;
+    // one per frame in flight
+    std::vector<FrameSlot> _frames;
+    std::unordered_map<VkDescriptorSetLayout, VkDescriptorUpdateTemplate> _updateTemplates;
+};
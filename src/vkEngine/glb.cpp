@@ -415,13 +415,33 @@ std::vector<uint8_t> readTextureRawBuffer(
 
 void readTextures(const Microsoft::glTF::Document &document,
                   const Microsoft::glTF::GLTFResourceReader &resourceReader,
-                  Scene &outputScene)
+                  Scene &outputScene,
+                  JobSystem *jobs)
 {
+    if (!jobs)
+    {
+        for (int i = 0; i < document.textures.Size(); ++i)
+        {
+            outputScene.textures.emplace_back(std::move(std::make_unique<Texture>(
+                readTextureRawBuffer(document, resourceReader, document.textures[i].imageId))));
+        }
+        return;
+    }
+    // the resource reader shares one stream: read sequentially, decode in parallel
+    std::vector<std::vector<uint8_t>> rawBuffers;
+    rawBuffers.reserve(document.textures.Size());
     for (int i = 0; i < document.textures.Size(); ++i)
     {
-        outputScene.textures.emplace_back(std::move(std::make_unique<Texture>(
-            readTextureRawBuffer(document, resourceReader, document.textures[i].imageId))));
+        rawBuffers.emplace_back(readTextureRawBuffer(document, resourceReader, document.textures[i].imageId));
     }
+    const auto firstTexture = outputScene.textures.size();
+    outputScene.textures.resize(firstTexture + rawBuffers.size());
+    jobs->parallelFor(rawBuffers.size(), 1, [&](size_t begin, size_t end)
+                      {
+                          for (auto i = begin; i < end; ++i)
+                          {
+                              outputScene.textures[firstTexture + i] = std::make_unique<Texture>(rawBuffers[i]);
+                          } });
 }
 
 void readMaterials(const Microsoft::glTF::Document &document, Scene &outputScene)
@@ -490,7 +510,7 @@ std::shared_ptr<Scene> GltfBinaryIOReader::read(const std::vector<char> &binaryb
     PrintResourceInfo(document, *glbResourceReader);
 
     readMeshes(document, *glbResourceReader, scene);
-    readTextures(document, *glbResourceReader, scene);
+    readTextures(document, *glbResourceReader, scene, _jobs);
     readMaterials(document, scene);
     return res;
 }
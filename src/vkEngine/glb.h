@@ -7,13 +7,19 @@
 #include <GLTFSDK/GLTF.h>
 #include <GLTFSDK/GLTFResourceReader.h>
 #include <scene.h>
+#include <jobSystem.h>
 
 class GltfBinaryIOReader {
 public:
+    GltfBinaryIOReader() = default;
+    // textures are decoded on the workers of the job system
+    explicit GltfBinaryIOReader(JobSystem *jobs) : _jobs(jobs) {}
+
     std::shared_ptr <Scene> read(const std::string &filePath);
 
     // for android
     std::shared_ptr <Scene> read(const std::vector<char> &binarybuffer);
 
 private:
+    JobSystem *_jobs{nullptr};
 };
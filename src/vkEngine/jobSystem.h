@@ -0,0 +1,395 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <thread>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <misc.h>
+#include <queueLockFree.h>
+
+// work-stealing job system
+// every worker owns a Chase-Lev deque: the owner pushes/pops at the bottom (lifo, cache friendly),
+// idle workers steal from the top of a random victim (fifo, oldest = biggest pieces of work)
+// worker 0 is the thread which created the job system, it participates while waiting (wait, parallelFor)
+// other threads may submit as well: their jobs go through a shared lock-free injection queue
+// jobs form a tree: a parent is done once its own function and every child are done
+// usage:
+//     JobSystem jobs;
+//     auto *root = jobs.createJob([]() {});
+//     for (auto &texture : textures)
+//     {
+//         jobs.run(jobs.createJob([&texture]() { decode(texture); }, root));
+//     }
+//     jobs.run(root);
+//     jobs.wait(root);
+//     // or
+//     jobs.parallelFor(meshCount, 64, [&](size_t begin, size_t end) { cull(begin, end); });
+class JobSystem
+{
+public:
+    struct Job
+    {
+        std::function<void()> fn;
+        Job *parent{nullptr};
+        // own function + unfinished children
+        std::atomic<int32_t> unfinished{0};
+    };
+
+    // jobs are recycled from a ring per thread (the std::function of a job may still allocate for big captures)
+    // past JOB_POOL_SIZE jobs in flight per submitting thread, createJob runs other jobs until the oldest one is done
+    static constexpr size_t JOB_POOL_SIZE = 4096;
+
+    explicit JobSystem(uint32_t workerCount = std::thread::hardware_concurrency())
+        : _workerCount(std::max(workerCount, 1u)), _injected(JOB_POOL_SIZE)
+    {
+        // one more job pool: threads which are not workers
+        _queues.reserve(_workerCount);
+        _pools.reserve(_workerCount + 1);
+        for (uint32_t worker = 0; worker < _workerCount; ++worker)
+        {
+            _queues.emplace_back(std::make_unique<WorkStealingDeque>());
+        }
+        for (uint32_t worker = 0; worker <= _workerCount; ++worker)
+        {
+            _pools.emplace_back(std::make_unique<JobPool>());
+        }
+        tlsSystem = this;
+        tlsWorker = 0;
+        _threads.reserve(_workerCount - 1);
+        for (uint32_t worker = 1; worker < _workerCount; ++worker)
+        {
+            _threads.emplace_back([this, worker]()
+                                  { workerLoop(worker); });
+        }
+    }
+
+    JobSystem(const JobSystem &) = delete;
+    JobSystem &operator=(const JobSystem &) = delete;
+
+    // jobs never run are dropped, wait for the ones which matter before
+    ~JobSystem()
+    {
+        {
+            std::scoped_lock lock{_sleepMux};
+            _stop = true;
+        }
+        _sleepCv.notify_all();
+        for (auto &thread : _threads)
+        {
+            thread.join();
+        }
+        if (tlsSystem == this)
+        {
+            tlsSystem = nullptr;
+        }
+    }
+
+    // parent: done only once this job is done as well, must not be running yet or be waited on from inside a child
+    Job *createJob(std::function<void()> fn, Job *parent = nullptr)
+    {
+        auto *job = allocateJob();
+        job->fn = std::move(fn);
+        job->parent = parent;
+        job->unfinished.store(1, std::memory_order_relaxed);
+        if (parent)
+        {
+            parent->unfinished.fetch_add(1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    void run(Job *job)
+    {
+        const auto worker = getWorkerIndex();
+        if (worker < _workerCount)
+        {
+            if (!_queues[worker]->push(job))
+            {
+                // deque full: no parallelism left to gain
+                execute(job);
+                return;
+            }
+        }
+        else if (!_injected.try_push(job))
+        {
+            execute(job);
+            return;
+        }
+        _sleepCv.notify_one();
+    }
+
+    inline bool isDone(const Job *job) const
+    {
+        return job->unfinished.load(std::memory_order_acquire) == 0;
+    }
+
+    // the calling thread executes jobs until job is done
+    void wait(const Job *job)
+    {
+        ZoneScopedN("JobSystem::wait");
+        const auto worker = getWorkerIndex();
+        while (!isDone(job))
+        {
+            if (auto *next = findJob(worker))
+            {
+                execute(next);
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // [0, count) in ranges of grain items, grain 0: a few ranges per worker
+    // returns once every range is done, the calling thread works as well
+    void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)> &fn)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        if (grain == 0)
+        {
+            grain = std::max<size_t>(1, count / (size_t(_workerCount) * 4));
+        }
+        // stay well within the job pool of the calling thread
+        grain = std::max(grain, (count + JOB_POOL_SIZE / 2 - 1) / (JOB_POOL_SIZE / 2));
+        auto *root = createJob([]() {});
+        for (size_t begin = 0; begin < count; begin += grain)
+        {
+            const auto end = std::min(begin + grain, count);
+            run(createJob([&fn, begin, end]()
+                          { fn(begin, end); },
+                          root));
+        }
+        run(root);
+        wait(root);
+    }
+
+    inline uint32_t getWorkerCount() const
+    {
+        return _workerCount;
+    }
+
+    // [0, getWorkerCount()) for the workers of this job system (0: the creating thread), getWorkerCount() otherwise
+    inline uint32_t getWorkerIndex() const
+    {
+        return tlsSystem == this ? tlsWorker : _workerCount;
+    }
+
+private:
+    // Chase-Lev: "Dynamic Circular Work-Stealing Deque", fixed capacity
+    // (memory orders from "Correct and Efficient Work-Stealing for Weak Memory Models")
+    class WorkStealingDeque
+    {
+    public:
+        static constexpr int64_t CAPACITY = 4096;
+
+        // owner only
+        bool push(Job *job)
+        {
+            const auto bottom = _bottom.load(std::memory_order_relaxed);
+            const auto top = _top.load(std::memory_order_acquire);
+            if (bottom - top >= CAPACITY)
+            {
+                return false;
+            }
+            _buffer[bottom & (CAPACITY - 1)].store(job, std::memory_order_relaxed);
+            // publishes the job (and what it points to) to the thieves
+            _bottom.store(bottom + 1, std::memory_order_release);
+            return true;
+        }
+
+        // owner only
+        Job *pop()
+        {
+            const auto bottom = _bottom.load(std::memory_order_relaxed) - 1;
+            _bottom.store(bottom, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto top = _top.load(std::memory_order_relaxed);
+            if (top > bottom)
+            {
+                // empty
+                _bottom.store(bottom + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            auto *job = _buffer[bottom & (CAPACITY - 1)].load(std::memory_order_relaxed);
+            if (top == bottom)
+            {
+                // last one: race against the thieves
+                if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                {
+                    job = nullptr;
+                }
+                _bottom.store(bottom + 1, std::memory_order_relaxed);
+            }
+            return job;
+        }
+
+        // any thread
+        Job *steal()
+        {
+            auto top = _top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const auto bottom = _bottom.load(std::memory_order_acquire);
+            if (top >= bottom)
+            {
+                return nullptr;
+            }
+            auto *job = _buffer[top & (CAPACITY - 1)].load(std::memory_order_relaxed);
+            if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                // lost against another thief or the owner
+                return nullptr;
+            }
+            return job;
+        }
+
+    private:
+        // separate cache lines: thieves hammer top, the owner bottom
+        alignas(64) std::atomic<int64_t> _top{0};
+        alignas(64) std::atomic<int64_t> _bottom{0};
+        std::array<std::atomic<Job *>, CAPACITY> _buffer{};
+    };
+
+    struct JobPool
+    {
+        std::array<Job, JOB_POOL_SIZE> jobs;
+        size_t next{0};
+    };
+
+    // a job created but never run holds its slot forever: a thread must not create more than JOB_POOL_SIZE
+    // jobs before running them (e.g. the children of a root)
+    Job *allocateJob()
+    {
+        const auto worker = getWorkerIndex();
+        auto &pool = *_pools[worker];
+        for (;;)
+        {
+            {
+                // threads which are not workers share the last pool
+                std::unique_lock lock{_externalPoolMux, std::defer_lock};
+                if (worker == _workerCount)
+                {
+                    lock.lock();
+                }
+                auto *job = &pool.jobs[pool.next % JOB_POOL_SIZE];
+                if (isDone(job))
+                {
+                    ++pool.next;
+                    // claimed: no other thread sharing the pool picks it before createJob fills it
+                    job->unfinished.store(1, std::memory_order_relaxed);
+                    return job;
+                }
+            }
+            // pool exhausted: help with the jobs in flight, outside of the lock since they may create jobs as well
+            if (auto *next = findJob(worker))
+            {
+                execute(next);
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    void execute(Job *job)
+    {
+        job->fn();
+        finish(job);
+    }
+
+    void finish(Job *job)
+    {
+        // read before: once done, the job may be recycled by its creator
+        auto *parent = job->parent;
+        // last one out notifies the parent
+        if (job->unfinished.fetch_sub(1, std::memory_order_acq_rel) == 1 && parent)
+        {
+            finish(parent);
+        }
+    }
+
+    Job *findJob(uint32_t worker)
+    {
+        if (worker < _workerCount)
+        {
+            if (auto *job = _queues[worker]->pop())
+            {
+                return job;
+            }
+        }
+        if (Job *injected{nullptr}; _injected.try_pop(injected))
+        {
+            return injected;
+        }
+        // random victim first, then everyone once
+        thread_local std::minstd_rand rng{std::random_device{}()};
+        const auto start = rng() % _workerCount;
+        for (uint32_t i = 0; i < _workerCount; ++i)
+        {
+            const auto victim = (start + i) % _workerCount;
+            if (victim == worker)
+            {
+                continue;
+            }
+            if (auto *job = _queues[victim]->steal())
+            {
+                return job;
+            }
+        }
+        return nullptr;
+    }
+
+    void workerLoop(uint32_t worker)
+    {
+        tlsSystem = this;
+        tlsWorker = worker;
+        uint32_t idleSpins = 0;
+        while (!_stop.load(std::memory_order_relaxed))
+        {
+            if (auto *job = findJob(worker))
+            {
+                execute(job);
+                idleSpins = 0;
+                continue;
+            }
+            if (++idleSpins < 64)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            // nothing to steal for a while: sleep until run() notifies, the timeout covers a missed notification
+            std::unique_lock lock{_sleepMux};
+            _sleepCv.wait_for(lock, std::chrono::milliseconds(1), [this]()
+                              { return _stop.load(std::memory_order_relaxed); });
+            idleSpins = 0;
+        }
+    }
+
+    inline static thread_local const JobSystem *tlsSystem{nullptr};
+    inline static thread_local uint32_t tlsWorker{0};
+
+    uint32_t _workerCount{1};
+    std::vector<std::unique_ptr<WorkStealingDeque>> _queues;
+    // [0, workerCount): one per worker, workerCount: shared by the other threads
+    std::vector<std::unique_ptr<JobPool>> _pools;
+    std::mutex _externalPoolMux;
+    QueueLockFree<Job *> _injected;
+    std::vector<std::thread> _threads;
+
+    std::mutex _sleepMux;
+    std::condition_variable _sleepCv;
+    std::atomic<bool> _stop{false};
+};
@@ -1,11 +1,19 @@
 #include <filesystem>
 #include <fstream>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+#include <unordered_set>
+#include <thread>
+#include <chrono>
+#include <mutex>
 
 #include <glslang/Include/glslang_c_interface.h>
 #include <glslang/Public/resource_limits_c.h> //c
 #include <glslang/Public/ResourceLimits.h>    //c++
 #include <glslang/Public/ShaderLang.h>
 #include <glslang/SPIRV/GlslangToSpv.h>
+#include <spirv-tools/optimizer.hpp>
 
 #include <DirStackFileIncluder.h>
 
@@ -21,6 +29,54 @@ std::string getAssetPath()
 #endif
 }
 
+std::string getCachePath()
+{
+#if defined(VK_USE_PLATFORM_ANDROID_KHR)
+    return "";
+#else
+    const auto path = std::filesystem::current_path().parent_path() / "cache";
+    return path.string();
+#endif
+}
+
+bool writeFileAtomic(const std::string &filePath, const void *data, size_t sizeInBytes)
+{
+    const std::filesystem::path path(filePath);
+    // unique per thread: concurrent writers of the same file never share the temporary file
+    const auto tmpPath = std::filesystem::path(
+        filePath + "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp");
+    std::error_code ec;
+    if (path.has_parent_path())
+    {
+        std::filesystem::create_directories(path.parent_path(), ec);
+    }
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            log(Level::Warn, "writeFileAtomic: failed to open ", tmpPath.string());
+            return false;
+        }
+        file.write(reinterpret_cast<const char *>(data), sizeInBytes);
+        file.flush();
+        if (!file.good())
+        {
+            log(Level::Warn, "writeFileAtomic: failed to write ", tmpPath.string());
+            std::filesystem::remove(tmpPath, ec);
+            return false;
+        }
+    }
+    // replaces the existing file in one step
+    std::filesystem::rename(tmpPath, path, ec);
+    if (ec)
+    {
+        log(Level::Warn, "writeFileAtomic: failed to rename into ", filePath, ": ", ec.message());
+        std::filesystem::remove(tmpPath, ec);
+        return false;
+    }
+    return true;
+}
+
 std::vector<char> readFile(const std::string &filePath, bool isBinary)
 {
     std::ios_base::openmode mode = std::ios::ate;
@@ -83,6 +139,210 @@ EShLanguage shaderStageFromFileName(const std::filesystem::path &path)
     }
 }
 
+// spirv cache key: fnv-1a 64
+constexpr uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+constexpr uint64_t FNV_PRIME = 1099511628211ull;
+// bump when the compile path changes in a way the key does not capture
+constexpr uint32_t SPIRV_CACHE_VERSION = 1;
+constexpr uint32_t SPIRV_MAGIC_NUMBER = 0x07230203;
+
+uint64_t hashBytes(uint64_t hash, const void *data, size_t sizeInBytes)
+{
+    const auto bytes = reinterpret_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < sizeInBytes; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+uint64_t hashString(uint64_t hash, const std::string &str)
+{
+    // length first: "ab"+"c" and "a"+"bc" must differ
+    const uint64_t size = str.size();
+    hash = hashBytes(hash, &size, sizeof(size));
+    return hashBytes(hash, str.data(), str.size());
+}
+
+// text of readFile(.., false) is null terminated
+std::string shaderSource(const std::vector<char> &shaderText)
+{
+    return std::string(shaderText.data(), strnlen(shaderText.data(), shaderText.size()));
+}
+
+// same search order as DirStackFileIncluder: directory of the includer, then the include directories
+std::filesystem::path resolveInclude(const std::string &headerName,
+                                     const std::filesystem::path &includerDir,
+                                     const std::vector<std::string> &includeDirs)
+{
+    if (auto path = includerDir / headerName; !includerDir.empty() && std::filesystem::exists(path))
+    {
+        return path;
+    }
+    for (auto it = includeDirs.rbegin(); it != includeDirs.rend(); ++it)
+    {
+        if (auto path = std::filesystem::path(*it) / headerName; std::filesystem::exists(path))
+        {
+            return path;
+        }
+    }
+    return {};
+}
+
+// header names of the #include directives of source, in order
+// the preprocessor is not run: includes inside inactive #if branches are reported too
+std::vector<std::string> includeDirectives(const std::string &source)
+{
+    std::vector<std::string> headerNames;
+    std::istringstream lines(source);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        auto pos = line.find_first_not_of(" \t");
+        if (pos == std::string::npos || line[pos] != '#')
+        {
+            continue;
+        }
+        pos = line.find_first_not_of(" \t", pos + 1);
+        if (pos == std::string::npos || line.compare(pos, 7, "include") != 0)
+        {
+            continue;
+        }
+        const auto open = line.find_first_of("\"<", pos + 7);
+        if (open == std::string::npos)
+        {
+            continue;
+        }
+        const auto close = line.find_first_of(line[open] == '"' ? "\"" : ">", open + 1);
+        if (close == std::string::npos)
+        {
+            continue;
+        }
+        headerNames.emplace_back(line.substr(open + 1, close - open - 1));
+    }
+    return headerNames;
+}
+
+// fold the content of every #include (recursively) into the hash
+// includes inside inactive #if branches are folded too, which only costs a spurious miss
+uint64_t hashIncludes(uint64_t hash,
+                      const std::string &source,
+                      const std::filesystem::path &includerDir,
+                      const std::vector<std::string> &includeDirs,
+                      std::unordered_set<std::string> &visited)
+{
+    for (const auto &headerName : includeDirectives(source))
+    {
+        hash = hashString(hash, headerName);
+        const auto path = resolveInclude(headerName, includerDir, includeDirs);
+        if (path.empty())
+        {
+            // glslang reports the error on the miss path
+            continue;
+        }
+        const auto canonicalPath = std::filesystem::weakly_canonical(path).string();
+        if (!visited.insert(canonicalPath).second)
+        {
+            continue;
+        }
+        const auto includeSource = shaderSource(readFile(canonicalPath, false));
+        hash = hashString(hash, includeSource);
+        hash = hashIncludes(hash, includeSource, path.parent_path(), includeDirs, visited);
+    }
+    return hash;
+}
+
+// everything which changes the output of compileGlslToSpirv
+uint64_t spirvCacheKey(const std::string &source,
+                       EShLanguage shaderStage,
+                       const std::string &shaderDir,
+                       const std::vector<std::string> &includeDirs,
+                       const char *entryPoint,
+                       const std::string &compileOptions)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+    hash = hashBytes(hash, &SPIRV_CACHE_VERSION, sizeof(SPIRV_CACHE_VERSION));
+    const auto generatorVersion = glslang::GetSpirvGeneratorVersion();
+    hash = hashBytes(hash, &generatorVersion, sizeof(generatorVersion));
+    hash = hashBytes(hash, &shaderStage, sizeof(shaderStage));
+    hash = hashString(hash, entryPoint);
+    hash = hashString(hash, compileOptions);
+    hash = hashString(hash, source);
+    std::unordered_set<std::string> visited;
+    return hashIncludes(hash, source, shaderDir, includeDirs, visited);
+}
+
+// canonical paths of every #include (recursively), same resolution as hashIncludes
+void collectIncludes(const std::string &source,
+                     const std::filesystem::path &includerDir,
+                     const std::vector<std::string> &includeDirs,
+                     std::unordered_set<std::string> &visited,
+                     std::vector<std::string> &includes)
+{
+    for (const auto &headerName : includeDirectives(source))
+    {
+        const auto path = resolveInclude(headerName, includerDir, includeDirs);
+        if (path.empty())
+        {
+            continue;
+        }
+        const auto canonicalPath = std::filesystem::weakly_canonical(path).string();
+        if (!visited.insert(canonicalPath).second)
+        {
+            continue;
+        }
+        includes.emplace_back(canonicalPath);
+        collectIncludes(shaderSource(readFile(canonicalPath, false)), path.parent_path(), includeDirs, visited, includes);
+    }
+}
+
+const char *shaderBuildProfileName(SHADER_BUILD_PROFILE profile)
+{
+    switch (profile)
+    {
+    case SHADER_PROFILE_DEBUG:
+        return "debug";
+    case SHADER_PROFILE_RELEASE:
+        return "release";
+    case SHADER_PROFILE_SIZE:
+        return "size";
+    default:
+        ASSERT(false, "unsupported shader build profile");
+        return "";
+    }
+}
+
+// target environment, per stage
+std::tuple<glslang::EshTargetClientVersion, glslang::EShTargetLanguageVersion> spirvTarget(EShLanguage shaderStage)
+{
+    glslang::EshTargetClientVersion clientVersion = glslang::EShTargetVulkan_1_3;
+    glslang::EShTargetLanguageVersion langVersion = glslang::EShTargetSpv_1_6;
+    // raytracing
+    if (shaderStage == EShLangRayGen || shaderStage == EShLangAnyHit ||
+        shaderStage == EShLangClosestHit || shaderStage == EShLangMiss)
+    {
+        langVersion = glslang::EShTargetSpv_1_4;
+    }
+    return std::make_tuple(clientVersion, langVersion);
+}
+
+// SPIRV-Tools environment of the glslang client version
+static spv_target_env spirvToolsTarget(glslang::EshTargetClientVersion clientVersion)
+{
+    switch (clientVersion)
+    {
+    case glslang::EShTargetVulkan_1_0:
+        return SPV_ENV_VULKAN_1_0;
+    case glslang::EShTargetVulkan_1_1:
+        return SPV_ENV_VULKAN_1_1;
+    case glslang::EShTargetVulkan_1_2:
+        return SPV_ENV_VULKAN_1_2;
+    default:
+        return SPV_ENV_VULKAN_1_3;
+    }
+}
+
 // 1. load spv as binary, easy
 // 2. build from glsl in the runtime; complicated
 // data: txt array
@@ -90,24 +350,25 @@ EShLanguage shaderStageFromFileName(const std::filesystem::path &path)
 // shaderDir for include
 // entryPoint: main()
 // std::vector<char>: binary array
-std::vector<char> glslToSpirv(const std::vector<char> &shaderText,
-                              EShLanguage shaderStage,
-                              const std::string &shaderDir,
-                              const char *entryPoint)
+std::vector<char> compileGlslToSpirv(const std::vector<char> &shaderText,
+                                     EShLanguage shaderStage,
+                                     const std::vector<std::string> &includeDirs,
+                                     const char *entryPoint,
+                                     SHADER_BUILD_PROFILE profile)
 {
+    const bool debugInfo = profile == SHADER_PROFILE_DEBUG;
+
+    // process wide tables, once, before shaders are compiled from several threads
+    static std::once_flag glslangInitialized;
+    std::call_once(glslangInitialized, []()
+                   { glslang::InitializeProcess(); });
+
     glslang::TShader tmp(shaderStage);
     const char *data = shaderText.data();
     // c style: array + size
     tmp.setStrings(&data, 1);
 
-    glslang::EshTargetClientVersion clientVersion = glslang::EShTargetVulkan_1_3;
-    glslang::EShTargetLanguageVersion langVersion = glslang::EShTargetSpv_1_6;
-    // raytracing
-    if (shaderStage == EShLangRayGen || shaderStage == EShLangAnyHit ||
-        shaderStage == EShLangClosestHit || shaderStage == EShLangMiss)
-    {
-        langVersion = glslang::EShTargetSpv_1_4;
-    }
+    const auto [clientVersion, langVersion] = spirvTarget(shaderStage);
 
     // use opengl 4.6
     tmp.setEnvInput(glslang::EShSourceGlsl, shaderStage, glslang::EShClientVulkan, 460);
@@ -123,15 +384,11 @@ std::vector<char> glslToSpirv(const std::vector<char> &shaderText,
     const TBuiltInResource *resources = GetDefaultResources();
     // Message choices for what errors and warnings are given.
     // https://chromium.googlesource.com/external/github.com/KhronosGroup/glslang/+/refs/heads/SPIR-V_1.4/glslang/Public/ShaderLang.h
-    EShMessages messages = (EShMessages)(EShMsgDefault | EShMsgSpvRules | EShMsgVulkanRules | EShMsgDebugInfo);
+    EShMessages messages = (EShMessages)(EShMsgDefault | EShMsgSpvRules | EShMsgVulkanRules |
+                                         (debugInfo ? EShMsgDebugInfo : EShMsgDefault));
 
     DirStackFileIncluder includer;
-    std::vector<std::string> IncludeDirectoryList;
-
-    const auto sharedShaderPath = getAssetPath();
-    IncludeDirectoryList.push_back(sharedShaderPath);
-
-    std::for_each(IncludeDirectoryList.rbegin(), IncludeDirectoryList.rend(), [&includer](const std::string &dir)
+    std::for_each(includeDirs.rbegin(), includeDirs.rend(), [&includer](const std::string &dir)
                   { includer.pushExternalLocalDirectory(dir); });
     std::string preprocessedGLSL;
     if (!tmp.preprocess(resources, 460, ENoProfile, false, false, messages,
@@ -141,14 +398,12 @@ std::vector<char> glslToSpirv(const std::vector<char> &shaderText,
         std::cout << std::endl;
         std::cout << tmp.getInfoLog() << std::endl;
         std::cout << tmp.getInfoDebugLog() << std::endl;
-        ASSERT(false, "Error occured");
         return std::vector<char>();
     }
 
     // preprocessedGLSL = removeUnnecessaryLines(preprocessedGLSL);
 
     const char *preprocessedGLSLStr = preprocessedGLSL.c_str();
-    std::cout << preprocessedGLSL << std::endl;
 
     // without include
     glslang::TShader tshader(shaderStage);
@@ -165,20 +420,19 @@ std::vector<char> glslToSpirv(const std::vector<char> &shaderText,
         std::cout << std::endl;
         std::cout << tshader.getInfoLog() << std::endl;
         std::cout << tshader.getInfoDebugLog() << std::endl;
-        ASSERT(false, "parse failed");
         return std::vector<char>();
     }
 
     glslang::SpvOptions spvOptions;
 
-    // use debug settings
-    tshader.setDebugInfo(true);
-    spvOptions.emitNonSemanticShaderDebugInfo = true;
-    spvOptions.emitNonSemanticShaderDebugSource = true;
-    spvOptions.generateDebugInfo = true;
+    // debug: keep everything for shader debuggers
+    // release/size: no debug info, optimized after GlslangToSpv
+    // glslang itself only optimizes hlsl or optimizeSize, and only when built with ENABLE_OPT (off, see CMakeLists.txt)
+    tshader.setDebugInfo(debugInfo);
+    spvOptions.emitNonSemanticShaderDebugInfo = debugInfo;
+    spvOptions.emitNonSemanticShaderDebugSource = debugInfo;
+    spvOptions.generateDebugInfo = debugInfo;
     spvOptions.disableOptimizer = true;
-    spvOptions.optimizeSize = false;
-    spvOptions.stripDebugInfo = false;
 
     glslang::TProgram program;
     program.addShader(&tshader);
@@ -187,7 +441,7 @@ std::vector<char> glslToSpirv(const std::vector<char> &shaderText,
         std::cout << "Parsing failed for shader " << std::endl;
         std::cout << program.getInfoLog() << std::endl;
         std::cout << program.getInfoDebugLog() << std::endl;
-        ASSERT(false, "Failed to link shader stage to program");
+        return std::vector<char>();
     }
 
     std::vector<uint32_t> spirvArtifacts;
@@ -198,6 +452,36 @@ std::vector<char> glslToSpirv(const std::vector<char> &shaderText,
                           &spvLogger,
                           &spvOptions);
 
+    // release/size: SPIRV-Tools performance or size recipe, then strip what is left of the debug info
+    if (!debugInfo)
+    {
+        spvtools::Optimizer optimizer(spirvToolsTarget(clientVersion));
+        optimizer.SetMessageConsumer([](spv_message_level_t level, const char *, const spv_position_t &, const char *message)
+                                     {
+                                         if (level <= SPV_MSG_ERROR)
+                                         {
+                                             log(Level::Warn, "SPIRV-Tools: ", message);
+                                         } });
+        if (profile == SHADER_PROFILE_SIZE)
+        {
+            optimizer.RegisterSizePasses();
+        }
+        else
+        {
+            optimizer.RegisterPerformancePasses();
+        }
+        optimizer.RegisterPass(spvtools::CreateStripDebugInfoPass());
+        std::vector<uint32_t> optimized;
+        if (optimizer.Run(spirvArtifacts.data(), spirvArtifacts.size(), &optimized))
+        {
+            spirvArtifacts.swap(optimized);
+        }
+        else
+        {
+            log(Level::Warn, "SPIRV-Tools optimizer failed, keeping the unoptimized SPIR-V");
+        }
+    }
+
     std::vector<char> byteCode;
     byteCode.resize(spirvArtifacts.size() * (sizeof(uint32_t) / sizeof(char)));
     std::memcpy(byteCode.data(), spirvArtifacts.data(), byteCode.size());
@@ -205,22 +489,105 @@ std::vector<char> glslToSpirv(const std::vector<char> &shaderText,
     return byteCode;
 }
 
-VkShaderModule createShaderModule(
-    VkDevice logicalDevice,
+// content addressed: getCachePath()/spirv/<key>.spv
+// a hit skips glslang entirely
+std::vector<char> glslToSpirv(const std::vector<char> &shaderText,
+                              EShLanguage shaderStage,
+                              const std::string &shaderDir,
+                              const char *entryPoint,
+                              SHADER_BUILD_PROFILE profile)
+{
+    const std::vector<std::string> includeDirs{getAssetPath()};
+    // must follow compileGlslToSpirv
+    const auto [clientVersion, langVersion] = spirvTarget(shaderStage);
+    const std::string compileOptions = "glsl460;vulkan" + std::to_string(clientVersion) +
+                                       ";spv" + std::to_string(langVersion) +
+                                       ";" + shaderBuildProfileName(profile) +
+                                       // entries written before the optimizer ran are not reused
+                                       ";spvopt";
+
+    const auto source = shaderSource(shaderText);
+    const auto key = spirvCacheKey(source, shaderStage, shaderDir, includeDirs, entryPoint, compileOptions);
+    std::ostringstream fileName;
+    fileName << std::hex << std::setw(16) << std::setfill('0') << key << ".spv";
+    const auto cachePath = (std::filesystem::path(getCachePath()) / "spirv" / fileName.str()).string();
+
+    if (std::filesystem::exists(cachePath))
+    {
+        auto byteCode = readFile(cachePath);
+        // truncated/foreign file: compile and overwrite it
+        uint32_t magic{0};
+        if (byteCode.size() >= sizeof(magic) && byteCode.size() % sizeof(uint32_t) == 0)
+        {
+            memcpy(&magic, byteCode.data(), sizeof(magic));
+        }
+        if (magic == SPIRV_MAGIC_NUMBER)
+        {
+            return byteCode;
+        }
+        log(Level::Warn, "spirv cache: invalid entry ", cachePath);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    auto byteCode = compileGlslToSpirv(shaderText, shaderStage, includeDirs, entryPoint, profile);
+    if (byteCode.empty())
+    {
+        // compile error, never cached: the next call compiles and reports it again
+        return byteCode;
+    }
+    const auto elapsedInMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    log(Level::Info, "spirv cache: miss, compiled (", shaderBuildProfileName(profile), ") in ", elapsedInMs,
+        " ms, ", byteCode.size(), " bytes, stored as ", cachePath);
+    writeFileAtomic(cachePath, byteCode.data(), byteCode.size());
+    return byteCode;
+}
+
+std::vector<std::string> shaderIncludes(const std::string &filePath)
+{
+    const auto path = std::filesystem::path(filePath);
+    std::vector<std::string> includes;
+    if (path.extension().string() == ".spv")
+    {
+        return includes;
+    }
+    const std::vector<std::string> includeDirs{getAssetPath()};
+    std::unordered_set<std::string> visited;
+    collectIncludes(shaderSource(readFile(filePath, false)), path.parent_path(), includeDirs, visited, includes);
+    return includes;
+}
+
+std::vector<char> buildSpirv(
     const std::string &filePath,
     const std::string &entryPoint,
-    const std::string &correlationId)
+    SHADER_BUILD_PROFILE profile)
 {
-    VkShaderModule res;
     const auto path = std::filesystem::path(filePath);
     const bool isBinary = path.extension().string() == ".spv";
     std::vector<char> data = readFile(filePath, isBinary);
-    if (!isBinary)
+    if (isBinary)
     {
-        data = glslToSpirv(data,
-                           shaderStageFromFileName(path),
-                           path.parent_path().string(),
-                           entryPoint.c_str());
+        return data;
+    }
+    return glslToSpirv(data,
+                       shaderStageFromFileName(path),
+                       path.parent_path().string(),
+                       entryPoint.c_str(),
+                       profile);
+}
+
+VkShaderModule tryCreateShaderModule(
+    VkDevice logicalDevice,
+    const std::string &filePath,
+    const std::string &entryPoint,
+    const std::string &correlationId,
+    SHADER_BUILD_PROFILE profile)
+{
+    VkShaderModule res{VK_NULL_HANDLE};
+    const auto data = buildSpirv(filePath, entryPoint, profile);
+    if (data.empty())
+    {
+        log(Level::Warn, "failed to build shader module ", filePath);
+        return res;
     }
     const VkShaderModuleCreateInfo shaderModule = {
         .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
@@ -231,6 +598,18 @@ VkShaderModule createShaderModule(
     return res;
 }
 
+VkShaderModule createShaderModule(
+    VkDevice logicalDevice,
+    const std::string &filePath,
+    const std::string &entryPoint,
+    const std::string &correlationId,
+    SHADER_BUILD_PROFILE profile)
+{
+    auto res = tryCreateShaderModule(logicalDevice, filePath, entryPoint, correlationId, profile);
+    ASSERT(res, "failed to compile shader");
+    return res;
+}
+
 // input: shaderModule Meta
 // output: to meet the vk api
 std::vector<VkPipelineShaderStageCreateInfo> gatherPipelineShaderStageCreateInfos(
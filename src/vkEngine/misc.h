@@ -78,6 +78,8 @@ void log(Level level, ARGS &&...args)
     } while (0)
 
 std::string getAssetPath();
+// persistent caches (pipeline cache, ...) which survive across runs
+std::string getCachePath();
 
 struct VertexDef1
 {
@@ -191,16 +193,49 @@ private:
 };
 
 std::vector<char> readFile(const std::string &filePath, bool isBinary = true);
+// write into a temporary file first, then rename it over filePath: readers never see a partial file
+bool writeFileAtomic(const std::string &filePath, const void *data, size_t sizeInBytes);
 inline uint32_t alignedSize(uint32_t value, uint32_t alignment)
 {
     return (value + alignment - 1) & ~(alignment - 1);
 }
 
+// runtime glsl -> spirv settings, part of the spirv cache key
+enum SHADER_BUILD_PROFILE : int
+{
+    // debug info (incl. non-semantic for shader debuggers), no optimizer
+    SHADER_PROFILE_DEBUG = 0,
+    // SPIRV-Tools performance passes, debug info stripped
+    SHADER_PROFILE_RELEASE,
+    // SPIRV-Tools size passes, debug info stripped
+    SHADER_PROFILE_SIZE,
+};
+
+const char *shaderBuildProfileName(SHADER_BUILD_PROFILE profile);
+
+// spirv of a glsl file built with the profile (through the spirv cache), .spv files as they are
+// empty on compile errors, the error is logged
+std::vector<char> buildSpirv(
+    const std::string &filePath,
+    const std::string &entryPoint,
+    SHADER_BUILD_PROFILE profile);
+
+// profile: the one of the context (VkContext::getShaderBuildProfile), or VkContext::createShaderModule which passes it
 VkShaderModule createShaderModule(
     VkDevice logicalDevice,
     const std::string &filePath,
     const std::string &entryPoint,
-    const std::string &correlationId);
+    const std::string &correlationId,
+    SHADER_BUILD_PROFILE profile);
+// VK_NULL_HANDLE on compile errors instead of asserting, the error is logged
+VkShaderModule tryCreateShaderModule(
+    VkDevice logicalDevice,
+    const std::string &filePath,
+    const std::string &entryPoint,
+    const std::string &correlationId,
+    SHADER_BUILD_PROFILE profile);
+// canonical paths of every file included by the glsl shader, recursively
+std::vector<std::string> shaderIncludes(const std::string &filePath);
 
 std::vector<VkPipelineShaderStageCreateInfo> gatherPipelineShaderStageCreateInfos(const std::unordered_map<VkShaderStageFlagBits, std::tuple<VkShaderModule, const char *, const VkSpecializationInfo *>> &shaderModuleEntities);
 uint32_t findShaderStageIndex(const std::vector<VkPipelineShaderStageCreateInfo> &shaderStages, const VkShaderModule shaderModule);
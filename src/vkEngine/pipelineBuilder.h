@@ -0,0 +1,287 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <misc.h>
+#include <context.h>
+#include <shaderHotReload.h>
+#include <jobSystem.h>
+
+// startup pipeline build phase
+// 1. passes register their shaders and pipelines (RenderPassBase::registerPipelines)
+// 2. build(): every shader stage is compiled concurrently (glslang or the spirv cache),
+//    then every pipeline is created concurrently against the shared pipeline cache of the context
+// 3. the handles are written into the destinations given at registration
+// 4. optional: with enableHotReload, the pipelines are rebuilt whenever their shaders change on disk
+// usage:
+//     PipelineBuilder builder(&ctx);
+//     cullFustrum.registerPipelines(builder);
+//     rayTracing.registerPipelines(builder);
+//     builder.build();
+//     cullFustrum.finalizeInit();
+//     rayTracing.finalizeInit();
+class PipelineBuilder
+{
+public:
+    // index returned by addShader, referenced by the pipelines
+    using ShaderId = size_t;
+    using ShaderStages = std::unordered_map<VkShaderStageFlagBits, ShaderId>;
+
+    explicit PipelineBuilder(VkContext *ctx, uint32_t workerCount = std::thread::hardware_concurrency())
+        : _ctx(ctx), _workerCount(std::max(workerCount, 1u))
+    {
+        ASSERT(_ctx, "vk context should be defined");
+    }
+
+    // the same file/entry point is compiled once, every destination receives the module
+    ShaderId addShader(const std::string &filePath,
+                       const std::string &entryPoint,
+                       const std::string &correlationId,
+                       VkShaderModule *dst = nullptr)
+    {
+        const auto key = filePath + ":" + entryPoint;
+        auto [it, inserted] = _shaderIds.try_emplace(key, _shaders.size());
+        if (inserted)
+        {
+            _shaders.emplace_back(ShaderRequest{
+                .filePath = filePath,
+                .entryPoint = entryPoint,
+                .correlationId = correlationId,
+            });
+        }
+        if (dst)
+        {
+            _shaders[it->second].dsts.push_back(dst);
+        }
+        return it->second;
+    }
+
+    // compile and create on the workers of the job system instead of threads of its own
+    void setJobSystem(JobSystem *jobs)
+    {
+        _jobs = jobs;
+    }
+
+    // track every pipeline built from here on, see ShaderHotReload
+    void enableHotReload(ShaderHotReload *hotReload)
+    {
+        _hotReload = hotReload;
+    }
+
+    // onReloaded: called once a hot reloaded pipeline is swapped into dst, e.g. to refresh state derived from it
+    // not called when the reloaded pipeline fails to be created, dst keeps the previous one
+    // pipeline layouts are cached by the context, a reload only replaces the pipeline
+    void addGraphicsPipeline(
+        const ShaderStages &shaders,
+        const std::vector<VkDescriptorSetLayout> &dsLayouts,
+        const std::vector<VkPushConstantRange> &pushConstants,
+        VkRenderPass renderPass,
+        std::tuple<std::unordered_map<GRAPHICS_PIPELINE_SEMANTIC, VkPipeline>, VkPipelineLayout> *dst,
+        std::function<void()> onReloaded = {})
+    {
+        ASSERT(dst, "pipeline destination should be defined");
+        using PipelineEntity = std::tuple<std::unordered_map<GRAPHICS_PIPELINE_SEMANTIC, VkPipeline>, VkPipelineLayout>;
+        auto create = [ctx = _ctx, dsLayouts, pushConstants, renderPass](const ShaderHotReload::ShaderModuleEntities &entities, VkResult *result)
+        { return ctx->createGraphicsPipeline(entities, dsLayouts, pushConstants, renderPass, result); };
+        auto destroy = [logicalDevice = _ctx->getLogicDevice()](const PipelineEntity &pipeline)
+        {
+            for (const auto &[semantic, handle] : std::get<0>(pipeline))
+            {
+                vkDestroyPipeline(logicalDevice, handle, nullptr);
+            }
+        };
+        addPipeline<PipelineEntity>(shaders, create, destroy, dst, onReloaded);
+    }
+
+    void addComputePipeline(
+        ShaderId shader,
+        const std::vector<VkDescriptorSetLayout> &dsLayouts,
+        const std::vector<VkPushConstantRange> &pushConstants,
+        std::tuple<VkPipeline, VkPipelineLayout> *dst,
+        std::function<void()> onReloaded = {})
+    {
+        ASSERT(dst, "pipeline destination should be defined");
+        using PipelineEntity = std::tuple<VkPipeline, VkPipelineLayout>;
+        auto create = [ctx = _ctx, dsLayouts, pushConstants](const ShaderHotReload::ShaderModuleEntities &entities, VkResult *result)
+        { return ctx->createComputePipeline(entities, dsLayouts, pushConstants, result); };
+        auto destroy = [logicalDevice = _ctx->getLogicDevice()](const PipelineEntity &pipeline)
+        {
+            vkDestroyPipeline(logicalDevice, std::get<0>(pipeline), nullptr);
+        };
+        addPipeline<PipelineEntity>({{VK_SHADER_STAGE_COMPUTE_BIT, shader}}, create, destroy, dst, onReloaded);
+    }
+
+    void addRayTracingPipeline(
+        const ShaderStages &shaders,
+        const std::vector<VkDescriptorSetLayout> &dsLayouts,
+        const std::vector<VkPushConstantRange> &pushConstants,
+        std::tuple<VkPipeline, VkPipelineLayout, std::vector<VkRayTracingShaderGroupCreateInfoKHR>> *dst,
+        std::function<void()> onReloaded = {})
+    {
+        ASSERT(dst, "pipeline destination should be defined");
+        using PipelineEntity = std::tuple<VkPipeline, VkPipelineLayout, std::vector<VkRayTracingShaderGroupCreateInfoKHR>>;
+        auto create = [ctx = _ctx, dsLayouts, pushConstants](const ShaderHotReload::ShaderModuleEntities &entities, VkResult *result)
+        { return ctx->createRayTracingPipeline(entities, dsLayouts, pushConstants, result); };
+        auto destroy = [logicalDevice = _ctx->getLogicDevice()](const PipelineEntity &pipeline)
+        {
+            vkDestroyPipeline(logicalDevice, std::get<0>(pipeline), nullptr);
+        };
+        addPipeline<PipelineEntity>(shaders, create, destroy, dst, onReloaded);
+    }
+
+    // blocks until every shader module and pipeline is created
+    void build()
+    {
+        ZoneScopedN("PipelineBuilder::build");
+        const auto start = std::chrono::steady_clock::now();
+        auto logicalDevice = _ctx->getLogicDevice();
+        const auto shaderBuildProfile = _ctx->getShaderBuildProfile();
+
+        _shaderModules.assign(_shaders.size(), VK_NULL_HANDLE);
+        parallelFor(_shaders.size(), [&](size_t i)
+                    {
+                        const auto &shader = _shaders[i];
+                        _shaderModules[i] = createShaderModule(logicalDevice, shader.filePath, shader.entryPoint, shader.correlationId, shaderBuildProfile);
+                        for (auto dst : shader.dsts)
+                        {
+                            *dst = _shaderModules[i];
+                        } });
+        const auto shaderEnd = std::chrono::steady_clock::now();
+
+        parallelFor(_pipelines.size(), [&](size_t i)
+                    { _pipelines[i].create(); });
+        const auto pipelineEnd = std::chrono::steady_clock::now();
+
+        if (_hotReload)
+        {
+            for (auto &pipeline : _pipelines)
+            {
+                pipeline.track(*_hotReload);
+            }
+        }
+
+        using ms = std::chrono::duration<double, std::milli>;
+        log(Level::Info, "PipelineBuilder: ", _shaders.size(), " shader(s) in ", ms(shaderEnd - start).count(), " ms, ",
+            _pipelines.size(), " pipeline(s) in ", ms(pipelineEnd - shaderEnd).count(), " ms, ",
+            _jobs ? _jobs->getWorkerCount() : _workerCount, " worker(s)");
+
+        _shaders.clear();
+        _shaderIds.clear();
+        _pipelines.clear();
+    }
+
+private:
+    struct ShaderRequest
+    {
+        std::string filePath;
+        std::string entryPoint;
+        std::string correlationId;
+        std::vector<VkShaderModule *> dsts;
+    };
+
+    struct PipelineRequest
+    {
+        std::function<void()> create;
+        // after create, with the final shader modules
+        std::function<void(ShaderHotReload &)> track;
+    };
+
+    template <typename PipelineEntity>
+    void addPipeline(const ShaderStages &shaders,
+                     std::function<PipelineEntity(const ShaderHotReload::ShaderModuleEntities &, VkResult *)> create,
+                     std::function<void(const PipelineEntity &)> destroy,
+                     PipelineEntity *dst,
+                     std::function<void()> onReloaded)
+    {
+        _pipelines.emplace_back(PipelineRequest{
+            // startup: a failure aborts
+            .create = [this, shaders, create, dst]()
+            { *dst = create(shaderModuleEntities(shaders), nullptr); },
+            .track = [this, shaders, create, destroy, dst, onReloaded](ShaderHotReload &hotReload)
+            { hotReload.track<PipelineEntity>(shaderSources(shaders), create, destroy, dst, onReloaded); },
+        });
+    }
+
+    std::unordered_map<VkShaderStageFlagBits, ShaderHotReload::ShaderSource> shaderSources(const ShaderStages &shaders) const
+    {
+        std::unordered_map<VkShaderStageFlagBits, ShaderHotReload::ShaderSource> sources;
+        for (const auto &[stage, shader] : shaders)
+        {
+            const auto &request = _shaders[shader];
+            sources.emplace(stage, ShaderHotReload::ShaderSource{
+                                       .filePath = request.filePath,
+                                       .entryPoint = request.entryPoint,
+                                       .correlationId = request.correlationId,
+                                       .module = _shaderModules[shader],
+                                       .dsts = request.dsts,
+                                   });
+        }
+        return sources;
+    }
+
+    // called from the pipeline phase, every module exists by then
+    std::unordered_map<VkShaderStageFlagBits, std::tuple<VkShaderModule, const char *, const VkSpecializationInfo *>> shaderModuleEntities(
+        const ShaderStages &shaders) const
+    {
+        std::unordered_map<VkShaderStageFlagBits, std::tuple<VkShaderModule, const char *, const VkSpecializationInfo *>> entities;
+        for (const auto &[stage, shader] : shaders)
+        {
+            ASSERT(shader < _shaderModules.size() && _shaderModules[shader], "shader should be registered to the same builder");
+            entities.insert(std::make_pair(stage, std::make_tuple(_shaderModules[shader], _shaders[shader].entryPoint.c_str(), nullptr)));
+        }
+        return entities;
+    }
+
+    // the calling thread works as well, indices are handed out one by one
+    void parallelFor(size_t count, const std::function<void(size_t)> &fn)
+    {
+        if (_jobs)
+        {
+            // one item per job: a single shader or pipeline is already coarse
+            _jobs->parallelFor(count, 1, [&](size_t begin, size_t end)
+                               {
+                                   for (auto i = begin; i < end; ++i)
+                                   {
+                                       fn(i);
+                                   } });
+            return;
+        }
+        std::atomic<size_t> next{0};
+        auto worker = [&]()
+        {
+            for (auto i = next.fetch_add(1); i < count; i = next.fetch_add(1))
+            {
+                fn(i);
+            }
+        };
+        const auto helperCount = std::min<size_t>(_workerCount, count) > 0 ? std::min<size_t>(_workerCount, count) - 1 : 0;
+        std::vector<std::future<void>> helpers;
+        helpers.reserve(helperCount);
+        for (size_t i = 0; i < helperCount; ++i)
+        {
+            helpers.emplace_back(std::async(std::launch::async, worker));
+        }
+        worker();
+        for (auto &helper : helpers)
+        {
+            helper.get();
+        }
+    }
+
+    VkContext *_ctx{nullptr};
+    uint32_t _workerCount{1};
+    std::vector<ShaderRequest> _shaders;
+    std::unordered_map<std::string, ShaderId> _shaderIds;
+    std::vector<VkShaderModule> _shaderModules;
+    std::vector<PipelineRequest> _pipelines;
+    ShaderHotReload *_hotReload{nullptr};
+    JobSystem *_jobs{nullptr};
+};
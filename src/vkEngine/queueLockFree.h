@@ -0,0 +1,321 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <concepts>
+
+// bounded multi-producer multi-consumer ring, lock-free (Vyukov):
+// every cell carries a sequence number which says whose turn it is,
+// producers/consumers claim positions with one cas on the enqueue/dequeue counter, no lock on push/pop
+// the mutex and cv are only taken by threads sleeping in wait_pop_for, and by pushers when someone sleeps
+// unlike QueueThreadSafe: move-only elements, bulk operations, close() and timed wait
+// usage:
+//     QueueLockFree<std::unique_ptr<Task>> queue(1024);
+//     // producers
+//     if (!queue.try_push(std::move(task))) { /* full or closed */ }
+//     // consumers
+//     while (auto task = queue.wait_pop_for(std::chrono::milliseconds(10))) { (*task)->run(); }
+//     // shutdown: every waiter returns, pops drain what is left
+//     queue.close();
+template <typename T>
+class QueueLockFree
+{
+public:
+    // rounded up to a power of two
+    explicit QueueLockFree(size_t capacity)
+        : _capacity(std::bit_ceil(std::max<size_t>(capacity, 2))),
+          _mask(_capacity - 1),
+          _cells(std::make_unique<Cell[]>(_capacity))
+    {
+        for (size_t i = 0; i < _capacity; ++i)
+        {
+            _cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    QueueLockFree(const QueueLockFree &) = delete;
+    QueueLockFree &operator=(const QueueLockFree &) = delete;
+
+    ~QueueLockFree()
+    {
+        // whatever was never popped
+        while (try_pop())
+        {
+        }
+    }
+
+    // false: full or closed, v is left untouched
+    bool try_push(T &&v)
+    {
+        return try_push_bulk(&v, 1) == 1;
+    }
+
+    bool try_push(const T &v)
+        requires std::copy_constructible<T>
+    {
+        T copy(v);
+        return try_push(std::move(copy));
+    }
+
+    // moves the leading elements of [first, first + count) which fit, returns how many
+    // one cas for the whole run of free cells
+    size_t try_push_bulk(T *first, size_t count)
+    {
+        if (count == 0 || closed())
+        {
+            return 0;
+        }
+        auto pos = _enqueuePos.load(std::memory_order_relaxed);
+        size_t claimed = 0;
+        for (;;)
+        {
+            claimed = 0;
+            bool stale = false;
+            while (claimed < count)
+            {
+                const auto sequence = _cells[(pos + claimed) & _mask].sequence.load(std::memory_order_acquire);
+                const auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos + claimed);
+                if (diff == 0)
+                {
+                    // free for this lap
+                    ++claimed;
+                    continue;
+                }
+                // diff < 0: still occupied from the previous lap (full), diff > 0: another producer got further
+                stale = diff > 0 && claimed == 0;
+                break;
+            }
+            if (claimed == 0 && !stale)
+            {
+                return 0;
+            }
+            if (claimed > 0 && _enqueuePos.compare_exchange_weak(pos, pos + claimed, std::memory_order_relaxed))
+            {
+                break;
+            }
+            if (stale)
+            {
+                pos = _enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        for (size_t i = 0; i < claimed; ++i)
+        {
+            auto &cell = _cells[(pos + i) & _mask];
+            new (cell.storage) T(std::move(first[i]));
+            // ready for the consumer of this lap
+            cell.sequence.store(pos + i + 1, std::memory_order_release);
+        }
+        notifyWaiters(claimed);
+        return claimed;
+    }
+
+    // false: empty (closed or not)
+    bool try_pop(T &v)
+    {
+        return try_pop_bulk(&v, 1) == 1;
+    }
+
+    std::optional<T> try_pop()
+    {
+        std::optional<T> v;
+        if (auto pos = claimPop(1); pos.first)
+        {
+            v.emplace(take(pos.second));
+        }
+        return v;
+    }
+
+    // moves up to maxCount elements into out, returns how many, one cas for the whole run
+    size_t try_pop_bulk(T *out, size_t maxCount)
+    {
+        const auto [claimed, pos] = claimPop(maxCount);
+        for (size_t i = 0; i < claimed; ++i)
+        {
+            out[i] = take(pos + i);
+        }
+        return claimed;
+    }
+
+    // nullopt: timed out, or closed and drained
+    template <typename Rep, typename Period>
+    std::optional<T> wait_pop_for(const std::chrono::duration<Rep, Period> &timeout)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        uint32_t backoff = 0;
+        for (;;)
+        {
+            if (auto v = try_pop())
+            {
+                return v;
+            }
+            if (closed())
+            {
+                return std::nullopt;
+            }
+            if (!empty())
+            {
+                // a producer claimed a cell but has not published it yet: the cv predicate would hold at once,
+                // back off instead of spinning on it (yield first, then short sleeps while the producer is descheduled)
+                const auto now = std::chrono::steady_clock::now();
+                if (now >= deadline)
+                {
+                    return try_pop();
+                }
+                if (backoff < MAX_YIELDS)
+                {
+                    ++backoff;
+                    std::this_thread::yield();
+                }
+                else
+                {
+                    std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(BACKOFF_SLEEP, deadline - now));
+                }
+                continue;
+            }
+            backoff = 0;
+            std::unique_lock lock{_mux};
+            // before the predicate: a pusher which misses the increment has already published (seq_cst on both sides)
+            _waiters.fetch_add(1, std::memory_order_seq_cst);
+            const auto ready = _cv.wait_until(lock, deadline, [this]()
+                                              { return closed() || !empty(); });
+            _waiters.fetch_sub(1, std::memory_order_relaxed);
+            if (!ready)
+            {
+                lock.unlock();
+                return try_pop();
+            }
+        }
+    }
+
+    // pushes fail from now on, every waiter wakes up, what is queued can still be popped
+    void close()
+    {
+        {
+            std::scoped_lock lock{_mux};
+            _closed.store(true, std::memory_order_seq_cst);
+        }
+        _cv.notify_all();
+    }
+
+    inline bool closed() const
+    {
+        return _closed.load(std::memory_order_acquire);
+    }
+
+    // approximate under contention
+    inline bool empty() const
+    {
+        return _dequeuePos.load(std::memory_order_seq_cst) >= _enqueuePos.load(std::memory_order_seq_cst);
+    }
+
+    inline size_t capacity() const
+    {
+        return _capacity;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence{0};
+        alignas(T) std::byte storage[sizeof(T)];
+    };
+
+    // {count, first position}
+    std::pair<size_t, size_t> claimPop(size_t maxCount)
+    {
+        if (maxCount == 0)
+        {
+            return {0, 0};
+        }
+        auto pos = _dequeuePos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            size_t claimed = 0;
+            bool stale = false;
+            while (claimed < maxCount)
+            {
+                const auto sequence = _cells[(pos + claimed) & _mask].sequence.load(std::memory_order_acquire);
+                const auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos + claimed + 1);
+                if (diff == 0)
+                {
+                    // filled for this lap
+                    ++claimed;
+                    continue;
+                }
+                // diff < 0: not produced yet (empty), diff > 0: another consumer got further
+                stale = diff > 0 && claimed == 0;
+                break;
+            }
+            if (claimed == 0 && !stale)
+            {
+                return {0, 0};
+            }
+            if (claimed > 0 && _dequeuePos.compare_exchange_weak(pos, pos + claimed, std::memory_order_relaxed))
+            {
+                return {claimed, pos};
+            }
+            if (stale)
+            {
+                pos = _dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // claimed position: move out, destroy, hand the cell to the producer of the next lap
+    T take(size_t pos)
+    {
+        auto &cell = _cells[pos & _mask];
+        auto *element = std::launder(reinterpret_cast<T *>(cell.storage));
+        T v(std::move(*element));
+        element->~T();
+        cell.sequence.store(pos + _capacity, std::memory_order_release);
+        return v;
+    }
+
+    void notifyWaiters(size_t count)
+    {
+        // pairs with the increment in wait_pop_for: either the waiter sees the new elements or we see the waiter
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_waiters.load(std::memory_order_seq_cst) == 0)
+        {
+            return;
+        }
+        // under the lock: a waiter is either before its predicate or already asleep
+        std::scoped_lock lock{_mux};
+        if (count == 1)
+        {
+            _cv.notify_one();
+        }
+        else
+        {
+            _cv.notify_all();
+        }
+    }
+
+    // wait_pop_for on a claimed but unpublished cell
+    static constexpr uint32_t MAX_YIELDS = 16;
+    static constexpr std::chrono::microseconds BACKOFF_SLEEP{50};
+
+    const size_t _capacity;
+    const size_t _mask;
+    std::unique_ptr<Cell[]> _cells;
+
+    // separate cache lines: producers hammer one, consumers the other
+    alignas(64) std::atomic<size_t> _enqueuePos{0};
+    alignas(64) std::atomic<size_t> _dequeuePos{0};
+    alignas(64) std::atomic<bool> _closed{false};
+    std::atomic<uint32_t> _waiters{0};
+    std::mutex _mux;
+    std::condition_variable _cv;
+};
@@ -5,7 +5,9 @@
 #include <glm/gtx/transform.hpp>
 
 #include <misc.h>
-#include <renderPassBase.h>
+#include <renderGraph.h>
+#include <pipelineBuilder.h>
+#include <barrierBatch.h>
 
 class RayTracing : public RenderPassBase,
                    public VkContextAccessor,
@@ -18,8 +20,13 @@ public:
     {
     }
 
+    // the caller makes sure the gpu is done (e.g. vkDeviceWaitIdle), sbts retired by a reload are freed at once
     ~RayTracing()
     {
+        for (auto &[frameNumber, destroy] : _retired)
+        {
+            destroy();
+        }
     }
 
     virtual void setContext(VkContext *ctx) override
@@ -83,50 +90,64 @@ public:
         _indirectDrawB = idb;
     }
 
-    virtual void finalizeInit() override
+    virtual void registerPipelines(PipelineBuilder &builder) override
     {
-        initShaderModules();
+        ASSERT(_ctx, "vk context should be defined");
         createDescriptorSetLayout();
-        initRTPipeline();
+
+        const auto shadersPath = getAssetPath();
+        const std::string entryPoint{"main"};
+        // ray generation, ray miss intersection, closet intersection: compiled concurrently
+        const auto rayGen = builder.addShader(shadersPath + "/rayGeneration.rgen", entryPoint, "rayGeneration.rgen", &_rtRayGenShaderModule);
+        const auto rayMiss = builder.addShader(shadersPath + "/rayMiss.rmiss", entryPoint, "rayMiss.rmiss", &_rtRayMissShaderModule);
+        const auto rayClosestHit = builder.addShader(shadersPath + "/rayClosestHit.rchit", entryPoint, "rayClosestHit.rchit", &_rtRayClosestHitShaderModule);
+        builder.addRayTracingPipeline(
+            {
+                {VK_SHADER_STAGE_RAYGEN_BIT_KHR, rayGen},
+                {VK_SHADER_STAGE_MISS_BIT_KHR, rayMiss},
+                {VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, rayClosestHit},
+            },
+            _descriptorSetLayouts,
+            {},
+            &_rtPipelineEntity,
+            [this]()
+            {
+                // hot reload: the shader group handles belong to the pipeline, the frames in flight still trace
+                // with the previous sbt: new sbt buffers, the previous ones are destroyed once those frames are complete
+                _retired.emplace_back(_ctx->getFrameNumber() - 1,
+                                      [vmaAllocator = _ctx->getVmaAllocator(),
+                                       sbts = std::array{std::get<0>(_rayGenSTBBuffer), std::get<0>(_rayMissSTBBuffer), std::get<0>(_rayClosestHitSTBBuffer)}]()
+                                      {
+                                          for (const auto &sbt : sbts)
+                                          {
+                                              vmaDestroyBuffer(vmaAllocator, std::get<BUFFER_ENTITY_UID::BUFFER>(sbt), std::get<BUFFER_ENTITY_UID::VMA_ALLOCATION>(sbt));
+                                          }
+                                      });
+                createSBT();
+            });
+    }
+
+    virtual void finalizeInit() override
+    {
+        // not part of a shared startup build phase: build its own
+        if (!std::get<0>(_rtPipelineEntity))
+        {
+            PipelineBuilder builder(_ctx);
+            registerPipelines(builder);
+            builder.build();
+        }
         allocateDescriptorSets();
         createSBT();
-        initRTOutputImage();
+        // output image is a transient resource of the render graph, see setup
         initUniformCameraPropBuffer();
         initBLAS();
         initTLAS();
 
-        // in & out
+        // in: bound once here, whether the render graph keeps the pass or not
+        // out: bound in onCompiled, once the render graph has created the output images
         bindResourceToDescriptorSets();
     }
 
-    void initShaderModules()
-    {
-        ASSERT(_ctx, "vk context should be defined");
-        auto logicalDevice = _ctx->getLogicDevice();
-        const auto shadersPath = getAssetPath();
-        // ray generation
-        const auto rayGenerationShaderPath = shadersPath + "/rayGeneration.rgen";
-        _rtRayGenShaderModule = createShaderModule(
-            logicalDevice,
-            rayGenerationShaderPath,
-            "main",
-            "rayGeneration.rgen");
-        // ray miss intersection
-        const auto rayMissShaderPath = shadersPath + "/rayMiss.rmiss";
-        _rtRayMissShaderModule = createShaderModule(
-            logicalDevice,
-            rayMissShaderPath,
-            "main",
-            "rayMiss.rmiss");
-        // closet intersection
-        const auto rayClosestHitShaderPath = shadersPath + "/rayClosestHit.rchit";
-        _rtRayClosestHitShaderModule = createShaderModule(
-            logicalDevice,
-            rayClosestHitShaderPath,
-            "main",
-            "rayClosestHit.rchit");
-    }
-
     enum DESC_LAYOUT_SEMANTIC : int
     {
         AS = 0, // accelerated structure
@@ -167,35 +188,19 @@ public:
         _descriptorSetLayouts = _ctx->createDescriptorSetLayout(setBindings);
     }
 
-    void initRTPipeline()
-    {
-        ASSERT(_ctx, "vk context should be defined");
-        ASSERT(_rtRayGenShaderModule, "ray gen shader module should be defined");
-        ASSERT(_rtRayMissShaderModule, "ray miss shader module should be defined");
-        ASSERT(_rtRayClosestHitShaderModule, "ray closest hit shader module should be defined");
-
-        const std::string entryPoint{"main"};
-        _rtPipelineEntity = _ctx->createRayTracingPipeline(
-            {
-                {VK_SHADER_STAGE_RAYGEN_BIT_KHR, std::make_tuple(_rtRayGenShaderModule, entryPoint.c_str(), nullptr)},
-                {VK_SHADER_STAGE_MISS_BIT_KHR, std::make_tuple(_rtRayMissShaderModule, entryPoint.c_str(), nullptr)},
-                {VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, std::make_tuple(_rtRayClosestHitShaderModule, entryPoint.c_str(), nullptr)},
-            },
-            _descriptorSetLayouts,
-            {});
-    }
-
+    // output image and camera: one set per frame slot
     void allocateDescriptorSets()
     {
         ASSERT(_ctx, "vk context should be defined");
         ASSERT(_dsPool, "descriptorset pool should be defined");
+        const auto numFramesInFlight = _ctx->getFramesInFlight();
         _descriptorSets = _ctx->allocateDescriptorSet(_dsPool,
                                                       {{&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::AS],
                                                         1},
                                                        {&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::OUTPUT_IMAGE],
-                                                        1},
+                                                        numFramesInFlight},
                                                        {&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::CAMERA_PROP],
-                                                        1}});
+                                                        numFramesInFlight}});
     }
 
     // Shader Binding Table:
@@ -205,24 +210,10 @@ public:
     void createSBT()
     {
         ASSERT(_ctx, "vk context should be defined");
-        auto logicalDevice = _ctx->getLogicDevice();
 
         const auto &rtProperties = _ctx->getSelectedPhysicalDeviceRayTracingProperties();
         const uint32_t handleSizeInBytes = rtProperties.shaderGroupHandleSize;
         const uint32_t handleSizeAligned = alignedSize(handleSizeInBytes, rtProperties.shaderGroupHandleAlignment);
-
-        const auto rtPipeline = std::get<0>(_rtPipelineEntity);
-        const auto shaderGroupCount = std::get<2>(_rtPipelineEntity).size();
-        const uint32_t sbtSizeInBytes = shaderGroupCount * handleSizeAligned;
-        std::vector<uint8_t> shaderGroupHandles(sbtSizeInBytes);
-        // filling the shaderGroupHandles buffer
-        VK_CHECK(vkGetRayTracingShaderGroupHandlesKHR(
-            logicalDevice,
-            rtPipeline,
-            0, // first Shader Group
-            shaderGroupCount,
-            sbtSizeInBytes,
-            shaderGroupHandles.data()));
         {
             //  buffer is suitable for use as a Shader Binding Table.
             _rayGenSTBBuffer = _ctx->createShaderBindTableBuffer(
@@ -232,9 +223,6 @@ public:
                 handleSizeAligned,
                 true // mapping
             );
-            // copy into _rayGenSTBBuffer
-            auto &dst = std::get<BUFFER_ENTITY_UID::MAPPING_ADDRESS>(std::get<0>(_rayGenSTBBuffer));
-            memcpy(dst, shaderGroupHandles.data(), handleSizeInBytes);
         }
 
         {
@@ -244,8 +232,6 @@ public:
                 handleSizeAligned * 1, // buffer size considering alignment
                 handleSizeAligned,
                 true);
-            auto &dst = std::get<BUFFER_ENTITY_UID::MAPPING_ADDRESS>(std::get<0>(_rayMissSTBBuffer));
-            memcpy(dst, shaderGroupHandles.data() + handleSizeInBytes, handleSizeInBytes);
         }
 
         {
@@ -255,50 +241,50 @@ public:
                 handleSizeAligned * 1, // buffer size considering alignment
                 handleSizeAligned,
                 true);
-            auto &dst = std::get<BUFFER_ENTITY_UID::MAPPING_ADDRESS>(std::get<0>(_rayClosestHitSTBBuffer));
-            memcpy(dst, shaderGroupHandles.data() + handleSizeInBytes * 2, handleSizeInBytes);
         }
+        writeShaderGroupHandles();
     }
 
-    void initRTOutputImage()
+    // copy the shader group handles of the current pipeline into the mapped sbt buffers
+    void writeShaderGroupHandles()
     {
         ASSERT(_ctx, "vk context should be defined");
-        const bool generateMipmaps = false;
-        VkFormat swapChainFormat{VK_FORMAT_B8G8R8A8_UNORM};
-        uint32_t textureMipLevels{1};
-        uint32_t textureLayoutCount{1};
-        auto extents = _ctx->getSwapChainExtent();
-        _rtOutputImage = _ctx->createImage("rt output image",
-                                           VK_IMAGE_TYPE_2D,
-                                           swapChainFormat,
-                                           {
-                                               .width = extents.width,
-                                               .height = extents.height,
-                                               .depth = 1,
-                                           },
-                                           textureMipLevels,
-                                           textureLayoutCount,
-                                           VK_SAMPLE_COUNT_1_BIT,
-                                           // usage here: both dst and src as mipmap generation
-                                           VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-                                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                                           generateMipmaps);
+        auto logicalDevice = _ctx->getLogicDevice();
+
+        const auto &rtProperties = _ctx->getSelectedPhysicalDeviceRayTracingProperties();
+        const uint32_t handleSizeInBytes = rtProperties.shaderGroupHandleSize;
+        const uint32_t handleSizeAligned = alignedSize(handleSizeInBytes, rtProperties.shaderGroupHandleAlignment);
+
+        const auto rtPipeline = std::get<0>(_rtPipelineEntity);
+        const auto shaderGroupCount = std::get<2>(_rtPipelineEntity).size();
+        const uint32_t sbtSizeInBytes = shaderGroupCount * handleSizeAligned;
+        std::vector<uint8_t> shaderGroupHandles(sbtSizeInBytes);
+        // filling the shaderGroupHandles buffer
+        VK_CHECK(vkGetRayTracingShaderGroupHandlesKHR(
+            logicalDevice,
+            rtPipeline,
+            0, // first Shader Group
+            shaderGroupCount,
+            sbtSizeInBytes,
+            shaderGroupHandles.data()));
+        // ray gen, ray miss, closest hit
+        memcpy(std::get<BUFFER_ENTITY_UID::MAPPING_ADDRESS>(std::get<0>(_rayGenSTBBuffer)),
+               shaderGroupHandles.data(), handleSizeInBytes);
+        memcpy(std::get<BUFFER_ENTITY_UID::MAPPING_ADDRESS>(std::get<0>(_rayMissSTBBuffer)),
+               shaderGroupHandles.data() + handleSizeInBytes, handleSizeInBytes);
+        memcpy(std::get<BUFFER_ENTITY_UID::MAPPING_ADDRESS>(std::get<0>(_rayClosestHitSTBBuffer)),
+               shaderGroupHandles.data() + handleSizeInBytes * 2, handleSizeInBytes);
     }
 
+    // one chunk per frame slot: the cpu writes the chunk of the frame being recorded only
+    // a slice of the host visible buffer arena instead of a VkBuffer of its own
     void initUniformCameraPropBuffer()
     {
         ASSERT(_ctx, "vk context should be defined");
 
-        _uniformCameraPropBuffer = _ctx->createPersistentBuffer(
-            "Uniform Camera Prop Buffer",
-            sizeof(UniformCameraProp),
-            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
-                VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
-                VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+        const auto alignment = std::max(static_cast<uint32_t>(_ctx->getSelectedPhysicalDeviceProp().limits.minUniformBufferOffsetAlignment), 16u);
+        _cameraPropStride = alignedSize(sizeof(UniformCameraProp), alignment);
+        _uniformCameraPropSlice = _ctx->allocateBufferSlice(ARENA_HOST_VISIBLE, _cameraPropStride * _ctx->getFramesInFlight());
     }
 
     void initBLAS()
@@ -307,10 +293,11 @@ public:
         ASSERT(_ctx, "vk context should be defined");
         ASSERT(_scene, "scene should be defined");
         auto logicalDevice = _ctx->getLogicDevice();
-        // a graphics command buffer is needed for build AS
-        auto cmdBuffersForIO = _ctx->getCommandBufferForIO();
-        // where the command buffer submitted to.
-        auto graphicsComputeQueue = _ctx->getGraphicsComputeQueue();
+        // all the blas builds go into one upload batch (graphics queue): one submit, one wait
+        auto batch = _ctx->createUploadBatch();
+        // scratch buffers have to live until the batch is done
+        std::vector<BufferEntity> blasBuildBuffers;
+        blasBuildBuffers.reserve(_scene->meshes.size());
 
         size_t meshId = 0;
         for (const auto &mesh : _scene->meshes)
@@ -411,38 +398,18 @@ public:
             accelerationStructureBuildRangeInfo.primitiveOffset = 0;
             accelerationStructureBuildRangeInfo.firstVertex = 0;
             accelerationStructureBuildRangeInfo.transformOffset = 0;
-            std::vector<VkAccelerationStructureBuildRangeInfoKHR *> accelerationBuildStructureRangeInfos = {&accelerationStructureBuildRangeInfo};
-
-            // submit command to gpu to build the blas
-            const auto commandBufferToBuildAS = std::get<COMMAND_BUFFER_ENTITY_OFFSET::COMMAND_BUFFER>(cmdBuffersForIO);
-            const auto fenceToBuildAS = std::get<COMMAND_BUFFER_ENTITY_OFFSET::FENCE>(cmdBuffersForIO);
-            _ctx->BeginRecordCommandBuffer(cmdBuffersForIO);
-            vkCmdBuildAccelerationStructuresKHR(commandBufferToBuildAS,
-                                                1, &accelerationBuildGeometryInfo,
-                                                accelerationBuildStructureRangeInfos.data());
-            _ctx->EndRecordCommandBuffer(cmdBuffersForIO);
-
-            // wait for no body
-            VkSubmitInfo submitInfo{};
-            submitInfo.waitSemaphoreCount = 0;
-            submitInfo.pWaitSemaphores = VK_NULL_HANDLE;
-            // only useful when having waitsemaphore
-            submitInfo.pWaitDstStageMask = VK_NULL_HANDLE;
-            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-            submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &commandBufferToBuildAS;
-            // no body needs to be notified
-            submitInfo.signalSemaphoreCount = 0;
-            submitInfo.pSignalSemaphores = VK_NULL_HANDLE;
-
-            VK_CHECK(vkResetFences(logicalDevice, 1, &fenceToBuildAS));
-            VK_CHECK(vkQueueSubmit(graphicsComputeQueue, 1, &submitInfo, fenceToBuildAS));
-            const auto result = vkWaitForFences(logicalDevice, 1, &fenceToBuildAS, VK_TRUE,
-                                                100000000000);
-            if (result == VK_TIMEOUT)
-            {
-                vkDeviceWaitIdle(logicalDevice);
-            }
+
+            // recorded at submit, so capture by value and patch the pointers there
+            batch.record(
+                [accelerationStructureGeometry, accelerationBuildGeometryInfo, accelerationStructureBuildRangeInfo](VkCommandBuffer commandBufferToBuildAS) mutable
+                {
+                    accelerationBuildGeometryInfo.pGeometries = &accelerationStructureGeometry;
+                    const VkAccelerationStructureBuildRangeInfoKHR *accelerationBuildStructureRangeInfos = &accelerationStructureBuildRangeInfo;
+                    vkCmdBuildAccelerationStructuresKHR(commandBufferToBuildAS,
+                                                        1, &accelerationBuildGeometryInfo,
+                                                        &accelerationBuildStructureRangeInfos);
+                });
+            blasBuildBuffers.emplace_back(blasBuildBuffer);
 
             // connection between blas and tlas
             // 64-bit address: which can be used for device and shader operations
@@ -453,13 +420,28 @@ public:
             const auto blasAddress2 = std::get<BUFFER_ENTITY_UID::DEVICE_HOST_ADDRESS>(blasBuffer).deviceAddress;
             ASSERT(blasAddress == blasAddress2, "Two different ways to fetch the 64bit address of blas");
 
-            // be done with the scratch buffer that used in the previous build process
-            auto vmaAllocator = _ctx->getVmaAllocator();
-            vmaDestroyBuffer(vmaAllocator, std::get<BUFFER_ENTITY_UID::BUFFER>(blasBuildBuffer), std::get<BUFFER_ENTITY_UID::VMA_ALLOCATION>(blasBuildBuffer));
-
             _blasEntity = std::make_tuple(blasBuffer, blasForTriangles, blasAddress);
             ++meshId;
         }
+
+        // blas builds are done before the tlas build or any trace reads them
+        batch.record(
+            [](VkCommandBuffer commandBufferToBuildAS)
+            {
+                BarrierBatch barriers;
+                barriers.memory(VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_ACCESS_2_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                                VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR,
+                                VK_ACCESS_2_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+                barriers.flush(commandBufferToBuildAS);
+            });
+        _ctx->waitUpload(batch.submit());
+
+        // be done with the scratch buffers that used in the build process
+        auto vmaAllocator = _ctx->getVmaAllocator();
+        for (const auto &blasBuildBuffer : blasBuildBuffers)
+        {
+            vmaDestroyBuffer(vmaAllocator, std::get<BUFFER_ENTITY_UID::BUFFER>(blasBuildBuffer), std::get<BUFFER_ENTITY_UID::VMA_ALLOCATION>(blasBuildBuffer));
+        }
     }
 
     // about the instancing
@@ -548,21 +530,217 @@ public:
             &accelerationStructureBuildSizesInfo);
 
         const auto tlasBufferSizeInBytes = accelerationStructureBuildSizesInfo.accelerationStructureSize;
-        // TO DO
-        // tLAS_.buffer = context_->createBuffer(
-        //     accelerationStructureBuildSizesInfo.accelerationStructureSize,
-        //     VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR |
-        //         VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-        //     VMA_MEMORY_USAGE_GPU_ONLY, "Top Level accel struct buffer");
+        const auto tlasBuildBufferSizeInBytes = accelerationStructureBuildSizesInfo.buildScratchSize;
+        const auto tlasBuffer = _ctx->createDeviceLocalBuffer(
+            "TLAS Buffer",
+            tlasBufferSizeInBytes,
+            VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+        const auto tlasBuildBuffer = _ctx->createDeviceLocalBuffer(
+            "TLAS Buffer for build op",
+            tlasBuildBufferSizeInBytes,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+
+        VkAccelerationStructureKHR tlas;
+        VkAccelerationStructureCreateInfoKHR accelerationStructureCreateInfo{};
+        accelerationStructureCreateInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+        accelerationStructureCreateInfo.buffer = std::get<BUFFER_ENTITY_UID::BUFFER>(tlasBuffer);
+        accelerationStructureCreateInfo.size = tlasBufferSizeInBytes;
+        accelerationStructureCreateInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+        VK_CHECK(vkCreateAccelerationStructureKHR(logicalDevice, &accelerationStructureCreateInfo, nullptr, &tlas));
+
+        // same steps as the blas build: size query above, now the actual build
+        accelerationStructureBuildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+        accelerationStructureBuildGeometryInfo.dstAccelerationStructure = tlas;
+        accelerationStructureBuildGeometryInfo.scratchData.deviceAddress = std::get<BUFFER_ENTITY_UID::DEVICE_HOST_ADDRESS>(tlasBuildBuffer).deviceAddress;
+
+        VkAccelerationStructureBuildRangeInfoKHR accelerationStructureBuildRangeInfo{};
+        accelerationStructureBuildRangeInfo.primitiveCount = instanceCount;
+
+        auto batch = _ctx->createUploadBatch();
+        batch.record(
+            [accelerationStructureGeometry, accelerationStructureBuildGeometryInfo, accelerationStructureBuildRangeInfo](VkCommandBuffer commandBufferToBuildAS) mutable
+            {
+                accelerationStructureBuildGeometryInfo.pGeometries = &accelerationStructureGeometry;
+                const VkAccelerationStructureBuildRangeInfoKHR *accelerationBuildStructureRangeInfos = &accelerationStructureBuildRangeInfo;
+                vkCmdBuildAccelerationStructuresKHR(commandBufferToBuildAS,
+                                                    1, &accelerationStructureBuildGeometryInfo,
+                                                    &accelerationBuildStructureRangeInfos);
+                // the tlas is read by the traces of the first frames
+                BarrierBatch barriers;
+                barriers.memory(VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_ACCESS_2_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                                VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR, VK_ACCESS_2_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+                barriers.flush(commandBufferToBuildAS);
+            });
+        _ctx->waitUpload(batch.submit());
+
+        // be done with the instances and the scratch buffer
+        auto vmaAllocator = _ctx->getVmaAllocator();
+        vmaUnmapMemory(vmaAllocator, std::get<BUFFER_ENTITY_UID::VMA_ALLOCATION>(aiStagingBuffer));
+        vmaDestroyBuffer(vmaAllocator, std::get<BUFFER_ENTITY_UID::BUFFER>(aiStagingBuffer), std::get<BUFFER_ENTITY_UID::VMA_ALLOCATION>(aiStagingBuffer));
+        vmaDestroyBuffer(vmaAllocator, std::get<BUFFER_ENTITY_UID::BUFFER>(tlasBuildBuffer), std::get<BUFFER_ENTITY_UID::VMA_ALLOCATION>(tlasBuildBuffer));
+
+        VkAccelerationStructureDeviceAddressInfoKHR accelerationDeviceAddressInfo{};
+        accelerationDeviceAddressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+        accelerationDeviceAddressInfo.accelerationStructure = tlas;
+        _tlasEntity = std::make_tuple(tlasBuffer, tlas, vkGetAccelerationStructureDeviceAddressKHR(logicalDevice, &accelerationDeviceAddressInfo));
     };
 
+    // tlas and the camera chunk of every frame slot
     void bindResourceToDescriptorSets()
     {
         ASSERT(_ctx, "vk context should be defined");
+        const auto tlas = std::get<AS_ENTITY_UID::AS>(_tlasEntity);
+        ASSERT(tlas, "tlas should be built");
+        {
+            const auto &dstSets = _descriptorSets[&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::AS]];
+            ASSERT(dstSets.size() == 1, "AS descriptor set size is 1");
+            const VkWriteDescriptorSetAccelerationStructureKHR asInfo{
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR,
+                .accelerationStructureCount = 1,
+                .pAccelerationStructures = &tlas,
+            };
+            const VkWriteDescriptorSet write{
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .pNext = &asInfo,
+                .dstSet = dstSets[0],
+                .dstBinding = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR,
+            };
+            vkUpdateDescriptorSets(_ctx->getLogicDevice(), 1, &write, 0, nullptr);
+        }
+        {
+            const auto &dstSets = _descriptorSets[&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::CAMERA_PROP]];
+            for (size_t i = 0; i < dstSets.size(); ++i)
+            {
+                _ctx->bindBufferToDescriptorSet(
+                    std::get<BUFFER_SLICE_OFFSET::SLICE_BUFFER>(_uniformCameraPropSlice),
+                    std::get<BUFFER_SLICE_OFFSET::SLICE_OFFSET>(_uniformCameraPropSlice) + i * _cameraPropStride,
+                    sizeof(UniformCameraProp),
+                    dstSets[i],
+                    VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                    0);
+            }
+        }
+    }
+
+    // transient: the output image of every frame slot
+    void bindOutputImageToDescriptorSets()
+    {
+        ASSERT(_ctx, "vk context should be defined");
+        const auto &dstSets = _descriptorSets[&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::OUTPUT_IMAGE]];
+        ASSERT(dstSets.size() == _rtOutputImages.size(), "one output image descriptor set per frame slot");
+        for (size_t i = 0; i < dstSets.size(); ++i)
+        {
+            const VkDescriptorImageInfo imageInfo{
+                .imageView = std::get<IMAGE_ENTITY_OFFSET::IMAGE_VIEW>(_rtOutputImages[i]),
+                .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+            };
+            const VkWriteDescriptorSet write{
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = dstSets[i],
+                .dstBinding = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                .pImageInfo = &imageInfo,
+            };
+            vkUpdateDescriptorSets(_ctx->getLogicDevice(), 1, &write, 0, nullptr);
+        }
+    }
+
+    // render graph resource names
+    inline static const std::string CAMERA_PROP_RESOURCE{"rayTracing.cameraProp"};
+    inline static const std::string RT_OUTPUT_RESOURCE{"rayTracing.output"};
+
+    // after finalizeInit
+    // the output image is only kept alive when it is read by another pass or marked as a graph output
+    virtual void setup(RenderGraphBuilder &builder) override
+    {
+        ASSERT(_ctx, "vk context should be defined");
+        VkFormat swapChainFormat{VK_FORMAT_B8G8R8A8_UNORM};
+        auto extents = _ctx->getSwapChainExtent();
+        builder.importBuffer(CAMERA_PROP_RESOURCE, _uniformCameraPropSlice)
+            .createImage(RT_OUTPUT_RESOURCE,
+                         swapChainFormat,
+                         {
+                             .width = extents.width,
+                             .height = extents.height,
+                             .depth = 1,
+                         },
+                         VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT)
+            .read(CAMERA_PROP_RESOURCE, VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR, VK_ACCESS_2_UNIFORM_READ_BIT)
+            // storage image written by the ray generation shader
+            .write(RT_OUTPUT_RESOURCE, VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                   VK_IMAGE_LAYOUT_GENERAL);
+    }
+
+    // not called when the pass is culled: nothing consumes the output
+    virtual void onCompiled(const RenderGraph &graph) override
+    {
+        _rtOutputImages.resize(_ctx->getFramesInFlight());
+        for (uint32_t i = 0; i < _rtOutputImages.size(); ++i)
+        {
+            _rtOutputImages[i] = graph.getImage(RT_OUTPUT_RESOURCE, i);
+        }
+        bindOutputImageToDescriptorSets();
+    }
+
+    virtual void update(int currentFrameId) override
+    {
+        std::erase_if(_retired, [this](auto &retired)
+                      {
+                          auto &[frameNumber, destroy] = retired;
+                          if (!_ctx->isFrameComplete(frameNumber))
+                          {
+                              return false;
+                          }
+                          destroy();
+                          return true; });
+
+        // the chunk of this frame slot is not read by the frames in flight
+        const auto view = _camera->viewTransformLH();
+        const auto proj = glm::perspective(glm::radians(_camera->verticalFov()), _camera->aspect(), _camera->nearPlaneD(), _camera->farPlaneD());
+        const UniformCameraProp cameraProp{
+            .viewInverse = glm::inverse(view),
+            .projInverse = glm::inverse(proj),
+        };
+        auto *dst = static_cast<uint8_t *>(std::get<BUFFER_SLICE_OFFSET::SLICE_MAPPING_ADDRESS>(_uniformCameraPropSlice)) + currentFrameId * _cameraPropStride;
+        memcpy(dst, &cameraProp, sizeof(UniformCameraProp));
     }
 
     virtual void execute(CommandBufferEntity cmd, int currentFrameId) override
     {
+        auto commandBufferHandle = std::get<COMMAND_BUFFER_ENTITY_OFFSET::COMMAND_BUFFER>(cmd);
+        const auto rtPipelineHandle = std::get<0>(_rtPipelineEntity);
+        const auto rtPipelineLayout = std::get<1>(_rtPipelineEntity);
+
+        update(currentFrameId);
+
+        // sets 0..2: tlas, output image and camera of this frame slot
+        const std::array<VkDescriptorSet, DESC_LAYOUT_SEMANTIC_SIZE> descriptorSets{
+            _descriptorSets[&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::AS]][0],
+            _descriptorSets[&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::OUTPUT_IMAGE]][currentFrameId],
+            _descriptorSets[&_descriptorSetLayouts[DESC_LAYOUT_SEMANTIC::CAMERA_PROP]][currentFrameId],
+        };
+        vkCmdBindPipeline(commandBufferHandle, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, rtPipelineHandle);
+        vkCmdBindDescriptorSets(commandBufferHandle,
+                                VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
+                                rtPipelineLayout, 0, static_cast<uint32_t>(descriptorSets.size()),
+                                descriptorSets.data(),
+                                0,
+                                nullptr);
+        // one ray generation invocation per pixel of the output image, no callable shaders
+        const auto extent = std::get<IMAGE_ENTITY_OFFSET::IMAGE_EXTENT>(_rtOutputImages[currentFrameId]);
+        const VkStridedDeviceAddressRegionKHR callableRegion{};
+        vkCmdTraceRaysKHR(commandBufferHandle,
+                          &std::get<1>(_rayGenSTBBuffer),
+                          &std::get<1>(_rayMissSTBBuffer),
+                          &std::get<1>(_rayClosestHitSTBBuffer),
+                          &callableRegion,
+                          extent.width,
+                          extent.height,
+                          1);
+        // barrier from the trace to the consumers of the output image is emitted by the render graph
     }
 
 private:
@@ -578,11 +756,15 @@ private:
     std::tuple<BufferEntity, VkStridedDeviceAddressRegionKHR> _rayGenSTBBuffer;
     std::tuple<BufferEntity, VkStridedDeviceAddressRegionKHR> _rayMissSTBBuffer;
     std::tuple<BufferEntity, VkStridedDeviceAddressRegionKHR> _rayClosestHitSTBBuffer;
+    // sbt buffers replaced by a hot reload: frame number after which the destruction is safe
+    std::vector<std::tuple<uint64_t, std::function<void()>>> _retired;
 
     // image which rt output to
-    // input/output of rt shaders
-    ImageEntity _rtOutputImage;
-    BufferEntity _uniformCameraPropBuffer;
+    // input/output of rt shaders, transient resource of the render graph, per frame slot
+    std::vector<ImageEntity> _rtOutputImages;
+    // one UniformCameraProp chunk per frame slot
+    BufferSlice _uniformCameraPropSlice;
+    uint32_t _cameraPropStride{0};
 
     // to build blas, it needs following:
     BufferEntity *_compositeVB;
@@ -591,4 +773,5 @@ private:
     BufferEntity *_indirectDrawB;
 
     ASEntity _blasEntity;
+    ASEntity _tlasEntity;
 };
\ No newline at end of file
@@ -0,0 +1,1143 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <queue>
+#include <limits>
+#include <algorithm>
+#include <functional>
+
+#include <misc.h>
+#include <context.h>
+#include <renderPassBase.h>
+#include <barrierBatch.h>
+#include <commandRecorder.h>
+#include <residencyManager.h>
+
+// frame graph on top of RenderPassBase
+// 1. every pass declares the named resources it reads and writes in RenderPassBase::setup
+// 2. compile(): cull the passes nobody consumes, order the rest by their dependencies,
+//    create the transient resources and alias them into shared vma memory when their lifetimes don't overlap,
+//    one instance per frame in flight: a frame never writes what a previous frame may still read
+// 3. execute(): per pass, emit the barriers the tracked resource states require (one vkCmdPipelineBarrier2), then RenderPassBase::execute
+// 4. pre-recorded mode (VK_PRERECORD_COMMANDS or setPrerecordStaticPasses): static passes are recorded once per frame slot
+//    into a secondary command buffer and replayed with vkCmdExecuteCommands, only RenderPassBase::update runs per frame
+// usage:
+//     RenderGraph graph(&ctx);
+//     graph.addPass("cull fustrum", &cullFustrum);
+//     graph.markOutput(CullFustrum::CULLED_IDR, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT);
+//     graph.compile();
+//     // per frame
+//     graph.execute(cmd, frameIndex);
+//     // or: passes recorded concurrently into secondaries, barriers stay in the primary
+//     graph.executeParallel(cmd, frameIndex, recorder);
+//     // imports tracked by a ResidencyManager are touched every frame a kept pass uses them
+//     graph.setResidencyManager(&residency);
+//     graph.trackResidency("albedo", albedoHandle);
+
+enum RENDER_GRAPH_RESOURCE_TYPE : int
+{
+    RG_BUFFER = 0,
+    RG_IMAGE
+};
+
+class RenderGraph;
+
+// handed to RenderPassBase::setup, records the declarations of a single pass
+class RenderGraphBuilder
+{
+public:
+    RenderGraphBuilder(RenderGraph *graph, size_t passIndex)
+        : _graph(graph), _passIndex(passIndex)
+    {
+    }
+
+    // transient: created by the graph at compile, valid from onCompiled on, one instance per frame slot
+    RenderGraphBuilder &createBuffer(const std::string &name, VkDeviceSize sizeInBytes, VkBufferUsageFlags usage);
+    RenderGraphBuilder &createImage(const std::string &name, VkFormat format, VkExtent3D extent, VkImageUsageFlags usage);
+    // imported: owned by someone else, state tracking starts from what is given here
+    RenderGraphBuilder &importBuffer(const std::string &name, const BufferEntity &buffer);
+    RenderGraphBuilder &importBuffer(const std::string &name, const BufferSlice &slice);
+    RenderGraphBuilder &importImage(const std::string &name, const ImageEntity &image, VkImageLayout currentLayout);
+
+    // layout is only meaningful for images
+    RenderGraphBuilder &read(const std::string &name,
+                             VkPipelineStageFlags2 stageMask,
+                             VkAccessFlags2 accessMask,
+                             VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED);
+    RenderGraphBuilder &write(const std::string &name,
+                              VkPipelineStageFlags2 stageMask,
+                              VkAccessFlags2 accessMask,
+                              VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED);
+    // never culled (e.g. cpu readback, present)
+    RenderGraphBuilder &sideEffect();
+
+private:
+    RenderGraph *_graph{nullptr};
+    size_t _passIndex{0};
+};
+
+class RenderGraph
+{
+    friend class RenderGraphBuilder;
+
+public:
+    explicit RenderGraph(VkContext *ctx)
+        : _ctx(ctx)
+    {
+        ASSERT(_ctx, "vk context should be defined");
+    }
+
+    // pre-recorded commands are freed with their pool, the caller makes sure the gpu is done with them (e.g. vkDeviceWaitIdle)
+    ~RenderGraph()
+    {
+        releaseTransientResources();
+        for (auto &[frameNumber, destroy] : _retired)
+        {
+            destroy();
+        }
+        if (_prerecordPool)
+        {
+            vkDestroyCommandPool(_ctx->getLogicDevice(), _prerecordPool, nullptr);
+        }
+    }
+
+    RenderGraph(const RenderGraph &) = delete;
+    RenderGraph &operator=(const RenderGraph &) = delete;
+
+    // graph level imports, for resources no pass owns
+    void importBuffer(const std::string &name, const BufferEntity &buffer)
+    {
+        auto &resource = declareResource(name, RG_BUFFER, false);
+        ASSERT(!std::get<BUFFER_ENTITY_UID::BUFFER>(resource.buffer) ||
+                   std::get<BUFFER_ENTITY_UID::BUFFER>(resource.buffer) == std::get<BUFFER_ENTITY_UID::BUFFER>(buffer),
+               "resource name is already bound to another buffer");
+        resource.buffer = buffer;
+    }
+
+    // arena slice: barriers cover the slice's range of the backing buffer only
+    void importBuffer(const std::string &name, const BufferSlice &slice)
+    {
+        BufferEntity buffer{};
+        std::get<BUFFER_ENTITY_UID::BUFFER>(buffer) = std::get<BUFFER_SLICE_OFFSET::SLICE_BUFFER>(slice);
+        std::get<BUFFER_ENTITY_UID::BUFFER_SIZE>(buffer) = std::get<BUFFER_SLICE_OFFSET::SLICE_SIZE>(slice);
+        importBuffer(name, buffer);
+        auto &resource = declareResource(name, RG_BUFFER, false);
+        resource.importedOffset = std::get<BUFFER_SLICE_OFFSET::SLICE_OFFSET>(slice);
+        resource.importedRange = std::get<BUFFER_SLICE_OFFSET::SLICE_SIZE>(slice);
+    }
+
+    void importImage(const std::string &name, const ImageEntity &image, VkImageLayout currentLayout)
+    {
+        auto &resource = declareResource(name, RG_IMAGE, false);
+        ASSERT(!std::get<IMAGE_ENTITY_OFFSET::IMAGE>(resource.image) ||
+                   std::get<IMAGE_ENTITY_OFFSET::IMAGE>(resource.image) == std::get<IMAGE_ENTITY_OFFSET::IMAGE>(image),
+               "resource name is already bound to another image");
+        resource.image = image;
+        resource.state.layout = currentLayout;
+    }
+
+    // setup() is called right away, the pass must outlive the graph
+    void addPass(const std::string &name, RenderPassBase *pass)
+    {
+        ASSERT(pass, "render pass should be defined");
+        _passes.emplace_back(Pass{.name = name, .pass = pass});
+        _compiled = false;
+        RenderGraphBuilder builder(this, _passes.size() - 1);
+        pass->setup(builder);
+    }
+
+    // consumed outside of the graph: keeps the producers alive and the resource is left in this state after execute
+    void markOutput(const std::string &name,
+                    VkPipelineStageFlags2 stageMask,
+                    VkAccessFlags2 accessMask,
+                    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED)
+    {
+        _outputs[name] = Usage{
+            .stageMask = stageMask,
+            .accessMask = accessMask,
+            .layout = layout,
+            .write = false,
+        };
+        _compiled = false;
+    }
+
+    // touch the tracked imports used by the executed passes, once per frame in execute
+    void setResidencyManager(ResidencyManager *residency)
+    {
+        _residency = residency;
+    }
+
+    void trackResidency(const std::string &name, ResidencyHandle handle)
+    {
+        auto &resource = _resources.at(name);
+        ASSERT(!resource.transient, "transient resources are owned by the graph, not tracked");
+        resource.residency = handle;
+    }
+
+    // static passes (RenderPassBase::isStatic) replay their commands recorded in an earlier frame
+    void setPrerecordStaticPasses(bool prerecord)
+    {
+        _prerecordStaticPasses = prerecord;
+    }
+
+    void compile()
+    {
+        releaseTransientResources();
+        // the transient resources are new
+        for (auto &pass : _passes)
+        {
+            pass.prerecordedVersions.assign(pass.prerecordedVersions.size(), NOT_RECORDED);
+        }
+        cullPasses();
+        orderPasses();
+        computeLifetimes();
+        createTransientResources();
+        _compiled = true;
+
+        for (auto passIndex : _executionOrder)
+        {
+            _passes[passIndex].pass->onCompiled(*this);
+        }
+        log(Level::Info, "RenderGraph: ", _executionOrder.size(), "/", _passes.size(), " passes, ",
+            _memoryBlocks.size(), " transient memory block(s)");
+    }
+
+    void execute(CommandBufferEntity cmd, int frameIndex)
+    {
+        ASSERT(_compiled, "render graph should be compiled before execute");
+        auto commandBufferHandle = std::get<COMMAND_BUFFER_ENTITY_OFFSET::COMMAND_BUFFER>(cmd);
+        beginFrame(frameIndex);
+
+        BarrierBatch barriers;
+        for (auto passIndex : _executionOrder)
+        {
+            auto &pass = _passes[passIndex];
+            for (const auto &[name, usage] : pass.usages)
+            {
+                transition(barriers, _resources.at(name), usage);
+            }
+            barriers.flush(commandBufferHandle);
+            if (isPrerecorded(pass))
+            {
+                const auto secondary = prerecorded(pass, cmd, frameIndex);
+                vkCmdExecuteCommands(commandBufferHandle, 1, &secondary);
+            }
+            else
+            {
+                pass.pass->execute(cmd, frameIndex);
+            }
+        }
+
+        for (const auto &[name, usage] : _outputs)
+        {
+            transition(barriers, _resources.at(name), usage);
+        }
+        barriers.flush(commandBufferHandle);
+    }
+
+    // every pass records into its own secondary command buffer on the workers of the recorder,
+    // the primary only holds the barriers and one vkCmdExecuteCommands per run of passes without barriers in between
+    // passes must not share cpu state in execute, and must not begin render passes (primary only)
+    void executeParallel(CommandBufferEntity cmd, int frameIndex, ParallelCommandRecorder &recorder)
+    {
+        ASSERT(_compiled, "render graph should be compiled before execute");
+        auto commandBufferHandle = std::get<COMMAND_BUFFER_ENTITY_OFFSET::COMMAND_BUFFER>(cmd);
+        beginFrame(frameIndex);
+
+        // static passes are replayed, the others recorded on the workers
+        std::vector<VkCommandBuffer> secondaries(_executionOrder.size(), VK_NULL_HANDLE);
+        std::vector<size_t> dynamicPasses;
+        for (size_t i = 0; i < _executionOrder.size(); ++i)
+        {
+            auto &pass = _passes[_executionOrder[i]];
+            if (isPrerecorded(pass))
+            {
+                secondaries[i] = prerecorded(pass, cmd, frameIndex);
+            }
+            else
+            {
+                dynamicPasses.push_back(i);
+            }
+        }
+        const auto recorded = recorder.record(dynamicPasses.size(), [&](size_t i, VkCommandBuffer secondary)
+                                              {
+                                                  auto passCmd = cmd;
+                                                  std::get<COMMAND_BUFFER_ENTITY_OFFSET::COMMAND_BUFFER>(passCmd) = secondary;
+                                                  _passes[_executionOrder[dynamicPasses[i]]].pass->execute(passCmd, frameIndex); });
+        for (size_t i = 0; i < dynamicPasses.size(); ++i)
+        {
+            secondaries[dynamicPasses[i]] = recorded[i];
+        }
+
+        BarrierBatch barriers;
+        std::vector<VkCommandBuffer> pending;
+        for (size_t i = 0; i < _executionOrder.size(); ++i)
+        {
+            for (const auto &[name, usage] : _passes[_executionOrder[i]].usages)
+            {
+                transition(barriers, _resources.at(name), usage);
+            }
+            if (!barriers.empty())
+            {
+                recorder.execute(commandBufferHandle, pending);
+                pending.clear();
+                barriers.flush(commandBufferHandle);
+            }
+            pending.push_back(secondaries[i]);
+        }
+        recorder.execute(commandBufferHandle, pending);
+
+        for (const auto &[name, usage] : _outputs)
+        {
+            transition(barriers, _resources.at(name), usage);
+        }
+        barriers.flush(commandBufferHandle);
+    }
+
+    // transient: the instance of the frame slot, imported: frameIndex is ignored
+    inline const BufferEntity &getBuffer(const std::string &name, int frameIndex = 0) const
+    {
+        const auto &resource = _resources.at(name);
+        ASSERT(resource.type == RG_BUFFER, "resource is not a buffer");
+        return resource.transient ? resource.transientBuffers.at(frameIndex) : resource.buffer;
+    }
+
+    inline const ImageEntity &getImage(const std::string &name, int frameIndex = 0) const
+    {
+        const auto &resource = _resources.at(name);
+        ASSERT(resource.type == RG_IMAGE, "resource is not an image");
+        return resource.transient ? resource.transientImages.at(frameIndex) : resource.image;
+    }
+
+    inline bool isCulled(const RenderPassBase *pass) const
+    {
+        return std::none_of(_executionOrder.begin(), _executionOrder.end(), [&](size_t passIndex)
+                            { return _passes[passIndex].pass == pass; });
+    }
+
+private:
+    struct Usage
+    {
+        VkPipelineStageFlags2 stageMask{VK_PIPELINE_STAGE_2_NONE};
+        VkAccessFlags2 accessMask{VK_ACCESS_2_NONE};
+        VkImageLayout layout{VK_IMAGE_LAYOUT_UNDEFINED};
+        bool write{false};
+    };
+
+    // what the barrier in front of the next use has to wait for
+    struct State
+    {
+        VkPipelineStageFlags2 writeStageMask{VK_PIPELINE_STAGE_2_NONE};
+        VkAccessFlags2 writeAccessMask{VK_ACCESS_2_NONE};
+        // stages/accesses which already see the last write
+        VkPipelineStageFlags2 readStageMask{VK_PIPELINE_STAGE_2_NONE};
+        VkAccessFlags2 readAccessMask{VK_ACCESS_2_NONE};
+        VkImageLayout layout{VK_IMAGE_LAYOUT_UNDEFINED};
+    };
+
+    struct Resource
+    {
+        RENDER_GRAPH_RESOURCE_TYPE type{RG_BUFFER};
+        bool transient{false};
+        // transient description
+        VkDeviceSize sizeInBytes{0};
+        VkBufferUsageFlags bufferUsage{0};
+        VkFormat format{VK_FORMAT_UNDEFINED};
+        VkExtent3D extent{};
+        VkImageUsageFlags imageUsage{0};
+        // handles, imported
+        BufferEntity buffer{};
+        ImageEntity image{};
+        // range of an imported buffer, a sub-range when imported as an arena slice
+        VkDeviceSize importedOffset{0};
+        VkDeviceSize importedRange{VK_WHOLE_SIZE};
+        // imported, ResidencyManager::INVALID_HANDLE: not tracked
+        ResidencyHandle residency{ResidencyManager::INVALID_HANDLE};
+        // handles, transient: one per frame slot
+        std::vector<BufferEntity> transientBuffers;
+        std::vector<ImageEntity> transientImages;
+        State state{};
+        // lifetime in execution order: [firstPass, lastPass]
+        size_t firstPass{std::numeric_limits<size_t>::max()};
+        size_t lastPass{0};
+        int memoryBlock{-1};
+        bool firstUseInFrame{false};
+    };
+
+    struct Pass
+    {
+        std::string name;
+        RenderPassBase *pass{nullptr};
+        // one merged usage per resource
+        std::unordered_map<std::string, Usage> usages;
+        bool sideEffect{false};
+        // static passes: one secondary per frame slot, and the RenderPassBase::getCommandsVersion it was recorded at
+        std::vector<VkCommandBuffer> prerecorded;
+        std::vector<uint64_t> prerecordedVersions;
+    };
+
+    static constexpr uint64_t NOT_RECORDED = std::numeric_limits<uint64_t>::max();
+
+    // transient resources with disjoint lifetimes share one block, all bound at offset 0
+    // one allocation per frame slot, the residents of a slot are bound to the allocation of that slot
+    struct MemoryBlock
+    {
+        std::vector<VmaAllocation> allocations;
+        std::vector<VmaAllocationInfo> allocationInfos;
+        VkMemoryRequirements requirements{};
+        std::vector<std::string> residents;
+        // accumulated stages/writes of the current resident in the frame, the next one waits for them
+        VkPipelineStageFlags2 stageMask{VK_PIPELINE_STAGE_2_NONE};
+        VkAccessFlags2 writeAccessMask{VK_ACCESS_2_NONE};
+    };
+
+    // the frame slot was retired by advanceCommandBuffer: its transient instances are free,
+    // transient content does not survive the frame
+    void beginFrame(int frameIndex)
+    {
+        ASSERT(frameIndex >= 0 && frameIndex < static_cast<int>(_ctx->getFramesInFlight()), "frameIndex should be in a valid range");
+        _frameIndex = frameIndex;
+        std::erase_if(_retired, [this](auto &retired)
+                      {
+                          auto &[frameNumber, destroy] = retired;
+                          if (!_ctx->isFrameComplete(frameNumber))
+                          {
+                              return false;
+                          }
+                          destroy();
+                          return true; });
+        for (auto &[name, resource] : _resources)
+        {
+            if (resource.transient)
+            {
+                resource.firstUseInFrame = true;
+            }
+            // used by a pass which is not culled: not idle, not evicted
+            if (_residency && resource.residency != ResidencyManager::INVALID_HANDLE &&
+                resource.firstPass != std::numeric_limits<size_t>::max())
+            {
+                _residency->touch(resource.residency);
+            }
+        }
+        for (auto &block : _memoryBlocks)
+        {
+            block.stageMask = VK_PIPELINE_STAGE_2_NONE;
+            block.writeAccessMask = VK_ACCESS_2_NONE;
+        }
+    }
+
+    // handles of the frame being executed
+    inline VkBuffer frameBuffer(const Resource &resource) const
+    {
+        return std::get<BUFFER_ENTITY_UID::BUFFER>(resource.transient ? resource.transientBuffers[_frameIndex] : resource.buffer);
+    }
+
+    inline const ImageEntity &frameImage(const Resource &resource) const
+    {
+        return resource.transient ? resource.transientImages[_frameIndex] : resource.image;
+    }
+
+    Resource &declareResource(const std::string &name, RENDER_GRAPH_RESOURCE_TYPE type, bool transient)
+    {
+        auto [it, inserted] = _resources.try_emplace(name);
+        if (inserted)
+        {
+            it->second.type = type;
+            it->second.transient = transient;
+        }
+        ASSERT(it->second.type == type, "resource is declared with another type");
+        ASSERT(!(transient && !inserted), "transient resource is declared twice");
+        ASSERT(it->second.transient == transient, "resource is both transient and imported");
+        _compiled = false;
+        return it->second;
+    }
+
+    void addUsage(size_t passIndex, const std::string &name, const Usage &usage)
+    {
+        ASSERT(_resources.contains(name), "resource should be created or imported before it is used");
+        auto [it, inserted] = _passes[passIndex].usages.try_emplace(name, usage);
+        if (!inserted)
+        {
+            auto &merged = it->second;
+            ASSERT(merged.layout == usage.layout, "a pass uses a resource in one layout only");
+            merged.stageMask |= usage.stageMask;
+            merged.accessMask |= usage.accessMask;
+            merged.write |= usage.write;
+        }
+    }
+
+    // a pass survives when it (transitively) feeds an output, an imported resource, or has side effects
+    void cullPasses()
+    {
+        std::unordered_map<std::string, std::vector<size_t>> writers;
+        for (size_t i = 0; i < _passes.size(); ++i)
+        {
+            for (const auto &[name, usage] : _passes[i].usages)
+            {
+                if (usage.write)
+                {
+                    writers[name].push_back(i);
+                }
+            }
+        }
+
+        _kept.assign(_passes.size(), false);
+        std::vector<size_t> stack;
+        for (size_t i = 0; i < _passes.size(); ++i)
+        {
+            bool root = _passes[i].sideEffect;
+            for (const auto &[name, usage] : _passes[i].usages)
+            {
+                root |= usage.write && (_outputs.contains(name) || !_resources.at(name).transient);
+            }
+            if (root)
+            {
+                _kept[i] = true;
+                stack.push_back(i);
+            }
+        }
+
+        while (!stack.empty())
+        {
+            const auto passIndex = stack.back();
+            stack.pop_back();
+            for (const auto &[name, usage] : _passes[passIndex].usages)
+            {
+                if (!writers.contains(name))
+                {
+                    continue;
+                }
+                for (auto writer : writers.at(name))
+                {
+                    if (!_kept[writer])
+                    {
+                        _kept[writer] = true;
+                        stack.push_back(writer);
+                    }
+                }
+            }
+        }
+
+        for (size_t i = 0; i < _passes.size(); ++i)
+        {
+            if (!_kept[i])
+            {
+                log(Level::Info, "RenderGraph: cull pass ", _passes[i].name);
+            }
+        }
+    }
+
+    // producers run before consumers, otherwise the order of addPass is kept
+    void orderPasses()
+    {
+        std::vector<std::unordered_set<size_t>> edges(_passes.size());
+        std::vector<size_t> inDegree(_passes.size(), 0);
+        auto addEdge = [&](size_t from, size_t to)
+        {
+            if (from != to && edges[from].insert(to).second)
+            {
+                ++inDegree[to];
+            }
+        };
+
+        for (const auto &[name, resource] : _resources)
+        {
+            std::vector<size_t> users;
+            for (size_t i = 0; i < _passes.size(); ++i)
+            {
+                if (_kept[i] && _passes[i].usages.contains(name))
+                {
+                    users.push_back(i);
+                }
+            }
+            size_t lastWriter = std::numeric_limits<size_t>::max();
+            std::vector<size_t> readersSinceWrite;
+            std::vector<size_t> earlyReaders;
+            for (auto user : users)
+            {
+                if (_passes[user].usages.at(name).write)
+                {
+                    if (lastWriter != std::numeric_limits<size_t>::max())
+                    {
+                        addEdge(lastWriter, user);
+                    }
+                    for (auto reader : readersSinceWrite)
+                    {
+                        addEdge(reader, user);
+                    }
+                    readersSinceWrite.clear();
+                    lastWriter = user;
+                }
+                else if (lastWriter != std::numeric_limits<size_t>::max())
+                {
+                    addEdge(lastWriter, user);
+                    readersSinceWrite.push_back(user);
+                }
+                else if (resource.transient)
+                {
+                    // added before its producer, read what the producer writes
+                    earlyReaders.push_back(user);
+                }
+                else
+                {
+                    // imported content is read before the first write
+                    readersSinceWrite.push_back(user);
+                }
+            }
+            for (auto reader : earlyReaders)
+            {
+                ASSERT(lastWriter != std::numeric_limits<size_t>::max(), "transient resource is read but never written");
+                addEdge(lastWriter, reader);
+            }
+        }
+
+        // kahn, the smallest addPass index first
+        std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t>> ready;
+        for (size_t i = 0; i < _passes.size(); ++i)
+        {
+            if (_kept[i] && inDegree[i] == 0)
+            {
+                ready.push(i);
+            }
+        }
+        _executionOrder.clear();
+        while (!ready.empty())
+        {
+            const auto passIndex = ready.top();
+            ready.pop();
+            _executionOrder.push_back(passIndex);
+            for (auto next : edges[passIndex])
+            {
+                if (--inDegree[next] == 0)
+                {
+                    ready.push(next);
+                }
+            }
+        }
+        ASSERT(_executionOrder.size() == static_cast<size_t>(std::count(_kept.begin(), _kept.end(), true)),
+               "render graph has a cycle");
+    }
+
+    void computeLifetimes()
+    {
+        for (auto &[name, resource] : _resources)
+        {
+            resource.firstPass = std::numeric_limits<size_t>::max();
+            resource.lastPass = 0;
+        }
+        for (size_t order = 0; order < _executionOrder.size(); ++order)
+        {
+            for (const auto &[name, usage] : _passes[_executionOrder[order]].usages)
+            {
+                auto &resource = _resources.at(name);
+                resource.firstPass = std::min(resource.firstPass, order);
+                resource.lastPass = std::max(resource.lastPass, order);
+            }
+        }
+        // outputs live until the end of the graph
+        for (const auto &[name, usage] : _outputs)
+        {
+            ASSERT(_resources.contains(name), "output should be created or imported by a pass");
+            auto &resource = _resources.at(name);
+            resource.firstPass = std::min(resource.firstPass, _executionOrder.size());
+            resource.lastPass = _executionOrder.size();
+        }
+    }
+
+    void createTransientResources()
+    {
+        auto logicalDevice = _ctx->getLogicDevice();
+        auto vmaAllocator = _ctx->getVmaAllocator();
+        const auto numFramesInFlight = _ctx->getFramesInFlight();
+
+        // step1: handles without memory, one per frame slot, to query the requirements (identical for every slot)
+        std::vector<std::tuple<std::string, VkMemoryRequirements>> candidates;
+        for (auto &[name, resource] : _resources)
+        {
+            if (!resource.transient || resource.firstPass == std::numeric_limits<size_t>::max())
+            {
+                continue;
+            }
+            VkMemoryRequirements requirements{};
+            if (resource.type == RG_BUFFER)
+            {
+                const VkBufferCreateInfo bufferCreateInfo{
+                    .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                    .size = resource.sizeInBytes,
+                    .usage = resource.bufferUsage,
+                    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+                };
+                resource.transientBuffers.resize(numFramesInFlight);
+                for (uint32_t frame = 0; frame < numFramesInFlight; ++frame)
+                {
+                    VkBuffer buffer;
+                    VK_CHECK(vkCreateBuffer(logicalDevice, &bufferCreateInfo, nullptr, &buffer));
+                    setCorrlationId(buffer, logicalDevice, VK_OBJECT_TYPE_BUFFER, "RenderGraph Buffer: " + name + " frame " + std::to_string(frame));
+                    vkGetBufferMemoryRequirements(logicalDevice, buffer, &requirements);
+                    std::get<BUFFER_ENTITY_UID::BUFFER>(resource.transientBuffers[frame]) = buffer;
+                    std::get<BUFFER_ENTITY_UID::BUFFER_SIZE>(resource.transientBuffers[frame]) = resource.sizeInBytes;
+                }
+            }
+            else
+            {
+                const VkImageCreateInfo imageCreateInfo{
+                    .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+                    .imageType = VK_IMAGE_TYPE_2D,
+                    .format = resource.format,
+                    .extent = resource.extent,
+                    .mipLevels = 1,
+                    .arrayLayers = 1,
+                    .samples = VK_SAMPLE_COUNT_1_BIT,
+                    .tiling = VK_IMAGE_TILING_OPTIMAL,
+                    .usage = resource.imageUsage,
+                    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+                    .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+                };
+                resource.transientImages.resize(numFramesInFlight);
+                for (uint32_t frame = 0; frame < numFramesInFlight; ++frame)
+                {
+                    VkImage image;
+                    VK_CHECK(vkCreateImage(logicalDevice, &imageCreateInfo, nullptr, &image));
+                    setCorrlationId(image, logicalDevice, VK_OBJECT_TYPE_IMAGE, "RenderGraph Image: " + name + " frame " + std::to_string(frame));
+                    vkGetImageMemoryRequirements(logicalDevice, image, &requirements);
+                    resource.transientImages[frame] = ImageEntity{image, VK_NULL_HANDLE, VK_NULL_HANDLE, VmaAllocationInfo{},
+                                                                  1, resource.extent, resource.format};
+                }
+            }
+            candidates.emplace_back(name, requirements);
+        }
+
+        // step2: greedy, largest first, into the first block whose residents never overlap in time
+        std::sort(candidates.begin(), candidates.end(), [](const auto &a, const auto &b)
+                  { return std::get<1>(a).size > std::get<1>(b).size; });
+        for (const auto &[name, requirements] : candidates)
+        {
+            auto &resource = _resources.at(name);
+            int blockIndex = -1;
+            for (size_t i = 0; i < _memoryBlocks.size() && blockIndex < 0; ++i)
+            {
+                auto &block = _memoryBlocks[i];
+                if (!(block.requirements.memoryTypeBits & requirements.memoryTypeBits))
+                {
+                    continue;
+                }
+                const bool overlapped = std::any_of(block.residents.begin(), block.residents.end(), [&](const std::string &resident)
+                                                    {
+                                                        const auto &other = _resources.at(resident);
+                                                        return !(other.lastPass < resource.firstPass || resource.lastPass < other.firstPass); });
+                if (!overlapped)
+                {
+                    blockIndex = static_cast<int>(i);
+                }
+            }
+            if (blockIndex < 0)
+            {
+                _memoryBlocks.emplace_back(MemoryBlock{.requirements = requirements});
+                blockIndex = static_cast<int>(_memoryBlocks.size() - 1);
+            }
+            auto &block = _memoryBlocks[blockIndex];
+            block.requirements.size = std::max(block.requirements.size, requirements.size);
+            block.requirements.alignment = std::max(block.requirements.alignment, requirements.alignment);
+            block.requirements.memoryTypeBits &= requirements.memoryTypeBits;
+            block.residents.push_back(name);
+            resource.memoryBlock = blockIndex;
+        }
+
+        // step3: one allocation per block and frame slot, every resident bound at offset 0
+        const VmaAllocationCreateInfo allocCreateInfo{
+            .usage = VMA_MEMORY_USAGE_UNKNOWN,
+            .requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        };
+        for (auto &block : _memoryBlocks)
+        {
+            block.allocations.resize(numFramesInFlight, VK_NULL_HANDLE);
+            block.allocationInfos.resize(numFramesInFlight);
+            for (uint32_t frame = 0; frame < numFramesInFlight; ++frame)
+            {
+                VK_CHECK(vmaAllocateMemory(vmaAllocator, &block.requirements, &allocCreateInfo,
+                                           &block.allocations[frame], &block.allocationInfos[frame]));
+                for (const auto &name : block.residents)
+                {
+                    bindTransientResource(_resources.at(name), block.allocations[frame], block.allocationInfos[frame], frame);
+                }
+            }
+            log(Level::Info, "RenderGraph: memory block of ", block.requirements.size, " bytes aliased by ",
+                block.residents.size(), " resource(s), ", numFramesInFlight, " frame slot(s)");
+        }
+    }
+
+    void bindTransientResource(Resource &resource, VmaAllocation allocation, const VmaAllocationInfo &allocationInfo, uint32_t frame)
+    {
+        auto logicalDevice = _ctx->getLogicDevice();
+        auto vmaAllocator = _ctx->getVmaAllocator();
+        if (resource.type == RG_BUFFER)
+        {
+            auto &bufferEntity = resource.transientBuffers[frame];
+            auto buffer = std::get<BUFFER_ENTITY_UID::BUFFER>(bufferEntity);
+            VK_CHECK(vmaBindBufferMemory2(vmaAllocator, allocation, 0, buffer, nullptr));
+            std::get<BUFFER_ENTITY_UID::VMA_ALLOCATION>(bufferEntity) = allocation;
+            std::get<BUFFER_ENTITY_UID::VMA_ALLOCATION_INFO>(bufferEntity) = allocationInfo;
+            if (resource.bufferUsage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT)
+            {
+                const VkBufferDeviceAddressInfo bufferDeviceAI{
+                    .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+                    .buffer = buffer,
+                };
+                std::get<BUFFER_ENTITY_UID::DEVICE_HOST_ADDRESS>(bufferEntity) = VkDeviceOrHostAddressConstKHR{
+                    .deviceAddress = vkGetBufferDeviceAddressKHR(logicalDevice, &bufferDeviceAI),
+                };
+            }
+        }
+        else
+        {
+            auto &imageEntity = resource.transientImages[frame];
+            auto image = std::get<IMAGE_ENTITY_OFFSET::IMAGE>(imageEntity);
+            VK_CHECK(vmaBindImageMemory2(vmaAllocator, allocation, 0, image, nullptr));
+            const VkImageViewCreateInfo imageViewInfo{
+                .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+                .image = image,
+                .viewType = VK_IMAGE_VIEW_TYPE_2D,
+                .format = resource.format,
+                .subresourceRange = {getAspectMask(resource.format), 0, 1, 0, 1},
+            };
+            VK_CHECK(vkCreateImageView(logicalDevice, &imageViewInfo, nullptr,
+                                       &std::get<IMAGE_ENTITY_OFFSET::IMAGE_VIEW>(imageEntity)));
+            std::get<IMAGE_ENTITY_OFFSET::IMAGE_VMA_ALLOCATION>(imageEntity) = allocation;
+            std::get<IMAGE_ENTITY_OFFSET::IMAGE_VMA_ALLOCATION_INFO>(imageEntity) = allocationInfo;
+        }
+        resource.state = State{};
+    }
+
+    // recompile: the frames recorded so far may still use the previous instances, destroyed once they are done
+    void releaseTransientResources()
+    {
+        if (_memoryBlocks.empty())
+        {
+            return;
+        }
+        std::vector<VkBuffer> buffers;
+        std::vector<VkImageView> imageViews;
+        std::vector<VkImage> images;
+        std::vector<VmaAllocation> allocations;
+        for (auto &[name, resource] : _resources)
+        {
+            if (!resource.transient)
+            {
+                continue;
+            }
+            for (const auto &buffer : resource.transientBuffers)
+            {
+                buffers.push_back(std::get<BUFFER_ENTITY_UID::BUFFER>(buffer));
+            }
+            for (const auto &image : resource.transientImages)
+            {
+                imageViews.push_back(std::get<IMAGE_ENTITY_OFFSET::IMAGE_VIEW>(image));
+                images.push_back(std::get<IMAGE_ENTITY_OFFSET::IMAGE>(image));
+            }
+            resource.transientBuffers.clear();
+            resource.transientImages.clear();
+            resource.memoryBlock = -1;
+        }
+        for (auto &block : _memoryBlocks)
+        {
+            allocations.insert(allocations.end(), block.allocations.begin(), block.allocations.end());
+        }
+        _memoryBlocks.clear();
+        _retired.emplace_back(_ctx->getFrameNumber(),
+                              [logicalDevice = _ctx->getLogicDevice(), vmaAllocator = _ctx->getVmaAllocator(),
+                               buffers = std::move(buffers), imageViews = std::move(imageViews), images = std::move(images),
+                               allocations = std::move(allocations)]()
+                              {
+                                  for (auto buffer : buffers)
+                                  {
+                                      vkDestroyBuffer(logicalDevice, buffer, nullptr);
+                                  }
+                                  for (auto imageView : imageViews)
+                                  {
+                                      vkDestroyImageView(logicalDevice, imageView, nullptr);
+                                  }
+                                  for (auto image : images)
+                                  {
+                                      vkDestroyImage(logicalDevice, image, nullptr);
+                                  }
+                                  for (auto allocation : allocations)
+                                  {
+                                      vmaFreeMemory(vmaAllocator, allocation);
+                                  }
+                              });
+    }
+
+    // minimal barrier for the next use of a resource, merged into the pass' batch
+    // read after read: nothing, unless the last write is not visible to the new stage yet
+    // read after write: src is the write
+    // write or layout transition: src is the last write and every read since
+    void transition(BarrierBatch &barriers, Resource &resource, const Usage &usage)
+    {
+        auto &state = resource.state;
+        const bool isImage = resource.type == RG_IMAGE;
+
+        if (resource.transient && resource.firstUseInFrame)
+        {
+            // whatever lived in the aliased memory before in this frame (previous resident) has to be done
+            auto &block = _memoryBlocks[resource.memoryBlock];
+            resource.firstUseInFrame = false;
+            state = State{};
+            if (block.stageMask != VK_PIPELINE_STAGE_2_NONE)
+            {
+                barriers.memory(block.stageMask, block.writeAccessMask, usage.stageMask, usage.accessMask);
+            }
+            if (isImage)
+            {
+                // discard: content is undefined anyway
+                barriers.image(std::get<IMAGE_ENTITY_OFFSET::IMAGE>(frameImage(resource)),
+                               VK_IMAGE_LAYOUT_UNDEFINED, usage.layout,
+                               block.stageMask, VK_ACCESS_2_NONE, usage.stageMask, usage.accessMask,
+                               {getAspectMask(resource.format), 0, 1, 0, 1});
+            }
+            block.stageMask = VK_PIPELINE_STAGE_2_NONE;
+            block.writeAccessMask = VK_ACCESS_2_NONE;
+            state.layout = usage.layout;
+            state.writeStageMask = usage.stageMask;
+            state.writeAccessMask = usage.write ? usage.accessMask : VK_ACCESS_2_NONE;
+            if (!usage.write)
+            {
+                state.readStageMask = usage.stageMask;
+                state.readAccessMask = usage.accessMask;
+            }
+        }
+        else
+        {
+            const bool layoutChanged = isImage && state.layout != usage.layout;
+            if (!usage.write && !layoutChanged)
+            {
+                const bool visible = state.writeStageMask == VK_PIPELINE_STAGE_2_NONE ||
+                                     ((state.readStageMask & usage.stageMask) == usage.stageMask &&
+                                      (state.readAccessMask & usage.accessMask) == usage.accessMask);
+                if (!visible)
+                {
+                    addBarrier(barriers, resource, state.writeStageMask, state.writeAccessMask, usage);
+                }
+                state.readStageMask |= usage.stageMask;
+                state.readAccessMask |= usage.accessMask;
+            }
+            else
+            {
+                const auto srcStageMask = state.writeStageMask | state.readStageMask;
+                if (srcStageMask != VK_PIPELINE_STAGE_2_NONE || layoutChanged)
+                {
+                    addBarrier(barriers, resource, srcStageMask, state.writeAccessMask, usage);
+                }
+                state.layout = usage.layout;
+                state.writeStageMask = usage.stageMask;
+                if (usage.write)
+                {
+                    state.writeAccessMask = usage.accessMask;
+                    state.readStageMask = VK_PIPELINE_STAGE_2_NONE;
+                    state.readAccessMask = VK_ACCESS_2_NONE;
+                }
+                else
+                {
+                    // the layout transition is the write, already visible to this read
+                    state.writeAccessMask = VK_ACCESS_2_NONE;
+                    state.readStageMask = usage.stageMask;
+                    state.readAccessMask = usage.accessMask;
+                }
+            }
+        }
+
+        if (resource.transient)
+        {
+            auto &block = _memoryBlocks[resource.memoryBlock];
+            block.stageMask |= usage.stageMask;
+            block.writeAccessMask |= usage.write ? usage.accessMask : VK_ACCESS_2_NONE;
+        }
+    }
+
+    void addBarrier(BarrierBatch &barriers,
+                    const Resource &resource,
+                    VkPipelineStageFlags2 srcStageMask,
+                    VkAccessFlags2 srcAccessMask,
+                    const Usage &usage)
+    {
+        if (resource.type == RG_BUFFER)
+        {
+            barriers.buffer(frameBuffer(resource),
+                            srcStageMask, srcAccessMask, usage.stageMask, usage.accessMask,
+                            resource.importedOffset, resource.importedRange);
+        }
+        else
+        {
+            const auto &image = frameImage(resource);
+            const auto format = std::get<IMAGE_ENTITY_OFFSET::IMAGE_FORMAT>(image);
+            barriers.image(std::get<IMAGE_ENTITY_OFFSET::IMAGE>(image),
+                           resource.state.layout, usage.layout,
+                           srcStageMask, srcAccessMask, usage.stageMask, usage.accessMask,
+                           {getAspectMask(format), 0, std::get<IMAGE_ENTITY_OFFSET::MIPMAP_COUNT>(image), 0, 1});
+        }
+    }
+
+    static VkImageAspectFlags getAspectMask(VkFormat format)
+    {
+        switch (format)
+        {
+        case VK_FORMAT_D16_UNORM:
+        case VK_FORMAT_X8_D24_UNORM_PACK32:
+        case VK_FORMAT_D32_SFLOAT:
+            return VK_IMAGE_ASPECT_DEPTH_BIT;
+        case VK_FORMAT_D16_UNORM_S8_UINT:
+        case VK_FORMAT_D24_UNORM_S8_UINT:
+        case VK_FORMAT_D32_SFLOAT_S8_UINT:
+            return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+        case VK_FORMAT_S8_UINT:
+            return VK_IMAGE_ASPECT_STENCIL_BIT;
+        default:
+            return VK_IMAGE_ASPECT_COLOR_BIT;
+        }
+    }
+
+    inline bool isPrerecorded(const Pass &pass) const
+    {
+        return _prerecordStaticPasses && pass.pass->isStatic();
+    }
+
+    // recorded again when the pass was invalidated since, otherwise only the cpu side of the frame runs
+    // the frame slot was retired by advanceCommandBuffer: its secondary is not pending anymore
+    VkCommandBuffer prerecorded(Pass &pass, const CommandBufferEntity &cmd, int frameIndex)
+    {
+        auto logicalDevice = _ctx->getLogicDevice();
+        if (pass.prerecorded.empty())
+        {
+            if (!_prerecordPool)
+            {
+                const VkCommandPoolCreateInfo poolInfo{
+                    .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                    // re-recorded one by one on invalidation
+                    .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+                    .queueFamilyIndex = std::get<COMMAND_BUFFER_ENTITY_OFFSET::QUEUE_FAMILY_INDEX>(cmd),
+                };
+                VK_CHECK(vkCreateCommandPool(logicalDevice, &poolInfo, nullptr, &_prerecordPool));
+                setCorrlationId(_prerecordPool, logicalDevice, VK_OBJECT_TYPE_COMMAND_POOL, "render graph prerecorded");
+            }
+            pass.prerecorded.resize(_ctx->getFramesInFlight(), VK_NULL_HANDLE);
+            pass.prerecordedVersions.assign(pass.prerecorded.size(), NOT_RECORDED);
+            const VkCommandBufferAllocateInfo allocInfo{
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .commandPool = _prerecordPool,
+                .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+                .commandBufferCount = static_cast<uint32_t>(pass.prerecorded.size()),
+            };
+            VK_CHECK(vkAllocateCommandBuffers(logicalDevice, &allocInfo, pass.prerecorded.data()));
+        }
+        ASSERT(pass.prerecorded.size() == _ctx->getFramesInFlight(), "frames in flight changed after the pass was pre-recorded");
+        ASSERT(frameIndex >= 0 && static_cast<size_t>(frameIndex) < pass.prerecorded.size(), "frameIndex should be in a valid range");
+
+        auto secondary = pass.prerecorded[frameIndex];
+        auto &version = pass.prerecordedVersions[frameIndex];
+        if (version == pass.pass->getCommandsVersion())
+        {
+            pass.pass->update(frameIndex);
+            return secondary;
+        }
+
+        ZoneScopedN("RenderGraph::prerecord");
+        const VkCommandBufferInheritanceInfo inheritanceInfo{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        };
+        // no one time submit: replayed until invalidated
+        const VkCommandBufferBeginInfo beginInfo{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .pInheritanceInfo = &inheritanceInfo,
+        };
+        VK_CHECK(vkBeginCommandBuffer(secondary, &beginInfo));
+        auto passCmd = cmd;
+        std::get<COMMAND_BUFFER_ENTITY_OFFSET::COMMAND_BUFFER>(passCmd) = secondary;
+        pass.pass->_prerecording = true;
+        pass.pass->execute(passCmd, frameIndex);
+        pass.pass->_prerecording = false;
+        VK_CHECK(vkEndCommandBuffer(secondary));
+        version = pass.pass->getCommandsVersion();
+        return secondary;
+    }
+
+    VkContext *_ctx{nullptr};
+    std::vector<Pass> _passes;
+    std::unordered_map<std::string, Resource> _resources;
+    std::unordered_map<std::string, Usage> _outputs;
+    std::vector<bool> _kept;
+    std::vector<size_t> _executionOrder;
+    std::vector<MemoryBlock> _memoryBlocks;
+    // frame slot being executed, selects the transient instances
+    int _frameIndex{0};
+    // previous transient instances, destroyed once the frame number is complete
+    std::vector<std::tuple<uint64_t, std::function<void()>>> _retired;
+    ResidencyManager *_residency{nullptr};
+    bool _compiled{false};
+#ifdef VK_PRERECORD_COMMANDS
+    bool _prerecordStaticPasses{true};
+#else
+    bool _prerecordStaticPasses{false};
+#endif
+    VkCommandPool _prerecordPool{VK_NULL_HANDLE};
+};
+
+inline RenderGraphBuilder &RenderGraphBuilder::createBuffer(const std::string &name, VkDeviceSize sizeInBytes, VkBufferUsageFlags usage)
+{
+    auto &resource = _graph->declareResource(name, RG_BUFFER, true);
+    resource.sizeInBytes = sizeInBytes;
+    resource.bufferUsage = usage;
+    return *this;
+}
+
+inline RenderGraphBuilder &RenderGraphBuilder::createImage(const std::string &name, VkFormat format, VkExtent3D extent, VkImageUsageFlags usage)
+{
+    auto &resource = _graph->declareResource(name, RG_IMAGE, true);
+    resource.format = format;
+    resource.extent = extent;
+    resource.imageUsage = usage;
+    return *this;
+}
+
+inline RenderGraphBuilder &RenderGraphBuilder::importBuffer(const std::string &name, const BufferEntity &buffer)
+{
+    _graph->importBuffer(name, buffer);
+    return *this;
+}
+
+inline RenderGraphBuilder &RenderGraphBuilder::importBuffer(const std::string &name, const BufferSlice &slice)
+{
+    _graph->importBuffer(name, slice);
+    return *this;
+}
+
+inline RenderGraphBuilder &RenderGraphBuilder::importImage(const std::string &name, const ImageEntity &image, VkImageLayout currentLayout)
+{
+    _graph->importImage(name, image, currentLayout);
+    return *this;
+}
+
+inline RenderGraphBuilder &RenderGraphBuilder::read(const std::string &name,
+                                                    VkPipelineStageFlags2 stageMask,
+                                                    VkAccessFlags2 accessMask,
+                                                    VkImageLayout layout)
+{
+    _graph->addUsage(_passIndex, name, {.stageMask = stageMask, .accessMask = accessMask, .layout = layout, .write = false});
+    return *this;
+}
+
+inline RenderGraphBuilder &RenderGraphBuilder::write(const std::string &name,
+                                                     VkPipelineStageFlags2 stageMask,
+                                                     VkAccessFlags2 accessMask,
+                                                     VkImageLayout layout)
+{
+    _graph->addUsage(_passIndex, name, {.stageMask = stageMask, .accessMask = accessMask, .layout = layout, .write = true});
+    return *this;
+}
+
+inline RenderGraphBuilder &RenderGraphBuilder::sideEffect()
+{
+    _graph->_passes[_passIndex].sideEffect = true;
+    return *this;
+}
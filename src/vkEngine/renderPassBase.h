@@ -4,13 +4,35 @@
 #include <scene.h>      // for scene accessor
 #include <cameraBase.h> // for camera accessor
 
+class RenderGraph;
+class RenderGraphBuilder;
+class PipelineBuilder;
+
 class RenderPassBase
 {
+    friend class RenderGraph;
+
 public:
     RenderPassBase() = default;
     virtual ~RenderPassBase() = default;
     virtual void finalizeInit() = 0;
     virtual void execute(CommandBufferEntity cmd, int frameIndex) = 0;
+    // cpu side per-frame work (e.g. uniform updates), the only part which runs when pre-recorded commands are replayed
+    virtual void update(int frameIndex) {}
+    // static: the commands of execute only depend on frameIndex and gpu buffers,
+    // the render graph records them once per frame slot and replays them until invalidateCommands
+    virtual bool isStatic() const { return false; }
+    // pipelines, descriptor sets, dispatch sizes... changed: static passes are recorded again
+    inline void invalidateCommands() { ++_commandsVersion; }
+    inline uint64_t getCommandsVersion() const { return _commandsVersion; }
+    // startup pipeline build phase: register shaders and pipelines before finalizeInit,
+    // handles are filled in by PipelineBuilder::build
+    virtual void registerPipelines(PipelineBuilder &builder) {}
+    // render graph: declare the resources read and written by execute, barriers are emitted by the graph
+    // a pass which declares nothing is culled
+    virtual void setup(RenderGraphBuilder &builder) {}
+    // transient resources of the graph exist from here on, e.g. bind them to descriptor sets
+    virtual void onCompiled(const RenderGraph &graph) {}
 
 protected:
     VkContext *_ctx{nullptr};
@@ -18,6 +40,9 @@ protected:
     const CameraBase *_camera{nullptr};
     // descriptorset pool, every render pass needs to allocate ds from it
     VkDescriptorPool _dsPool{VK_NULL_HANDLE};
+    // execute records commands which are replayed in later frames, e.g. no tracy zones
+    bool _prerecording{false};
+    uint64_t _commandsVersion{0};
 };
 
 class VkContextAccessor
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <thread>
+
+#include <glm/glm.hpp>
+
+#include <misc.h>
+#include <cameraBase.h>
+#include <tripleBuffer.h>
+
+// everything the render thread needs from the simulation for one frame, immutable once submitted
+struct FramePacket
+{
+    // increases by one per submitted packet, gaps on the render side are dropped packets
+    uint64_t packetNumber{0};
+    double dt{0.0};
+    // camera
+    glm::mat4 view{1.0f};
+    glm::vec3 viewPos{0.0f};
+    float nearPlaneD{0.0f};
+    float farPlaneD{1.0f};
+    float verticalFov{65.f};
+    float aspect{1.0f};
+    Fustrum fustrum{};
+
+    void captureCamera(const CameraBase &camera)
+    {
+        view = camera.viewTransformLH();
+        viewPos = camera.viewPos();
+        nearPlaneD = camera.nearPlaneD();
+        farPlaneD = camera.farPlaneD();
+        verticalFov = camera.verticalFov();
+        aspect = camera.aspect();
+        fustrum = camera.fustrumPlanes();
+    }
+};
+
+// read-only camera for the render passes, set from the current packet on the render thread
+// the passes never see the camera the main thread keeps mutating from input events
+class CameraSnapshot : public CameraBase
+{
+public:
+    void set(const FramePacket &packet)
+    {
+        _view = packet.view;
+        _eye = packet.viewPos;
+        _nearPlaneD = packet.nearPlaneD;
+        _farPlaneD = packet.farPlaneD;
+        _verticalFov = packet.verticalFov;
+        _aspect = packet.aspect;
+        _fustrum = packet.fustrum;
+    }
+
+    virtual glm::mat4 viewTransformLH() const override
+    {
+        return _view;
+    }
+    virtual glm::vec3 viewPos() const override
+    {
+        return _eye;
+    }
+    virtual Fustrum fustrumPlanes() const override
+    {
+        return _fustrum;
+    }
+
+    // input goes to the live camera on the main thread
+    virtual void handleKeyboardEvent(CameraActionType, float) override {}
+    virtual void handleMouseCursorEvent(int, int, const glm::ivec2 &, const glm::ivec2 &) override {}
+    virtual void handleMouseClickEvent(int, int, int, int) override {}
+    virtual void handleMouseWheelEvent(float) override {}
+
+private:
+    glm::mat4 _view{1.0f};
+    Fustrum _fustrum{};
+};
+
+// render thread fed by the main thread through a triple buffer of frame packets
+// main thread: sdl events, input, simulation, one packet per tick, never blocks on the gpu or the swapchain
+// render thread: the latest packet, then record and submit (vkAcquireNextImageKHR, vkQueueSubmit, vkQueuePresentKHR)
+// the vk context is driven from the render thread only, packets the render thread has no time for are dropped
+// parallel recording: the render function calls ParallelCommandRecorder::record, which accepts any calling thread
+// with its own workers the render thread records as worker 0, with a JobSystem the render thread is not one of
+// its workers and records into the shared pools while the job workers use theirs
+// usage:
+//     CameraSnapshot renderCamera;
+//     pass->setCamera(&renderCamera);
+//     RenderThread renderThread([&](const FramePacket &packet)
+//                               {
+//                                   renderCamera.set(packet);
+//                                   ctx.advanceCommandBuffer();
+//                                   auto [frameIndex, cmd] = ctx.getCommandBufferForRendering();
+//                                   auto secondaries = recorder.record(drawChunkCount, recordDraws);
+//                                   recorder.execute(std::get<1>(cmd), secondaries);
+//                                   renderGraph.execute(cmd, frameIndex);
+//                                   ctx.submitCommand(); ... });
+//     while (gRunning)
+//     {
+//         window.pollEvents();
+//         auto &packet = renderThread.beginPacket();
+//         packet.dt = gDt;
+//         packet.captureCamera(camera);
+//         renderThread.submitPacket();
+//     }
+//     renderThread.stop();
+//     vkDeviceWaitIdle(device);
+class RenderThread
+{
+public:
+    explicit RenderThread(std::function<void(const FramePacket &)> renderFn)
+        : _renderFn(std::move(renderFn))
+    {
+        ASSERT(_renderFn, "render function should be defined");
+        _thread = std::thread([this]()
+                              { renderLoop(); });
+    }
+
+    RenderThread(const RenderThread &) = delete;
+    RenderThread &operator=(const RenderThread &) = delete;
+
+    ~RenderThread()
+    {
+        stop();
+    }
+
+    // main thread: the packet to fill, its previous content is a packet from two submits ago
+    inline FramePacket &beginPacket()
+    {
+        return _packets.back();
+    }
+
+    // main thread: hands the packet over, never blocks
+    void submitPacket()
+    {
+        _packets.back().packetNumber = ++_submitted;
+        _packets.publish();
+    }
+
+    // main thread: the render thread finishes its current frame, packets not picked up yet are dropped
+    void stop()
+    {
+        if (!_thread.joinable())
+        {
+            return;
+        }
+        _packets.close();
+        _thread.join();
+    }
+
+    // telemetry
+    inline uint64_t getSubmittedPackets() const
+    {
+        return _submitted;
+    }
+    inline uint64_t getRenderedPackets() const
+    {
+        return _rendered.load(std::memory_order_relaxed);
+    }
+    inline uint64_t getDroppedPackets() const
+    {
+        return _dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    void renderLoop()
+    {
+        uint64_t lastPacket = 0;
+        while (_packets.waitUpdate())
+        {
+            const auto &packet = _packets.front();
+            _dropped.fetch_add(packet.packetNumber - lastPacket - 1, std::memory_order_relaxed);
+            lastPacket = packet.packetNumber;
+            {
+                ZoneScopedN("RenderThread::render");
+                _renderFn(packet);
+            }
+            _rendered.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    std::function<void(const FramePacket &)> _renderFn;
+    TripleBuffer<FramePacket> _packets;
+    // main thread only
+    uint64_t _submitted{0};
+    std::atomic<uint64_t> _rendered{0};
+    std::atomic<uint64_t> _dropped{0};
+    std::thread _thread;
+};
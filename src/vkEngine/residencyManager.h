@@ -0,0 +1,465 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <misc.h>
+#include <context.h>
+#include <barrierBatch.h>
+
+// eviction order, pinned resources are never touched (render targets, rings, acceleration structures)
+enum RESIDENCY_PRIORITY : int
+{
+    RESIDENCY_PINNED = 0,
+    RESIDENCY_HIGH,
+    RESIDENCY_NORMAL,
+    // released first: streamed meshes, top mips of textures
+    RESIDENCY_STREAMED
+};
+
+using ResidencyHandle = uint32_t;
+
+// residency over the buffers and images of the VkContext
+// every frame: per-heap budget/usage from vma (VK_EXT_memory_budget when the device has it)
+// above the high watermark of a device local heap, tracked resources are reclaimed until usage is back under the low one:
+// lowest priority first, least recently used first, only resources the gpu is done with and which were idle for a while
+// the manager decides what and when, the owner of a resource how: its reclaim callback downgrades (e.g. dropTopMips)
+// or releases it (e.g. streamed mesh), then streams it back in on demand (rebind)
+// on VK_ERROR_OUT_OF_DEVICE_MEMORY in createBuffer/createImage, the same is done at once before the allocation is retried
+// a tracked resource is treated as in use until it is touched for the first time: whoever tracks it opts in to eviction
+// by touching it whenever it is used (RenderGraph::trackResidency does it for the imports of the graph)
+// usage:
+//     ResidencyManager residency(&ctx);
+//     auto handle = residency.track("albedo", texture, RESIDENCY_STREAMED, [&](VkCommandBuffer cmd) -> VmaAllocation
+//                                   {
+//                                       if (cmd == VK_NULL_HANDLE) { destroyTexture(texture); return VK_NULL_HANDLE; }
+//                                       texture = residency.dropTopMips(texture, 1, cmd, "albedo");
+//                                       heap.updateTexture(slot, texture);
+//                                       return std::get<IMAGE_ENTITY_OFFSET::IMAGE_VMA_ALLOCATION>(texture); });
+//     // per frame, after advanceCommandBuffer
+//     residency.update(cmd);
+//     // whenever the texture is drawn, or once: graph.trackResidency("albedo", handle)
+//     residency.touch(handle);
+class ResidencyManager
+{
+public:
+    // cmd: command buffer of the frame being recorded, copies for a downgrade go there,
+    // the replaced memory is handed to retire (freed once the frame is done on the gpu)
+    // cmd VK_NULL_HANDLE: out of memory right now, release and destroy at once (the gpu is done with the resource)
+    // returns the allocation now backing the resource, VK_NULL_HANDLE once released
+    using Reclaim = std::function<VmaAllocation(VkCommandBuffer)>;
+
+    struct HeapBudget
+    {
+        // what the process may use without the driver paging
+        VkDeviceSize budget{0};
+        // by the process, vma or not
+        VkDeviceSize usage{0};
+        // VkDeviceMemory blocks of vma, and the allocations placed in them
+        VkDeviceSize blockBytes{0};
+        VkDeviceSize allocationBytes{0};
+        bool deviceLocal{false};
+    };
+
+    struct Stats
+    {
+        uint32_t trackedCount{0};
+        VkDeviceSize trackedBytes{0};
+        uint64_t downgradeCount{0};
+        uint64_t releaseCount{0};
+        VkDeviceSize reclaimedBytes{0};
+        uint64_t outOfMemoryRecoveries{0};
+    };
+
+    static constexpr ResidencyHandle INVALID_HANDLE = std::numeric_limits<ResidencyHandle>::max();
+    // lastUsedFrame of a resource never touched: never idle, never reclaimed
+    static constexpr uint64_t NEVER_TOUCHED = std::numeric_limits<uint64_t>::max();
+
+    explicit ResidencyManager(VkContext *ctx) : _ctx(ctx)
+    {
+        ASSERT(_ctx, "vk context should be defined");
+        const VkPhysicalDeviceMemoryProperties *memoryProperties{nullptr};
+        vmaGetMemoryProperties(_ctx->getVmaAllocator(), &memoryProperties);
+        _memoryProperties = *memoryProperties;
+        _heapBudgets.resize(_memoryProperties.memoryHeapCount);
+        queryBudgets();
+        _ctx->setOutOfDeviceMemoryHandler([this](VkDeviceSize sizeInBytes)
+                                          { return recoverFromOutOfDeviceMemory(sizeInBytes); });
+    }
+
+    ResidencyManager(const ResidencyManager &) = delete;
+    ResidencyManager &operator=(const ResidencyManager &) = delete;
+
+    // the caller makes sure the gpu is done (e.g. vkDeviceWaitIdle), retired memory is freed at once
+    ~ResidencyManager()
+    {
+        _ctx->setOutOfDeviceMemoryHandler({});
+        for (auto &[frameNumber, destroy] : _retired)
+        {
+            destroy();
+        }
+    }
+
+    ResidencyHandle track(const std::string &name, VmaAllocation allocation, RESIDENCY_PRIORITY priority, Reclaim reclaim = {})
+    {
+        ASSERT(priority == RESIDENCY_PINNED || reclaim, "reclaimable resource should have a reclaim callback");
+        std::scoped_lock lock{_mux};
+        ResidencyHandle handle = INVALID_HANDLE;
+        if (_freeHandles.empty())
+        {
+            handle = static_cast<ResidencyHandle>(_residents.size());
+            _residents.emplace_back();
+        }
+        else
+        {
+            handle = _freeHandles.back();
+            _freeHandles.pop_back();
+        }
+        auto &resident = _residents[handle];
+        resident.name = name;
+        resident.priority = priority;
+        resident.reclaim = std::move(reclaim);
+        resident.tracked = true;
+        resident.lastUsedFrame.store(NEVER_TOUCHED, std::memory_order_relaxed);
+        setAllocation(resident, allocation);
+        return handle;
+    }
+
+    ResidencyHandle track(const std::string &name, const BufferEntity &buffer, RESIDENCY_PRIORITY priority, Reclaim reclaim = {})
+    {
+        return track(name, std::get<BUFFER_ENTITY_UID::VMA_ALLOCATION>(buffer), priority, std::move(reclaim));
+    }
+
+    ResidencyHandle track(const std::string &name, const ImageEntity &image, RESIDENCY_PRIORITY priority, Reclaim reclaim = {})
+    {
+        return track(name, std::get<IMAGE_ENTITY_OFFSET::IMAGE_VMA_ALLOCATION>(image), priority, std::move(reclaim));
+    }
+
+    // before the owner destroys the resource
+    void untrack(ResidencyHandle handle)
+    {
+        std::scoped_lock lock{_mux};
+        auto &resident = _residents[handle];
+        ASSERT(resident.tracked, "resource should be tracked");
+        resident.tracked = false;
+        resident.reclaim = {};
+        resident.allocation = VK_NULL_HANDLE;
+        resident.size = 0;
+        _freeHandles.push_back(handle);
+    }
+
+    // the owner streamed the resource back in, or reallocated it
+    void rebind(ResidencyHandle handle, VmaAllocation allocation)
+    {
+        std::scoped_lock lock{_mux};
+        auto &resident = _residents[handle];
+        ASSERT(resident.tracked, "resource should be tracked");
+        setAllocation(resident, allocation);
+        if (resident.lastUsedFrame.load(std::memory_order_relaxed) != NEVER_TOUCHED)
+        {
+            resident.lastUsedFrame.store(_ctx->getFrameNumber(), std::memory_order_relaxed);
+        }
+    }
+
+    // used by the frame being recorded, any thread (e.g. workers recording secondaries), not concurrently with track
+    inline void touch(ResidencyHandle handle)
+    {
+        _residents[handle].lastUsedFrame.store(_ctx->getFrameNumber(), std::memory_order_relaxed);
+    }
+
+    bool isResident(ResidencyHandle handle) const
+    {
+        std::scoped_lock lock{_mux};
+        return _residents[handle].allocation != VK_NULL_HANDLE;
+    }
+
+    // reclaim above high * budget of a device local heap, down to low * budget
+    void setWatermarks(float high, float low)
+    {
+        ASSERT(low > 0.f && low <= high && high <= 1.f, "watermarks should be 0 < low <= high <= 1");
+        _highWatermark = high;
+        _lowWatermark = low;
+    }
+
+    // resources used within the last minIdleFrames frames are left alone (no thrashing of the working set)
+    void setMinIdleFrames(uint32_t minIdleFrames)
+    {
+        _minIdleFrames = minIdleFrames;
+    }
+
+    // runs once the gpu is done with the frame being recorded
+    void retire(std::function<void()> destroy)
+    {
+        std::scoped_lock lock{_mux};
+        _retired.emplace_back(_ctx->getFrameNumber(), std::move(destroy));
+    }
+
+    // once per frame, after advanceCommandBuffer, cmd: the command buffer of the frame, recorded before the passes
+    void update(VkCommandBuffer cmd)
+    {
+        ZoneScopedN("ResidencyManager::update");
+        std::scoped_lock lock{_mux};
+        const auto completedFrameNumber = _ctx->getCompletedFrameNumber();
+        // moved out first: destroy callbacks may retire more
+        const auto pending = std::stable_partition(_retired.begin(), _retired.end(), [completedFrameNumber](const auto &retired)
+                                                   { return std::get<0>(retired) > completedFrameNumber; });
+        std::vector<std::function<void()>> destroys;
+        std::transform(std::make_move_iterator(pending), std::make_move_iterator(_retired.end()), std::back_inserter(destroys),
+                       [](auto &&retired)
+                       { return std::move(std::get<1>(retired)); });
+        _retired.erase(pending, _retired.end());
+        for (auto &destroy : destroys)
+        {
+            destroy();
+        }
+
+        queryBudgets();
+        for (uint32_t heapIndex = 0; heapIndex < _heapBudgets.size(); ++heapIndex)
+        {
+            const auto &heap = _heapBudgets[heapIndex];
+            if (!heap.deviceLocal || heap.budget == 0 ||
+                heap.usage <= static_cast<VkDeviceSize>(heap.budget * _highWatermark))
+            {
+                continue;
+            }
+            const auto target = static_cast<VkDeviceSize>(heap.budget * _lowWatermark);
+            const auto reclaimed = reclaim(heapIndex, heap.usage - target, cmd);
+            log(Level::Info, "memory heap ", heapIndex, " at ", heap.usage >> 20, "/", heap.budget >> 20,
+                " MB, reclaimed ", reclaimed >> 20, " MB");
+        }
+    }
+
+    // copy of the image without its mipsToDrop largest levels, recorded into cmd
+    // the image must be a 2d color image with VK_IMAGE_USAGE_TRANSFER_SRC_BIT in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    // the copy ends up in the same layout, the old image is retired: descriptors must be pointed at the copy
+    ImageEntity dropTopMips(const ImageEntity &image, uint32_t mipsToDrop, VkCommandBuffer cmd, const std::string &name)
+    {
+        const auto mipCount = std::get<IMAGE_ENTITY_OFFSET::MIPMAP_COUNT>(image);
+        const auto extent = std::get<IMAGE_ENTITY_OFFSET::IMAGE_EXTENT>(image);
+        mipsToDrop = std::min(mipsToDrop, mipCount - 1);
+        if (mipsToDrop == 0)
+        {
+            return image;
+        }
+        const VkExtent3D smallerExtent{
+            .width = std::max(extent.width >> mipsToDrop, 1u),
+            .height = std::max(extent.height >> mipsToDrop, 1u),
+            .depth = 1,
+        };
+        auto smaller = _ctx->createImage(name, VK_IMAGE_TYPE_2D, std::get<IMAGE_ENTITY_OFFSET::IMAGE_FORMAT>(image),
+                                         smallerExtent, mipCount - mipsToDrop, 1, VK_SAMPLE_COUNT_1_BIT,
+                                         VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
+        const auto srcImage = std::get<IMAGE_ENTITY_OFFSET::IMAGE>(image);
+        const auto dstImage = std::get<IMAGE_ENTITY_OFFSET::IMAGE>(smaller);
+
+        BarrierBatch barriers;
+        barriers.image(srcImage, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_SHADER_READ_BIT,
+                       VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT,
+                       {VK_IMAGE_ASPECT_COLOR_BIT, mipsToDrop, mipCount - mipsToDrop, 0, 1});
+        barriers.image(smaller, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+                       VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+        barriers.flush(cmd);
+
+        std::vector<VkImageCopy> regions;
+        regions.reserve(mipCount - mipsToDrop);
+        for (uint32_t level = mipsToDrop; level < mipCount; ++level)
+        {
+            regions.emplace_back(VkImageCopy{
+                .srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1},
+                .dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - mipsToDrop, 0, 1},
+                .extent = {std::max(extent.width >> level, 1u), std::max(extent.height >> level, 1u), 1},
+            });
+        }
+        vkCmdCopyImage(cmd, srcImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       static_cast<uint32_t>(regions.size()), regions.data());
+
+        barriers.image(smaller, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                       VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                       VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_SHADER_READ_BIT);
+        barriers.flush(cmd);
+
+        retire([device = _ctx->getLogicDevice(), allocator = _ctx->getVmaAllocator(), image]()
+               {
+                   vkDestroyImageView(device, std::get<IMAGE_ENTITY_OFFSET::IMAGE_VIEW>(image), nullptr);
+                   vmaDestroyImage(allocator, std::get<IMAGE_ENTITY_OFFSET::IMAGE>(image),
+                                   std::get<IMAGE_ENTITY_OFFSET::IMAGE_VMA_ALLOCATION>(image)); });
+        return smaller;
+    }
+
+    // telemetry, per memory heap, as of the last update
+    std::vector<HeapBudget> getHeapBudgets() const
+    {
+        std::scoped_lock lock{_mux};
+        return _heapBudgets;
+    }
+
+    Stats getStats() const
+    {
+        std::scoped_lock lock{_mux};
+        auto stats = _stats;
+        for (const auto &resident : _residents)
+        {
+            if (resident.tracked)
+            {
+                ++stats.trackedCount;
+                stats.trackedBytes += resident.size;
+            }
+        }
+        return stats;
+    }
+
+private:
+    struct Resident
+    {
+        std::string name;
+        VmaAllocation allocation{VK_NULL_HANDLE};
+        VkDeviceSize size{0};
+        uint32_t heapIndex{0};
+        RESIDENCY_PRIORITY priority{RESIDENCY_PINNED};
+        Reclaim reclaim;
+        std::atomic<uint64_t> lastUsedFrame{0};
+        bool tracked{false};
+    };
+
+    void setAllocation(Resident &resident, VmaAllocation allocation)
+    {
+        resident.allocation = allocation;
+        resident.size = 0;
+        if (allocation == VK_NULL_HANDLE)
+        {
+            return;
+        }
+        VmaAllocationInfo allocationInfo;
+        vmaGetAllocationInfo(_ctx->getVmaAllocator(), allocation, &allocationInfo);
+        resident.size = allocationInfo.size;
+        resident.heapIndex = _memoryProperties.memoryTypes[allocationInfo.memoryType].heapIndex;
+    }
+
+    void queryBudgets()
+    {
+        std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> budgets{};
+        vmaGetHeapBudgets(_ctx->getVmaAllocator(), budgets.data());
+        for (uint32_t heapIndex = 0; heapIndex < _heapBudgets.size(); ++heapIndex)
+        {
+            const auto &budget = budgets[heapIndex];
+            _heapBudgets[heapIndex] = HeapBudget{
+                .budget = budget.budget,
+                .usage = budget.usage,
+                .blockBytes = budget.statistics.blockBytes,
+                .allocationBytes = budget.statistics.allocationBytes,
+                .deviceLocal = (_memoryProperties.memoryHeaps[heapIndex].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0,
+            };
+        }
+        if (!_heapBudgets.empty())
+        {
+            TracyPlot("heap 0 usage (MB)", static_cast<int64_t>(_heapBudgets[0].usage >> 20));
+        }
+    }
+
+    // under _mux, returns the bytes given back on heapIndex
+    VkDeviceSize reclaim(uint32_t heapIndex, VkDeviceSize bytesToFree, VkCommandBuffer cmd)
+    {
+        if (_reclaiming)
+        {
+            // a reclaim callback ran out of memory itself
+            return 0;
+        }
+        _reclaiming = true;
+        const auto frameNumber = _ctx->getFrameNumber();
+        const auto completedFrameNumber = _ctx->getCompletedFrameNumber();
+        std::vector<Resident *> candidates;
+        for (auto &resident : _residents)
+        {
+            const auto lastUsedFrame = resident.lastUsedFrame.load(std::memory_order_relaxed);
+            // the gpu must be done with it, out of memory: anything idle goes
+            const auto idle = lastUsedFrame <= completedFrameNumber &&
+                              (cmd == VK_NULL_HANDLE || lastUsedFrame + _minIdleFrames <= frameNumber);
+            if (resident.tracked && resident.allocation != VK_NULL_HANDLE && resident.heapIndex == heapIndex &&
+                resident.priority != RESIDENCY_PINNED && idle)
+            {
+                candidates.push_back(&resident);
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(), [](const Resident *a, const Resident *b)
+                  {
+                      if (a->priority != b->priority)
+                      {
+                          return a->priority > b->priority;
+                      }
+                      return a->lastUsedFrame.load(std::memory_order_relaxed) < b->lastUsedFrame.load(std::memory_order_relaxed); });
+
+        VkDeviceSize reclaimed = 0;
+        for (auto *resident : candidates)
+        {
+            if (reclaimed >= bytesToFree)
+            {
+                break;
+            }
+            const auto sizeBefore = resident->size;
+            setAllocation(*resident, resident->reclaim(cmd));
+            if (resident->size >= sizeBefore)
+            {
+                continue;
+            }
+            reclaimed += sizeBefore - resident->size;
+            if (resident->allocation == VK_NULL_HANDLE)
+            {
+                ++_stats.releaseCount;
+            }
+            else
+            {
+                ++_stats.downgradeCount;
+            }
+        }
+        _stats.reclaimedBytes += reclaimed;
+        _reclaiming = false;
+        return reclaimed;
+    }
+
+    bool recoverFromOutOfDeviceMemory(VkDeviceSize sizeInBytes)
+    {
+        std::scoped_lock lock{_mux};
+        VkDeviceSize reclaimed = 0;
+        for (uint32_t heapIndex = 0; heapIndex < _heapBudgets.size() && reclaimed < sizeInBytes; ++heapIndex)
+        {
+            if (_heapBudgets[heapIndex].deviceLocal)
+            {
+                reclaimed += reclaim(heapIndex, sizeInBytes - reclaimed, VK_NULL_HANDLE);
+            }
+        }
+        if (reclaimed > 0)
+        {
+            ++_stats.outOfMemoryRecoveries;
+        }
+        log(Level::Warn, "out of device memory: released ", reclaimed >> 20, " MB for a ", sizeInBytes >> 20, " MB request");
+        return reclaimed > 0;
+    }
+
+    VkContext *_ctx{nullptr};
+    VkPhysicalDeviceMemoryProperties _memoryProperties{};
+    // recursive: reclaim callbacks may retire, untrack or allocate (and run out of memory) themselves
+    mutable std::recursive_mutex _mux;
+    // deque: touch reads entries without the lock, elements never move
+    std::deque<Resident> _residents;
+    std::vector<ResidencyHandle> _freeHandles;
+    // frame number which last used the memory, destroy
+    std::vector<std::tuple<uint64_t, std::function<void()>>> _retired;
+    std::vector<HeapBudget> _heapBudgets;
+    float _highWatermark{0.9f};
+    float _lowWatermark{0.8f};
+    uint32_t _minIdleFrames{120};
+    bool _reclaiming{false};
+    Stats _stats;
+};
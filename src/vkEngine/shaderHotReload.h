@@ -0,0 +1,403 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <misc.h>
+#include <context.h>
+
+// shader hot reload for development builds
+// 1. pipelines are tracked at creation (PipelineBuilder::enableHotReload), together with the shaders they are built from
+// 2. a background thread polls the shader sources under getAssetPath() and every file they include,
+//    recompiles the changed shaders and their includers, and rebuilds the affected pipelines off the render thread
+// 3. update() at the frame boundary swaps the new pipelines in; the old ones are destroyed once
+//    the frames which may still reference them are complete
+// a compile error keeps the previous shader module and pipeline running, fix the file and save again
+// usage:
+//     ShaderHotReload hotReload(&ctx);
+//     PipelineBuilder builder(&ctx);
+//     builder.enableHotReload(&hotReload);
+//     ...
+//     builder.build();
+//     // render loop
+//     ctx.advanceCommandBuffer();
+//     hotReload.update();
+class ShaderHotReload
+{
+public:
+    using ShaderModuleEntities = std::unordered_map<VkShaderStageFlagBits, std::tuple<VkShaderModule, const char *, const VkSpecializationInfo *>>;
+
+    // shader a tracked pipeline is built from
+    struct ShaderSource
+    {
+        std::string filePath;
+        std::string entryPoint;
+        std::string correlationId;
+        // current module
+        VkShaderModule module{VK_NULL_HANDLE};
+        // written at the swap, e.g. the shader module members of a pass
+        std::vector<VkShaderModule *> dsts;
+    };
+
+    explicit ShaderHotReload(VkContext *ctx, std::chrono::milliseconds pollInterval = std::chrono::milliseconds(250))
+        : _ctx(ctx), _pollInterval(pollInterval)
+    {
+        ASSERT(_ctx, "vk context should be defined");
+        _watcher = std::thread([this]()
+                               { watch(); });
+    }
+
+    ShaderHotReload(const ShaderHotReload &) = delete;
+    ShaderHotReload &operator=(const ShaderHotReload &) = delete;
+
+    ~ShaderHotReload()
+    {
+        {
+            std::scoped_lock lock{_stopMux};
+            _stop = true;
+        }
+        _stopCv.notify_one();
+        _watcher.join();
+
+        // pipelines and modules which are never swapped in, and the retired ones
+        vkDeviceWaitIdle(_ctx->getLogicDevice());
+        for (auto &reload : _reloads)
+        {
+            for (auto &pipeline : reload.pipelines)
+            {
+                pipeline.discard();
+            }
+            for (const auto &module : reload.modules)
+            {
+                vkDestroyShaderModule(_ctx->getLogicDevice(), module.module, nullptr);
+            }
+        }
+        for (auto &[frameNumber, destroy] : _retired)
+        {
+            destroy();
+        }
+    }
+
+    // the pipeline was created into *dst from the given shaders, keep it up to date with them
+    // create runs on the background thread, destroy and onSwapped on the thread calling update()
+    // create reports a failure through its VkResult, like a compile error the previous pipeline is kept
+    template <typename PipelineEntity>
+    void track(const std::unordered_map<VkShaderStageFlagBits, ShaderSource> &stages,
+               std::function<PipelineEntity(const ShaderModuleEntities &, VkResult *)> create,
+               std::function<void(const PipelineEntity &)> destroy,
+               PipelineEntity *dst,
+               std::function<void()> onSwapped = {})
+    {
+        ASSERT(dst, "pipeline destination should be defined");
+        std::scoped_lock lock{_mux};
+        TrackedPipeline pipeline;
+        for (const auto &[stage, source] : stages)
+        {
+            pipeline.stages.emplace(stage, trackShader(source));
+        }
+        pipeline.rebuild = [create, destroy, dst, onSwapped](const ShaderModuleEntities &entities) -> std::optional<PipelineSwap>
+        {
+            VkResult result{VK_SUCCESS};
+            auto newPipeline = std::make_shared<PipelineEntity>(create(entities, &result));
+            if (result != VK_SUCCESS)
+            {
+                return std::nullopt;
+            }
+            return PipelineSwap{
+                .apply = [newPipeline, destroy, dst, onSwapped]() -> std::function<void()>
+                {
+                    auto oldPipeline = std::exchange(*dst, *newPipeline);
+                    if (onSwapped)
+                    {
+                        onSwapped();
+                    }
+                    return [oldPipeline, destroy]()
+                    { destroy(oldPipeline); };
+                },
+                .discard = [newPipeline, destroy]()
+                { destroy(*newPipeline); },
+            };
+        };
+        _pipelines.emplace_back(std::move(pipeline));
+    }
+
+    // frame boundary, before recording: swap in every rebuilt pipeline and destroy the retired ones
+    // the frames up to getFrameNumber() - 1 may still reference the old pipelines
+    void update()
+    {
+        ZoneScopedN("ShaderHotReload::update");
+        auto logicalDevice = _ctx->getLogicDevice();
+        std::erase_if(_retired, [this](auto &retired)
+                      {
+                          auto &[frameNumber, destroy] = retired;
+                          if (!_ctx->isFrameComplete(frameNumber))
+                          {
+                              return false;
+                          }
+                          destroy();
+                          return true; });
+
+        std::vector<Reload> reloads;
+        {
+            std::scoped_lock lock{_reloadMux};
+            reloads.swap(_reloads);
+        }
+        if (reloads.empty())
+        {
+            return;
+        }
+        const auto retireFrameNumber = _ctx->getFrameNumber() - 1;
+        for (auto &reload : reloads)
+        {
+            for (const auto &module : reload.modules)
+            {
+                for (auto dst : module.dsts)
+                {
+                    *dst = module.module;
+                }
+                if (module.previous)
+                {
+                    _retired.emplace_back(retireFrameNumber, [logicalDevice, previous = module.previous]()
+                                          { vkDestroyShaderModule(logicalDevice, previous, nullptr); });
+                }
+            }
+            for (auto &pipeline : reload.pipelines)
+            {
+                _retired.emplace_back(retireFrameNumber, pipeline.apply());
+            }
+            log(Level::Info, "ShaderHotReload: swapped ", reload.pipelines.size(), " pipeline(s)");
+        }
+    }
+
+private:
+    struct PipelineSwap
+    {
+        // render thread: exchange the destination, returns the destruction of the old pipeline
+        std::function<std::function<void()>()> apply;
+        // never swapped in
+        std::function<void()> discard;
+    };
+
+    struct TrackedShader
+    {
+        ShaderSource source;
+        // the shader file and everything it includes, canonical
+        std::vector<std::string> files;
+    };
+
+    struct TrackedPipeline
+    {
+        std::unordered_map<VkShaderStageFlagBits, size_t> stages;
+        // nullopt: the pipeline could not be created
+        std::function<std::optional<PipelineSwap>(const ShaderModuleEntities &)> rebuild;
+    };
+
+    struct ModuleSwap
+    {
+        std::vector<VkShaderModule *> dsts;
+        VkShaderModule module{VK_NULL_HANDLE};
+        VkShaderModule previous{VK_NULL_HANDLE};
+    };
+
+    // result of one poll, applied in order by update()
+    struct Reload
+    {
+        std::vector<ModuleSwap> modules;
+        std::vector<PipelineSwap> pipelines;
+    };
+
+    // the same file/entry point is tracked once, shared by every pipeline built from it
+    size_t trackShader(const ShaderSource &source)
+    {
+        const auto key = source.filePath + ":" + source.entryPoint;
+        auto [it, inserted] = _shaderIds.try_emplace(key, _shaders.size());
+        if (inserted)
+        {
+            _shaders.emplace_back(TrackedShader{.source = source});
+            _shaders.back().source.dsts.clear();
+            watchFiles(it->second);
+        }
+        auto &dsts = _shaders[it->second].source.dsts;
+        for (auto dst : source.dsts)
+        {
+            if (std::find(dsts.begin(), dsts.end(), dst) == dsts.end())
+            {
+                dsts.push_back(dst);
+            }
+        }
+        return it->second;
+    }
+
+    // (re)build the dependencies of a shader, includes can change with every edit
+    void watchFiles(size_t shaderId)
+    {
+        auto &shader = _shaders[shaderId];
+        for (const auto &file : shader.files)
+        {
+            _dependents[file].erase(shaderId);
+        }
+        shader.files = {std::filesystem::weakly_canonical(shader.source.filePath).string()};
+        try
+        {
+            const auto includes = shaderIncludes(shader.source.filePath);
+            shader.files.insert(shader.files.end(), includes.begin(), includes.end());
+        }
+        catch (const std::exception &e)
+        {
+            log(Level::Warn, "ShaderHotReload: failed to scan the includes of ", shader.source.filePath, ": ", e.what());
+        }
+        for (const auto &file : shader.files)
+        {
+            _dependents[file].insert(shaderId);
+            if (!_lastWriteTimes.contains(file))
+            {
+                _lastWriteTimes[file] = lastWriteTime(file);
+            }
+        }
+    }
+
+    static std::filesystem::file_time_type lastWriteTime(const std::string &file)
+    {
+        std::error_code ec;
+        const auto time = std::filesystem::last_write_time(file, ec);
+        // being replaced by the editor: picked up by a later poll
+        return ec ? std::filesystem::file_time_type::min() : time;
+    }
+
+    void watch()
+    {
+        std::unique_lock lock{_stopMux};
+        while (!_stopCv.wait_for(lock, _pollInterval, [this]()
+                                 { return _stop; }))
+        {
+            lock.unlock();
+            poll();
+            lock.lock();
+        }
+    }
+
+    void poll()
+    {
+        std::scoped_lock lock{_mux};
+        std::unordered_set<size_t> dirtyShaders;
+        for (auto &[file, time] : _lastWriteTimes)
+        {
+            const auto currentTime = lastWriteTime(file);
+            if (currentTime == time || currentTime == std::filesystem::file_time_type::min())
+            {
+                continue;
+            }
+            time = currentTime;
+            if (auto it = _dependents.find(file); it != _dependents.end())
+            {
+                dirtyShaders.insert(it->second.begin(), it->second.end());
+            }
+        }
+        if (dirtyShaders.empty())
+        {
+            return;
+        }
+
+        ZoneScopedN("ShaderHotReload::poll");
+        const auto start = std::chrono::steady_clock::now();
+        auto logicalDevice = _ctx->getLogicDevice();
+        const auto shaderBuildProfile = _ctx->getShaderBuildProfile();
+        Reload reload;
+        std::unordered_set<size_t> rebuiltShaders;
+        for (auto shaderId : dirtyShaders)
+        {
+            auto &shader = _shaders[shaderId];
+            VkShaderModule module{VK_NULL_HANDLE};
+            try
+            {
+                module = tryCreateShaderModule(logicalDevice, shader.source.filePath, shader.source.entryPoint,
+                                               shader.source.correlationId, shaderBuildProfile);
+            }
+            catch (const std::exception &e)
+            {
+                log(Level::Warn, "ShaderHotReload: ", e.what());
+            }
+            watchFiles(shaderId);
+            if (!module)
+            {
+                log(Level::Warn, "ShaderHotReload: keeping the previous pipelines of ", shader.source.filePath);
+                continue;
+            }
+            reload.modules.emplace_back(ModuleSwap{
+                .dsts = shader.source.dsts,
+                .module = module,
+                .previous = std::exchange(shader.source.module, module),
+            });
+            rebuiltShaders.insert(shaderId);
+        }
+
+        for (auto &pipeline : _pipelines)
+        {
+            if (std::none_of(pipeline.stages.begin(), pipeline.stages.end(), [&](const auto &stage)
+                             { return rebuiltShaders.contains(stage.second); }))
+            {
+                continue;
+            }
+            ShaderModuleEntities entities;
+            for (const auto &[stage, shaderId] : pipeline.stages)
+            {
+                const auto &source = _shaders[shaderId].source;
+                entities.insert(std::make_pair(stage, std::make_tuple(source.module, source.entryPoint.c_str(), nullptr)));
+            }
+            auto swap = pipeline.rebuild(entities);
+            if (!swap)
+            {
+                log(Level::Warn, "ShaderHotReload: keeping the previous pipeline, its rebuild failed");
+                continue;
+            }
+            reload.pipelines.emplace_back(std::move(*swap));
+        }
+
+        using ms = std::chrono::duration<double, std::milli>;
+        log(Level::Info, "ShaderHotReload: ", rebuiltShaders.size(), "/", dirtyShaders.size(), " shader(s), ",
+            reload.pipelines.size(), " pipeline(s) rebuilt in ", ms(std::chrono::steady_clock::now() - start).count(), " ms");
+        if (reload.modules.empty())
+        {
+            return;
+        }
+        std::scoped_lock reloadLock{_reloadMux};
+        _reloads.emplace_back(std::move(reload));
+    }
+
+    VkContext *_ctx{nullptr};
+    std::chrono::milliseconds _pollInterval;
+
+    // tracked shaders and pipelines: track() and the watcher thread
+    std::mutex _mux;
+    std::vector<TrackedShader> _shaders;
+    std::unordered_map<std::string, size_t> _shaderIds;
+    std::vector<TrackedPipeline> _pipelines;
+    // canonical file path -> ids of the shaders built from it
+    std::unordered_map<std::string, std::unordered_set<size_t>> _dependents;
+    std::unordered_map<std::string, std::filesystem::file_time_type> _lastWriteTimes;
+
+    // watcher thread -> update()
+    std::mutex _reloadMux;
+    std::vector<Reload> _reloads;
+
+    // update() only: frame number after which the destruction is safe
+    std::vector<std::tuple<uint64_t, std::function<void()>>> _retired;
+
+    std::mutex _stopMux;
+    std::condition_variable _stopCv;
+    bool _stop{false};
+    std::thread _watcher;
+};
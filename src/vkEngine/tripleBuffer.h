@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// single producer, single consumer, latest value wins, no lock
+// the producer fills back() and publishes it, the consumer picks up the newest published value into front()
+// neither side ever waits for the other: a slow consumer skips values, a slow producer gets the same value again
+// the three slots rotate: back (producer), middle (last published), front (consumer)
+// usage:
+//     TripleBuffer<FramePacket> packets;
+//     // producer
+//     packets.back() = packet;
+//     packets.publish();
+//     // consumer
+//     if (packets.waitUpdate())
+//     {
+//         render(packets.front());
+//     }
+template <typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() = default;
+    TripleBuffer(const TripleBuffer &) = delete;
+    TripleBuffer &operator=(const TripleBuffer &) = delete;
+
+    // producer side
+    inline T &back()
+    {
+        return _slots[_back];
+    }
+
+    // producer side: back becomes the newest value, the producer continues in the previous middle slot
+    void publish()
+    {
+        auto middle = _middle.load(std::memory_order_relaxed);
+        // keep the closed bit
+        while (!_middle.compare_exchange_weak(middle, uint8_t(_back | NEW_BIT | (middle & CLOSED_BIT)),
+                                              std::memory_order_acq_rel, std::memory_order_relaxed))
+        {
+        }
+        _back = middle & INDEX_MASK;
+        _middle.notify_one();
+    }
+
+    // consumer side
+    inline const T &front() const
+    {
+        return _slots[_front];
+    }
+
+    // consumer side: false if nothing was published since the last update
+    bool update()
+    {
+        auto middle = _middle.load(std::memory_order_relaxed);
+        if (!(middle & NEW_BIT))
+        {
+            return false;
+        }
+        while (!_middle.compare_exchange_weak(middle, uint8_t(_front | (middle & CLOSED_BIT)),
+                                              std::memory_order_acq_rel, std::memory_order_relaxed))
+        {
+        }
+        _front = middle & INDEX_MASK;
+        return true;
+    }
+
+    // consumer side: blocks until something new is published, false once closed with nothing new
+    bool waitUpdate()
+    {
+        auto middle = _middle.load(std::memory_order_acquire);
+        while (!(middle & (NEW_BIT | CLOSED_BIT)))
+        {
+            _middle.wait(middle, std::memory_order_acquire);
+            middle = _middle.load(std::memory_order_acquire);
+        }
+        return update();
+    }
+
+    // wakes the consumer for good
+    void close()
+    {
+        _middle.fetch_or(CLOSED_BIT, std::memory_order_acq_rel);
+        _middle.notify_all();
+    }
+
+    inline bool closed() const
+    {
+        return _middle.load(std::memory_order_acquire) & CLOSED_BIT;
+    }
+
+private:
+    static constexpr uint8_t INDEX_MASK = 0x3;
+    static constexpr uint8_t NEW_BIT = 0x4;
+    static constexpr uint8_t CLOSED_BIT = 0x8;
+
+    std::array<T, 3> _slots{};
+    // producer only
+    uint8_t _back{0};
+    // index of the middle slot | NEW_BIT | CLOSED_BIT, shared
+    alignas(64) std::atomic<uint8_t> _middle{1};
+    // consumer only
+    alignas(64) uint8_t _front{2};
+};
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#include <misc.h>
+#include <context.h>
+
+// dynamic offset inside the slot buffer of a frame, mapping address already points at it
+using UniformAllocation = std::tuple<uint32_t, MappingAddressType>;
+enum UNIFORM_ALLOCATION_OFFSET : int
+{
+    UNIFORM_DYNAMIC_OFFSET = 0,
+    UNIFORM_MAPPING_ADDRESS
+};
+
+// per frame uniform ring: one persistently mapped buffer per frame slot, aligned ubo chunks are bump allocated
+// one set per frame slot with a single VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC binding, the chunk is selected
+// by the dynamic offset at bind time: passes push per frame constants without owning buffers or descriptor sets
+// a slot is rewound the first time it is allocated from in a new frame, advanceFrame already waited for its last use
+// two kinds of chunks:
+//     transient (allocate/push): valid for the frame being recorded only
+//     reserved (reserve/write): same dynamic offset in every frame slot, for commands recorded once (static passes)
+// glsl side, the set index is up to the pipeline layout:
+//     layout(set = 2, binding = 0) uniform Fustrum { vec4 planes[6]; } fustrum;
+// usage:
+//     UniformRing uniformRing(&ctx);
+//     pipeline layout: {..., uniformRing.getDescriptorSetLayout(), ...}
+//     const auto offset = uniformRing.push(frameIndex, constants);
+//     uniformRing.bind(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 2, frameIndex, offset);
+class UniformRing
+{
+public:
+    // range: size of the window the dynamic binding exposes, upper bound of a single chunk
+    explicit UniformRing(VkContext *ctx,
+                         VkDeviceSize sizePerFrame = 1u << 20,
+                         VkDeviceSize range = 1u << 14)
+        : _ctx(ctx)
+    {
+        ASSERT(_ctx, "vk context should be defined");
+        const auto limits = _ctx->getSelectedPhysicalDeviceProp().limits;
+        // chunks are also read as storage buffers (bindless heap): both offset alignments hold
+        _alignment = std::max<VkDeviceSize>({limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment, 16});
+        _range = std::min<VkDeviceSize>(range, limits.maxUniformBufferRange);
+        _sizePerFrame = alignUp(sizePerFrame);
+        // dynamic offsets are uint32_t
+        ASSERT(_sizePerFrame + _range <= UINT32_MAX, "uniform ring slot must be addressable by a dynamic offset");
+
+        std::vector<std::vector<VkDescriptorSetLayoutBinding>> setBindings(1);
+        setBindings[0].emplace_back(VkDescriptorSetLayoutBinding{
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_ALL,
+        });
+        // dynamic: no update after bind, the sets are written once below
+        _descriptorSetLayout = _ctx->createDescriptorSetLayout(setBindings)[0];
+
+        const auto numFramesInFlight = _ctx->getFramesInFlight();
+        _descriptorPool = _ctx->createDescriptorSetPool({{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, numFramesInFlight}},
+                                                        numFramesInFlight);
+        _descriptorSets = _ctx->allocateDescriptorSet(_descriptorPool,
+                                                      {{&_descriptorSetLayout, numFramesInFlight}})[&_descriptorSetLayout];
+        _slots.resize(numFramesInFlight);
+        for (uint32_t i = 0; i < numFramesInFlight; ++i)
+        {
+            // the window of the last chunk may reach past sizePerFrame
+            _slots[i].buffer = _ctx->createPersistentBuffer(
+                "Uniform Ring " + std::to_string(i),
+                _sizePerFrame + _range,
+                // storage: the chunks can also be read through the bindless heap
+                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+            _ctx->bindBufferToDescriptorSet(std::get<BUFFER_ENTITY_UID::BUFFER>(_slots[i].buffer),
+                                            0,
+                                            _range,
+                                            _descriptorSets[i],
+                                            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                                            0);
+            setCorrlationId(_descriptorSets[i], _ctx->getLogicDevice(), VK_OBJECT_TYPE_DESCRIPTOR_SET,
+                            "Uniform Ring " + std::to_string(i));
+        }
+        log(Level::Info, "UniformRing: ", numFramesInFlight, " x ", _sizePerFrame, " bytes, range ", _range,
+            ", alignment ", _alignment);
+    }
+
+    UniformRing(const UniformRing &) = delete;
+    UniformRing &operator=(const UniformRing &) = delete;
+
+    // the app waits for the device before tearing down
+    ~UniformRing()
+    {
+        auto vmaAllocator = _ctx->getVmaAllocator();
+        for (const auto &slot : _slots)
+        {
+            vmaUnmapMemory(vmaAllocator, std::get<BUFFER_ENTITY_UID::VMA_ALLOCATION>(slot.buffer));
+            vmaDestroyBuffer(vmaAllocator, std::get<BUFFER_ENTITY_UID::BUFFER>(slot.buffer),
+                             std::get<BUFFER_ENTITY_UID::VMA_ALLOCATION>(slot.buffer));
+        }
+        // the set layout is owned by the context
+        vkDestroyDescriptorPool(_ctx->getLogicDevice(), _descriptorPool, nullptr);
+    }
+
+    // same dynamic offset in every frame slot, never rewound
+    uint32_t reserve(VkDeviceSize sizeInBytes)
+    {
+        ASSERT(sizeInBytes > 0 && sizeInBytes <= _range, "uniform chunk must fit into the binding range");
+        std::scoped_lock lock{_mux};
+        // behind every chunk already handed out in this frame
+        VkDeviceSize offset = _reservedEnd;
+        for (const auto &slot : _slots)
+        {
+            offset = std::max(offset, slot.head);
+        }
+        offset = alignUp(offset);
+        if (offset + sizeInBytes > _sizePerFrame)
+        {
+            log(Level::Fatal, "uniform ring is full: increase sizePerFrame");
+            abort();
+        }
+        _reservedEnd = offset + sizeInBytes;
+        for (auto &slot : _slots)
+        {
+            slot.head = _reservedEnd;
+        }
+        return static_cast<uint32_t>(offset);
+    }
+
+    // reserved chunk of the frame slot, written by the cpu while that slot is recorded
+    inline MappingAddressType map(int frameIndex, uint32_t reservedOffset) const
+    {
+        ASSERT(frameIndex >= 0 && static_cast<size_t>(frameIndex) < _slots.size(), "frameIndex should be in a valid range");
+        ASSERT(reservedOffset < _reservedEnd, "offset should come from reserve");
+        return static_cast<uint8_t *>(std::get<BUFFER_ENTITY_UID::MAPPING_ADDRESS>(_slots[frameIndex].buffer)) + reservedOffset;
+    }
+
+    template <typename T>
+    void write(int frameIndex, uint32_t reservedOffset, const T &constants)
+    {
+        memcpy(map(frameIndex, reservedOffset), &constants, sizeof(T));
+    }
+
+    // valid for the frame being recorded
+    UniformAllocation allocate(int frameIndex, VkDeviceSize sizeInBytes)
+    {
+        ASSERT(_slots.size() == _ctx->getFramesInFlight(), "frames in flight changed after the uniform ring was created");
+        ASSERT(frameIndex >= 0 && static_cast<size_t>(frameIndex) < _slots.size(), "frameIndex should be in a valid range");
+        ASSERT(sizeInBytes > 0 && sizeInBytes <= _range, "uniform chunk must fit into the binding range");
+        std::scoped_lock lock{_mux};
+        auto &slot = _slots[frameIndex];
+        const auto frameNumber = _ctx->getFrameNumber();
+        if (slot.frameNumber != frameNumber)
+        {
+            slot.frameNumber = frameNumber;
+            slot.head = _reservedEnd;
+        }
+        const auto offset = alignUp(slot.head);
+        if (offset + sizeInBytes > _sizePerFrame)
+        {
+            log(Level::Fatal, "uniform ring is full for this frame: increase sizePerFrame");
+            abort();
+        }
+        slot.head = offset + sizeInBytes;
+        return std::make_tuple(static_cast<uint32_t>(offset),
+                               static_cast<MappingAddressType>(static_cast<uint8_t *>(std::get<BUFFER_ENTITY_UID::MAPPING_ADDRESS>(slot.buffer)) + offset));
+    }
+
+    // copy into a transient chunk, returns its dynamic offset
+    template <typename T>
+    uint32_t push(int frameIndex, const T &constants)
+    {
+        const auto [offset, mappingAddress] = allocate(frameIndex, sizeof(T));
+        memcpy(mappingAddress, &constants, sizeof(T));
+        return offset;
+    }
+
+    // any pipeline layout with getDescriptorSetLayout() at set
+    void bind(VkCommandBuffer cmdBufferHandle, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout,
+              uint32_t set, int frameIndex, uint32_t dynamicOffset) const
+    {
+        ASSERT(frameIndex >= 0 && static_cast<size_t>(frameIndex) < _descriptorSets.size(), "frameIndex should be in a valid range");
+        vkCmdBindDescriptorSets(cmdBufferHandle, bindPoint, pipelineLayout, set, 1, &_descriptorSets[frameIndex], 1, &dynamicOffset);
+    }
+
+    inline VkDescriptorSetLayout getDescriptorSetLayout() const
+    {
+        return _descriptorSetLayout;
+    }
+
+    inline VkDescriptorSet getDescriptorSet(int frameIndex) const
+    {
+        return _descriptorSets[frameIndex];
+    }
+
+    // backing buffer of a frame slot, e.g. to expose a reserved chunk through the bindless heap
+    inline const BufferEntity &getBuffer(int frameIndex) const
+    {
+        return _slots[frameIndex].buffer;
+    }
+
+    inline VkDeviceSize getRange() const
+    {
+        return _range;
+    }
+
+    inline VkDeviceSize getAlignment() const
+    {
+        return _alignment;
+    }
+
+private:
+    // power of 2 (vulkan spec)
+    inline VkDeviceSize alignUp(VkDeviceSize offset) const
+    {
+        return (offset + _alignment - 1) & ~(_alignment - 1);
+    }
+
+    struct Slot
+    {
+        BufferEntity buffer;
+        // next free byte
+        VkDeviceSize head{0};
+        // frame which allocated last, the slot is rewound when it changes
+        uint64_t frameNumber{0};
+    };
+
+    VkContext *_ctx{nullptr};
+    VkDeviceSize _alignment{16};
+    VkDeviceSize _range{0};
+    VkDeviceSize _sizePerFrame{0};
+    VkDescriptorSetLayout _descriptorSetLayout{VK_NULL_HANDLE};
+    VkDescriptorPool _descriptorPool{VK_NULL_HANDLE};
+    std::vector<VkDescriptorSet> _descriptorSets;
+
+    // passes may record in parallel
+    std::mutex _mux;
+    std::vector<Slot> _slots;
+    // [0, _reservedEnd) holds the reserved chunks in every slot
+    VkDeviceSize _reservedEnd{0};
+};